@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Demultiplexer for the interleaved sample stream produced by the ESP32's
+// continuous (I2S DMA) ADC mode.
+//
+// Every DMA word is a TYPE1 conversion result: bits 15..12 hold the ADC1
+// channel, bits 11..0 the 12-bit code. push() routes each word to its
+// slot, optionally through a per-channel filter, and adds it to that
+// slot's decimator; conversion code reads the mean since its last reading
+// with takeAverage(). No hardware access happens here, so DMA captures can
+// be replayed through it on a host (test/test_adc_demux).
+
+#define ADC_DEMUX_CHANNEL(word) ((uint8_t)(((word) >> 12) & 0x0F))
+#define ADC_DEMUX_CODE(word)    ((uint16_t)((word) & 0x0FFF))
+
+template <size_t Slots>
+class AdcDemux {
+public:
+  AdcDemux() {
+    for (size_t i = 0; i < 16; i++) {
+      slotOf_[i] = kUnmapped;
+    }
+  }
+
+  // Route conversions from ADC1 channel adcChannel to slot.
+  bool mapChannel(size_t slot, uint8_t adcChannel) {
+    if (slot >= Slots || adcChannel >= 16) {
+      return false;
+    }
+    slotOf_[adcChannel] = (uint8_t)slot;
+    return true;
+  }
+
+  // Feed raw DMA words (as read from the driver).
+  void push(const uint16_t* words, size_t count) {
+    push(words, count, [](size_t, int32_t code) { return code; });
+  }
+
+  // Feed raw DMA words, passing every code through filter(slot, code)
+  // before it reaches the decimator.
+  template <typename Filter>
+  void push(const uint16_t* words, size_t count, Filter&& filter) {
+    for (size_t i = 0; i < count; i++) {
+      uint8_t slot = slotOf_[ADC_DEMUX_CHANNEL(words[i])];
+      if (slot == kUnmapped) {
+        unmapped_++;
+        continue;
+      }
+      int32_t filtered = filter((size_t)slot, (int32_t)ADC_DEMUX_CODE(words[i]));
+      uint16_t code = filtered < 0 ? 0 : filtered > 0x0FFF ? 0x0FFF : (uint16_t)filtered;
+      Channel& ch = channels_[slot];
+      ch.sum += code;
+      ch.count++;
+      ch.received++;
+    }
+  }
+
+  // Mean of every sample received on slot since the previous call, then
+  // restart the decimator. Returns false if nothing arrived.
+  bool takeAverage(size_t slot, float& average, uint32_t* samples = nullptr) {
+    Channel& ch = channels_[slot];
+    if (samples != nullptr) {
+      *samples = ch.count;
+    }
+    if (ch.count == 0) {
+      return false;
+    }
+    average = (float)ch.sum / (float)ch.count;
+    ch.sum = 0;
+    ch.count = 0;
+    return true;
+  }
+
+  // Total samples ever received on slot.
+  uint32_t received(size_t slot) const { return channels_[slot].received; }
+
+  // Words whose channel was not mapped to any slot.
+  uint32_t unmapped() const { return unmapped_; }
+
+private:
+  static const uint8_t kUnmapped = 0xFF;
+
+  struct Channel {
+    uint64_t sum = 0;
+    uint32_t count = 0;
+    uint32_t received = 0;
+  };
+
+  uint8_t slotOf_[16];
+  Channel channels_[Slots];
+  uint32_t unmapped_ = 0;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+// Declarative route table for the HTTP API.
+//
+// Every endpoint is one ApiRoute row (method, exact path, handler, a line
+// for the route listing); the router only matches, so it works with any
+// server library and can be driven on a host:
+//
+//   switch (router.match(path, method, route)) {
+//     case API_ROUTE_FOUND: route->handler(request); break;
+//     case API_PREFLIGHT:   ... // OPTIONS on a known path
+//     ...
+//   }
+//
+// OPTIONS is answered for every path in the table, so CORS preflight needs
+// no routes of its own.
+
+enum ApiMatch {
+  API_ROUTE_FOUND = 0,
+  API_PREFLIGHT,
+  API_METHOD_NOT_ALLOWED,
+  API_NOT_FOUND
+};
+
+template <typename Method, typename Handler>
+struct ApiRoute {
+  Method method;
+  const char* path;
+  Handler handler;
+  const char* description;
+};
+
+template <typename Method, typename Handler>
+class ApiRouter {
+public:
+  typedef ApiRoute<Method, Handler> Route;
+
+  template <size_t Count>
+  ApiRouter(const Route (&routes)[Count], Method options)
+    : routes_(routes), count_(Count), options_(options) {}
+
+  // Look up path + method; route is set only for API_ROUTE_FOUND.
+  template <typename RequestMethod>
+  ApiMatch match(const char* path, RequestMethod method, const Route*& route) const {
+    bool pathKnown = false;
+    for (size_t i = 0; i < count_; i++) {
+      if (strcmp(routes_[i].path, path) != 0) {
+        continue;
+      }
+      if (method == routes_[i].method) {
+        route = &routes_[i];
+        return API_ROUTE_FOUND;
+      }
+      pathKnown = true;
+    }
+    if (!pathKnown) {
+      return API_NOT_FOUND;
+    }
+    return method == options_ ? API_PREFLIGHT : API_METHOD_NOT_ALLOWED;
+  }
+
+  size_t size() const { return count_; }
+  const Route& operator[](size_t i) const { return routes_[i]; }
+
+private:
+  const Route* routes_;
+  size_t count_;
+  Method options_;
+};
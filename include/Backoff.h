@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Capped exponential backoff with jitter.
+//
+// The n-th consecutive failure waits min(cap, base * 2^n), half of it fixed
+// and half random ("equal jitter"), so devices that lost the same network
+// don't all retry in lockstep. The random source is passed in so the
+// sequence can be reproduced on a host.
+class Backoff {
+public:
+  Backoff(uint32_t baseMs, uint32_t capMs) : baseMs_(baseMs), capMs_(capMs) {}
+
+  // Record a failure; returns how long to wait before the next attempt.
+  uint32_t fail(uint32_t random) {
+    uint32_t delay = baseMs_;
+    for (uint32_t i = 0; i < failures_ && delay < capMs_; i++) {
+      delay = delay > capMs_ / 2 ? capMs_ : delay * 2;
+    }
+    if (delay > capMs_) {
+      delay = capMs_;
+    }
+    failures_++;
+    uint32_t half = delay / 2;
+    return delay - half + random % (half + 1);
+  }
+
+  void reset() { failures_ = 0; }
+  uint32_t failures() const { return failures_; }
+
+private:
+  uint32_t baseMs_;
+  uint32_t capMs_;
+  uint32_t failures_ = 0;
+};
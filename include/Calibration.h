@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// Multi-point probe calibration.
+//
+// A probe is calibrated with 2-5 (input, value) points captured in
+// reference solutions; evaluate() interpolates linearly between the
+// neighbouring points and extrapolates along the end segments. Points are
+// persisted through a small key/value interface so the same code runs
+// against ESP32 NVS on the device and an in-memory stand-in on a host.
+
+#define CALIBRATION_MIN_POINTS 2
+#define CALIBRATION_MAX_POINTS 5
+
+struct CalibrationPoint {
+  float input;  // Probe voltage (temperature-normalised where applicable)
+  float value;  // Reference value of the solution (likewise)
+};
+
+struct ProbeCalibration {
+  uint8_t count;
+  CalibrationPoint points[CALIBRATION_MAX_POINTS];
+
+  void clear() { count = 0; }
+
+  bool usable() const { return count >= CALIBRATION_MIN_POINTS; }
+
+  // Add a point, keeping points sorted by input. A point whose value is
+  // within replaceWithin (relative) of one already present replaces it
+  // (re-measuring a buffer). Fails, leaving the points as they were, if
+  // the calibration is full or the input would coincide with another
+  // point's input.
+  bool addPoint(float input, float value, float replaceWithin = kValueTolerance) {
+    if (!isfinite(input) || !isfinite(value)) {
+      return false;
+    }
+
+    // Check against the points that stay; a rejected capture changes nothing
+    int replaced = -1;
+    for (uint8_t i = 0; i < count; i++) {
+      if (fabsf(points[i].value - value) <= replaceWithin * fmaxf(1.0f, fabsf(value))) {
+        replaced = i;
+        break;
+      }
+    }
+    if (replaced < 0 && count >= CALIBRATION_MAX_POINTS) {
+      return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+      if (i != replaced && fabsf(points[i].input - input) < kMinInputSpacing) {
+        return false;
+      }
+    }
+    if (replaced >= 0) {
+      removeAt((uint8_t)replaced);
+    }
+
+    uint8_t i = count;
+    while (i > 0 && points[i - 1].input > input) {
+      points[i] = points[i - 1];
+      i--;
+    }
+    points[i].input = input;
+    points[i].value = value;
+    count++;
+    return true;
+  }
+
+  float evaluate(float input) const {
+    if (count == 0) {
+      return 0.0f;
+    }
+    if (count == 1) {
+      return points[0].value;
+    }
+
+    // Segment containing input, or the nearest end segment
+    uint8_t hi = 1;
+    while (hi < count - 1 && input > points[hi].input) {
+      hi++;
+    }
+    const CalibrationPoint& a = points[hi - 1];
+    const CalibrationPoint& b = points[hi];
+    float slope = (b.value - a.value) / (b.input - a.input);
+    return a.value + slope * (input - a.input);
+  }
+
+  static constexpr float kValueTolerance = 1e-3f;
+
+private:
+  static constexpr float kMinInputSpacing = 1e-3f; // Volts
+
+  void removeAt(uint8_t index) {
+    for (uint8_t i = index; i + 1 < count; i++) {
+      points[i] = points[i + 1];
+    }
+    count--;
+  }
+};
+
+// Byte-blob key/value storage (NVS on the device).
+class CalibrationStorage {
+public:
+  virtual ~CalibrationStorage() {}
+  virtual size_t read(const char* key, void* data, size_t length) = 0;
+  virtual bool write(const char* key, const void* data, size_t length) = 0;
+  virtual bool remove(const char* key) = 0;
+};
+
+// Versioned persistence of ProbeCalibration records.
+class CalibrationStore {
+public:
+  explicit CalibrationStore(CalibrationStorage& storage) : storage_(storage) {}
+
+  // Load a calibration. Missing or invalid records leave cal empty and
+  // return false.
+  bool load(const char* key, ProbeCalibration& cal) {
+    cal.clear();
+    Record record;
+    if (storage_.read(key, &record, sizeof(record)) != sizeof(record)) {
+      return false;
+    }
+    if (record.magic != kMagic || record.version != kVersion || record.count > CALIBRATION_MAX_POINTS) {
+      return false;
+    }
+    for (uint8_t i = 0; i < record.count; i++) {
+      if (!cal.addPoint(record.points[i].input, record.points[i].value)) {
+        cal.clear();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool save(const char* key, const ProbeCalibration& cal) {
+    if (cal.count == 0) {
+      return storage_.remove(key);
+    }
+    Record record = {};
+    record.magic = kMagic;
+    record.version = kVersion;
+    record.count = cal.count;
+    for (uint8_t i = 0; i < cal.count; i++) {
+      record.points[i] = cal.points[i];
+    }
+    return storage_.write(key, &record, sizeof(record));
+  }
+
+private:
+  static const uint16_t kMagic = 0xCA1B;
+  static const uint8_t kVersion = 1;
+
+  struct Record {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t count;
+    CalibrationPoint points[CALIBRATION_MAX_POINTS];
+  };
+
+  CalibrationStorage& storage_;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// Change-driven reporting for one output channel.
+//
+// The channel offers its current field values as often as it likes;
+// offer() answers which fields to send (bit i = field i), or 0 when nothing
+// is due:
+//
+//   uint32_t fields = reporter.offer(values, millis());
+//   for each set bit: emit field i
+//
+// A field is due once it has moved past its deadband from the value last
+// sent: more than max(absolute, relative * |last|). Fields past the end of
+// the deadband table have none, so any change counts (on/off state). The
+// first change opens a hold window and everything that changes within it
+// goes out as one report at its end. Every heartbeatMs (0 = never) all
+// fields are sent regardless, so consumers can tell stale from stable.
+//
+// Per-field counters (sent, and suppressed: offered with a different value
+// that stayed inside the deadband) are kept for tuning the thresholds.
+
+struct Deadband {
+  float absolute;
+  float relative;  // Fraction of the last sent value
+};
+
+template <size_t Fields>
+class DeltaReporter {
+  static_assert(Fields <= 32, "DeltaReporter tracks fields in a 32-bit mask");
+
+public:
+  DeltaReporter(const Deadband* bands, size_t bandCount, uint32_t holdMs, uint32_t heartbeatMs)
+    : bands_(bands), bandCount_(bandCount), holdMs_(holdMs), heartbeatMs_(heartbeatMs) {}
+
+  static constexpr uint32_t allFields() { return Fields == 32 ? 0xFFFFFFFFUL : (1UL << Fields) - 1; }
+
+  uint32_t offer(const float* values, uint32_t nowMs) {
+    offers_++;
+    for (size_t i = 0; i < Fields; i++) {
+      uint32_t bit = 1UL << i;
+      if (pending_ & bit) {
+        continue;
+      }
+      if (exceeds(i, values[i])) {
+        if (pending_ == 0) {
+          holdStart_ = nowMs;
+        }
+        pending_ |= bit;
+      } else if (values[i] != last_[i] && !(isnan(values[i]) && isnan(last_[i]))) {
+        suppressed_[i]++;
+      }
+    }
+
+    uint32_t fields = 0;
+    if (!primed_ || (heartbeatMs_ != 0 && nowMs - lastFull_ >= heartbeatMs_)) {
+      fields = allFields();
+      heartbeats_++;
+    } else if (pending_ != 0 && nowMs - holdStart_ >= holdMs_) {
+      fields = pending_;
+    } else {
+      return 0;
+    }
+
+    for (size_t i = 0; i < Fields; i++) {
+      if (fields & (1UL << i)) {
+        last_[i] = values[i];
+        sent_[i]++;
+      }
+    }
+    if (fields == allFields()) {
+      lastFull_ = nowMs;
+    }
+    primed_ = true;
+    pending_ = 0;
+    reports_++;
+    return fields;
+  }
+
+  // Send everything on the next offer (e.g. a consumer lost its state).
+  void forceFull() { primed_ = false; }
+
+  uint32_t offers() const { return offers_; }
+  uint32_t reports() const { return reports_; }
+  uint32_t heartbeats() const { return heartbeats_; }
+  uint32_t sent(size_t field) const { return sent_[field]; }
+  uint32_t suppressed(size_t field) const { return suppressed_[field]; }
+  static constexpr size_t size() { return Fields; }
+
+private:
+  bool exceeds(size_t i, float value) const {
+    float last = last_[i];
+    if (isnan(value) || isnan(last)) {
+      return isnan(value) != isnan(last);
+    }
+    float band = 0;
+    if (i < bandCount_) {
+      band = bands_[i].absolute;
+      float relative = bands_[i].relative * fabsf(last);
+      if (relative > band) {
+        band = relative;
+      }
+    }
+    return fabsf(value - last) > band;
+  }
+
+  const Deadband* bands_;
+  size_t bandCount_;
+  uint32_t holdMs_;
+  uint32_t heartbeatMs_;
+
+  float last_[Fields] = {};
+  uint32_t pending_ = 0;
+  uint32_t holdStart_ = 0;
+  uint32_t lastFull_ = 0;
+  bool primed_ = false;
+
+  uint32_t offers_ = 0;
+  uint32_t reports_ = 0;
+  uint32_t heartbeats_ = 0;
+  uint32_t sent_[Fields] = {};
+  uint32_t suppressed_[Fields] = {};
+};
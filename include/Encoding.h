@@ -0,0 +1,322 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// Flat-record encoders for JSON, CBOR (RFC 8949) and MessagePack.
+//
+// All three share one interface, so a payload is described once as a
+// template over the encoder and can't drift between formats:
+//
+//   template <typename Encoder>
+//   void encodeThing(Encoder& out) {
+//     out.beginObject();
+//     out.field("temp", 21.5f);
+//     out.field("on", true);
+//     out.endObject();
+//   }
+//
+// Output goes straight into a caller-supplied buffer (no heap); ok() turns
+// false if it didn't fit. Only one level of object is supported. Maps are
+// written with a 16-bit length that endObject() patches in, and
+// non-finite floats become null in every format.
+
+class EncodeBuffer {
+public:
+  EncodeBuffer(uint8_t* data, size_t capacity) : data_(data), capacity_(capacity) {}
+
+  void put(uint8_t byte) {
+    if (length_ < capacity_) {
+      data_[length_++] = byte;
+    } else {
+      overflow_ = true;
+    }
+  }
+
+  void put(const void* bytes, size_t count) {
+    // Written so the compiler can see the copy stays inside the buffer
+    size_t room = length_ < capacity_ ? capacity_ - length_ : 0;
+    if (count > room) {
+      overflow_ = true;
+      return;
+    }
+    memcpy(data_ + length_, bytes, count);
+    length_ += count;
+  }
+
+  void putBE16(uint16_t v) {
+    put((uint8_t)(v >> 8));
+    put((uint8_t)v);
+  }
+
+  void putBE32(uint32_t v) {
+    putBE16((uint16_t)(v >> 16));
+    putBE16((uint16_t)v);
+  }
+
+  void patchBE16(size_t offset, uint16_t v) {
+    if (offset + 2 <= length_) {
+      data_[offset] = (uint8_t)(v >> 8);
+      data_[offset + 1] = (uint8_t)v;
+    }
+  }
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return length_; }
+  bool ok() const { return !overflow_; }
+
+protected:
+  uint8_t* data_;
+  size_t capacity_;
+  size_t length_ = 0;
+  bool overflow_ = false;
+};
+
+class JsonEncoder : public EncodeBuffer {
+public:
+  JsonEncoder(uint8_t* data, size_t capacity) : EncodeBuffer(data, capacity) {}
+
+  static const char* contentType() { return "application/json"; }
+
+  void beginObject() {
+    put('{');
+    first_ = true;
+  }
+  void endObject() { put('}'); }
+
+  void field(const char* key, float value) {
+    if (!isfinite(value)) {
+      nullField(key);
+      return;
+    }
+    char text[24];
+    int n = snprintf(text, sizeof(text), "%.7g", (double)value);
+    raw(key, text, (size_t)n);
+  }
+  void field(const char* key, int32_t value) {
+    char text[12];
+    int n = snprintf(text, sizeof(text), "%ld", (long)value);
+    raw(key, text, (size_t)n);
+  }
+  void field(const char* key, uint32_t value) {
+    char text[12];
+    int n = snprintf(text, sizeof(text), "%lu", (unsigned long)value);
+    raw(key, text, (size_t)n);
+  }
+  void field(const char* key, bool value) { raw(key, value ? "true" : "false", value ? 4 : 5); }
+  void field(const char* key, const char* value) {
+    writeKey(key);
+    string(value);
+  }
+  void nullField(const char* key) { raw(key, "null", 4); }
+
+private:
+  void writeKey(const char* key) {
+    if (!first_) {
+      put(',');
+    }
+    first_ = false;
+    string(key);
+    put(':');
+  }
+
+  void raw(const char* key, const char* text, size_t length) {
+    writeKey(key);
+    put(text, length);
+  }
+
+  void string(const char* s) {
+    put('"');
+    for (; *s; s++) {
+      if (*s == '"' || *s == '\\') {
+        put('\\');
+      }
+      put((uint8_t)*s);
+    }
+    put('"');
+  }
+
+  bool first_ = true;
+};
+
+class CborEncoder : public EncodeBuffer {
+public:
+  CborEncoder(uint8_t* data, size_t capacity) : EncodeBuffer(data, capacity) {}
+
+  static const char* contentType() { return "application/cbor"; }
+
+  void beginObject() {
+    put(0xB9);  // Map, 16-bit length follows
+    countAt_ = size();
+    putBE16(0);
+    fields_ = 0;
+  }
+  void endObject() { patchBE16(countAt_, fields_); }
+
+  void field(const char* key, float value) {
+    if (!isfinite(value)) {
+      nullField(key);
+      return;
+    }
+    writeKey(key);
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(0xFA);
+    putBE32(bits);
+  }
+  void field(const char* key, int32_t value) {
+    writeKey(key);
+    if (value < 0) {
+      head(1, (uint32_t)(-1 - value));
+    } else {
+      head(0, (uint32_t)value);
+    }
+  }
+  void field(const char* key, uint32_t value) {
+    writeKey(key);
+    head(0, value);
+  }
+  void field(const char* key, bool value) {
+    writeKey(key);
+    put(value ? 0xF5 : 0xF4);
+  }
+  void field(const char* key, const char* value) {
+    writeKey(key);
+    string(value);
+  }
+  void nullField(const char* key) {
+    writeKey(key);
+    put(0xF6);
+  }
+
+private:
+  void writeKey(const char* key) {
+    fields_++;
+    string(key);
+  }
+
+  void string(const char* s) {
+    size_t n = strlen(s);
+    head(3, (uint32_t)n);
+    put(s, n);
+  }
+
+  // Initial byte plus the shortest argument encoding
+  void head(uint8_t major, uint32_t value) {
+    uint8_t type = (uint8_t)(major << 5);
+    if (value < 24) {
+      put((uint8_t)(type | value));
+    } else if (value <= 0xFF) {
+      put((uint8_t)(type | 24));
+      put((uint8_t)value);
+    } else if (value <= 0xFFFF) {
+      put((uint8_t)(type | 25));
+      putBE16((uint16_t)value);
+    } else {
+      put((uint8_t)(type | 26));
+      putBE32(value);
+    }
+  }
+
+  size_t countAt_ = 0;
+  uint16_t fields_ = 0;
+};
+
+class MsgPackEncoder : public EncodeBuffer {
+public:
+  MsgPackEncoder(uint8_t* data, size_t capacity) : EncodeBuffer(data, capacity) {}
+
+  static const char* contentType() { return "application/msgpack"; }
+
+  void beginObject() {
+    put(0xDE);  // map 16
+    countAt_ = size();
+    putBE16(0);
+    fields_ = 0;
+  }
+  void endObject() { patchBE16(countAt_, fields_); }
+
+  void field(const char* key, float value) {
+    if (!isfinite(value)) {
+      nullField(key);
+      return;
+    }
+    writeKey(key);
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(0xCA);
+    putBE32(bits);
+  }
+  void field(const char* key, int32_t value) {
+    if (value >= 0) {
+      field(key, (uint32_t)value);
+      return;
+    }
+    writeKey(key);
+    if (value >= -32) {
+      put((uint8_t)(int8_t)value);
+    } else if (value >= -128) {
+      put(0xD0);
+      put((uint8_t)(int8_t)value);
+    } else if (value >= -32768) {
+      put(0xD1);
+      putBE16((uint16_t)(int16_t)value);
+    } else {
+      put(0xD2);
+      putBE32((uint32_t)value);
+    }
+  }
+  void field(const char* key, uint32_t value) {
+    writeKey(key);
+    if (value < 0x80) {
+      put((uint8_t)value);
+    } else if (value <= 0xFF) {
+      put(0xCC);
+      put((uint8_t)value);
+    } else if (value <= 0xFFFF) {
+      put(0xCD);
+      putBE16((uint16_t)value);
+    } else {
+      put(0xCE);
+      putBE32(value);
+    }
+  }
+  void field(const char* key, bool value) {
+    writeKey(key);
+    put(value ? 0xC3 : 0xC2);
+  }
+  void field(const char* key, const char* value) {
+    writeKey(key);
+    string(value);
+  }
+  void nullField(const char* key) {
+    writeKey(key);
+    put(0xC0);
+  }
+
+private:
+  void writeKey(const char* key) {
+    fields_++;
+    string(key);
+  }
+
+  void string(const char* s) {
+    size_t n = strlen(s);
+    if (n < 32) {
+      put((uint8_t)(0xA0 | n));
+    } else if (n <= 0xFF) {
+      put(0xD9);
+      put((uint8_t)n);
+    } else {
+      put(0xDA);
+      putBE16((uint16_t)n);
+    }
+    put(s, n);
+  }
+
+  size_t countAt_ = 0;
+  uint16_t fields_ = 0;
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming filter stages for raw ADC codes.
+//
+// Every stage has the same shape:
+//   int32_t update(int32_t sample);   // push one sample, return the output
+//   void reset();
+// and keeps all of its state inline (no heap), so stages can be composed at
+// compile time with Chain<>:
+//
+//   Chain<Median<7>, Ema<q15(0.05)>> phFilter;
+//   int32_t out = phFilter.update(code);
+//
+// The integer stages work in ADC codes; Ema keeps 8 extra fractional bits
+// internally so small alphas don't stall on rounding.
+
+// Q15 fixed-point constant (0.0 .. <1.0) for use as a template argument.
+constexpr uint16_t q15(double value) {
+  return value <= 0.0 ? 0 : value >= 1.0 ? 32767 : (uint16_t)(value * 32768.0 + 0.5);
+}
+
+// Sliding median of the last N samples. O(N) per sample.
+template <size_t N>
+class Median {
+  static_assert(N > 0, "Median window must not be empty");
+
+public:
+  int32_t update(int32_t sample) {
+    if (count_ == N) {
+      // Drop the oldest sample from the sorted window
+      int32_t oldest = ring_[head_];
+      size_t i = 0;
+      while (sorted_[i] != oldest) i++;
+      for (; i + 1 < count_; i++) sorted_[i] = sorted_[i + 1];
+      count_--;
+    }
+    ring_[head_] = sample;
+    head_ = (head_ + 1) % N;
+
+    // Insert the new sample in order
+    size_t i = count_;
+    while (i > 0 && sorted_[i - 1] > sample) {
+      sorted_[i] = sorted_[i - 1];
+      i--;
+    }
+    sorted_[i] = sample;
+    count_++;
+
+    return sorted_[count_ / 2];
+  }
+
+  // Current median without pushing a sample
+  int32_t value() const { return count_ > 0 ? sorted_[count_ / 2] : 0; }
+  size_t size() const { return count_; }
+
+  void reset() {
+    head_ = 0;
+    count_ = 0;
+  }
+
+private:
+  int32_t ring_[N] = {};
+  int32_t sorted_[N] = {};
+  size_t head_ = 0;
+  size_t count_ = 0;
+};
+
+// Exponential moving average, alpha in Q15 (see q15()).
+template <uint16_t AlphaQ15>
+class Ema {
+  static_assert(AlphaQ15 > 0, "Ema alpha must be non-zero");
+
+public:
+  int32_t update(int32_t sample) {
+    int32_t scaled = sample * kScale;
+    if (!primed_) {
+      state_ = scaled;
+      primed_ = true;
+    } else {
+      state_ += (int32_t)(((int64_t)(scaled - state_) * AlphaQ15) >> 15);
+    }
+    return (state_ + kScale / 2) / kScale;
+  }
+
+  void reset() { primed_ = false; }
+
+private:
+  static const int32_t kScale = 256;
+  int32_t state_ = 0;
+  bool primed_ = false;
+};
+
+// Boxcar average over the last N samples, using a running sum.
+template <size_t N>
+class MovingAverage {
+  static_assert(N > 0, "MovingAverage window must not be empty");
+
+public:
+  int32_t update(int32_t sample) {
+    if (count_ == N) {
+      sum_ -= ring_[head_];
+    } else {
+      count_++;
+    }
+    ring_[head_] = sample;
+    sum_ += sample;
+    head_ = (head_ + 1) % N;
+    return (int32_t)(sum_ / (int64_t)count_);
+  }
+
+  void reset() {
+    sum_ = 0;
+    head_ = 0;
+    count_ = 0;
+  }
+
+private:
+  int32_t ring_[N] = {};
+  int64_t sum_ = 0;
+  size_t head_ = 0;
+  size_t count_ = 0;
+};
+
+// Scalar Kalman filter for a slowly varying level. ProcessNoise and
+// MeasurementNoise are variances in codes^2 per sample.
+template <uint32_t ProcessNoise, uint32_t MeasurementNoise>
+class Kalman1D {
+public:
+  int32_t update(int32_t sample) {
+    if (!primed_) {
+      estimate_ = (float)sample;
+      error_ = (float)MeasurementNoise;
+      primed_ = true;
+    } else {
+      error_ += (float)ProcessNoise;
+      float gain = error_ / (error_ + (float)MeasurementNoise);
+      estimate_ += gain * ((float)sample - estimate_);
+      error_ *= 1.0f - gain;
+    }
+    return (int32_t)(estimate_ + 0.5f);
+  }
+
+  void reset() { primed_ = false; }
+
+private:
+  float estimate_ = 0.0f;
+  float error_ = 0.0f;
+  bool primed_ = false;
+};
+
+// Hampel-style spike rejection: a sample further than MaxDeviation codes
+// from the median of the last N accepted samples is replaced by that
+// median. Pump switching transients on pH/TDS are what this is for. N
+// rejections in a row are taken as a real level change and let through.
+template <size_t N, int32_t MaxDeviation>
+class OutlierReject {
+public:
+  int32_t update(int32_t sample) {
+    if (window_.size() == N) {
+      int32_t median = window_.value();
+      int32_t deviation = sample > median ? sample - median : median - sample;
+      if (deviation > MaxDeviation && rejectedRun_ < N) {
+        rejected_++;
+        rejectedRun_++;
+        return median;
+      }
+    }
+    rejectedRun_ = 0;
+    window_.update(sample);
+    return sample;
+  }
+
+  void reset() {
+    window_.reset();
+    rejected_ = 0;
+    rejectedRun_ = 0;
+  }
+
+  uint32_t rejected() const { return rejected_; }
+
+private:
+  Median<N> window_;
+  uint32_t rejected_ = 0;
+  size_t rejectedRun_ = 0;
+};
+
+// Compile-time composition: samples flow through the stages left to right.
+template <typename... Stages>
+class Chain;
+
+template <>
+class Chain<> {
+public:
+  int32_t update(int32_t sample) { return sample; }
+  void reset() {}
+};
+
+template <typename First, typename... Rest>
+class Chain<First, Rest...> {
+public:
+  int32_t update(int32_t sample) { return rest_.update(first_.update(sample)); }
+
+  void reset() {
+    first_.reset();
+    rest_.reset();
+  }
+
+  First& head() { return first_; }
+  Chain<Rest...>& tail() { return rest_; }
+
+private:
+  First first_;
+  Chain<Rest...> rest_;
+};
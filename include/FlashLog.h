@@ -0,0 +1,322 @@
+#pragma once
+
+#include <FS.h>
+#include "LogFormat.h"
+
+// Append-only sensor log on a flash filesystem (LittleFS).
+//
+// Records go into a RAM block (LogFormat.h) that is written out at its
+// block-aligned offset when it fills up or on flush(); a partial tail
+// block is rewritten in place until it is full, so the flash sees at most
+// one block write per flush. Blocks are grouped into fixed-size segment
+// files <dir>/<sequence>.log; when MaxSegments exist the oldest is
+// deleted. A small in-RAM index (first/last time per segment, rebuilt
+// from block headers at boot) lets scan() skip whole segments, and
+// blocks within a segment are binary searched by their base time.
+//
+// Not thread-safe: callers on different tasks must serialize append,
+// flush and scan.
+template <size_t Values, size_t SegmentBlocks, size_t MaxSegments>
+class FlashLog {
+public:
+  FlashLog(fs::FS& fs, const char* dir) : fs_(fs), dir_(dir) {}
+
+  // Index existing segments and reload the open tail block.
+  bool begin() {
+    segmentCount_ = 0;
+    if (!fs_.exists(dir_) && !fs_.mkdir(dir_)) {
+      return false;
+    }
+
+    File dir = fs_.open(dir_);
+    if (!dir || !dir.isDirectory()) {
+      return false;
+    }
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+      const char* name = strrchr(file.name(), '/');
+      name = name ? name + 1 : file.name();
+      char* end = nullptr;
+      uint32_t sequence = strtoul(name, &end, 10);
+      if (end == name || strcmp(end, ".log") != 0) {
+        continue;
+      }
+      Segment segment = {sequence, 0, 0, (uint32_t)(file.size() / LOG_BLOCK_BYTES)};
+      file.close();
+      insertSegment(segment);
+    }
+    dir.close();
+
+    // Too many segments (MaxSegments lowered): drop the oldest
+    while (segmentCount_ > MaxSegments) {
+      dropOldest();
+    }
+    for (size_t i = 0; i < segmentCount_; i++) {
+      indexSegment(segments_[i]);
+    }
+
+    // Reopen the newest segment's last block if it has room left
+    writer_.reset();
+    if (segmentCount_ > 0) {
+      Segment& tail = segments_[segmentCount_ - 1];
+      uint8_t block[LOG_BLOCK_BYTES];
+      if (tail.blocks > 0 && readBlock(tail, tail.blocks - 1, block) && writer_.resume(block) && !writer_.full()) {
+        tail.blocks--;
+      } else {
+        writer_.reset();
+      }
+    }
+    ready_ = true;
+    return true;
+  }
+
+  bool ready() const { return ready_; }
+
+  // Buffer one record; completed blocks are written straight away.
+  bool append(uint32_t at, const int16_t* values) {
+    if (!ready_) {
+      return false;
+    }
+    if (writer_.append(at, values)) {
+      dirty_ = true;
+      return writer_.full() ? commitBlock(true) : true;
+    }
+    // Time jumped out of the block's range: close it, start another
+    if (!writer_.empty() && !commitBlock(true)) {
+      return false;
+    }
+    dirty_ = writer_.append(at, values);
+    return dirty_;
+  }
+
+  // Write the partial tail block in place (crash safety point).
+  bool flush() {
+    if (!ready_ || writer_.empty() || !dirty_) {
+      return true;
+    }
+    return commitBlock(false);
+  }
+
+  // Call emit(time, values, count) for every record in [from, to], oldest
+  // first, including records not yet flushed. emit returns false to stop
+  // early (the caller resumes from the last time it took + 1). Returns
+  // the number of records emit accepted.
+  template <typename Fn>
+  size_t scan(uint32_t from, uint32_t to, Fn emit) {
+    size_t emitted = 0;
+    bool more = true;
+    uint8_t block[LOG_BLOCK_BYTES];
+    for (size_t s = 0; s < segmentCount_ && more; s++) {
+      const Segment& segment = segments_[s];
+      if (segment.blocks == 0 || segment.lastTime < from || segment.firstTime > to) {
+        continue;
+      }
+      File file = openSegment(segment.sequence, "r");
+      if (!file) {
+        continue;
+      }
+      for (uint32_t b = firstBlockFor(file, segment, from); b < segment.blocks && more; b++) {
+        if (!file.seek((size_t)b * LOG_BLOCK_BYTES) || file.read(block, LOG_BLOCK_BYTES) != LOG_BLOCK_BYTES) {
+          break;
+        }
+        LogBlockReader reader;
+        if (!reader.open(block)) {
+          crcErrors_++;
+          continue;
+        }
+        if (reader.baseTime() > to) {
+          break;
+        }
+        emitted += emitBlock(reader, from, to, emit, more);
+      }
+      file.close();
+    }
+
+    if (more && !writer_.empty()) {
+      LogBlockReader reader;
+      if (reader.open(writer_.data())) {
+        emitted += emitBlock(reader, from, to, emit, more);
+      }
+    }
+    return emitted;
+  }
+
+  size_t segments() const { return segmentCount_; }
+  uint32_t blocksWritten() const { return blocksWritten_; }
+  uint32_t crcErrors() const { return crcErrors_; }
+  uint32_t oldestTime() const { return segmentCount_ ? segments_[0].firstTime : writer_.baseTime(); }
+
+  size_t storedBytes() const {
+    size_t blocks = writer_.empty() ? 0 : 1;
+    for (size_t i = 0; i < segmentCount_; i++) {
+      blocks += segments_[i].blocks;
+    }
+    return blocks * LOG_BLOCK_BYTES;
+  }
+
+  static constexpr size_t capacityBytes() { return (size_t)SegmentBlocks * MaxSegments * LOG_BLOCK_BYTES; }
+
+private:
+  struct Segment {
+    uint32_t sequence;
+    uint32_t firstTime;
+    uint32_t lastTime;
+    uint32_t blocks;    // Complete (or flushed) blocks on flash
+  };
+
+  File openSegment(uint32_t sequence, const char* mode) {
+    char path[48];
+    snprintf(path, sizeof(path), "%s/%08lu.log", dir_, (unsigned long)sequence);
+    return fs_.open(path, mode);
+  }
+
+  void removeSegment(uint32_t sequence) {
+    char path[48];
+    snprintf(path, sizeof(path), "%s/%08lu.log", dir_, (unsigned long)sequence);
+    fs_.remove(path);
+  }
+
+  // Keep segments_ sorted by sequence
+  void insertSegment(const Segment& segment) {
+    if (segmentCount_ == MaxSegments + 1) {
+      if (segment.sequence < segments_[0].sequence) {
+        removeSegment(segment.sequence);
+        return;
+      }
+      dropOldest();
+    }
+    size_t i = segmentCount_;
+    while (i > 0 && segments_[i - 1].sequence > segment.sequence) {
+      segments_[i] = segments_[i - 1];
+      i--;
+    }
+    segments_[i] = segment;
+    segmentCount_++;
+  }
+
+  void dropOldest() {
+    removeSegment(segments_[0].sequence);
+    for (size_t i = 1; i < segmentCount_; i++) {
+      segments_[i - 1] = segments_[i];
+    }
+    segmentCount_--;
+  }
+
+  bool readBlock(const Segment& segment, uint32_t index, uint8_t* block) {
+    File file = openSegment(segment.sequence, "r");
+    if (!file) {
+      return false;
+    }
+    bool ok = file.seek((size_t)index * LOG_BLOCK_BYTES) && file.read(block, LOG_BLOCK_BYTES) == LOG_BLOCK_BYTES;
+    file.close();
+    return ok;
+  }
+
+  // First and last record time from the first and last valid block
+  void indexSegment(Segment& segment) {
+    uint8_t block[LOG_BLOCK_BYTES];
+    LogBlockReader reader;
+    for (uint32_t b = 0; b < segment.blocks; b++) {
+      if (readBlock(segment, b, block) && reader.open(block)) {
+        segment.firstTime = reader.baseTime();
+        break;
+      }
+    }
+    for (uint32_t b = segment.blocks; b > 0; b--) {
+      if (readBlock(segment, b - 1, block) && reader.open(block)) {
+        segment.lastTime = reader.lastTime();
+        break;
+      }
+    }
+  }
+
+  // Last block whose base time is <= from (blocks are in time order)
+  uint32_t firstBlockFor(File& file, const Segment& segment, uint32_t from) {
+    uint32_t lo = 0;
+    uint32_t hi = segment.blocks;
+    uint8_t header[LOG_HEADER_BYTES];
+    while (hi - lo > 1) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (!file.seek((size_t)mid * LOG_BLOCK_BYTES) || file.read(header, LOG_HEADER_BYTES) != LOG_HEADER_BYTES
+          || logGet16(header) != LOG_BLOCK_MAGIC) {
+        return lo;  // Damaged header: fall back to a linear scan from lo
+      }
+      if (logGet32(header + 8) <= from) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  template <typename Fn>
+  static size_t emitBlock(const LogBlockReader& reader, uint32_t from, uint32_t to, Fn& emit, bool& more) {
+    size_t emitted = 0;
+    int16_t values[Values];
+    for (size_t r = 0; r < reader.count(); r++) {
+      uint32_t at = reader.time(r);
+      if (at < from || at > to) {
+        continue;
+      }
+      size_t n = reader.read(r, values, Values);
+      if (!emit(at, values, n)) {
+        more = false;
+        break;
+      }
+      emitted++;
+    }
+    return emitted;
+  }
+
+  // Write the RAM block at its slot; complete blocks advance the tail.
+  bool commitBlock(bool complete) {
+    if (segmentCount_ == 0 || segments_[segmentCount_ - 1].blocks >= SegmentBlocks) {
+      Segment segment = {segmentCount_ ? segments_[segmentCount_ - 1].sequence + 1 : 1, writer_.baseTime(), 0, 0};
+      File created = openSegment(segment.sequence, "w");
+      if (!created) {
+        return false;
+      }
+      created.close();
+      if (segmentCount_ == MaxSegments) {
+        dropOldest();
+      }
+      segments_[segmentCount_++] = segment;
+    }
+
+    Segment& tail = segments_[segmentCount_ - 1];
+    File file = openSegment(tail.sequence, "r+");
+    if (!file) {
+      return false;
+    }
+    bool ok = file.seek((size_t)tail.blocks * LOG_BLOCK_BYTES)
+      && file.write(writer_.data(), LOG_BLOCK_BYTES) == LOG_BLOCK_BYTES;
+    file.close();
+    if (!ok) {
+      return false;
+    }
+
+    blocksWritten_++;
+    if (tail.blocks == 0) {
+      tail.firstTime = writer_.baseTime();
+    }
+    LogBlockReader reader;
+    reader.open(writer_.data());
+    tail.lastTime = reader.lastTime();
+    if (complete) {
+      tail.blocks++;
+      writer_.reset();
+    }
+    dirty_ = false;
+    return true;
+  }
+
+  fs::FS& fs_;
+  const char* dir_;
+  Segment segments_[MaxSegments + 1];
+  size_t segmentCount_ = 0;
+  LogBlockWriter<Values> writer_;
+  bool ready_ = false;
+  bool dirty_ = false;
+  uint32_t blocksWritten_ = 0;
+  uint32_t crcErrors_ = 0;
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Tiered in-memory time series.
+//
+// Every tier is a fixed ring of time buckets; bucket i of a tier covers
+// [slot * interval, (slot + 1) * interval) seconds, so timestamps are
+// implicit and only the newest slot number is stored. Values are int16
+// fixed-point (the caller picks a scale per metric) in struct-of-arrays
+// layout, one column per metric. The first tier stores samples as they
+// arrive; the others store min/max/avg rollups that are accumulated
+// incrementally and flushed when a bucket closes. Missing buckets hold
+// HISTORY_NO_DATA. Memory use is exactly sizeof(History<...>).
+
+#define HISTORY_NO_DATA INT16_MIN
+
+template <size_t Metrics, size_t Capacity, bool Rollup>
+class HistoryTier {
+public:
+  explicit HistoryTier(uint32_t intervalSec) : interval_(intervalSec) {}
+
+  uint32_t interval() const { return interval_; }
+  size_t size() const { return count_; }
+  uint32_t newestSlot() const { return newest_; }
+  uint32_t oldestSlot() const { return newest_ + 1 - (uint32_t)count_; }
+
+  // Store the bucket for slot; skipped slots in between become gaps.
+  // Slots older than the newest one are ignored.
+  void put(uint32_t slot, const int16_t* avg, const int16_t* mins, const int16_t* maxs) {
+    if (count_ > 0 && slot < newest_) {
+      return;
+    }
+    if (count_ > 0 && slot > newest_) {
+      uint32_t gap = slot - newest_ - 1;
+      if (gap > Capacity) gap = Capacity;
+      for (uint32_t i = 0; i < gap; i++) {
+        advance();
+        write(head(), nullptr, nullptr, nullptr);
+      }
+    }
+    if (count_ == 0 || slot > newest_) {
+      advance();
+    }
+    newest_ = slot;
+    write(head(), avg, mins, maxs);
+  }
+
+  // Read one metric of a bucket. Returns false for gaps and slots that
+  // are no longer (or not yet) held.
+  bool get(size_t metric, uint32_t slot, int16_t& mins, int16_t& maxs, int16_t& avg) const {
+    if (count_ == 0 || slot > newest_ || slot < oldestSlot()) {
+      return false;
+    }
+    size_t index = (head() + Capacity - (newest_ - slot)) % Capacity;
+    avg = avg_[metric][index];
+    if (avg == HISTORY_NO_DATA) {
+      return false;
+    }
+    mins = Rollup ? min_[metric][index] : avg;
+    maxs = Rollup ? max_[metric][index] : avg;
+    return true;
+  }
+
+private:
+  size_t head() const { return (start_ + count_ - 1) % Capacity; }
+
+  void advance() {
+    if (count_ < Capacity) {
+      count_++;
+    } else {
+      start_ = (start_ + 1) % Capacity;
+    }
+  }
+
+  void write(size_t index, const int16_t* avg, const int16_t* mins, const int16_t* maxs) {
+    for (size_t m = 0; m < Metrics; m++) {
+      avg_[m][index] = avg ? avg[m] : HISTORY_NO_DATA;
+      if (Rollup) {
+        min_[m][index] = mins ? mins[m] : HISTORY_NO_DATA;
+        max_[m][index] = maxs ? maxs[m] : HISTORY_NO_DATA;
+      }
+    }
+  }
+
+  uint32_t interval_;
+  uint32_t newest_ = 0;
+  size_t start_ = 0;
+  size_t count_ = 0;
+  int16_t avg_[Metrics][Capacity];
+  int16_t min_[Rollup ? Metrics : 1][Rollup ? Capacity : 1];
+  int16_t max_[Rollup ? Metrics : 1][Rollup ? Capacity : 1];
+};
+
+// Open rollup bucket, folded into a tier when its slot closes
+template <size_t Metrics>
+struct HistoryAccumulator {
+  uint32_t slot = 0;
+  int32_t sum[Metrics] = {};
+  int16_t mins[Metrics] = {};
+  int16_t maxs[Metrics] = {};
+  uint16_t count[Metrics] = {};
+  bool open = false;
+
+  void add(const int16_t* values) {
+    for (size_t m = 0; m < Metrics; m++) {
+      int16_t v = values[m];
+      if (v == HISTORY_NO_DATA) continue;
+      if (count[m] == 0 || v < mins[m]) mins[m] = v;
+      if (count[m] == 0 || v > maxs[m]) maxs[m] = v;
+      sum[m] += v;
+      count[m]++;
+    }
+    open = true;
+  }
+
+  template <typename Tier>
+  void flushTo(Tier& tier) {
+    if (!open) {
+      return;
+    }
+    int16_t avg[Metrics];
+    for (size_t m = 0; m < Metrics; m++) {
+      if (count[m] == 0) {
+        avg[m] = mins[m] = maxs[m] = HISTORY_NO_DATA;
+      } else {
+        avg[m] = (int16_t)(sum[m] / (int32_t)count[m]);
+      }
+      sum[m] = 0;
+      count[m] = 0;
+    }
+    tier.put(slot, avg, mins, maxs);
+    open = false;
+  }
+};
+
+template <size_t Metrics, size_t RawCapacity, size_t MidCapacity, size_t LongCapacity>
+class History {
+public:
+  static const int TIER_COUNT = 3;
+
+  History(uint32_t rawIntervalSec, uint32_t midIntervalSec, uint32_t longIntervalSec)
+    : raw_(rawIntervalSec), mid_(midIntervalSec), long_(longIntervalSec) {}
+
+  // Record one sample of every metric (HISTORY_NO_DATA for missing ones)
+  void add(uint32_t timeSec, const int16_t* values) {
+    raw_.put(timeSec / raw_.interval(), values, nullptr, nullptr);
+    roll(midAcc_, mid_, timeSec, values);
+    roll(longAcc_, long_, timeSec, values);
+  }
+
+  uint32_t interval(int tier) const {
+    return tier == 0 ? raw_.interval() : tier == 1 ? mid_.interval() : long_.interval();
+  }
+
+  // Finest tier that still holds data from fromSec, else the coarsest
+  int pickTier(uint32_t fromSec) const {
+    if (raw_.size() > 0 && fromSec / raw_.interval() >= raw_.oldestSlot()) return 0;
+    if (mid_.size() > 0 && fromSec / mid_.interval() >= mid_.oldestSlot()) return 1;
+    return 2;
+  }
+
+  // Call emit(timeSec, min, max, avg) for every stored bucket of metric
+  // in [fromSec, toSec], oldest first; emit returns false to stop early.
+  // Returns the number of buckets emit accepted.
+  template <typename Fn>
+  size_t query(int tier, size_t metric, uint32_t fromSec, uint32_t toSec, Fn emit) const {
+    switch (tier) {
+      case 0:  return scan(raw_, metric, fromSec, toSec, emit);
+      case 1:  return scan(mid_, metric, fromSec, toSec, emit);
+      default: return scan(long_, metric, fromSec, toSec, emit);
+    }
+  }
+
+  static constexpr size_t memoryBytes() { return sizeof(History); }
+
+private:
+  template <typename Tier>
+  static void roll(HistoryAccumulator<Metrics>& acc, Tier& tier, uint32_t timeSec, const int16_t* values) {
+    uint32_t slot = timeSec / tier.interval();
+    if (acc.open && slot != acc.slot) {
+      acc.flushTo(tier);
+    }
+    acc.slot = slot;
+    acc.add(values);
+  }
+
+  template <typename Tier, typename Fn>
+  static size_t scan(const Tier& tier, size_t metric, uint32_t fromSec, uint32_t toSec, Fn& emit) {
+    if (tier.size() == 0 || metric >= Metrics) {
+      return 0;
+    }
+    uint32_t first = fromSec / tier.interval();
+    uint32_t last = toSec / tier.interval();
+    if (first < tier.oldestSlot()) first = tier.oldestSlot();
+    if (last > tier.newestSlot()) last = tier.newestSlot();
+
+    size_t emitted = 0;
+    for (uint32_t slot = first; slot <= last && slot >= first; slot++) {
+      int16_t mins, maxs, avg;
+      if (tier.get(metric, slot, mins, maxs, avg)) {
+        if (!emit(slot * tier.interval(), mins, maxs, avg)) {
+          break;
+        }
+        emitted++;
+      }
+    }
+    return emitted;
+  }
+
+  HistoryTier<Metrics, RawCapacity, false> raw_;
+  HistoryTier<Metrics, MidCapacity, true> mid_;
+  HistoryTier<Metrics, LongCapacity, true> long_;
+  HistoryAccumulator<Metrics> midAcc_;
+  HistoryAccumulator<Metrics> longAcc_;
+};
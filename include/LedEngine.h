@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// Frame-based effects for an LED strip split into equal zones.
+//
+// The engine never touches hardware: render() computes the frame at a
+// given time into the caller's wire buffer (GRB, gamma and brightness
+// applied through a 256-entry table) and says whether it differs from the
+// last frame, so unchanged frames are never sent. Each zone plays one
+// transition at a time: from the colour it showed when the transition
+// started, through up to MaxStops intermediate colours, to its target.
+// Stop times are permille of the duration, so one ramp table (a sunrise,
+// a sunset) serves any duration; a fade is a transition without stops.
+//
+// A step sequence (a blink pattern) can take over the whole strip for a
+// while. Transitions started meanwhile begin when it ends.
+
+struct Rgb {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+};
+
+inline bool operator==(const Rgb& a, const Rgb& b) { return a.r == b.r && a.g == b.g && a.b == b.b; }
+inline bool operator!=(const Rgb& a, const Rgb& b) { return !(a == b); }
+
+struct LedStop {
+  uint16_t at;  // Permille of the transition
+  Rgb color;
+};
+
+struct LedStep {
+  uint16_t durationMs;
+  uint8_t lit;  // Pixels from the start of the strip shown in color; the rest are off
+  Rgb color;
+};
+
+template <size_t Pixels, size_t Zones, size_t MaxStops = 4>
+class LedEngine {
+  static_assert(Zones > 0 && Pixels >= Zones, "LedEngine needs at least one pixel per zone");
+  static_assert(Pixels <= 255, "LedStep::lit counts pixels in a byte");
+
+public:
+  explicit LedEngine(float gamma) : gamma_(gamma) { setBrightness(255); }
+
+  void setBrightness(uint8_t brightness) {
+    for (int v = 0; v < 256; v++) {
+      lut_[v] = (uint8_t)lroundf(powf(v / 255.0f, gamma_) * brightness);
+    }
+    dirty_ = true;
+  }
+
+  // Fade one zone to target over durationMs (0 = at once).
+  void fadeZone(size_t zone, Rgb target, uint32_t durationMs, uint32_t nowMs) {
+    begin(zone, nullptr, 0, target, durationMs, nowMs);
+  }
+
+  // Move every zone to its target through stops (a ramp) or directly.
+  void transition(const LedStop* stops, size_t count, const Rgb* targets, uint32_t durationMs, uint32_t nowMs) {
+    for (size_t z = 0; z < Zones; z++) {
+      begin(z, stops, count, targets[z], durationMs, nowMs);
+    }
+  }
+
+  // Show steps (caller-owned, must outlive the sequence) from nowMs on.
+  void play(const LedStep* steps, size_t count, uint32_t nowMs) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+      total += steps[i].durationMs;
+    }
+    steps_ = steps;
+    stepCount_ = count;
+    sequenceStart_ = nowMs;
+    sequenceEnd_ = nowMs + total;
+  }
+
+  bool playing(uint32_t nowMs) const {
+    return stepCount_ > 0 && (int32_t)(sequenceEnd_ - nowMs) > 0;
+  }
+
+  // A zone's colour at nowMs, before gamma and brightness.
+  Rgb color(size_t zone, uint32_t nowMs) const {
+    const Track& t = tracks_[zone];
+    int32_t elapsed = (int32_t)(nowMs - t.start);
+    if (elapsed < 0) {
+      return t.from;  // Deferred until a sequence ends
+    }
+    if ((uint32_t)elapsed >= t.duration) {
+      return t.to;
+    }
+    uint32_t permille = (uint32_t)((uint64_t)elapsed * 1000 / t.duration);
+    uint16_t fromAt = 0;
+    Rgb from = t.from;
+    for (size_t i = 0; i <= t.count; i++) {
+      uint16_t toAt = i < t.count ? t.stops[i].at : 1000;
+      Rgb to = i < t.count ? t.stops[i].color : t.to;
+      if (permille < toAt) {
+        uint32_t u = toAt > fromAt ? (permille - fromAt) * 256 / (toAt - fromAt) : 256;
+        return {mix(from.r, to.r, u), mix(from.g, to.g, u), mix(from.b, to.b, u)};
+      }
+      fromAt = toAt;
+      from = to;
+    }
+    return t.to;
+  }
+
+  Rgb target(size_t zone) const { return tracks_[zone].to; }
+
+  // Any zone heading for a colour other than black
+  bool lit() const {
+    for (size_t z = 0; z < Zones; z++) {
+      if (tracks_[z].to != Rgb{0, 0, 0}) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Write the frame at nowMs to grb (Pixels * 3 bytes, wire order) if it
+  // differs from the last one written. Returns false (grb untouched) if
+  // it does not.
+  bool render(uint32_t nowMs, uint8_t* grb) {
+    int step = playing(nowMs) ? stepAt(nowMs) : -1;
+    Rgb shown[Zones];
+    bool same = !dirty_ && step == lastStep_;
+    if (step < 0) {
+      for (size_t z = 0; z < Zones; z++) {
+        Rgb c = color(z, nowMs);
+        shown[z] = {lut_[c.r], lut_[c.g], lut_[c.b]};
+        same = same && shown[z] == lastShown_[z];
+      }
+    }
+    if (same) {
+      return false;
+    }
+
+    if (step >= 0) {
+      const LedStep& s = steps_[step];
+      for (size_t i = 0; i < Pixels; i++) {
+        Rgb c = i < s.lit ? Rgb{lut_[s.color.r], lut_[s.color.g], lut_[s.color.b]} : Rgb{0, 0, 0};
+        put(grb, i, c);
+      }
+    } else {
+      for (size_t z = 0; z < Zones; z++) {
+        for (size_t i = zoneStart(z); i < zoneStart(z + 1); i++) {
+          put(grb, i, shown[z]);
+        }
+        lastShown_[z] = shown[z];
+      }
+    }
+    lastStep_ = step;
+    dirty_ = false;
+    return true;
+  }
+
+  static constexpr size_t zoneStart(size_t zone) { return zone * Pixels / Zones; }
+  static constexpr size_t frameBytes() { return Pixels * 3; }
+
+private:
+  struct Track {
+    Rgb from;
+    Rgb to;
+    LedStop stops[MaxStops];
+    size_t count;
+    uint32_t start;
+    uint32_t duration;
+  };
+
+  static uint8_t mix(uint8_t a, uint8_t b, uint32_t u) {
+    return (uint8_t)(a + (((int32_t)b - a) * (int32_t)u) / 256);
+  }
+
+  static void put(uint8_t* grb, size_t pixel, Rgb c) {
+    grb[pixel * 3] = c.g;
+    grb[pixel * 3 + 1] = c.r;
+    grb[pixel * 3 + 2] = c.b;
+  }
+
+  void begin(size_t zone, const LedStop* stops, size_t count, Rgb target, uint32_t durationMs, uint32_t nowMs) {
+    Track& t = tracks_[zone];
+    t.from = color(zone, nowMs);
+    t.to = target;
+    t.count = count < MaxStops ? count : MaxStops;
+    for (size_t i = 0; i < t.count; i++) {
+      t.stops[i] = stops[i];
+    }
+    t.start = playing(nowMs) ? sequenceEnd_ : nowMs;
+    t.duration = durationMs;
+  }
+
+  int stepAt(uint32_t nowMs) const {
+    uint32_t elapsed = nowMs - sequenceStart_;
+    for (size_t i = 0; i < stepCount_; i++) {
+      if (elapsed < steps_[i].durationMs) {
+        return (int)i;
+      }
+      elapsed -= steps_[i].durationMs;
+    }
+    return (int)stepCount_ - 1;
+  }
+
+  float gamma_;
+  uint8_t lut_[256];
+  Track tracks_[Zones] = {};
+  Rgb lastShown_[Zones] = {};
+  int lastStep_ = -1;
+  bool dirty_ = true;
+
+  const LedStep* steps_ = nullptr;
+  size_t stepCount_ = 0;
+  uint32_t sequenceStart_ = 0;
+  uint32_t sequenceEnd_ = 0;
+};
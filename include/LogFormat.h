@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Binary block format of the on-flash sensor log.
+//
+// The log is a sequence of LOG_BLOCK_BYTES blocks, each self-contained:
+//
+//   offset  size  field
+//   0       2     magic 0x4C47 ("GL" little-endian)
+//   2       1     format version
+//   3       1     values per record
+//   4       2     record count
+//   6       2     reserved (0)
+//   8       4     base time, seconds since the Unix epoch
+//   12      4     CRC-32 of the header (this field zeroed) and the records
+//   16      ...   records: uint16 seconds since base time, then int16
+//                 fixed-point values; unused bytes are 0xFF
+//
+// All fields are little-endian. A block that fails its CRC (torn write,
+// erased flash) is skipped as a whole. Nothing here touches hardware, so
+// the same code decodes exported log files on a host.
+
+#define LOG_BLOCK_BYTES   512
+#define LOG_HEADER_BYTES  16
+#define LOG_BLOCK_MAGIC   0x4C47
+#define LOG_FORMAT_VERSION 1
+
+// CRC-32 (IEEE 802.3, reflected), nibble table
+inline uint32_t logCrc32(const uint8_t* data, size_t length, uint32_t crc = 0) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = (crc >> 4) ^ table[(crc ^ data[i]) & 0x0F];
+    crc = (crc >> 4) ^ table[(crc ^ (data[i] >> 4)) & 0x0F];
+  }
+  return ~crc;
+}
+
+inline uint16_t logGet16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+inline uint32_t logGet32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+inline void logPut16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+inline void logPut32(uint8_t* p, uint32_t v) {
+  logPut16(p, (uint16_t)v);
+  logPut16(p + 2, (uint16_t)(v >> 16));
+}
+
+// Fills one block in RAM. The block is always kept finished (header and
+// CRC valid), so it can be written out at any point and rewritten in place
+// as more records arrive.
+template <size_t Values>
+class LogBlockWriter {
+public:
+  static const size_t RECORD_BYTES = 2 + 2 * Values;
+  static const size_t CAPACITY = (LOG_BLOCK_BYTES - LOG_HEADER_BYTES) / RECORD_BYTES;
+  static_assert(CAPACITY > 0, "Record does not fit in a log block");
+
+  LogBlockWriter() { reset(); }
+
+  void reset() {
+    memset(block_, 0xFF, sizeof(block_));
+    count_ = 0;
+    baseTime_ = 0;
+  }
+
+  // Continue a block read back from flash (the open tail after a reboot).
+  bool resume(const uint8_t* block);
+
+  // Add a record. Fails when the block is full or time doesn't fit its
+  // 16-bit offset; the caller then writes the block out and resets.
+  bool append(uint32_t time, const int16_t* values) {
+    if (count_ == 0) {
+      baseTime_ = time;
+    }
+    if (count_ >= CAPACITY || time < baseTime_ || time - baseTime_ > 0xFFFF) {
+      return false;
+    }
+    uint8_t* record = block_ + LOG_HEADER_BYTES + count_ * RECORD_BYTES;
+    logPut16(record, (uint16_t)(time - baseTime_));
+    for (size_t i = 0; i < Values; i++) {
+      logPut16(record + 2 + 2 * i, (uint16_t)values[i]);
+    }
+    count_++;
+    seal();
+    return true;
+  }
+
+  bool empty() const { return count_ == 0; }
+  bool full() const { return count_ >= CAPACITY; }
+  size_t count() const { return count_; }
+  uint32_t baseTime() const { return baseTime_; }
+  const uint8_t* data() const { return block_; }
+
+private:
+  void seal() {
+    logPut16(block_, LOG_BLOCK_MAGIC);
+    block_[2] = LOG_FORMAT_VERSION;
+    block_[3] = (uint8_t)Values;
+    logPut16(block_ + 4, (uint16_t)count_);
+    logPut16(block_ + 6, 0);
+    logPut32(block_ + 8, baseTime_);
+    logPut32(block_ + 12, 0);
+    uint32_t crc = logCrc32(block_, LOG_HEADER_BYTES + count_ * RECORD_BYTES);
+    logPut32(block_ + 12, crc);
+  }
+
+  uint8_t block_[LOG_BLOCK_BYTES];
+  size_t count_;
+  uint32_t baseTime_;
+};
+
+// Validates and decodes one block.
+class LogBlockReader {
+public:
+  // Returns false for erased, torn or foreign blocks.
+  bool open(const uint8_t* block) {
+    block_ = nullptr;
+    if (logGet16(block) != LOG_BLOCK_MAGIC || block[2] != LOG_FORMAT_VERSION || block[3] == 0) {
+      return false;
+    }
+    size_t values = block[3];
+    size_t count = logGet16(block + 4);
+    size_t recordBytes = 2 + 2 * values;
+    if (LOG_HEADER_BYTES + count * recordBytes > LOG_BLOCK_BYTES) {
+      return false;
+    }
+    uint8_t header[LOG_HEADER_BYTES];
+    memcpy(header, block, LOG_HEADER_BYTES);
+    logPut32(header + 12, 0);
+    uint32_t crc = logCrc32(header, LOG_HEADER_BYTES);
+    crc = logCrc32(block + LOG_HEADER_BYTES, count * recordBytes, crc);
+    if (crc != logGet32(block + 12)) {
+      return false;
+    }
+    block_ = block;
+    values_ = values;
+    count_ = count;
+    recordBytes_ = recordBytes;
+    baseTime_ = logGet32(block + 8);
+    return true;
+  }
+
+  size_t count() const { return count_; }
+  size_t values() const { return values_; }
+  uint32_t baseTime() const { return baseTime_; }
+  uint32_t lastTime() const { return count_ ? time(count_ - 1) : baseTime_; }
+
+  uint32_t time(size_t record) const {
+    return baseTime_ + logGet16(block_ + LOG_HEADER_BYTES + record * recordBytes_);
+  }
+
+  // Copy up to maxValues values of a record; returns how many were copied.
+  size_t read(size_t record, int16_t* out, size_t maxValues) const {
+    const uint8_t* p = block_ + LOG_HEADER_BYTES + record * recordBytes_ + 2;
+    size_t n = values_ < maxValues ? values_ : maxValues;
+    for (size_t i = 0; i < n; i++) {
+      out[i] = (int16_t)logGet16(p + 2 * i);
+    }
+    return n;
+  }
+
+private:
+  const uint8_t* block_ = nullptr;
+  size_t values_ = 0;
+  size_t count_ = 0;
+  size_t recordBytes_ = 0;
+  uint32_t baseTime_ = 0;
+};
+
+template <size_t Values>
+bool LogBlockWriter<Values>::resume(const uint8_t* block) {
+  LogBlockReader reader;
+  if (!reader.open(block) || reader.values() != Values || reader.count() > CAPACITY) {
+    return false;
+  }
+  memcpy(block_, block, LOG_BLOCK_BYTES);
+  count_ = reader.count();
+  baseTime_ = reader.baseTime();
+  return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+
+// Piecewise-linear lookup table for a smooth 1-D function.
+//
+// build() samples fn at Segments + 1 evenly spaced points once (at boot or
+// after recalibration); lookup() is then one multiply, one table read pair
+// and a lerp, with inputs clamped to the built range. For a function with
+// bounded curvature f'' the interpolation error is at most
+// step^2 / 8 * max|f''|, and zero for linear functions.
+template <size_t Segments>
+class LutCurve {
+  static_assert(Segments > 0, "LutCurve needs at least one segment");
+
+public:
+  template <typename Fn>
+  void build(float minInput, float maxInput, Fn fn) {
+    min_ = minInput;
+    invStep_ = (float)Segments / (maxInput - minInput);
+    float step = (maxInput - minInput) / (float)Segments;
+    for (size_t i = 0; i <= Segments; i++) {
+      table_[i] = fn(minInput + step * (float)i);
+    }
+  }
+
+  float lookup(float x) const {
+    float pos = (x - min_) * invStep_;
+    if (pos <= 0.0f) {
+      return table_[0];
+    }
+    if (pos >= (float)Segments) {
+      return table_[Segments];
+    }
+    size_t i = (size_t)pos;
+    float frac = pos - (float)i;
+    return table_[i] + (table_[i + 1] - table_[i]) * frac;
+  }
+
+  static constexpr size_t bytes() { return sizeof(float) * (Segments + 1); }
+
+private:
+  float table_[Segments + 1] = {};
+  float min_ = 0.0f;
+  float invStep_ = 1.0f;
+};
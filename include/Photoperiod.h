@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Daily schedule for grow lights: a photoperiod with dawn and dusk ramps
+// and an optional daily light integral (DLI) budget.
+//
+// Times are local seconds (Unix time shifted by the zone offset). Every
+// day the light period starts at onMinute with a dawn ramp from off to the
+// day level, holds, and ends periodMinutes later when the dusk ramp
+// reaches off. The light delivered is integrated as the day goes, from
+// the level (fraction of full brightness) and the PPFD at full
+// brightness; with a budget set, dusk is brought forward so the day ends
+// on it, and a level change mid-day re-plans from what was delivered so
+// far. update() does the bookkeeping up to now and says how long the
+// current phase lasts, so the caller sleeps until the next transition
+// instead of polling: an ordinary day is four calls.
+
+struct PhotoperiodConfig {
+  uint16_t onMinute;       // Local minute of the day dawn starts
+  uint16_t periodMinutes;  // Light period, both ramps included
+  uint16_t rampMinutes;    // Length of dawn, and of dusk
+  uint8_t levelPercent;    // Day brightness, percent of full
+  float ppfd;              // µmol/m²/s at the canopy at full brightness
+  float dliTarget;         // mol/m²/day, 0 = no budget
+};
+
+inline bool operator==(const PhotoperiodConfig& a, const PhotoperiodConfig& b) {
+  return a.onMinute == b.onMinute && a.periodMinutes == b.periodMinutes && a.rampMinutes == b.rampMinutes
+      && a.levelPercent == b.levelPercent && a.ppfd == b.ppfd && a.dliTarget == b.dliTarget;
+}
+
+inline bool operator!=(const PhotoperiodConfig& a, const PhotoperiodConfig& b) { return !(a == b); }
+
+enum LightPhase : uint8_t {
+  LIGHT_NIGHT = 0,
+  LIGHT_DAWN,
+  LIGHT_DAY,
+  LIGHT_DUSK
+};
+
+struct LightStep {
+  LightPhase phase;
+  float level;    // Fraction of full brightness now
+  uint32_t next;  // Seconds until the phase ends; call update() again then
+};
+
+class Photoperiod {
+public:
+  static const uint32_t DAY = 86400;
+
+  explicit Photoperiod(const PhotoperiodConfig& config) : config_(config) {}
+
+  // New settings from nowSec on; light delivered so far today is kept,
+  // and a dusk that has already begun runs its course. Call it when the
+  // settings change, not on every wake.
+  void configure(const PhotoperiodConfig& config, uint32_t nowSec) {
+    bool duskBegun = false;
+    if (started_) {
+      accrue(nowSec);
+      duskBegun = nowSec - cycleStart_ < DAY && nowSec - cycleStart_ >= dusk_;
+    }
+    config_ = config;
+    if (!duskBegun) {
+      dusk_ = naturalDusk();
+    }
+  }
+
+  LightStep update(uint32_t nowSec) {
+    uint32_t on = (uint32_t)config_.onMinute * 60 % DAY;
+    uint32_t rel = (nowSec % DAY + DAY - on) % DAY;
+    uint32_t cycle = nowSec - rel;
+    if (!started_ || cycle != cycleStart_) {
+      if (started_ && cycle > cycleStart_) {
+        accrue(cycleStart_ + DAY);
+        lastDli_ = dli();
+      }
+      // A first call catches up from dawn as if the schedule had run
+      cycleStart_ = cycle;
+      lastSec_ = cycle;
+      accrued_ = 0;
+      dusk_ = naturalDusk();
+      started_ = true;
+    }
+    accrue(nowSec);
+    plan(rel);
+
+    uint32_t ramp = rampSec();
+    LightStep step;
+    step.level = level(rel);
+    if (rel < ramp) {
+      step.phase = LIGHT_DAWN;
+      step.next = ramp - rel;
+    } else if (rel < dusk_) {
+      step.phase = LIGHT_DAY;
+      step.next = dusk_ - rel;
+    } else if (rel < dusk_ + ramp) {
+      step.phase = LIGHT_DUSK;
+      step.next = dusk_ + ramp - rel;
+    } else {
+      step.phase = LIGHT_NIGHT;
+      step.next = DAY - rel;
+    }
+    return step;
+  }
+
+  // mol/m² delivered since the last dawn, and over the whole day before
+  float dli() const { return accrued_ * config_.ppfd / 1e6f; }
+  float lastDli() const { return lastDli_; }
+
+  // dli() brought forward to nowSec without touching the schedule
+  float dliAt(uint32_t nowSec) const {
+    if (!started_ || (int32_t)(nowSec - lastSec_) <= 0 || nowSec - cycleStart_ >= DAY) {
+      return dli();
+    }
+    float pending = cumulative(nowSec - cycleStart_) - cumulative(lastSec_ - cycleStart_);
+    return (accrued_ + pending) * config_.ppfd / 1e6f;
+  }
+
+  // Local time dusk starts (or started) in the current cycle
+  uint32_t duskStart() const { return cycleStart_ + dusk_; }
+
+  const PhotoperiodConfig& config() const { return config_; }
+
+private:
+  float dayLevel() const { return config_.levelPercent / 100.0f; }
+
+  uint32_t periodSec() const {
+    uint32_t period = (uint32_t)config_.periodMinutes * 60;
+    return period < DAY ? period : DAY;
+  }
+
+  uint32_t rampSec() const {
+    uint32_t ramp = (uint32_t)config_.rampMinutes * 60;
+    return ramp < periodSec() / 2 ? ramp : periodSec() / 2;
+  }
+
+  uint32_t naturalDusk() const { return periodSec() - rampSec(); }
+
+  // Light level at rel seconds into the cycle
+  float level(uint32_t rel) const {
+    uint32_t ramp = rampSec();
+    if (rel < ramp) return dayLevel() * rel / ramp;
+    if (rel < dusk_) return dayLevel();
+    if (rel < dusk_ + ramp) return dayLevel() * (dusk_ + ramp - rel) / ramp;
+    return 0;
+  }
+
+  // Integral of the level from the cycle start to rel, in seconds at full
+  float cumulative(uint32_t rel) const {
+    float lv = dayLevel();
+    float r = (float)rampSec();
+    float d = (float)dusk_;
+    float t = (float)rel;
+    if (rampSec() == 0) {
+      return lv * (t < d ? t : d);
+    }
+    if (t < r) return lv * t * t / (2 * r);
+    if (t < d) return lv * (t - r / 2);
+    if (t < d + r) {
+      float u = t - d;
+      return lv * (d - r / 2 + u - u * u / (2 * r));
+    }
+    return lv * d;
+  }
+
+  void accrue(uint32_t nowSec) {
+    if ((int32_t)(nowSec - lastSec_) <= 0) {
+      return;
+    }
+    uint32_t from = lastSec_ - cycleStart_;
+    uint32_t to = nowSec - cycleStart_;
+    if (to > DAY) to = DAY;
+    if (to > from) {
+      accrued_ += cumulative(to) - cumulative(from);
+    }
+    lastSec_ = nowSec;
+  }
+
+  // Bring dusk forward if the rest of the day would overshoot the budget
+  void plan(uint32_t rel) {
+    uint32_t natural = naturalDusk();
+    if (rel >= dusk_) {
+      return;  // Dusk has begun; it runs its course
+    }
+    float lv = dayLevel();
+    if (config_.dliTarget <= 0 || config_.ppfd <= 0 || lv <= 0) {
+      dusk_ = natural;
+      return;
+    }
+    float r = (float)rampSec();
+    float remaining = config_.dliTarget * 1e6f / config_.ppfd - accrued_;
+    float earliest = (float)rel;
+    float dusk;
+    if (rel < rampSec()) {
+      float t = (float)rel;
+      float dawnLeft = lv * (r * r - t * t) / (2 * r);
+      earliest = r;
+      dusk = r + (remaining - dawnLeft - lv * r / 2) / lv;
+    } else {
+      dusk = rel + (remaining - lv * r / 2) / lv;
+    }
+    if (dusk < earliest) dusk = earliest;
+    dusk_ = dusk < (float)natural ? (uint32_t)(dusk + 0.5f) : natural;
+  }
+
+  PhotoperiodConfig config_;
+  bool started_ = false;
+  uint32_t cycleStart_ = 0;  // Local time of the current cycle's dawn
+  uint32_t lastSec_ = 0;     // Light is accounted up to here
+  uint32_t dusk_ = 0;        // Dusk start, seconds into the cycle
+  float accrued_ = 0;        // Integral of the level, seconds at full
+  float lastDli_ = 0;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <math.h>
+#include "LutCurve.h"
+#include "Calibration.h"
+
+// ADC code to reading conversion for the TDS, EC and pH probes.
+//
+// The formulas and factory calibrations are defined once here; build()
+// samples them into lookup tables, so each reading is a temperature
+// lookup plus one interpolated code lookup. The firmware and the host
+// tests (test/test_lut) share this header, so the tests check the very
+// tables the sampler reads.
+//
+// Against the direct formulas, over every 12-bit code and 0-50 °C, the
+// tables are within 0.1 ppm for TDS, 0.01 µS/cm for EC and 0.0001 pH.
+
+#define ADC_MAX_CODE        4095.0
+#define ADC_VOLTS_PER_CODE  (3.3 / ADC_MAX_CODE)
+#define TEMP_TABLE_MIN      0.0    // °C; readings outside are clamped
+#define TEMP_TABLE_MAX      50.0
+
+// Cubic TDS curve, voltage already temperature-compensated
+inline float tdsFromVoltage(float voltage) {
+  float tds = (133.42 * pow(voltage, 3))
+            - (255.86 * pow(voltage, 2))
+            + (857.39 * voltage);
+  return tds * 124.0 / 165.0;
+}
+
+// Temperature compensation (2% per degree from 25°C)
+inline float tempCoefficient(float temperature) {
+  return 1.0 + 0.02 * (temperature - 25.0);
+}
+
+// Factory calibration, used until a probe has two captured points.
+// pH: 1.810V measured in pH 4.0, 1.326V estimated for pH 7.0.
+// EC: 1.229V measured in 1413 µS/cm, assuming ~0V in distilled water.
+// TDS has no default points and falls back to the cubic curve.
+const ProbeCalibration PH_FACTORY_CALIBRATION = {2, {{1.326, 7.0}, {1.810, 4.0}}};
+const ProbeCalibration EC_FACTORY_CALIBRATION = {2, {{0.0, 0.0}, {1.229, 1413.0}}};
+
+// Calibration points from a live reading, in the terms the tables are
+// built in, so a point reads back as its reference at the temperature it
+// was captured at: the TDS input is compensated the way tdsAt()
+// compensates the code, and the EC value is divided by the coefficient
+// ecAt() multiplies by.
+inline CalibrationPoint phCalibrationPoint(float voltage, float reference) {
+  return {voltage, reference};
+}
+inline CalibrationPoint tdsCalibrationPoint(float voltage, float temperature, float reference) {
+  return {voltage / tempCoefficient(temperature), reference};
+}
+inline CalibrationPoint ecCalibrationPoint(float voltage, float temperature, float reference) {
+  return {voltage, reference / tempCoefficient(temperature)};
+}
+
+// The EC value of a re-measured solution moves 2 % per °C with the
+// capture temperature; within this (relative) it still replaces the old
+// point. Standard EC solutions are far further apart.
+const float EC_REPLACE_WITHIN = 0.25f;
+
+struct TemperatureTables {
+  LutCurve<500> coefficient;  // °C -> 1 + 0.02 (T - 25)
+  LutCurve<500> inverse;      // °C -> 1 / (1 + 0.02 (T - 25))
+
+  void build() {
+    coefficient.build(TEMP_TABLE_MIN, TEMP_TABLE_MAX, tempCoefficient);
+    inverse.build(TEMP_TABLE_MIN, TEMP_TABLE_MAX, [](float temperature) {
+      return 1.0f / tempCoefficient(temperature);
+    });
+  }
+};
+
+struct ConversionTables {
+  LutCurve<512> tds;  // Temperature-compensated code (0 .. 2x full scale) -> ppm
+  LutCurve<256> ec;   // Code -> µS/cm at 25 °C
+  LutCurve<256> ph;   // Code -> pH
+
+  // A TDS calibration that isn't usable falls back to tdsFromVoltage()
+  void build(const ProbeCalibration& tdsCal, const ProbeCalibration& ecCal, const ProbeCalibration& phCal) {
+    tds.build(0, 2 * ADC_MAX_CODE, [&](float code) {
+      float voltage = code * ADC_VOLTS_PER_CODE;
+      return tdsCal.usable() ? fmaxf(0.0f, tdsCal.evaluate(voltage)) : tdsFromVoltage(voltage);
+    });
+    ec.build(0, ADC_MAX_CODE, [&](float code) {
+      return fmaxf(0.0f, ecCal.evaluate(code * ADC_VOLTS_PER_CODE)); // Below zero, assume pure water
+    });
+    ph.build(0, ADC_MAX_CODE, [&](float code) {
+      return phCal.evaluate(code * ADC_VOLTS_PER_CODE);
+    });
+  }
+
+  // Readings from a mean ADC code, at water temperature temperature
+  float tdsAt(float code, float temperature, const TemperatureTables& temp) const {
+    return tds.lookup(code * temp.inverse.lookup(temperature));
+  }
+  float ecAt(float code, float temperature, const TemperatureTables& temp) const {
+    return ec.lookup(code) * temp.coefficient.lookup(temperature);
+  }
+  float phAt(float code) const { return ph.lookup(code); }
+};
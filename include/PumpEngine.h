@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// Timer control for the circulation pump, conditioned on sensor rules.
+//
+// The base schedule runs the pump runMs out of every periodMs (start to
+// start). Each rule watches one signal against a threshold. It becomes
+// active past the threshold and clears only once the value is back past
+// threshold -/+ hysteresis. While active, it inhibits the pump or scales
+// the run length or the period by its factor.
+//
+// Evaluation is incremental. sample() re-checks only the rules on that
+// signal and says whether one flipped. update() then re-plans and switches
+// the pump if a deadline is due. Nothing is polled: nextEventMs() says how
+// long the caller may sleep, unless a sample flips a rule first.
+//
+// A run lasts at least minOnMs unless a rule inhibits the pump. Inhibits
+// are interlocks (a low reservoir) and stop it at once. After a stop, the
+// pump stays off for at least minOffMs. A run cut short by an inhibit is
+// made up with a fresh cycle once the inhibit clears. last() describes
+// every switch (when, which way, why, which rule) for the caller's audit
+// trail.
+//
+// Times are millis() and may wrap. There are no other dependencies, so the
+// engine also runs on a host against recorded or synthetic traces
+// (tools/pump_sim.cpp).
+
+enum PumpSignal : uint8_t {
+  PUMP_SIGNAL_WATER_TEMP = 0,  // °C
+  PUMP_SIGNAL_AIR_TEMP,        // °C
+  PUMP_SIGNAL_WATER_LEVEL,     // %
+  PUMP_SIGNAL_EC,              // mS/cm
+  PUMP_SIGNAL_COUNT
+};
+
+enum PumpCompare : uint8_t {
+  PUMP_ABOVE = 0,
+  PUMP_BELOW
+};
+
+enum PumpEffect : uint8_t {
+  PUMP_INHIBIT = 0,   // Pump off while active
+  PUMP_SCALE_RUN,     // Run length times factor
+  PUMP_SCALE_PERIOD   // Period times factor
+};
+
+enum PumpReason : uint8_t {
+  PUMP_REASON_CYCLE_START = 0,
+  PUMP_REASON_CYCLE_END,
+  PUMP_REASON_INHIBIT,
+  PUMP_REASON_MANUAL  // Recorded by the caller; the engine is suspended meanwhile
+};
+
+struct PumpCycle {
+  uint32_t runMs;
+  uint32_t periodMs;
+  uint32_t minOnMs;
+  uint32_t minOffMs;
+};
+
+struct PumpRule {
+  const char* name;
+  PumpSignal signal;
+  PumpCompare compare;
+  float threshold;
+  float hysteresis;
+  PumpEffect effect;
+  float factor;  // PUMP_SCALE_RUN / PUMP_SCALE_PERIOD only
+};
+
+struct PumpActuation {
+  uint32_t atMs;
+  bool on;
+  PumpReason reason;
+  int8_t rule;  // Rule behind the switch, -1 = the base schedule
+};
+
+template <size_t MaxRules>
+class PumpEngine {
+  static_assert(MaxRules > 0 && MaxRules <= 32, "PumpEngine keeps active rules in a 32-bit mask");
+
+public:
+  PumpEngine(const PumpCycle& cycle, const PumpRule* rules, size_t count)
+    : cycle_(cycle), rules_(rules), count_(count < MaxRules ? count : MaxRules) {}
+
+  // Take control at nowMs with the pump in state on. A running pump gets
+  // a full run from now; an idle one starts its next cycle one period
+  // after lastStartMs.
+  void resume(uint32_t nowMs, bool on, uint32_t lastStartMs) {
+    enabled_ = true;
+    on_ = on;
+    changedAtMs_ = nowMs;
+    cycleStartMs_ = on ? nowMs : lastStartMs;
+    cutShort_ = false;
+    flipped_ = -1;
+  }
+
+  // Hand the pump to manual control; rules keep tracking their signals
+  void suspend(uint32_t nowMs) {
+    if (on_) {
+      onMs_ += nowMs - changedAtMs_;
+    }
+    enabled_ = false;
+  }
+
+  // New value for a signal. Returns true if a rule flipped, so update()
+  // should run now rather than at the old deadline. NaN is ignored.
+  bool sample(PumpSignal signal, float value, uint32_t nowMs) {
+    (void)nowMs;
+    if (isnan(value)) {
+      return false;
+    }
+    bool flipped = false;
+    for (size_t i = 0; i < count_; i++) {
+      const PumpRule& rule = rules_[i];
+      if (rule.signal != signal) {
+        continue;
+      }
+      bool was = (active_ >> i) & 1;
+      bool now = rule.compare == PUMP_ABOVE
+        ? value > (was ? rule.threshold - rule.hysteresis : rule.threshold)
+        : value < (was ? rule.threshold + rule.hysteresis : rule.threshold);
+      if (now != was) {
+        active_ ^= 1UL << i;
+        flipped_ = (int8_t)i;
+        flipped = true;
+      }
+    }
+    return flipped && enabled_;
+  }
+
+  // Act on whatever is due. Returns true if the pump switched (see last()).
+  bool update(uint32_t nowMs) {
+    if (!enabled_) {
+      return false;
+    }
+    int8_t flipped = flipped_;
+    flipped_ = -1;
+    int8_t inhibit = firstActive(PUMP_INHIBIT);
+
+    if (on_) {
+      if (inhibit >= 0) {
+        cutShort_ = true;
+        switchTo(false, nowMs, PUMP_REASON_INHIBIT, inhibit);
+        return true;
+      }
+      if (due(nowMs, endAt())) {
+        switchTo(false, nowMs, PUMP_REASON_CYCLE_END, flipped >= 0 ? flipped : firstActive(PUMP_SCALE_RUN));
+        return true;
+      }
+      return false;
+    }
+    if (inhibit < 0 && due(nowMs, startAt())) {
+      cycleStartMs_ = nowMs;
+      cutShort_ = false;
+      cycles_++;
+      switchTo(true, nowMs, PUMP_REASON_CYCLE_START, flipped >= 0 ? flipped : firstActive(PUMP_SCALE_PERIOD));
+      return true;
+    }
+    return false;
+  }
+
+  // Milliseconds until update() next has something to do; UINT32_MAX
+  // while suspended or inhibited (only a sample can change that)
+  uint32_t nextEventMs(uint32_t nowMs) const {
+    uint32_t at;
+    if (!deadline(at)) {
+      return UINT32_MAX;
+    }
+    return due(nowMs, at) ? 0 : at - nowMs;
+  }
+
+  // The next switch by the clock, if there is one
+  bool deadline(uint32_t& atMs) const {
+    if (!enabled_) {
+      return false;
+    }
+    if (on_) {
+      atMs = firstActive(PUMP_INHIBIT) >= 0 ? changedAtMs_ : endAt();
+      return true;
+    }
+    if (firstActive(PUMP_INHIBIT) >= 0) {
+      return false;
+    }
+    atMs = startAt();
+    return true;
+  }
+
+  // Run length and period with the active rules applied
+  uint32_t runMs() const { return scaled(cycle_.runMs, PUMP_SCALE_RUN); }
+  uint32_t periodMs() const { return scaled(cycle_.periodMs, PUMP_SCALE_PERIOD); }
+
+  bool on() const { return on_; }
+  bool enabled() const { return enabled_; }
+  bool inhibited() const { return firstActive(PUMP_INHIBIT) >= 0; }
+  uint32_t activeRules() const { return active_; }
+  const PumpActuation& last() const { return last_; }
+  uint32_t cycles() const { return cycles_; }
+  uint32_t cycleStart() const { return cycleStartMs_; }
+
+  // Time the pump has run under the engine, the current run included
+  uint64_t onMs(uint32_t nowMs) const { return onMs_ + (enabled_ && on_ ? nowMs - changedAtMs_ : 0); }
+
+  size_t ruleCount() const { return count_; }
+  const PumpRule& rule(size_t i) const { return rules_[i]; }
+
+private:
+  static bool due(uint32_t nowMs, uint32_t atMs) { return (int32_t)(nowMs - atMs) >= 0; }
+  static uint32_t later(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0 ? a : b; }
+
+  uint32_t endAt() const { return later(cycleStartMs_ + runMs(), changedAtMs_ + cycle_.minOnMs); }
+
+  uint32_t startAt() const {
+    uint32_t rested = changedAtMs_ + cycle_.minOffMs;
+    return cutShort_ ? rested : later(cycleStartMs_ + periodMs(), rested);
+  }
+
+  uint32_t scaled(uint32_t ms, PumpEffect effect) const {
+    float factor = 1.0f;
+    for (size_t i = 0; i < count_; i++) {
+      if (((active_ >> i) & 1) && rules_[i].effect == effect) {
+        factor *= rules_[i].factor;
+      }
+    }
+    return (uint32_t)(ms * factor + 0.5f);
+  }
+
+  int8_t firstActive(PumpEffect effect) const {
+    for (size_t i = 0; i < count_; i++) {
+      if (((active_ >> i) & 1) && rules_[i].effect == effect) {
+        return (int8_t)i;
+      }
+    }
+    return -1;
+  }
+
+  void switchTo(bool on, uint32_t nowMs, PumpReason reason, int8_t rule) {
+    if (!on) {
+      onMs_ += nowMs - changedAtMs_;
+    }
+    on_ = on;
+    changedAtMs_ = nowMs;
+    last_ = {nowMs, on, reason, rule};
+  }
+
+  PumpCycle cycle_;
+  const PumpRule* rules_;
+  size_t count_;
+
+  uint32_t active_ = 0;   // Bit i: rule i active
+  int8_t flipped_ = -1;   // Last rule to flip since update(), for the audit
+  bool enabled_ = false;
+  bool on_ = false;
+  bool cutShort_ = false;
+  uint32_t changedAtMs_ = 0;
+  uint32_t cycleStartMs_ = 0;
+  uint32_t cycles_ = 0;
+  uint64_t onMs_ = 0;
+  PumpActuation last_ = {0, false, PUMP_REASON_CYCLE_END, -1};
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "PumpEngine.h"
+
+// The tower's pump schedule and rules, shared by the firmware and
+// tools/pump_sim.cpp so a simulation runs exactly what gets flashed.
+
+// 10 minutes every hour; a run lasts at least 2 minutes, a rest at least 5
+const PumpCycle PUMP_CYCLE = {600000, 3600000, 120000, 300000};
+
+const PumpRule PUMP_RULES[] = {
+  // Never run dry: off below 20 %, back on above 25 %
+  {"lowLevel",  PUMP_SIGNAL_WATER_LEVEL, PUMP_BELOW, 20.0f, 5.0f, PUMP_INHIBIT,      1.0f},
+  // Warm water holds less oxygen: longer runs above 26 °C
+  {"warmWater", PUMP_SIGNAL_WATER_TEMP,  PUMP_ABOVE, 26.0f, 0.5f, PUMP_SCALE_RUN,    1.5f},
+  // Cool water, slow uptake: cycle half as often below 20 °C
+  {"coolWater", PUMP_SIGNAL_WATER_TEMP,  PUMP_BELOW, 20.0f, 0.5f, PUMP_SCALE_PERIOD, 2.0f},
+  // Hot air, fast transpiration: cycle more often above 30 °C
+  {"hotAir",    PUMP_SIGNAL_AIR_TEMP,    PUMP_ABOVE, 30.0f, 1.0f, PUMP_SCALE_PERIOD, 0.75f},
+};
+const size_t PUMP_RULE_COUNT = sizeof(PUMP_RULES) / sizeof(PUMP_RULES[0]);
+
+const float PUMP_POWER_W = 18.0f;  // Draw while running, for energy figures; set for the pump fitted
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Adafruit_GFX.h>
+
+// Off-screen drawing surface for repainting one screen rectangle.
+//
+// A widget draws its rectangle in local coordinates (0,0 = top left) with
+// the normal Adafruit_GFX calls; the pixels land in a caller-supplied
+// RGB565 buffer that is then pushed to the panel in one address window,
+// so the panel only ever receives finished pixels (no flicker, no
+// per-pixel window setup). A rectangle bigger than the buffer is rendered
+// as windows: the widget draws the whole thing each time and only the
+// pixels of the current window (a band of rows, optionally narrowed to a
+// band of columns) are kept, so the buffer can stay a few KB whatever the
+// widget size.
+//
+// With panelOrder set, pixels are stored high byte first, the order the
+// panel expects on the wire, so the buffer can go straight to SPI DMA.
+class RegionCanvas : public Adafruit_GFX {
+public:
+  RegionCanvas(uint16_t* buffer, size_t pixels, bool panelOrder = false)
+    : Adafruit_GFX(1, 1), buffer_(buffer), pixels_(pixels), panelOrder_(panelOrder) {}
+
+  // Rows of a cols-pixel-wide window that fit in the buffer.
+  int16_t rowsFor(int16_t cols) const {
+    size_t rows = cols > 0 ? pixels_ / (size_t)cols : 0;
+    return rows > 0x7FFF ? 0x7FFF : (int16_t)rows;
+  }
+
+  // Start the window holding columns [left, left + cols) and rows
+  // [top, top + rows) of a w x h rectangle.
+  void beginWindow(int16_t w, int16_t h, int16_t left, int16_t top, int16_t cols, int16_t rows) {
+    _width = w;
+    _height = h;
+    left_ = left;
+    top_ = top;
+    cols_ = cols;
+    rows_ = rows;
+  }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+    if (x >= left_ && x < left_ + cols_ && y >= top_ && y < top_ + rows_) {
+      buffer_[(size_t)(y - top_) * cols_ + (x - left_)] = stored(color);
+    }
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    int16_t x0 = x < left_ ? left_ : x;
+    int16_t x1 = x + w > left_ + cols_ ? left_ + cols_ : x + w;
+    int16_t y0 = y < top_ ? top_ : y;
+    int16_t y1 = y + h > top_ + rows_ ? top_ + rows_ : y + h;
+    color = stored(color);
+    for (int16_t row = y0; row < y1; row++) {
+      uint16_t* p = buffer_ + (size_t)(row - top_) * cols_;
+      for (int16_t col = x0; col < x1; col++) {
+        p[col - left_] = color;
+      }
+    }
+  }
+
+  void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) override { fillRect(x, y, w, 1, color); }
+  void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) override { fillRect(x, y, 1, h, color); }
+  void fillScreen(uint16_t color) override { fillRect(0, 0, _width, _height, color); }
+
+  uint16_t* buffer() { return buffer_; }
+
+private:
+  uint16_t stored(uint16_t color) const {
+    return panelOrder_ ? (uint16_t)((color >> 8) | (color << 8)) : color;
+  }
+
+  uint16_t* buffer_;
+  size_t pixels_;
+  bool panelOrder_;
+  int16_t left_ = 0;
+  int16_t top_ = 0;
+  int16_t cols_ = 0;
+  int16_t rows_ = 0;
+};
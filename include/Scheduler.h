@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Cooperative multi-rate scheduler.
+//
+// loop() calls tick() as often as it can; every task whose period has
+// elapsed runs once, in registration order. Tasks must never block: long
+// operations are split into state machines that do a little work per call.
+// The clock is injected so the same scheduler runs on a host under a fake
+// clock and worst-case tick latency can be asserted there
+// (test/test_scheduler). With a budget set, every task run and every tick
+// longer than it is counted as an overrun, so the worst offender shows up
+// in the per-task stats.
+
+typedef uint32_t (*SchedulerClock)();
+typedef void (*SchedulerTaskFn)();
+
+struct SchedulerTask {
+  const char* name;
+  SchedulerTaskFn run;
+  uint32_t periodMs;   // 0 = run on every tick
+  uint32_t nextRunMs;
+  uint32_t runs;
+  uint32_t maxRunUs;   // Longest single invocation seen
+  uint32_t overruns;   // Invocations longer than the budget
+};
+
+template <size_t MaxTasks>
+class Scheduler {
+public:
+  // budgetUs: longest acceptable task run or tick; 0 = don't count overruns
+  Scheduler(SchedulerClock clockMs, SchedulerClock clockUs, uint32_t budgetUs = 0)
+    : clockMs_(clockMs), clockUs_(clockUs), budgetUs_(budgetUs) {}
+
+  // Register a task. offsetMs delays the first run so tasks with the same
+  // period can be staggered instead of all firing on the same tick.
+  bool add(const char* name, SchedulerTaskFn fn, uint32_t periodMs, uint32_t offsetMs = 0) {
+    if (count_ >= MaxTasks || fn == nullptr) {
+      return false;
+    }
+    SchedulerTask& t = tasks_[count_++];
+    t.name = name;
+    t.run = fn;
+    t.periodMs = periodMs;
+    t.nextRunMs = clockMs_() + offsetMs;
+    t.runs = 0;
+    t.maxRunUs = 0;
+    t.overruns = 0;
+    return true;
+  }
+
+  // Run every task that is due. Returns the number of tasks that ran.
+  size_t tick() {
+    uint32_t tickStart = clockUs_();
+    size_t ran = 0;
+
+    for (size_t i = 0; i < count_; i++) {
+      SchedulerTask& t = tasks_[i];
+      uint32_t now = clockMs_();
+      if (!isDue(now, t.nextRunMs)) {
+        continue;
+      }
+
+      // Schedule from the ideal time, not from "now", so periods don't
+      // drift; if we fell more than a period behind, resync instead of
+      // running the task back-to-back to catch up.
+      t.nextRunMs += t.periodMs;
+      if (isDue(now, t.nextRunMs + t.periodMs)) {
+        t.nextRunMs = now + t.periodMs;
+      }
+
+      uint32_t runStart = clockUs_();
+      t.run();
+      uint32_t runUs = clockUs_() - runStart;
+      if (runUs > t.maxRunUs) {
+        t.maxRunUs = runUs;
+      }
+      if (budgetUs_ > 0 && runUs > budgetUs_) {
+        t.overruns++;
+      }
+      t.runs++;
+      ran++;
+    }
+
+    lastTickUs_ = clockUs_() - tickStart;
+    if (lastTickUs_ > maxTickUs_) {
+      maxTickUs_ = lastTickUs_;
+    }
+    if (budgetUs_ > 0 && lastTickUs_ > budgetUs_) {
+      overruns_++;
+    }
+    ticks_++;
+    return ran;
+  }
+
+  // Force a task to run on the next tick (e.g. after a state change).
+  void trigger(SchedulerTaskFn fn) {
+    for (size_t i = 0; i < count_; i++) {
+      if (tasks_[i].run == fn) {
+        tasks_[i].nextRunMs = clockMs_();
+      }
+    }
+  }
+
+  // Run a task next in delayMs instead of one period after this run. An
+  // event-driven task calls this each time with the wait until its next
+  // event; its period is then only an upper bound on the sleep.
+  void runIn(SchedulerTaskFn fn, uint32_t delayMs) {
+    for (size_t i = 0; i < count_; i++) {
+      if (tasks_[i].run == fn) {
+        tasks_[i].nextRunMs = clockMs_() + delayMs;
+      }
+    }
+  }
+
+  void resetStats() {
+    maxTickUs_ = 0;
+    for (size_t i = 0; i < count_; i++) {
+      tasks_[i].maxRunUs = 0;
+    }
+  }
+
+  size_t taskCount() const { return count_; }
+  const SchedulerTask& task(size_t i) const { return tasks_[i]; }
+  uint32_t lastTickUs() const { return lastTickUs_; }
+  uint32_t maxTickUs() const { return maxTickUs_; }
+  uint32_t ticks() const { return ticks_; }
+  uint32_t overruns() const { return overruns_; }  // Ticks longer than the budget
+  uint32_t budgetUs() const { return budgetUs_; }
+
+private:
+  // Wrap-safe "now >= deadline" for a 32-bit millisecond counter.
+  static bool isDue(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+  }
+
+  SchedulerClock clockMs_;
+  SchedulerClock clockUs_;
+  uint32_t budgetUs_;
+  SchedulerTask tasks_[MaxTasks] = {};
+  size_t count_ = 0;
+  uint32_t lastTickUs_ = 0;
+  uint32_t maxTickUs_ = 0;
+  uint32_t ticks_ = 0;
+  uint32_t overruns_ = 0;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// Latest sensor and pump state, as published by the acquisition core.
+struct SensorSnapshot {
+  float waterTemp;
+  float airTemp;
+  float humidity;
+  float tds;
+  float ph;
+  float ec;
+  float ecVoltage;          // Filtered probe voltages, for calibration
+  float tdsVoltage;
+  float phVoltage;
+  int32_t waterLevel;
+
+  bool pumpRunning;
+  bool autoPumpEnabled;
+  bool manualPumpOverride;
+  uint32_t pumpStartTime;   // millis() when the current run started
+  uint32_t lastPumpCycle;   // millis() of the last automatic cycle
+  uint32_t pumpDeadline;    // millis() of the next switch by the clock,
+  bool pumpScheduled;       // if there is one (not inhibited, not manual)
+  bool pumpInhibited;
+  uint32_t pumpRules;       // Bit i: PUMP_RULES[i] active
+  uint32_t pumpRunMs;       // Schedule with the active rules applied
+  uint32_t pumpPeriodMs;
+  uint32_t pumpRuntimeS;    // Every run since boot, manual ones included
+  uint32_t pumpAuditDropped;
+
+  uint32_t adcSamples;      // ADC samples averaged into the last reading
+  uint32_t phSpikesRejected;
+  uint32_t tdsSpikesRejected;
+  uint32_t sampledAt;       // millis() of the last sensor update
+  uint32_t loopLastUs;      // Acquisition loop timing
+  uint32_t loopMaxUs;
+  uint32_t loopOverruns;    // Iterations over the loop budget
+};
+
+// Single-writer sequence lock.
+//
+// The writer never waits: it bumps the sequence to an odd value, stores the
+// payload and bumps it again. Readers copy the payload and retry if the
+// sequence was odd or changed underneath them, so a reader never blocks the
+// writer and never observes a torn value. The payload is held as relaxed
+// atomic words, which keeps the concurrent copy free of data races.
+// Readers only spin while a write is in flight, so they should not run at a
+// higher priority on the same core as the writer.
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock payload must be trivially copyable");
+
+public:
+  SeqLock() {
+    for (size_t i = 0; i < kWords; i++) {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Publish a new value. Must only be called from one thread.
+  void write(const T& value) {
+    uint32_t buf[kWords] = {};
+    memcpy(buf, &value, sizeof(T));
+
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kWords; i++) {
+      words_[i].store(buf[i], std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Copy the latest consistent value into out. Returns its version, which
+  // increases by one with every write (0 means nothing was published yet).
+  uint32_t read(T& out) const {
+    uint32_t buf[kWords];
+    uint32_t before;
+    uint32_t after;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < kWords; i++) {
+        buf[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    memcpy(&out, buf, sizeof(T));
+    return before / 2;
+  }
+
+  T read() const {
+    T out;
+    read(out);
+    return out;
+  }
+
+  uint32_t version() const {
+    return seq_.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  static const size_t kWords = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<uint32_t> words_[kWords];
+};
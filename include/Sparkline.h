@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "History.h"
+
+// Fixed ring of plot columns for one metric's trend line.
+//
+// Samples (int16 fixed-point, HISTORY_NO_DATA for missing ones) are
+// averaged into columns of SamplesPerColumn each. Column index is screen
+// position: the ring is drawn as a sweep, the newest column just left of
+// cursor() and the oldest just right of it, so appending a column changes
+// exactly one slot and the widget can repaint it alone. written() counts
+// columns so the widget knows how many it has not drawn yet.
+//
+// The y range is kept while the data fits it and still uses a fair part
+// of it, so small wiggles don't rescale (and repaint) the whole plot.
+template <size_t Columns, uint16_t SamplesPerColumn>
+class Sparkline {
+  static_assert(Columns > 1 && SamplesPerColumn > 0, "Sparkline needs two columns and one sample per column");
+
+public:
+  Sparkline() {
+    for (size_t i = 0; i < Columns; i++) {
+      values_[i] = HISTORY_NO_DATA;
+    }
+  }
+
+  // Fold one sample into the open column; true if that closed it.
+  bool add(int16_t value) {
+    if (value != HISTORY_NO_DATA) {
+      sum_ += value;
+      valid_++;
+    }
+    if (++samples_ < SamplesPerColumn) {
+      return false;
+    }
+    values_[cursor_] = valid_ > 0 ? (int16_t)(sum_ / (int32_t)valid_) : HISTORY_NO_DATA;
+    cursor_ = (cursor_ + 1) % Columns;
+    written_++;
+    sum_ = 0;
+    valid_ = 0;
+    samples_ = 0;
+    return true;
+  }
+
+  int16_t at(size_t column) const { return values_[column]; }
+  size_t cursor() const { return cursor_; }
+  uint32_t written() const { return written_; }
+  static constexpr size_t columns() { return Columns; }
+
+  // Refit the y range to the stored columns. It is kept while every value
+  // lies inside it and the data spans at least a quarter of it; otherwise
+  // it becomes the data's range (at least minSpan) plus an eighth on each
+  // side. Returns true if it changed.
+  bool fit(int16_t minSpan) {
+    int32_t lo = INT16_MAX;
+    int32_t hi = INT16_MIN;
+    for (size_t i = 0; i < Columns; i++) {
+      if (values_[i] == HISTORY_NO_DATA) {
+        continue;
+      }
+      if (values_[i] < lo) lo = values_[i];
+      if (values_[i] > hi) hi = values_[i];
+    }
+    if (lo > hi) {
+      return false;
+    }
+    int32_t span = hi - lo < minSpan ? minSpan : hi - lo;
+    if (span < 1) {
+      span = 1;
+    }
+    if (hi_ > lo_ && lo >= lo_ && hi <= hi_ && 4 * span >= hi_ - lo_) {
+      return false;
+    }
+    int32_t low = (lo + hi - span) / 2 - span / 8;
+    int32_t high = low + span + 2 * (span / 8);
+    if (low <= INT16_MIN) low = INT16_MIN + 1;
+    if (high > INT16_MAX) high = INT16_MAX;
+    lo_ = (int16_t)low;
+    hi_ = (int16_t)(high > low ? high : low + 1);
+    return true;
+  }
+
+  // Row of value in a plot rows high (0 = top = hi()).
+  int16_t row(int16_t value, int16_t rows) const {
+    if (hi_ <= lo_) {
+      return rows / 2;
+    }
+    int32_t v = value < lo_ ? lo_ : value > hi_ ? hi_ : value;
+    return (int16_t)((rows - 1) - ((v - lo_) * (rows - 1) + (hi_ - lo_) / 2) / (hi_ - lo_));
+  }
+
+  int16_t lo() const { return lo_; }
+  int16_t hi() const { return hi_; }
+
+private:
+  int16_t values_[Columns];
+  size_t cursor_ = 0;
+  uint32_t written_ = 0;
+  int32_t sum_ = 0;
+  uint16_t valid_ = 0;
+  uint16_t samples_ = 0;
+  int16_t lo_ = 0;
+  int16_t hi_ = 0;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Outbound queue for retained state topics (one value per topic).
+//
+// Only the latest value of a state topic matters, so instead of a FIFO
+// every topic has one slot: set() stages a payload and marks the topic
+// pending if it differs from the last one staged, and the sender drains
+// pending topics whenever the connection has room. Memory is fixed, a slow
+// or absent broker only delays (and coalesces) updates, and nothing ever
+// waits. After a reconnect, requeueAll() republishes everything staged.
+template <size_t Topics, size_t PayloadBytes>
+class TopicOutbox {
+  static_assert(Topics <= 32, "TopicOutbox tracks topics in a 32-bit mask");
+
+public:
+  // Stage a payload for a topic. Returns true if it was queued.
+  bool set(size_t topic, const char* payload) {
+    uint32_t bit = 1UL << topic;
+    if ((staged_ & bit) && strncmp(payloads_[topic], payload, PayloadBytes - 1) == 0) {
+      return false;
+    }
+    strncpy(payloads_[topic], payload, PayloadBytes - 1);
+    payloads_[topic][PayloadBytes - 1] = '\0';
+    staged_ |= bit;
+    pending_ |= bit;
+    return true;
+  }
+
+  // Lowest pending topic, or -1 if there is nothing to send.
+  int next() const {
+    for (size_t i = 0; i < Topics; i++) {
+      if (pending_ & (1UL << i)) {
+        return (int)i;
+      }
+    }
+    return -1;
+  }
+
+  const char* payload(size_t topic) const { return payloads_[topic]; }
+  void sent(size_t topic) { pending_ &= ~(1UL << topic); }
+  void requeueAll() { pending_ = staged_; }
+  bool pending() const { return pending_ != 0; }
+
+private:
+  char payloads_[Topics][PayloadBytes] = {};
+  uint32_t staged_ = 0;
+  uint32_t pending_ = 0;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "Encoding.h"
+
+// Body of one Firebase Realtime Database multi-path update:
+//
+//   {"<key>":{record},"<key>":{record},...}
+//
+// PATCHed at a parent path, each key replaces that child as a whole, so a
+// batch that is sent again (the first reply was lost) overwrites its
+// records instead of adding copies, as long as a record always gets the
+// same key. uploadKey() makes keys that way.
+
+#define UPLOAD_KEY_BYTES 21  // 20 characters and the terminator
+
+// Push-ID-style key: 8 characters of time (ms), so keys sort with the
+// push IDs Firebase generates, then 12 from deviceId (the chip MAC).
+inline void uploadKey(uint32_t time, uint64_t deviceId, char* key) {
+  static const char ALPHABET[] = "-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz";
+  uint64_t ms = (uint64_t)time * 1000;
+  for (int i = 7; i >= 0; i--) {
+    key[i] = ALPHABET[ms % 64];
+    ms /= 64;
+  }
+  for (int i = 19; i >= 8; i--) {
+    key[i] = ALPHABET[deviceId % 64];
+    deviceId /= 64;
+  }
+  key[20] = '\0';
+}
+
+class UploadBatch {
+public:
+  UploadBatch(uint8_t* body, size_t capacity) : body_(body), capacity_(capacity) { reset(); }
+
+  void reset() {
+    body_[0] = '{';
+    used_ = 1;
+    records_ = 0;
+  }
+
+  // Append "key":{record}, the record written by encode(JsonEncoder&).
+  // Returns false and leaves the batch as it was if it doesn't fit; one
+  // byte is always kept for finish().
+  template <typename Encode>
+  bool add(const char* key, Encode encode) {
+    size_t keyLength = strlen(key);
+    if (used_ + keyLength + 4 >= capacity_) {
+      return false;
+    }
+    size_t used = used_ + snprintf((char*)body_ + used_, capacity_ - used_, "%s\"%s\":", records_ ? "," : "", key);
+    JsonEncoder record(body_ + used, capacity_ - used - 1);
+    encode(record);
+    if (!record.ok()) {
+      return false;
+    }
+    used_ = used + record.size();
+    records_++;
+    return true;
+  }
+
+  // Close the object; returns the body length.
+  size_t finish() {
+    body_[used_++] = '}';
+    return used_;
+  }
+
+  size_t records() const { return records_; }
+  size_t size() const { return used_; }
+
+private:
+  uint8_t* body_;
+  size_t capacity_;
+  size_t used_;
+  size_t records_;
+};
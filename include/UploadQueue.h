@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bounded FIFO of records waiting for upload, in RAM.
+//
+// push() never fails: when the queue is full the oldest record is handed
+// to the spill callback first (the caller moves it to flash), so memory
+// stays bounded and an outage only costs flash space. The uploader reads
+// a batch with at(0..n-1) and pop()s it once the server has it.
+template <typename Record, size_t Capacity>
+class UploadQueue {
+public:
+  template <typename Spill>
+  void push(const Record& record, Spill spill) {
+    if (count_ == Capacity) {
+      spill(records_[start_]);
+      pop(1);
+    }
+    records_[(start_ + count_) % Capacity] = record;
+    count_++;
+  }
+
+  void pop(size_t n) {
+    if (n > count_) {
+      n = count_;
+    }
+    start_ = (start_ + n) % Capacity;
+    count_ -= n;
+  }
+
+  Record& at(size_t i) { return records_[(start_ + i) % Capacity]; }
+  const Record& at(size_t i) const { return records_[(start_ + i) % Capacity]; }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  Record records_[Capacity];
+  size_t start_ = 0;
+  size_t count_ = 0;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Wall-clock time without waiting on NTP.
+//
+// The offset between Unix time and a monotonic microsecond counter is
+// cached when the clock is synced (from the SNTP callback), so reading the
+// time is one atomic load and an add: it never blocks and never jumps
+// backwards between syncs the way a step of the system clock can. Until
+// the first sync seconds() returns 0, which callers treat as "unknown".
+// The offset is kept in whole seconds so it stays a lock-free 32-bit
+// atomic on the ESP32.
+class WallClock {
+public:
+  // The clock read epochUs (Unix time, µs) at monotonic time monoUs.
+  void sync(int64_t epochUs, int64_t monoUs) {
+    int64_t offset = (epochUs - monoUs + 500000) / 1000000;
+    offset_.store((uint32_t)offset, std::memory_order_relaxed);
+  }
+
+  // Unix seconds at monotonic time monoUs, 0 before the first sync.
+  uint32_t seconds(int64_t monoUs) const {
+    uint32_t offset = offset_.load(std::memory_order_relaxed);
+    return offset == 0 ? 0 : offset + (uint32_t)(monoUs / 1000000);
+  }
+
+  bool valid() const { return offset_.load(std::memory_order_relaxed) != 0; }
+
+private:
+  std::atomic<uint32_t> offset_{0};
+};
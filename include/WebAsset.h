@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A dashboard file embedded by tools/embed_assets.py (WebAssetData.h).
+// data points into the flash-mapped rodata segment, so responses stream
+// from flash without the file ever being copied into RAM.
+struct WebAsset {
+  const char* path;
+  const char* contentType;
+  const uint8_t* data;
+  size_t length;
+  const char* etag;   // Quoted content hash
+  bool gzip;          // data is gzip'd: send Content-Encoding: gzip
+  bool immutable;     // Addressed by hash from the page: cache for a year
+};
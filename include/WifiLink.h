@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdint.h>
+#include "Backoff.h"
+
+// Station link manager, without the radio.
+//
+// The caller polls update() with whether the station is up (associated,
+// with an address) and carries out the action it returns: start an
+// attempt, give up on one that timed out, or start/stop what rides on the
+// link. An attempt that times out is retried after a capped exponential
+// backoff. When the caller holds a cached BSSID, channel and address from
+// the last session, the first attempt after a reset or a drop joins that
+// access point directly with that address (no scan, no DHCP); if it fails,
+// the cache is dropped and a full attempt follows at once. After
+// portalAfter consecutive failed full attempts, or with no credentials,
+// portalWanted() asks for the setup portal; attempts carry on behind it.
+//
+// Times are millis(); the random source for the backoff jitter is passed
+// in, as for Backoff.
+
+enum WifiLinkState : uint8_t {
+  WIFI_LINK_IDLE = 0,    // No credentials
+  WIFI_LINK_CONNECTING,  // An attempt is in flight
+  WIFI_LINK_UP,
+  WIFI_LINK_WAITING      // Backing off before the next attempt
+};
+
+enum WifiLinkAction : uint8_t {
+  WIFI_LINK_NONE = 0,
+  WIFI_LINK_CONNECT_FAST,  // Join the cached access point with the cached address
+  WIFI_LINK_CONNECT,       // Scan and use DHCP
+  WIFI_LINK_ABORT,         // Drop the attempt in flight
+  WIFI_LINK_ONLINE,        // The link came up
+  WIFI_LINK_OFFLINE        // The link went down
+};
+
+struct WifiLinkTiming {
+  uint32_t fastTimeoutMs;
+  uint32_t timeoutMs;
+  uint32_t backoffBaseMs;
+  uint32_t backoffCapMs;
+  uint8_t portalAfter;
+};
+
+class WifiLink {
+public:
+  explicit WifiLink(const WifiLinkTiming& timing)
+    : timing_(timing), backoff_(timing.backoffBaseMs, timing.backoffCapMs) {}
+
+  // Start over with (new) credentials. fastCached: the caller holds a
+  // cache for them. The first attempt is made on the next update(); if the
+  // link is up, once the caller has dropped it (and had WIFI_LINK_OFFLINE).
+  void begin(bool haveCredentials, bool fastCached, uint32_t nowMs) {
+    haveCredentials_ = haveCredentials;
+    fast_ = fastCached;
+    backoff_.reset();
+    fullFailures_ = 0;
+    nextAttemptMs_ = nowMs;
+    if (state_ != WIFI_LINK_UP) {
+      downSinceMs_ = nowMs;
+      state_ = haveCredentials ? WIFI_LINK_WAITING : WIFI_LINK_IDLE;
+    }
+  }
+
+  WifiLinkAction update(bool up, uint32_t nowMs, uint32_t random) {
+    if (up) {
+      if (state_ == WIFI_LINK_UP) {
+        return WIFI_LINK_NONE;
+      }
+      uint32_t downMs = nowMs - downSinceMs_;
+      if (connects_ > 0) {
+        reconnects_++;
+        downTotalMs_ += downMs;
+        if (downMs > maxReconnectMs_) {
+          maxReconnectMs_ = downMs;
+        }
+      }
+      lastConnectMs_ = downMs;
+      if (fastAttempt_) {
+        fastConnects_++;
+      }
+      connects_++;
+      backoff_.reset();
+      fullFailures_ = 0;
+      state_ = WIFI_LINK_UP;
+      return WIFI_LINK_ONLINE;
+    }
+
+    switch (state_) {
+      case WIFI_LINK_UP:
+        outages_++;
+        downSinceMs_ = nowMs;
+        nextAttemptMs_ = nowMs;
+        state_ = haveCredentials_ ? WIFI_LINK_WAITING : WIFI_LINK_IDLE;
+        return WIFI_LINK_OFFLINE;
+
+      case WIFI_LINK_CONNECTING: {
+        uint32_t timeout = fastAttempt_ ? timing_.fastTimeoutMs : timing_.timeoutMs;
+        if ((int32_t)(nowMs - attemptStartMs_) < (int32_t)timeout) {
+          return WIFI_LINK_NONE;
+        }
+        failedAttempts_++;
+        if (fastAttempt_) {
+          fast_ = false;  // Stale cache: scan at once
+          nextAttemptMs_ = nowMs;
+        } else {
+          if (fullFailures_ < UINT8_MAX) {
+            fullFailures_++;
+          }
+          nextAttemptMs_ = nowMs + backoff_.fail(random);
+        }
+        state_ = WIFI_LINK_WAITING;
+        return WIFI_LINK_ABORT;
+      }
+
+      case WIFI_LINK_WAITING:
+        if ((int32_t)(nowMs - nextAttemptMs_) < 0) {
+          return WIFI_LINK_NONE;
+        }
+        fastAttempt_ = fast_;
+        attemptStartMs_ = nowMs;
+        attempts_++;
+        state_ = WIFI_LINK_CONNECTING;
+        return fastAttempt_ ? WIFI_LINK_CONNECT_FAST : WIFI_LINK_CONNECT;
+
+      default:
+        return WIFI_LINK_NONE;
+    }
+  }
+
+  // The caller cached the access point and address of the session now up
+  void cached() { fast_ = true; }
+
+  bool portalWanted() const {
+    return state_ != WIFI_LINK_UP && (!haveCredentials_ || fullFailures_ >= timing_.portalAfter);
+  }
+
+  WifiLinkState state() const { return state_; }
+  bool up() const { return state_ == WIFI_LINK_UP; }
+
+  // Milliseconds until the next attempt (0 if one is due or in flight)
+  uint32_t retryInMs(uint32_t nowMs) const {
+    if (state_ != WIFI_LINK_WAITING || (int32_t)(nowMs - nextAttemptMs_) >= 0) {
+      return 0;
+    }
+    return nextAttemptMs_ - nowMs;
+  }
+
+  // Current outage so far (0 while up)
+  uint32_t downForMs(uint32_t nowMs) const { return state_ == WIFI_LINK_UP ? 0 : nowMs - downSinceMs_; }
+
+  uint32_t attempts() const { return attempts_; }
+  uint32_t failedAttempts() const { return failedAttempts_; }
+  uint32_t connects() const { return connects_; }
+  uint32_t fastConnects() const { return fastConnects_; }
+  uint32_t outages() const { return outages_; }
+  uint32_t reconnects() const { return reconnects_; }
+  uint32_t lastConnectMs() const { return lastConnectMs_; }   // Down (or boot) to up, last time
+  uint32_t maxReconnectMs() const { return maxReconnectMs_; } // Longest outage that ended
+  uint32_t downTotalMs() const { return downTotalMs_; }       // Outages that ended, summed
+
+private:
+  WifiLinkTiming timing_;
+  Backoff backoff_;
+  WifiLinkState state_ = WIFI_LINK_IDLE;
+  bool haveCredentials_ = false;
+  bool fast_ = false;         // A cache is held for the next attempt
+  bool fastAttempt_ = false;  // The attempt in flight (or last made) used it
+  uint8_t fullFailures_ = 0;
+  uint32_t attemptStartMs_ = 0;
+  uint32_t nextAttemptMs_ = 0;
+  uint32_t downSinceMs_ = 0;
+
+  uint32_t attempts_ = 0;
+  uint32_t failedAttempts_ = 0;
+  uint32_t connects_ = 0;
+  uint32_t fastConnects_ = 0;
+  uint32_t outages_ = 0;
+  uint32_t reconnects_ = 0;
+  uint32_t lastConnectMs_ = 0;
+  uint32_t maxReconnectMs_ = 0;
+  uint32_t downTotalMs_ = 0;
+};
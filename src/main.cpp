@@ -1,31 +1,65 @@
 #include <OneWire.h>
 #include <DallasTemperature.h>
 #include <DHT.h>
-#include <Adafruit_NeoPixel.h>
+#include <Ultrasonic.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_ILI9341.h>
+#include <TFT_eSPI.h>
 #include <SPI.h>
 #include <math.h>
-#include <DFRobot_EC.h>
+#include <Preferences.h>
+#include <LittleFS.h>
 #include <WiFi.h>
-#include <WebServer.h>
+#include <DNSServer.h>
+#include <ESPAsyncWebServer.h>
 #include <HTTPClient.h>
+#include <AsyncMqttClient.h>
+#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include <time.h>
+#include <atomic>
+#include <memory>
+#include <driver/adc.h>
+#include <driver/rmt.h>
+#include <esp_timer.h>
+#include <esp_sntp.h>
+#include <esp_system.h>
+#include "Scheduler.h"
+#include "SensorSnapshot.h"
+#include "AdcDemux.h"
+#include "Filters.h"
+#include "LutCurve.h"
+#include "Calibration.h"
+#include "ProbeConversion.h"
+#include "History.h"
+#include "FlashLog.h"
+#include "Encoding.h"
+#include "ApiRouter.h"
+#include "UploadQueue.h"
+#include "UploadBatch.h"
+#include "Backoff.h"
+#include "SpscQueue.h"
+#include "WallClock.h"
+#include "TopicOutbox.h"
+#include "DeltaReporter.h"
+#include "RegionCanvas.h"
+#include "Sparkline.h"
+#include "LedEngine.h"
+#include "Photoperiod.h"
+#include "WifiLink.h"
+#include "PumpRules.h"
+#include "WebAssetData.h"  // Generated by tools/embed_assets.py
 
 // --- TFT Display
-#define TFT_CS     5
-#define TFT_RST    2
-#define TFT_DC     4
-#define TFT_SCLK   18
-#define TFT_MOSI   23
+// Driver, bus pins (CS 5, RST 2, DC 4, SCLK 18, MOSI 23) and SPI clock are
+// TFT_eSPI build flags in platformio.ini
 #define TFT_LED    33
 
 // --- Water Pump Relay
 #define PUMP_RELAY_PIN 26
 
-Adafruit_ILI9341 tft = Adafruit_ILI9341(TFT_CS, TFT_DC, TFT_RST);
-WebServer server(80);
+TFT_eSPI tft;
+AsyncWebServer server(80);
+AsyncEventSource events("/api/events");
 
 // Colors (RGB565 format)
 #define BACKGROUND_COLOR      0xFFFF // White
@@ -44,6 +78,77 @@ WebServer server(80);
 #define WARNING_COLOR         0xFD20 // Orange
 #define TEXT_DARK             0x0000 // Black text
 #define TEXT_LIGHT            0xFFFF // White text
+
+// --- Display (network core only)
+// Retained mode: the static layout is drawn once, then each widget keeps
+// the text it last showed and repaints only its own rectangle when that
+// changes. Rectangles are rendered off-screen into one of two canvases
+// and pushed over SPI DMA as finished pixels, one address window per
+// strip; the next strip is drawn into the other canvas while the DMA
+// engine is still sending the previous one.
+#define TFT_CANVAS_PIXELS  2048  // 4 KB per strip buffer, two of them
+#define TFT_WINDOW_BYTES   11    // CASET + PASET + RAMWR per pushed window
+#define TFT_WIDGET_TEXT    24
+#define CARD_WIDTH         100
+#define CARD_HEIGHT        50
+#define WATER_BAR_WIDTH    296
+#define WATER_BAR_EASE     4     // The fill covers 1/4 of the remaining gap per frame
+
+enum TftCard {
+  CARD_AIR_TEMP = 0,
+  CARD_HUMIDITY,
+  CARD_TDS,
+  CARD_EC,
+  CARD_PH,
+  CARD_WATER_TEMP,
+  CARD_COUNT
+};
+
+struct CardLayout {
+  int16_t x;
+  int16_t y;
+  const char* title;
+};
+
+const CardLayout CARD_LAYOUT[CARD_COUNT] = {
+  {5, 45, "AIR TEMP"}, {110, 45, "HUMIDITY"}, {215, 45, "TDS"},
+  {5, 100, "EC"}, {110, 100, "pH"}, {215, 100, "H2O TEMP"}
+};
+
+// Internal RAM, so the SPI DMA engine can read it
+alignas(4) uint16_t tftCanvasBuffer[2][TFT_CANVAS_PIXELS];
+RegionCanvas tftCanvas[2] = {
+  RegionCanvas(tftCanvasBuffer[0], TFT_CANVAS_PIXELS, true),
+  RegionCanvas(tftCanvasBuffer[1], TFT_CANVAS_PIXELS, true)
+};
+uint8_t tftCanvasNext = 0;
+bool tftLayoutDrawn = false;
+
+// Frame in progress: the bus is held from the first push to the last pixel
+struct TftFrame {
+  bool open;
+  uint32_t startUs;
+  uint32_t bytes;
+  uint32_t renderUs;
+};
+TftFrame tftFrame = {};
+
+// Last frame that repainted anything
+uint32_t tftFrames = 0;
+uint32_t tftFrameBytes = 0;  // SPI payload
+uint32_t tftFrameUs = 0;     // First draw to last pixel on the panel
+uint32_t tftRenderUs = 0;    // CPU time spent drawing into the canvases
+uint32_t tftFrameMaxUs = 0;
+uint32_t tftBytesTotal = 0;
+
+// What each widget shows now; cleared to force a repaint
+char cardShown[CARD_COUNT][TFT_WIDGET_TEXT];
+char waterLevelShown[TFT_WIDGET_TEXT];
+char ledIndicatorShown[TFT_WIDGET_TEXT];
+char pumpIndicatorShown[TFT_WIDGET_TEXT];
+char footerShown[TFT_WIDGET_TEXT];
+char clockShown[TFT_WIDGET_TEXT];
+int16_t waterFillShown = -1;  // Fill width in pixels, -1 = repaint the whole bar
 #define TEXT_GREEN            0x0720 // Dark green text
 
 // --- DS18B20 (Water Temp)
@@ -56,21 +161,81 @@ DallasTemperature waterTempSensor(&oneWire);
 #define DHTTYPE DHT22
 DHT dht(DHTPIN, DHTTYPE);
 
+// --- JSN-SR04T (Water Level), looking down at the surface from the lid
+#define JSN_TRIG_PIN 14
+#define JSN_ECHO_PIN 15
+#define WATER_LEVEL_FULL_CM   25  // Surface distance at 100 %, clear of the ~20 cm blind zone
+#define WATER_LEVEL_EMPTY_CM  75  // Surface distance at 0 %
+#define JSN_ECHO_TIMEOUT_US   ((WATER_LEVEL_EMPTY_CM + 25) * 58)  // 58 us per cm, there and back
+Ultrasonic levelSensor(JSN_TRIG_PIN, JSN_ECHO_PIN, JSN_ECHO_TIMEOUT_US);
+
 // --- TDS Sensor
-#define TDS_PIN 36
+#define TDS_PIN 36          // ADC1_CH0
+#define TDS_ADC_CHANNEL ADC1_CHANNEL_0
 
 // --- pH Sensor
-#define PH_PIN 34
+#define PH_PIN 34           // ADC1_CH6
+#define PH_ADC_CHANNEL ADC1_CHANNEL_6
+
+// --- EC Sensor (was wired to GPIO 34 together with pH)
+#define EC_PIN 39           // ADC1_CH3
+#define EC_ADC_CHANNEL ADC1_CHANNEL_3
+
+// --- LED Strip (network core only)
+// Frames are computed by ledEngine (see LedEngine.h) every LED_FRAME_PERIOD
+// and only sent when they changed. Sending is rmt_write_sample(): it
+// returns at once and the RMT interrupt translates the GRB bytes into
+// WS2812 pulses as the channel's memory drains, so interrupts stay enabled
+// and no task waits for the ~4.3 ms a frame takes on the wire.
+#define LED_PIN           27
+#define NUM_LEDS          140
+#define BRIGHTNESS        200
+#define LED_ZONE_COUNT    4       // Tower levels, bottom first
+#define LED_GAMMA         2.6f
+#define LED_FRAME_PERIOD  20      // ms (50 fps)
+#define LED_FADE_MS       1500    // Preset and zone changes
+#define LED_SUNRISE_MS    20000   // Boot ramp into the growth preset
+#define LED_RMT_CHANNEL   RMT_CHANNEL_0
+#define LED_RMT_CLK_DIV   2       // 80 MHz APB / 2: 25 ns ticks
+#define LED_RMT_BLOCKS    2       // 128 items: a refill interrupt every 8 bytes
+#define LED_ZONE_PENDING  0x80000000UL
+
+LedEngine<NUM_LEDS, LED_ZONE_COUNT> ledEngine(LED_GAMMA);
+uint8_t ledFrame[NUM_LEDS * 3];  // Read by the RMT interrupt while sending
+uint32_t ledFramesSent = 0;
+uint32_t ledFramesUnchanged = 0;
 
-// --- EC Sensor  
-#define EC_PIN 34
-DFRobot_EC ec;
+// Dawn and dusk, between the current colour and the target
+const LedStop SUNRISE_STOPS[] = {{250, {60, 8, 0}}, {600, {255, 90, 20}}};
+const LedStop SUNSET_STOPS[] = {{400, {255, 90, 20}}, {750, {60, 8, 0}}};
 
-// --- LED Strip
-#define LED_PIN    27
-#define NUM_LEDS   140
-#define BRIGHTNESS 200
-Adafruit_NeoPixel strip(NUM_LEDS, LED_PIN, NEO_GRB + NEO_KHZ800);
+// Boot pattern showing the IP address (see startIpPattern)
+#define LED_IP_PATTERN_STEPS 40
+LedStep ipPatternSteps[LED_IP_PATTERN_STEPS];
+
+// Strip presets, indexed by ledMode
+enum LedModeId {
+  LED_MODE_OFF = 0,
+  LED_MODE_GROWTH,
+  LED_MODE_RELAX,
+  LED_MODE_SLEEP,
+  LED_MODE_COUNT
+};
+
+struct LedPreset {
+  const char* name;
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  const char* message;
+};
+
+const LedPreset LED_PRESETS[LED_MODE_COUNT] = {
+  {"off", 0, 0, 0, "LED turned OFF"},
+  {"growth", 255, 180, 80, "LED set to Growth Mode"},   // Warm sunlight
+  {"relax", 0, 100, 255, "LED set to Relaxing Mode"},   // Calm blue
+  {"sleep", 255, 50, 0, "LED set to Sleep Mode"}        // Soft red
+};
 
 // --- Global Variables
 float waterTemp = 25.0;
@@ -80,13 +245,12 @@ float tds_value = 0.0;
 float phValue = 7.0;
 float ecValue = 0.0;
 float ecVoltage = 0.0;
-bool ecCalibrated = false;
-float kValue = 1.0;  // K value for EC calculation
-bool manualCalibration = false;
-long waterLevel = 78; // Fixed water level percentage
-bool ledStatus = false;
+float tdsVoltage = 0.0;
+float phVoltage = 0.0;
+long waterLevel = 0;   // %, from the JSN-SR04T
+std::atomic<bool> ledStatus(false);  // Written by networkTask, read from any task
 bool pumpStatus = false;
-int ledMode = 0;
+std::atomic<int> ledMode(0);         // LedModeId; likewise
 
 // Pump control variables
 bool autoPumpEnabled = true;  // Auto mode enabled by default
@@ -95,946 +259,3135 @@ unsigned long lastPumpCycle = 0;  // Last time pump ran automatically
 unsigned long pumpStartTime = 0;  // When current pump cycle started
 bool pumpRunning = false;  // Current pump state
 bool pumpManualControl = false;  // Manual control flag
-const unsigned long PUMP_CYCLE_INTERVAL = 3600000;  // 1 hour in milliseconds
-const unsigned long PUMP_RUN_DURATION = 600000;     // 10 minutes in milliseconds
+uint64_t pumpRuntimeMs = 0;   // Every run, manual ones included
+
+// Auto mode: the schedule and rules are in PumpRules.h, pumpEngine
+// (acquisition core only) applies them; see handlePumpControl(). Every
+// switch goes to the network core for the audit trail.
+#define PUMP_IDLE_MS        60000  // Longest sleep of the pump task
+#define PUMP_AUDIT_DEPTH    32     // Switches kept for GET /api/pump/audit
+#define PUMP_AUDIT_HANDOFF  16
+#define PUMP_AUDIT_PERIOD   500    // Handoff drain
+const char* const PUMP_REASON_NAMES[] = {"cycleStart", "cycleEnd", "inhibit", "manual"};
+
+PumpEngine<PUMP_RULE_COUNT> pumpEngine(PUMP_CYCLE, PUMP_RULES, PUMP_RULE_COUNT);
+SpscQueue<PumpActuation, PUMP_AUDIT_HANDOFF> pumpAuditHandoff;  // Control loop -> networkTask
+uint32_t pumpAuditDropped = 0;              // Acquisition side only
+PumpActuation pumpAudit[PUMP_AUDIT_DEPTH];  // NetworkDataLock; ring, newest at pumpAuditCount - 1
+uint32_t pumpAuditCount = 0;                // NetworkDataLock
+
+// Sensor sampling (non-blocking, driven by the scheduler)
+const unsigned long SENSOR_SAMPLE_PERIOD = 2000;    // Every probe is read once per period
+const unsigned long DS18B20_CONVERSION_TIME = 750;  // 12-bit conversion time
+const unsigned long FIREBASE_UPLOAD_INTERVAL = 120000; // 2 minutes between samples (uploads are batched)
+const unsigned long TFT_FRAME_INTERVAL = 40;           // 25 fps for animation; unchanged widgets cost nothing
+
+// Continuous ADC: the I2S DMA engine scans every analog channel in turn and
+// fills the driver's ring buffer; adcDrain() moves whatever has arrived into
+// the demultiplexer, and each reading is the mean of everything collected
+// since the previous one (thousands of samples, no busy-waiting).
+#define ADC_DMA_SAMPLE_RATE   20000  // Conversions/s shared by all channels
+#define ADC_DMA_STORE_BYTES   4096   // Driver ring buffer
+#define ADC_DMA_FRAME_BYTES   256    // Bytes per DMA interrupt
+
+enum AdcSlot {
+  ADC_SLOT_TDS = 0,
+  ADC_SLOT_PH,
+  ADC_SLOT_EC,
+  ADC_SLOT_COUNT
+};
+
+AdcDemux<ADC_SLOT_COUNT> adcDemux;
+
+// Per-channel filter chains, run on every DMA sample before decimation.
+// pH and TDS see spikes when the pump switches, so both reject outliers
+// first; EC drifts slowly and is tracked with a Kalman filter.
+Chain<OutlierReject<15, 120>, Median<7>, Ema<q15(0.02)>> phFilter;
+Chain<OutlierReject<15, 120>, Median<5>, MovingAverage<64>> tdsFilter;
+Chain<Median<5>, Kalman1D<1, 400>> ecFilter;
+
+// Conversion tables (ProbeConversion.h), built from the probe
+// calibrations below.
+// Calibration changes rebuild the inactive buffer on the network core and
+// then swap the pointer, so the sampler never waits for (or sees) a
+// half-built table. Rebuilds are at least one sample period apart, which
+// guarantees the sampler has finished with the buffer being reused.
+ConversionTables conversionBuffers[2];
+std::atomic<const ConversionTables*> conversionTables(&conversionBuffers[0]);
+TemperatureTables temperatureTables;
+bool adcDmaRunning = false;
+uint32_t adcSamplesPerReading = 0;
+
+bool waterTempConverting = false;
+unsigned long waterTempRequestTime = 0;
+unsigned long waterTempNextSample = 0;
+
+// --- Dual-core split
+// Acquisition and pump control run in loop() on the Arduino core; HTTP,
+// serial reporting and the display run on the other core, in networkTask
+// and the async_tcp task (pinned there by CONFIG_ASYNC_TCP_RUNNING_CORE).
+// Outbound uploads, which can block for seconds on a bad link, get a task
+// of their own (uplinkTask) on the same core, fed samples through a
+// lock-free queue. The sides only share the seqlocked snapshot
+// (sensor -> network), the upload handoff (control -> uplink) and the
+// command mailboxes (network -> control), so a slow client, a TLS
+// handshake or an unreachable server can never hold up sampling or pump
+// timing.
+#define ACQUISITION_CORE 1   // Core the Arduino loopTask is pinned to
+#define NETWORK_CORE     0
+#define NETWORK_TASK_STACK 8192
+#define UPLINK_TASK_STACK  12288 // TLS handshakes need a deep stack
+#define LOOP_BUDGET_US     10000 // Worst-case loop() iteration; longer ones are counted
+#define NETWORK_BUDGET_US  50000 // Same for networkTask; flash writes and TFT frames fit
+
+enum PumpCommand : uint8_t {
+  PUMP_CMD_NONE = 0,
+  PUMP_CMD_ON,
+  PUMP_CMD_OFF,
+  PUMP_CMD_AUTO
+};
+
+// Command names, as in /api/pump/<name> and the MQTT pump command
+const char* const PUMP_COMMAND_NAMES[] = {"none", "on", "off", "auto"};
+
+SeqLock<SensorSnapshot> sensorSnapshot;
+bool snapshotDirty = true;  // Acquisition side only
+bool readingsStarted = false;  // Acquisition side only: a probe has produced a value
+std::atomic<uint8_t> pendingPumpCommand(PUMP_CMD_NONE);
+std::atomic<int8_t> pendingLedMode(-1);  // LedModeId posted by HTTP, applied by networkTask
+std::atomic<uint32_t> pendingLedZone[LED_ZONE_COUNT];  // LED_ZONE_PENDING | 0xRRGGBB, from HTTP
+TaskHandle_t networkTaskHandle = nullptr;
+TaskHandle_t uplinkTaskHandle = nullptr;
+WallClock wallClock;        // Synced by SNTP, read from any task
+
+// Boot timeline: when each stage was first reached, in ms since the app
+// started. setup() brings up the pump and sensors and returns so sampling
+// starts at once; the display, storage and network come up behind it.
+enum BootStage : uint8_t {
+  BOOT_PUMP = 0,      // Relay driven to its safe (off) state
+  BOOT_SENSORS,       // Probes started, sampling tasks registered
+  BOOT_FIRST_SAMPLE,  // First reading published
+  BOOT_DISPLAY,       // TFT up, first frame drawn
+  BOOT_STORAGE,       // LittleFS mounted, flash log indexed
+  BOOT_WIFI,          // Got an IP address
+  BOOT_SERVER,        // Web server listening
+  BOOT_NTP,           // Wall clock synced
+  BOOT_MQTT,          // Broker session up
+  BOOT_STAGE_COUNT
+};
+
+const char* const BOOT_STAGE_NAMES[BOOT_STAGE_COUNT] = {
+  "pump", "sensors", "firstSample", "display", "storage", "wifi", "server", "ntp", "mqtt"
+};
+#define BOOT_NOT_REACHED  UINT32_MAX
+
+std::atomic<uint32_t> bootStageMs[BOOT_STAGE_COUNT];  // Written once each, from any task
+
+// HTTP handlers run on the async_tcp task, networkTask's periodic work on
+// its own; this guards what both touch: calibrations, history, the flash
+// log and the status cache. Held only for short, non-blocking sections.
+SemaphoreHandle_t networkDataMutex = nullptr;
 
-// WiFi credentials
+class NetworkDataLock {
+public:
+  NetworkDataLock() { xSemaphoreTake(networkDataMutex, portMAX_DELAY); }
+  ~NetworkDataLock() { xSemaphoreGive(networkDataMutex); }
+};
+
+uint32_t schedulerMillis() { return millis(); }
+uint32_t schedulerMicros() { return micros(); }
+Scheduler<12> scheduler(schedulerMillis, schedulerMicros, LOOP_BUDGET_US);                // Acquisition core
+Scheduler<16> networkScheduler(schedulerMillis, schedulerMicros, NETWORK_BUDGET_US);      // Network core
+Scheduler<4> uplinkScheduler(schedulerMillis, schedulerMicros);  // Network core, uplinkTask; HTTP blocks by design
+
+// WiFi credentials: used until others are saved from the setup portal or
+// POST /api/wifi
 const char* ssid = "Traders Hotel";
 const char* password = "";
 
 // Firebase configuration
 const char* firebaseHost = "https://hydrobrain-1f3c2-default-rtdb.firebaseio.com";
 
+// Optional binary collector. Firebase only accepts JSON; when this is set,
+// every upload is also POSTed here encoded with CollectorEncoder.
+const char* collectorUrl = "";
+typedef CborEncoder CollectorEncoder;
+
+// Optional MQTT broker; leave the host empty to disable. Topics live under
+// hydrobrain/<chip id>/ (printed at boot).
+const char* mqttHost = "";
+const uint16_t mqttPort = 1883;
+const char* mqttUser = "";       // Empty: connect anonymously
+const char* mqttPassword = "";
+
+#define STATUS_BUFFER_BYTES 512   // Encoded /api/status body (~350 bytes of JSON)
+#define STATUS_SLOTS        3     // Bodies per encoding: the current one and two still sending
+#define UPLOAD_BUFFER_BYTES 512   // Encoded upload body
+
+enum StatusEncoding {
+  STATUS_JSON = 0,
+  STATUS_CBOR,
+  STATUS_MSGPACK,
+  STATUS_ENCODING_COUNT
+};
+
+struct StatusEncodingInfo {
+  const char* contentType;
+  const char* tag;  // ETag suffix
+};
+
+const StatusEncodingInfo STATUS_ENCODINGS[STATUS_ENCODING_COUNT] = {
+  {"application/json", "j"},
+  {"application/cbor", "c"},
+  {"application/msgpack", "m"}
+};
+
+// Encoded /api/status bodies (network core only). A body is never changed
+// while a response is sending it: responses send straight from the slot
+// and hold it until their connection closes, and a newer version is
+// encoded into a free slot.
+struct StatusBody {
+  uint32_t version;
+  bool ledStatus;
+  int ledMode;
+  size_t length;     // 0 = too large for the buffer
+  char etag[24];
+  mutable std::atomic<uint8_t> senders;  // Responses holding this slot
+  uint8_t body[STATUS_BUFFER_BYTES];
+};
+StatusBody statusBodies[STATUS_ENCODING_COUNT][STATUS_SLOTS];
+const StatusBody* statusCurrent[STATUS_ENCODING_COUNT] = {};  // NetworkDataLock
+uint32_t statusSlotsBusy = 0;  // Stale bodies served because every slot was sending
+
+// --- Live event stream
+// GET /api/events keeps the connection open as a Server-Sent Events
+// stream: the full status on connect, then a "delta" event with just the
+// changed fields whenever the snapshot or LED state changes. The event
+// source queues per client and drops messages a slow reader can't take.
+#define EVENTS_MAX_CLIENTS  4
+#define EVENTS_RETRY_MS     2000   // Browser reconnect delay
+#define EVENTS_PERIOD       100    // ms between change checks
+#define EVENTS_PING_PERIOD  15000  // Keep-alive event when nothing changes
+#define EVENTS_HOLD         250    // ms to gather a burst of changes into one delta
+
+// --- HTTP API
+// Chunked exports (history, flash log) hold a cursor between chunks and
+// the data lock while filling one; more than this at once gets 503.
+#define API_MAX_EXPORTS     2
+#define HISTORY_POINT_BYTES 64     // Upper bound for one [t,min,max,avg]
+#define LOG_LINE_BYTES      256    // Upper bound for one exported record
+
+std::atomic<int> activeExports(0);
+
+uint32_t liveVersion = 0;  // Snapshot version last checked for deltas
+unsigned long lastEventTime = 0;
+
 // Time configuration
 const char* ntpServer = "pool.ntp.org";
 const long gmtOffset_sec = 10800; // GMT+3 (adjust for your timezone)
 const int daylightOffset_sec = 0;
 
-float calculateECManual(float voltage, float temperature) {
-  // Updated calibration based on actual readings
-  // You measured 1.229V in 1413 µS/cm solution
-  
-  // Assuming distilled water gives ~0.0V (you should measure this)
-  float voltage_zero = 0.0;  // Voltage in distilled water
-  float voltage_1413 = 1.229; // Your actual measured voltage in 1413 µS/cm
-  
-  if (voltage <= voltage_zero) {
-    return 0.0; // Below minimum, assume pure water
+// --- Probe calibration (2-5 points per probe, persisted in NVS)
+enum CalibrationProbe {
+  PROBE_PH = 0,
+  PROBE_EC,
+  PROBE_TDS,
+  PROBE_COUNT
+};
+
+const char* const PROBE_NAMES[PROBE_COUNT] = {"ph", "ec", "tds"};
+
+// Factory calibration (ProbeConversion.h), used until a probe has two
+// captured points
+const ProbeCalibration DEFAULT_CALIBRATION[PROBE_COUNT] = {
+  PH_FACTORY_CALIBRATION,
+  EC_FACTORY_CALIBRATION,
+  {0, {}}
+};
+
+// NVS-backed storage for the calibration store
+class PreferencesStorage : public CalibrationStorage {
+public:
+  explicit PreferencesStorage(const char* name) : name_(name) {}
+
+  size_t read(const char* key, void* data, size_t length) override {
+    if (!prefs_.begin(name_, true)) {
+      return 0;
+    }
+    size_t got = prefs_.isKey(key) ? prefs_.getBytes(key, data, length) : 0;
+    prefs_.end();
+    return got;
   }
-  
-  // Linear interpolation
-  float slope = 1413.0 / (voltage_1413 - voltage_zero);
-  float rawEC = slope * (voltage - voltage_zero);
-  
-  // Temperature compensation (2% per degree from 25°C)
-  float tempCoeff = 1.0 + 0.02 * (temperature - 25.0);
-  float compensatedEC = rawEC * tempCoeff;
-  
-  return compensatedEC;
+
+  bool write(const char* key, const void* data, size_t length) override {
+    if (!prefs_.begin(name_, false)) {
+      return false;
+    }
+    bool ok = prefs_.putBytes(key, data, length) == length;
+    prefs_.end();
+    return ok;
+  }
+
+  bool remove(const char* key) override {
+    if (!prefs_.begin(name_, false)) {
+      return false;
+    }
+    if (prefs_.isKey(key)) {
+      prefs_.remove(key);
+    }
+    prefs_.end();
+    return true;
+  }
+
+private:
+  const char* name_;
+  Preferences prefs_;
+};
+
+PreferencesStorage calibrationStorage("calibration");
+CalibrationStore calibrationStore(calibrationStorage);
+ProbeCalibration calibrations[PROBE_COUNT];  // Captured points, network core only
+bool calibrationChanged = false;
+
+// --- Grow light schedule (network core only)
+// serviceLighting() runs at each photoperiod transition (see Photoperiod.h)
+// and sleeps in between. A settings change or a clock sync wakes it early
+// through lightingWake. Presets posted over HTTP or MQTT still apply at
+// once and hold until the next transition.
+#define LIGHTING_IDLE_MS        3600000  // Longest sleep (also while disabled or without a clock)
+#define LIGHTING_WAKE           1        // lightingWake bits: re-plan now,
+#define LIGHTING_REAPPLY        2        // and drive the strip even if the phase is unchanged
+#define LIGHTING_VERSION        1
+
+struct LightingSettings {
+  uint8_t version;
+  bool enabled;
+  PhotoperiodConfig schedule;
+};
+
+// 16/8 from 06:00 with 30 min ramps; set ppfd from a meter reading
+// before relying on a DLI target
+const LightingSettings DEFAULT_LIGHTING = {LIGHTING_VERSION, true, {360, 960, 30, 100, 150.0, 0}};
+const char* const LIGHT_PHASE_NAMES[] = {"night", "dawn", "day", "dusk"};
+
+PreferencesStorage lightingStorage("lighting");
+LightingSettings lightingSettings = DEFAULT_LIGHTING;  // NetworkDataLock
+Photoperiod photoperiod(DEFAULT_LIGHTING.schedule);    // NetworkDataLock
+LightStep lightingStep = {LIGHT_NIGHT, 0, 0};          // NetworkDataLock
+uint32_t lightingNextAt = 0;                           // Wall-clock seconds; 0 = not scheduled
+int8_t lightingPhaseApplied = -1;
+std::atomic<uint8_t> lightingWake(0);
+
+// --- WiFi link (network core only)
+// serviceWifi() drives WifiLink (see WifiLink.h) off the main loop: it
+// connects, retries with backoff, keeps the web server listening only
+// while there is a link or the portal, and opens the setup portal (an
+// open access point whose DNS answers every name with the tower) when
+// no network can be joined.
+#define WIFI_SERVICE_PERIOD     100     // Link poll; also answers portal DNS
+#define WIFI_FAST_TIMEOUT       4000    // Join with the cached BSSID, channel and address
+#define WIFI_CONNECT_TIMEOUT    15000   // Scan, join and DHCP
+#define WIFI_BACKOFF_BASE       1000
+#define WIFI_BACKOFF_CAP        60000
+#define WIFI_PORTAL_AFTER       3       // Failed full attempts before the portal opens
+#define WIFI_CREDENTIALS_VERSION 1
+#define WIFI_FAST_MAGIC         0x31434657  // "WFC1"
+#define PORTAL_DNS_PORT         53
+#define PORTAL_PAGE             "/portal.html"
+
+struct WifiCredentials {
+  uint8_t version;
+  char ssid[33];
+  char password[65];
+};
+
+// Where the last session was, kept across resets (not power cycles) in
+// RTC memory so the next one can skip the scan and DHCP. Laid out
+// without padding so the check covers every byte.
+struct WifiFastConnect {
+  uint32_t magic;
+  uint32_t ssidCrc;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t check;
+};
+
+const WifiLinkTiming WIFI_TIMING = {
+  WIFI_FAST_TIMEOUT, WIFI_CONNECT_TIMEOUT, WIFI_BACKOFF_BASE, WIFI_BACKOFF_CAP, WIFI_PORTAL_AFTER
+};
+const char* const WIFI_LINK_STATE_NAMES[] = {"idle", "connecting", "up", "waiting"};
+
+PreferencesStorage wifiStorage("wifi");
+WifiCredentials wifiCredentials = {};              // NetworkDataLock
+std::atomic<bool> wifiCredentialsChanged(false);  // Set by POST /api/wifi
+RTC_NOINIT_ATTR WifiFastConnect wifiFastConnect;
+WifiLink wifiLink(WIFI_TIMING);  // Counters also read by GET /api/wifi: diagnostic only
+DNSServer portalDns;
+std::atomic<bool> portalRunning(false);
+bool serverRunning = false;
+bool ntpStarted = false;
+bool ipPatternShown = false;
+
+// --- Sensor history (network core only)
+// Sampled from the snapshot every HISTORY_SAMPLE_PERIOD and kept as int16
+// fixed-point: 5 s samples for 30 min, 1 min rollups for 4 h and 15 min
+// rollups for 48 h. Times are seconds since boot.
+#define HISTORY_SAMPLE_PERIOD 5000
+#define HISTORY_DEFAULT_SPAN  3600   // Seconds returned when from is omitted
+
+enum HistoryMetric {
+  HIST_WATER_TEMP = 0,
+  HIST_AIR_TEMP,
+  HIST_HUMIDITY,
+  HIST_TDS,
+  HIST_PH,
+  HIST_EC,
+  HIST_WATER_LEVEL,
+  HIST_COUNT
+};
+
+struct HistoryMetricInfo {
+  const char* name;
+  float scale;     // Stored value = reading * scale
+  int decimals;    // Digits worth returning
+};
+
+const HistoryMetricInfo HISTORY_METRICS[HIST_COUNT] = {
+  {"waterTemp", 100.0, 2},
+  {"airTemp", 100.0, 2},
+  {"humidity", 100.0, 2},
+  {"tds", 1.0, 0},
+  {"ph", 1000.0, 3},
+  {"ec", 1.0, 0},
+  {"waterLevel", 1.0, 0}
+};
+
+// --- Change-driven reporting (see DeltaReporter.h)
+// Each output channel sends a reading again only once it has moved past
+// its deadband: max(absolute, relative * last sent value). On/off state
+// has no deadband. Counters per channel and field are at /api/reporting.
+const Deadband SENSOR_DEADBANDS[HIST_COUNT] = {
+  {0.1, 0},      // waterTemp, °C
+  {0.2, 0},      // airTemp, °C
+  {1.0, 0},      // humidity, %
+  {5.0, 0.02},   // tds, ppm
+  {0.05, 0},     // pH
+  {10.0, 0.02},  // ec, µS/cm
+  {1.0, 0}       // waterLevel, %
+};
+
+// Fields of an upload record and of the serial report
+enum ReportField {
+  REPORT_PUMP_RUNNING = HIST_COUNT,  // Below HIST_COUNT, fields are HistoryMetric values
+  REPORT_AUTO_MODE,
+  REPORT_LED_ON,
+  REPORT_FIELD_COUNT
+};
+
+const char* const REPORT_STATE_NAMES[REPORT_FIELD_COUNT - HIST_COUNT] = {"pumpStatus", "pumpMode", "ledStatus"};
+
+// Fields of the event stream's delta events
+enum LiveField {
+  LIVE_PUMP_RUNNING = HIST_COUNT,
+  LIVE_AUTO_PUMP,
+  LIVE_MANUAL_OVERRIDE,
+  LIVE_LED_ON,
+  LIVE_LED_MODE,
+  LIVE_FIELD_COUNT
+};
+
+const char* const LIVE_STATE_NAMES[LIVE_FIELD_COUNT - HIST_COUNT] = {
+  "pumpRunning", "autoPumpEnabled", "manualPumpOverride", "ledStatus", "ledMode"
+};
+
+#define UPLOAD_HEARTBEAT        1800000  // ms between full upload records
+#define SERIAL_REPORT_HOLD      5000
+#define SERIAL_REPORT_HEARTBEAT 60000
+
+DeltaReporter<REPORT_FIELD_COUNT> uploadReporter(SENSOR_DEADBANDS, HIST_COUNT, 0, UPLOAD_HEARTBEAT);  // uplinkTask
+DeltaReporter<REPORT_FIELD_COUNT> serialReporter(SENSOR_DEADBANDS, HIST_COUNT, SERIAL_REPORT_HOLD,
+                                                 SERIAL_REPORT_HEARTBEAT);                             // networkTask
+DeltaReporter<LIVE_FIELD_COUNT> liveReporter(SENSOR_DEADBANDS, HIST_COUNT, EVENTS_HOLD, 0);             // networkTask
+
+bool reported(uint32_t fields, size_t field) {
+  return (fields & (1UL << field)) != 0;
+}
+
+History<HIST_COUNT, 360, 240, 192> history(HISTORY_SAMPLE_PERIOD / 1000, 60, 900);
+
+// --- Card sparklines (network core only)
+// The last hour of each card's metric under its value: one column per
+// SPARK_COLUMN_SAMPLES history samples (40 s), fed by recordHistory().
+// The plot sweeps left to right with a blank column ahead of the newest,
+// so a new column repaints three columns (~95 bytes of SPI per card) and
+// only a change of scale repaints the whole plot.
+#define SPARK_COLUMNS        92
+#define SPARK_ROWS           14
+#define SPARK_COLUMN_SAMPLES 8
+#define SPARK_MIN_SPAN       4     // Smallest y range, in deadbands: noise stays flat
+
+const HistoryMetric CARD_METRICS[CARD_COUNT] = {
+  HIST_AIR_TEMP, HIST_HUMIDITY, HIST_TDS, HIST_EC, HIST_PH, HIST_WATER_TEMP
+};
+
+Sparkline<SPARK_COLUMNS, SPARK_COLUMN_SAMPLES> sparklines[CARD_COUNT];
+uint32_t sparkDrawn[CARD_COUNT];  // written() as of the last repaint
+bool sparkStale[CARD_COUNT];      // Repaint the whole plot next frame
+
+// --- Flash log (network core only)
+// Every LOG_INTERVAL the snapshot is appended to an append-only log on
+// LittleFS, in the history's fixed-point format, so samples survive
+// reboots and network outages. 16 segments of 64 KB (1 MB) hold ~3800
+// records each: about 85 days at one record per 2 minutes.
+#define LOG_INTERVAL        120000  // ms between records
+#define LOG_FLUSH_INTERVAL  600000  // ms between partial-block writes
+#define LOG_SEGMENT_BLOCKS  128
+#define LOG_MAX_SEGMENTS    16
+#define LOG_DEFAULT_SPAN    86400   // Seconds exported when from is omitted
+#define EPOCH_VALID_AFTER   1600000000UL  // Earlier clocks are not NTP-synced
+
+FlashLog<HIST_COUNT, LOG_SEGMENT_BLOCKS, LOG_MAX_SEGMENTS> flashLog(LittleFS, "/log");
+
+// --- Firebase uploader (uplinkTask only)
+// The control loop takes a sample every FIREBASE_UPLOAD_INTERVAL and hands
+// it over through uploadHandoff; uplinkTask queues it and sends the queue
+// in batches: one multi-path PATCH of /sensor_data per batch, over a
+// connection kept alive between batches, with jittered backoff on errors.
+// Keys are derived from the sample time, so a retried batch overwrites
+// instead of duplicating. When the RAM queue is full (a long outage) the
+// oldest samples spill to a small flash log and go out first once the
+// link is back. firebaseHost may be http:// to test against a local
+// stand-in for the Realtime Database REST API (e.g. its emulator).
+#define UPLOAD_QUEUE_RECORDS   64      // ~2 h of samples in RAM
+#define UPLOAD_BATCH_RECORDS   30      // Most samples per PATCH
+#define UPLOAD_BATCH_AGE       600     // s the oldest queued sample may wait
+#define UPLOAD_POLL_PERIOD     1000    // ms between uploader checks
+#define UPLOAD_BACKOFF_BASE    5000    // ms after the first failure
+#define UPLOAD_BACKOFF_CAP     900000  // 15 min
+#define UPLOAD_BODY_BYTES      8192
+#define UPLOAD_SPILL_BLOCKS    32      // 4 segments of 16 KB: ~4.8 days
+#define UPLOAD_SPILL_SEGMENTS  4
+#define UPLOAD_HANDOFF_RECORDS 4       // Samples in flight from the control loop
+#define UPLOAD_DRAIN_PERIOD    100     // ms between handoff checks
+#define UPLINK_CONNECT_TIMEOUT 5000    // ms; bounds each blocking call of the uplink
+#define UPLINK_IO_TIMEOUT      5000
+#define UPLOAD_FLAGS           HIST_COUNT        // values[]: history metrics, flags,
+#define UPLOAD_FIELDS          (HIST_COUNT + 1)  // then the ReportFields sent (0 = all)
+#define UPLOAD_VALUES          (HIST_COUNT + 2)
+
+enum UploadFlag {
+  UPLOAD_PUMP_RUNNING = 1,
+  UPLOAD_AUTO_MODE = 2,
+  UPLOAD_LED_ON = 4
+};
+
+struct UploadSample {
+  uint32_t time;     // Unix seconds, 0 until the clock is set
+  uint32_t uptime;   // uptimeSeconds() when taken
+  int16_t values[UPLOAD_VALUES];
+};
+
+SpscQueue<UploadSample, UPLOAD_HANDOFF_RECORDS> uploadHandoff;  // Control loop -> uplinkTask
+uint32_t uploadHandoffDropped = 0;  // Control loop only: handoff was full
+UploadQueue<UploadSample, UPLOAD_QUEUE_RECORDS> uploadQueue;
+FlashLog<UPLOAD_VALUES, UPLOAD_SPILL_BLOCKS, UPLOAD_SPILL_SEGMENTS> uploadSpill(LittleFS, "/upload");
+PreferencesStorage uploadStorage("upload");
+uint32_t uploadSpillCursor = 0;     // First spilled time not yet uploaded (kept in NVS)
+bool uploadSpillPending = false;
+uint32_t uploadDropped = 0;         // Overflowed before the clock was set
+uint32_t nextUploadAttempt = 0;
+Backoff uploadBackoff(UPLOAD_BACKOFF_BASE, UPLOAD_BACKOFF_CAP);
+
+WiFiClientSecure firebaseTls;       // Kept open between batches
+WiFiClient firebasePlain;           // http:// hosts
+HTTPClient firebaseHttp;
+
+// --- MQTT telemetry (networkTask; callbacks on async_tcp)
+// Every history metric plus the pump and LED state gets a retained topic
+// under mqttRoot, republished when its formatted value changes. Updates
+// go through a per-topic outbox that networkTask drains while the broker
+// keeps up, so a slow or missing broker only delays them. <root>/status
+// is "online" while connected and the broker's last will sets it to
+// "offline". Commands arrive on <root>/cmd/pump (on, off, auto) and
+// <root>/cmd/led (a preset name) and go through the same mailboxes as
+// the HTTP API.
+#define MQTT_STATE_QOS      1       // Metric and state topics
+#define MQTT_STATUS_QOS     1       // online / offline
+#define MQTT_COMMAND_QOS    1       // Command subscription
+#define MQTT_KEEPALIVE      30      // s
+#define MQTT_STAGE_PERIOD   5000    // ms between snapshots of the state
+#define MQTT_SEND_PERIOD    100     // ms between outbox drains
+#define MQTT_BACKOFF_BASE   2000    // ms between connection attempts...
+#define MQTT_BACKOFF_CAP    60000   // ...growing to this
+#define MQTT_PAYLOAD_BYTES  16
+
+enum MqttStateTopic {
+  MQTT_PUMP = HIST_COUNT,  // Below HIST_COUNT, topics are HistoryMetric values
+  MQTT_PUMP_MODE,
+  MQTT_LED,
+  MQTT_TOPIC_COUNT
+};
+
+const char* const MQTT_STATE_TOPICS[MQTT_TOPIC_COUNT - HIST_COUNT] = {"pump", "pumpMode", "led"};
+
+AsyncMqttClient mqttClient;
+TopicOutbox<MQTT_TOPIC_COUNT, MQTT_PAYLOAD_BYTES> mqttOutbox;
+DeltaReporter<MQTT_TOPIC_COUNT> mqttReporter(SENSOR_DEADBANDS, HIST_COUNT, 0, 0);
+Backoff mqttBackoff(MQTT_BACKOFF_BASE, MQTT_BACKOFF_CAP);
+uint32_t nextMqttConnect = 0;
+std::atomic<bool> mqttSessionStarted(false);  // Set by onMqttConnect, taken by networkTask
+char mqttClientId[24];     // hydrobrain-<chip id>
+char mqttRoot[24];         // hydrobrain/<chip id>
+char mqttStatusTopic[32];  // Kept for the last will
+
+// Forward declarations
+void updateTFTDisplay();
+void drawLayout(Adafruit_GFX& gfx);
+void drawHeader(Adafruit_GFX& gfx);
+void drawSensorCard(TftCard card, const char* value);
+void drawWaterLevelBar(long waterLevel);
+void drawSystemStatus(const SensorSnapshot& snap);
+void drawStatusIndicator(int16_t x, int16_t y, char* shown, const char* label, bool status, const char* statusText);
+void drawFooter();
+void drawClock();
+void drawSparkline(TftCard card);
+const char* getLedModeText();
+void handOffUploadSample();
+void drainUploadSamples();
+void serviceUploads();
+void flushUploadSpill();
+void sendToCollector(const UploadSample& sample);
+void serviceLighting();
+void serviceWifi();
+WifiCredentials currentWifiCredentials();
+void uplinkTask(void* param);
+uint32_t wallClockSeconds();
+void markBootStage(BootStage stage);
+
+// Captured calibration if the probe has one, factory calibration otherwise
+const ProbeCalibration& effectiveCalibration(CalibrationProbe probe) {
+  return calibrations[probe].usable() ? calibrations[probe] : DEFAULT_CALIBRATION[probe];
+}
+
+// Rebuild the inactive conversion buffer and publish it
+void rebuildConversionTables() {
+  const ConversionTables* active = conversionTables.load();
+  ConversionTables* target = active == &conversionBuffers[0] ? &conversionBuffers[1] : &conversionBuffers[0];
+
+  target->build(effectiveCalibration(PROBE_TDS), effectiveCalibration(PROBE_EC), effectiveCalibration(PROBE_PH));
+  conversionTables.store(target);
+}
+
+// Network-core task: pick up calibration changes
+void applyCalibrationChanges() {
+  NetworkDataLock lock;
+  if (!calibrationChanged) {
+    return;
+  }
+  calibrationChanged = false;
+  rebuildConversionTables();
+  Serial.println("Conversion tables rebuilt from calibration");
+}
+
+void loadCalibrations() {
+  for (int probe = 0; probe < PROBE_COUNT; probe++) {
+    if (calibrationStore.load(PROBE_NAMES[probe], calibrations[probe])) {
+      Serial.print("Loaded ");
+      Serial.print(calibrations[probe].count);
+      Serial.print("-point calibration for ");
+      Serial.println(PROBE_NAMES[probe]);
+    }
+  }
+}
+
+void buildConversionTables() {
+  rebuildConversionTables();
+  temperatureTables.build();
 }
 
 void controlPump(bool state) {
+  unsigned long now = millis();
   if (state) {
+    if (!pumpRunning) {
+      pumpStartTime = now;
+    }
     digitalWrite(PUMP_RELAY_PIN, LOW);  // Assuming active LOW relay
     pumpStatus = true;
     pumpRunning = true;
     Serial.println("Pump ON");
   } else {
+    if (pumpRunning) {
+      pumpRuntimeMs += now - pumpStartTime;
+    }
     digitalWrite(PUMP_RELAY_PIN, HIGH); // Assuming active LOW relay
     pumpStatus = false;
     pumpRunning = false;
     Serial.println("Pump OFF");
   }
+  snapshotDirty = true;
+}
+
+// Queue a switch for the audit trail kept on the network core
+void auditPump(const PumpActuation& change) {
+  if (!pumpAuditHandoff.push(change)) {
+    pumpAuditDropped++;
+  }
+}
+
+// Apply a pump command posted by the network core. Manual control
+// suspends the engine; auto hands the pump back to it as it stands.
+void applyPumpCommand(uint8_t command) {
+  uint32_t now = millis();
+  switch (command) {
+    case PUMP_CMD_ON:
+    case PUMP_CMD_OFF:
+      manualPumpOverride = true;
+      autoPumpEnabled = false;
+      pumpEngine.suspend(now);
+      controlPump(command == PUMP_CMD_ON);
+      auditPump({now, command == PUMP_CMD_ON, PUMP_REASON_MANUAL, -1});
+      break;
+    case PUMP_CMD_AUTO:
+      manualPumpOverride = false;
+      autoPumpEnabled = true;
+      pumpEngine.resume(now, pumpRunning, lastPumpCycle);
+      snapshotDirty = true;
+      break;
+    default:
+      break;
+  }
 }
 
+// Acquisition-core task, event-driven: runs at the engine's next
+// deadline, when a sample flips a rule and after a pump command
 void handlePumpControl() {
-  unsigned long currentTime = millis();
-  
-  // Handle manual override
-  if (manualPumpOverride) {
-    return; // Don't run auto control when manual override is active
+  uint32_t now = millis();
+  if (pumpEngine.update(now)) {
+    const PumpActuation& change = pumpEngine.last();
+    controlPump(change.on);
+    if (change.on) {
+      lastPumpCycle = now;
+    }
+    auditPump(change);
   }
-  
-  // Auto pump control
-  if (autoPumpEnabled) {
-    // Check if it's time to start a new pump cycle
-    if (!pumpRunning && (currentTime - lastPumpCycle >= PUMP_CYCLE_INTERVAL)) {
-      controlPump(true);
-      pumpStartTime = currentTime;
-      lastPumpCycle = currentTime;
-      Serial.println("Auto pump cycle started");
+  scheduler.runIn(handlePumpControl, min(pumpEngine.nextEventMs(now), (uint32_t)PUMP_IDLE_MS));
+}
+
+// Pump commands posted by the network core; only this mailbox is polled
+void pollPumpCommand() {
+  uint8_t command = pendingPumpCommand.exchange(PUMP_CMD_NONE);
+  if (command != PUMP_CMD_NONE) {
+    applyPumpCommand(command);
+    scheduler.trigger(handlePumpControl);
+  }
+}
+
+// A reading for the pump rules: re-plan now if it flipped one
+void feedPump(PumpSignal signal, float value) {
+  if (pumpEngine.sample(signal, value, millis())) {
+    snapshotDirty = true;
+    scheduler.trigger(handlePumpControl);
+  }
+}
+
+// WS2812 bits as RMT items, 25 ns ticks: 0 = 400/850 ns, 1 = 800/450 ns
+static const DRAM_ATTR rmt_item32_t WS2812_BIT0 = {{{16, 1, 34, 0}}};
+static const DRAM_ATTR rmt_item32_t WS2812_BIT1 = {{{32, 1, 18, 0}}};
+
+// RMT interrupt: turn as many whole bytes as fit into pulses. In IRAM,
+// like the interrupt, so a flash write can't stall a refill mid-frame.
+void IRAM_ATTR ws2812Translate(const void* src, rmt_item32_t* dest, size_t srcSize, size_t wantedItems,
+                               size_t* translatedSize, size_t* itemCount) {
+  const uint8_t* bytes = (const uint8_t*)src;
+  size_t size = 0;
+  size_t items = 0;
+  while (size < srcSize && items + 8 <= wantedItems) {
+    uint8_t byte = bytes[size++];
+    for (int bit = 7; bit >= 0; bit--) {
+      dest[items++] = (byte >> bit) & 1 ? WS2812_BIT1 : WS2812_BIT0;
     }
-    
-    // Check if current pump cycle should end
-    if (pumpRunning && (currentTime - pumpStartTime >= PUMP_RUN_DURATION)) {
-      controlPump(false);
-      Serial.println("Auto pump cycle ended");
+  }
+  *translatedSize = size;
+  *itemCount = items;
+}
+
+bool beginLedOutput() {
+  rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)LED_PIN, LED_RMT_CHANNEL);
+  config.clk_div = LED_RMT_CLK_DIV;
+  config.mem_block_num = LED_RMT_BLOCKS;
+  return rmt_config(&config) == ESP_OK
+      && (rmt_driver_install(LED_RMT_CHANNEL, 0, ESP_INTR_FLAG_IRAM) == ESP_OK
+          || rmt_driver_install(LED_RMT_CHANNEL, 0, 0) == ESP_OK)  // Builds without an IRAM-safe driver
+      && rmt_translator_init(LED_RMT_CHANNEL, ws2812Translate) == ESP_OK;
+}
+
+// Move the strip to a preset, fading or through a ramp (setup and
+// networkTask only)
+void applyLedMode(int mode, const LedStop* stops = nullptr, size_t stopCount = 0, uint32_t durationMs = LED_FADE_MS) {
+  const LedPreset& preset = LED_PRESETS[mode];
+  Rgb targets[LED_ZONE_COUNT];
+  for (size_t zone = 0; zone < LED_ZONE_COUNT; zone++) {
+    targets[zone] = {preset.red, preset.green, preset.blue};
+  }
+  ledEngine.transition(stops, stopCount, targets, durationMs, millis());
+  ledStatus = ledEngine.lit();
+  ledMode = mode;
+  Serial.print("LED mode: ");
+  Serial.println(preset.name);
+}
+
+// Apply what HTTP handlers posted: a preset resets every zone, then zone
+// colours are applied on top. A lighting wake is passed on here, where the
+// network scheduler may be touched.
+void applyLedCommand() {
+  uint8_t wake = lightingWake.exchange(0);
+  if (wake & LIGHTING_REAPPLY) {
+    lightingPhaseApplied = -1;
+  }
+  if (wake) {
+    networkScheduler.trigger(serviceLighting);
+  }
+
+  int8_t mode = pendingLedMode.exchange(-1);
+  if (mode >= 0 && mode < LED_MODE_COUNT) {
+    applyLedMode(mode);
+  }
+  for (size_t zone = 0; zone < LED_ZONE_COUNT; zone++) {
+    uint32_t command = pendingLedZone[zone].exchange(0);
+    if (command & LED_ZONE_PENDING) {
+      Rgb color = {(uint8_t)(command >> 16), (uint8_t)(command >> 8), (uint8_t)command};
+      ledEngine.fadeZone(zone, color, LED_FADE_MS, millis());
+      ledStatus = ledEngine.lit();
     }
   }
 }
 
-// Web API endpoints
-void handleGetStatus() {
-  Serial.println("=== Status Request Received ===");
-  
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
+// Network-core task: apply commands, then send the next frame if it
+// changed and the previous one is off the wire
+void serviceLeds() {
+  applyLedCommand();
+  if (rmt_wait_tx_done(LED_RMT_CHANNEL, 0) != ESP_OK) {
+    return;
+  }
+  if (!ledEngine.render(millis(), ledFrame)) {
+    ledFramesUnchanged++;
+    return;
+  }
+  rmt_write_sample(LED_RMT_CHANNEL, ledFrame, sizeof(ledFrame), false);
+  ledFramesSent++;
+}
+
+// Drive the strip into a photoperiod phase; ramps last what is left of it
+void applyLightPhase(const LightStep& step, uint8_t levelPercent) {
+  ledEngine.setBrightness(BRIGHTNESS * levelPercent / 100);
+  uint32_t rampMs = step.next * 1000;
+  switch (step.phase) {
+    case LIGHT_DAWN:
+      applyLedMode(LED_MODE_GROWTH, SUNRISE_STOPS, sizeof(SUNRISE_STOPS) / sizeof(SUNRISE_STOPS[0]), rampMs);
+      break;
+    case LIGHT_DAY:
+      applyLedMode(LED_MODE_GROWTH);
+      break;
+    case LIGHT_DUSK:
+      applyLedMode(LED_MODE_OFF, SUNSET_STOPS, sizeof(SUNSET_STOPS) / sizeof(SUNSET_STOPS[0]), rampMs);
+      break;
+    default:
+      applyLedMode(LED_MODE_OFF);
+      break;
+  }
+}
+
+// Network-core task, event-driven: bring the photoperiod up to now, apply
+// the phase if it changed and sleep until the next transition
+void serviceLighting() {
+  uint32_t now = wallClockSeconds();
+  LightingSettings settings;
+  LightStep step;
+  {
+    NetworkDataLock lock;
+    settings = lightingSettings;
+    if (now != 0 && settings.enabled) {
+      uint32_t local = now + gmtOffset_sec + daylightOffset_sec;
+      if (settings.schedule != photoperiod.config()) {
+        photoperiod.configure(settings.schedule, local);  // Only on a change: it re-plans dusk
+      }
+      lightingStep = photoperiod.update(local);
+      lightingNextAt = now + lightingStep.next;
+    } else {
+      lightingNextAt = 0;
+    }
+    step = lightingStep;
+  }
+
+  if (now == 0 || !settings.enabled) {
+    if (lightingPhaseApplied >= 0) {
+      ledEngine.setBrightness(BRIGHTNESS);  // Back to manual control
+      lightingPhaseApplied = -1;
+    }
+    networkScheduler.runIn(serviceLighting, LIGHTING_IDLE_MS);
+    return;
+  }
+  if (step.phase != lightingPhaseApplied) {
+    applyLightPhase(step, settings.schedule.levelPercent);
+    lightingPhaseApplied = step.phase;
+    Serial.printf("Lighting: %s for %lu s\n", LIGHT_PHASE_NAMES[step.phase], (unsigned long)step.next);
+  }
+  networkScheduler.runIn(serviceLighting, min(step.next * 1000UL, (unsigned long)LIGHTING_IDLE_MS));
+}
+
+void loadLightingSettings() {
+  LightingSettings stored;
+  if (lightingStorage.read("settings", &stored, sizeof(stored)) == sizeof(stored)
+      && stored.version == LIGHTING_VERSION) {
+    lightingSettings = stored;
+    Serial.println("Lighting schedule loaded");
+  }
+}
+
+// Status record, one schema for every encoding (see Encoding.h). Only
+// fields that change with the snapshot or LED state belong here so the
+// encoded body can be cached; clocks and counters go in /api/uptime.
+template <typename Encoder>
+void encodeStatus(Encoder& out, const SensorSnapshot& snap, uint32_t version) {
+  out.beginObject();
+  out.field("waterTemp", snap.waterTemp);
+  out.field("airTemp", snap.airTemp);
+  out.field("humidity", snap.humidity);
+  out.field("tds", snap.tds);
+  out.field("ph", snap.ph);
+  out.field("ec", snap.ec);
+  out.field("waterLevel", (int32_t)snap.waterLevel);
+  out.field("ledStatus", ledStatus.load());
+  out.field("ledMode", (int32_t)ledMode.load());
+  out.field("pumpStatus", snap.pumpRunning);
+  out.field("pumpRunning", snap.pumpRunning);
+  out.field("autoPumpEnabled", snap.autoPumpEnabled);
+  out.field("manualPumpOverride", snap.manualPumpOverride);
+  out.field("snapshotVersion", version);
+  out.field("adcSamplesPerReading", snap.adcSamples);
+  out.field("phSpikesRejected", snap.phSpikesRejected);
+  out.field("tdsSpikesRejected", snap.tdsSpikesRejected);
+  out.field("deviceId", "HydroBrain-ESP32");
+  out.endObject();
+}
+
+template <typename Encoder>
+size_t encodeStatusInto(uint8_t* body, const SensorSnapshot& snap, uint32_t version) {
+  Encoder out(body, STATUS_BUFFER_BYTES);
+  encodeStatus(out, snap, version);
+  return out.ok() ? out.size() : 0;
+}
+
+// Encoded status body for an encoding (caller holds NetworkDataLock),
+// re-serialized only when the snapshot version or LED state has moved on.
+// The new version goes into a slot no response holds; with every slot
+// still sending, the previous body is served again, ETag and all.
+const StatusBody* cachedStatus(StatusEncoding encoding) {
+  bool lit = ledStatus.load();
+  int mode = ledMode.load();
+  const StatusBody* current = statusCurrent[encoding];
+  if (current && current->version == sensorSnapshot.version()
+      && current->ledStatus == lit && current->ledMode == mode) {
+    return current;
+  }
+
+  StatusBody* slot = nullptr;
+  for (StatusBody& candidate : statusBodies[encoding]) {
+    if (candidate.senders.load() == 0) {
+      slot = &candidate;
+      break;
+    }
+  }
+  if (!slot) {
+    statusSlotsBusy++;
+    return current;
+  }
+
+  SensorSnapshot snap;
+  uint32_t version = sensorSnapshot.read(snap);
+  switch (encoding) {
+    case STATUS_CBOR:    slot->length = encodeStatusInto<CborEncoder>(slot->body, snap, version); break;
+    case STATUS_MSGPACK: slot->length = encodeStatusInto<MsgPackEncoder>(slot->body, snap, version); break;
+    default:             slot->length = encodeStatusInto<JsonEncoder>(slot->body, snap, version); break;
+  }
+  slot->version = version;
+  slot->ledStatus = lit;
+  slot->ledMode = mode;
+  snprintf(slot->etag, sizeof(slot->etag), "\"%lu-%d%d%s\"",
+           (unsigned long)version, lit ? 1 : 0, mode, STATUS_ENCODINGS[encoding].tag);
+  statusCurrent[encoding] = slot;
+  return slot;
+}
+
+// Web API endpoints. Handlers run on the async_tcp task: they never touch
+// hardware themselves, only post commands (pump, LED) for the tasks that
+// own it and read shared state under NetworkDataLock.
+
+void sendJson(AsyncWebServerRequest* request, int code, const JsonDocument& doc) {
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->setCode(code);
+  serializeJson(doc, *response);
+  request->send(response);
+}
+
+void sendError(AsyncWebServerRequest* request, int code, const char* message) {
+  JsonDocument doc;
+  doc["status"] = "error";
+  doc["message"] = message;
+  sendJson(request, code, doc);
+}
+
+// GET /api/status answers in CBOR or MessagePack when the Accept header
+// asks for it, JSON otherwise, from the cached body. A matching
+// If-None-Match gets 304 without a body. The body is sent from its slot,
+// not copied: the slot is held (StatusBody::senders) until the connection
+// closes, and the filler and release captures are a single pointer, so
+// they fit in std::function without a heap block.
+void handleGetStatus(AsyncWebServerRequest* request) {
+  StatusEncoding encoding = STATUS_JSON;
+  const String& accept = request->header("Accept");
+  if (accept.indexOf("application/cbor") >= 0) {
+    encoding = STATUS_CBOR;
+  } else if (accept.indexOf("msgpack") >= 0) {
+    encoding = STATUS_MSGPACK;
+  }
+
+  NetworkDataLock lock;
+  const StatusBody* status = cachedStatus(encoding);
+  if (status->length == 0) {
+    request->send(500, "text/plain", "Status too large");
+    return;
+  }
+
+  AsyncWebServerResponse* response;
+  if (request->header("If-None-Match") == status->etag) {
+    response = request->beginResponse(304);
+  } else {
+    status->senders++;
+    request->onDisconnect([status]() { status->senders--; });
+    response = request->beginResponse(STATUS_ENCODINGS[encoding].contentType, status->length,
+      [status](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        size_t n = status->length - index < maxLen ? status->length - index : maxLen;
+        memcpy(buffer, status->body + index, n);
+        return n;
+      });
+  }
+  response->addHeader("ETag", status->etag);
+  response->addHeader("Cache-Control", "no-cache");
+  response->addHeader("Vary", "Accept");
+  request->send(response);
+}
+
+// New /api/events client: the full status comes first, deltas follow
+// from publishEvents().
+void handleEventsConnect(AsyncEventSourceClient* client) {
+  if (events.count() > EVENTS_MAX_CLIENTS) {
+    client->close();
+    return;
+  }
+  char status[STATUS_BUFFER_BYTES + 1];
+  {
+    NetworkDataLock lock;
+    const StatusBody* cached = cachedStatus(STATUS_JSON);
+    memcpy(status, cached->body, cached->length);
+    status[cached->length] = '\0';
+  }
+  client->send(status, "status", millis(), EVENTS_RETRY_MS);
+}
+
+// Run times of one scheduler's tasks, to find the state machine that
+// blows the budget. Read without the scheduler's task: diagnostic only.
+template <size_t MaxTasks>
+void addSchedulerJson(JsonObject out, const Scheduler<MaxTasks>& tasks) {
+  out["ticks"] = tasks.ticks();
+  out["lastTickUs"] = tasks.lastTickUs();
+  out["maxTickUs"] = tasks.maxTickUs();
+  out["budgetUs"] = tasks.budgetUs();
+  out["overruns"] = tasks.overruns();
+  JsonArray list = out["tasks"].to<JsonArray>();
+  for (size_t i = 0; i < tasks.taskCount(); i++) {
+    const SchedulerTask& t = tasks.task(i);
+    JsonObject task = list.add<JsonObject>();
+    task["name"] = t.name;
+    task["runs"] = t.runs;
+    task["maxRunUs"] = t.maxRunUs;
+    task["overruns"] = t.overruns;
+  }
+}
+
+// GET /api/uptime: the fast-changing values kept out of the status cache
+void handleGetUptime(AsyncWebServerRequest* request) {
+  SensorSnapshot snap = sensorSnapshot.read();
   JsonDocument doc;
-  doc["waterTemp"] = waterTemp;
-  doc["airTemp"] = airTemp;
-  doc["humidity"] = humidity;
-  doc["tds"] = tds_value;
-  doc["ph"] = phValue;
-  doc["ec"] = ecValue;
-  doc["waterLevel"] = waterLevel;
-  doc["ledStatus"] = ledStatus;
-  doc["ledMode"] = ledMode;
-  doc["pumpStatus"] = pumpStatus;
-  doc["pumpRunning"] = pumpRunning;
-  doc["autoPumpEnabled"] = autoPumpEnabled;
-  doc["manualPumpOverride"] = manualPumpOverride;
-  doc["deviceId"] = "HydroBrain-ESP32";
   doc["uptime"] = millis() / 1000;
   doc["freeHeap"] = ESP.getFreeHeap();
   doc["wifiRSSI"] = WiFi.RSSI();
-  
-  // Add timing info
-  unsigned long currentTime = millis();
-  unsigned long timeToNextCycle = 0;
-  unsigned long timeRemaining = 0;
-  
-  if (pumpRunning) {
-    timeRemaining = PUMP_RUN_DURATION - (currentTime - pumpStartTime);
-    doc["pumpTimeRemaining"] = timeRemaining / 1000; // seconds
-  } else {
-    timeToNextCycle = PUMP_CYCLE_INTERVAL - (currentTime - lastPumpCycle);
-    doc["timeToNextPumpCycle"] = timeToNextCycle / 1000; // seconds
+
+  // Pump timing, in seconds, to the engine's next switch by the clock
+  // (none while inhibited or in manual mode)
+  uint32_t currentTime = millis();
+  if (snap.pumpScheduled) {
+    uint32_t left = (int32_t)(snap.pumpDeadline - currentTime) > 0 ? (snap.pumpDeadline - currentTime) / 1000 : 0;
+    doc[snap.pumpRunning ? "pumpTimeRemaining" : "timeToNextPumpCycle"] = left;
   }
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  Serial.print("Sending status response: ");
-  Serial.println(jsonString.length());
-  Serial.println("bytes");
-  
-  server.send(200, "application/json", jsonString);
-  Serial.println("Status response sent successfully");
+  doc["pumpInhibited"] = snap.pumpInhibited;
+  doc["pumpRuntime"] = snap.pumpRuntimeS;
+  doc["pumpEnergyWh"] = snap.pumpRuntimeS * PUMP_POWER_W / 3600.0f;
+
+  // Uploader, read without the network task: diagnostic only
+  doc["uploadQueued"] = uploadQueue.size();
+  doc["uploadSpillPending"] = uploadSpillPending;
+  doc["uploadFailures"] = uploadBackoff.failures();
+  doc["uploadDropped"] = uploadDropped + uploadHandoffDropped;
+  doc["mqttConnected"] = mqttClient.connected();
+  doc["tftFrames"] = tftFrames;
+  doc["tftFrameBytes"] = tftFrameBytes;
+  doc["tftFrameUs"] = tftFrameUs;
+  doc["tftRenderUs"] = tftRenderUs;
+  doc["tftFrameMaxUs"] = tftFrameMaxUs;
+  doc["tftBytes"] = tftBytesTotal;
+  doc["ledFrames"] = ledFramesSent;
+  doc["ledFramesUnchanged"] = ledFramesUnchanged;
+  doc["historyBytes"] = history.memoryBytes();
+  {
+    NetworkDataLock lock;
+    doc["statusSlotsBusy"] = statusSlotsBusy;
+    doc["logBytes"] = flashLog.storedBytes();
+    doc["logSegments"] = flashLog.segments();
+  }
+
+  JsonObject schedulers = doc["schedulers"].to<JsonObject>();
+  addSchedulerJson(schedulers["loop"].to<JsonObject>(), scheduler);
+  addSchedulerJson(schedulers["network"].to<JsonObject>(), networkScheduler);
+  addSchedulerJson(schedulers["uplink"].to<JsonObject>(), uplinkScheduler);
+
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->addHeader("Cache-Control", "no-store");
+  serializeJson(doc, *response);
+  request->send(response);
 }
 
-void handlePumpOn() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  manualPumpOverride = true;
-  autoPumpEnabled = false;
-  controlPump(true);
-  
+// Counters of one channel's reporter; fields past HIST_COUNT are named by
+// stateNames. Read without the channel's task: diagnostic only.
+template <size_t Fields>
+void encodeReporterStats(JsonObject out, const DeltaReporter<Fields>& reporter, const char* const* stateNames) {
+  out["offers"] = reporter.offers();
+  out["reports"] = reporter.reports();
+  out["heartbeats"] = reporter.heartbeats();
+  uint32_t sent = 0;
+  uint32_t suppressed = 0;
+  JsonObject fields = out["fields"].to<JsonObject>();
+  for (size_t i = 0; i < Fields; i++) {
+    JsonObject field = fields[i < HIST_COUNT ? HISTORY_METRICS[i].name : stateNames[i - HIST_COUNT]].to<JsonObject>();
+    field["sent"] = reporter.sent(i);
+    field["suppressed"] = reporter.suppressed(i);
+    sent += reporter.sent(i);
+    suppressed += reporter.suppressed(i);
+  }
+  out["sent"] = sent;
+  out["suppressed"] = suppressed;
+}
+
+// GET /api/reporting: how much each channel's deadbands hold back
+void handleGetReporting(AsyncWebServerRequest* request) {
+  JsonDocument doc;
+  encodeReporterStats(doc["upload"].to<JsonObject>(), uploadReporter, REPORT_STATE_NAMES);
+  encodeReporterStats(doc["serial"].to<JsonObject>(), serialReporter, REPORT_STATE_NAMES);
+  encodeReporterStats(doc["events"].to<JsonObject>(), liveReporter, LIVE_STATE_NAMES);
+  encodeReporterStats(doc["mqtt"].to<JsonObject>(), mqttReporter, MQTT_STATE_TOPICS);
+
+  JsonObject bands = doc["deadbands"].to<JsonObject>();
+  for (size_t i = 0; i < HIST_COUNT; i++) {
+    JsonObject band = bands[HISTORY_METRICS[i].name].to<JsonObject>();
+    band["absolute"] = SENSOR_DEADBANDS[i].absolute;
+    band["relative"] = SENSOR_DEADBANDS[i].relative;
+  }
+  sendJson(request, 200, doc);
+}
+
+// Pump commands are applied by the control loop on its next pass
+void handlePumpOn(AsyncWebServerRequest* request) {
+  pendingPumpCommand.store(PUMP_CMD_ON);
+
   JsonDocument doc;
   doc["status"] = "success";
   doc["message"] = "Pump turned ON manually";
-  doc["pumpStatus"] = pumpStatus;
+  doc["pumpStatus"] = true;
   doc["manualMode"] = true;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  server.send(200, "application/json", jsonString);
+  sendJson(request, 200, doc);
 }
 
-void handlePumpOff() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  manualPumpOverride = true;
-  autoPumpEnabled = false;
-  controlPump(false);
-  
+void handlePumpOff(AsyncWebServerRequest* request) {
+  pendingPumpCommand.store(PUMP_CMD_OFF);
+
   JsonDocument doc;
   doc["status"] = "success";
   doc["message"] = "Pump turned OFF manually";
-  doc["pumpStatus"] = pumpStatus;
+  doc["pumpStatus"] = false;
   doc["manualMode"] = true;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  server.send(200, "application/json", jsonString);
+  sendJson(request, 200, doc);
 }
 
-void handlePumpAuto() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  manualPumpOverride = false;
-  autoPumpEnabled = true;
-  
+void handlePumpAuto(AsyncWebServerRequest* request) {
+  pendingPumpCommand.store(PUMP_CMD_AUTO);
+
   JsonDocument doc;
   doc["status"] = "success";
   doc["message"] = "Pump set to AUTO mode";
   doc["autoMode"] = true;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  server.send(200, "application/json", jsonString);
+  sendJson(request, 200, doc);
 }
 
-void handleLedGrowth() {
-  Serial.println("=== LED Growth Mode Request Received ===");
-  
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  // Growth Light - Warm white/yellow like sun (high red, medium green, low blue)
-  Serial.println("Setting LEDs to Growth Mode (Warm Sunlight)");
-  for (int i = 0; i < NUM_LEDS; i++) {
-    strip.setPixelColor(i, strip.Color(255, 180, 80)); // Warm sunlight color
-  }
-  strip.show();
-  ledStatus = true;
-  ledMode = 1;
-  
-  Serial.println("LEDs updated successfully");
-  
+// LED presets are applied to the strip by networkTask (applyLedCommand)
+template <LedModeId Mode>
+void handleLedMode(AsyncWebServerRequest* request) {
+  pendingLedMode.store(Mode);
+
   JsonDocument doc;
   doc["status"] = "success";
-  doc["message"] = "LED set to Growth Mode";
-  doc["ledStatus"] = ledStatus;
-  doc["ledMode"] = "growth";
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  Serial.print("Sending response: ");
-  Serial.println(jsonString);
-  
-  server.send(200, "application/json", jsonString);
-  Serial.println("Response sent");
+  doc["message"] = LED_PRESETS[Mode].message;
+  doc["ledStatus"] = Mode != LED_MODE_OFF;
+  doc["ledMode"] = LED_PRESETS[Mode].name;
+  sendJson(request, 200, doc);
 }
 
-void handleLedRelax() {
-  Serial.println("=== LED Relax Mode Request Received ===");
-  
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  // Relaxing Light - Calm blue
-  Serial.println("Setting LEDs to Relax Mode (Calm Blue)");
-  for (int i = 0; i < NUM_LEDS; i++) {
-    strip.setPixelColor(i, strip.Color(0, 100, 255)); // Calm blue
-  }
-  strip.show();
-  ledStatus = true;
-  ledMode = 2;
-  
-  Serial.println("LEDs updated successfully");
-  
+// POST /api/led/zone?zone=N&color=RRGGBB: fade one tower level (0 =
+// bottom) to a colour. The next preset sets every level again.
+void handleLedZone(AsyncWebServerRequest* request) {
+  long zone = request->hasArg("zone") ? request->arg("zone").toInt() : -1;
+  String color = request->arg("color");
+  char* end = nullptr;
+  unsigned long rgb = strtoul(color.c_str(), &end, 16);
+  if (zone < 0 || zone >= LED_ZONE_COUNT || color.length() != 6 || *end != '\0') {
+    sendError(request, 400, "Expected a zone (tower level from 0) and color=RRGGBB");
+    return;
+  }
+  pendingLedZone[zone].store(LED_ZONE_PENDING | rgb);
+
   JsonDocument doc;
   doc["status"] = "success";
-  doc["message"] = "LED set to Relaxing Mode";
-  doc["ledStatus"] = ledStatus;
-  doc["ledMode"] = "relax";
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  Serial.print("Sending response: ");
-  Serial.println(jsonString);
-  
-  server.send(200, "application/json", jsonString);
-  Serial.println("Response sent");
+  doc["message"] = "LED zone updated";
+  doc["zone"] = zone;
+  doc["color"] = color;
+  sendJson(request, 200, doc);
 }
 
-void handleLedSleep() {
-  Serial.println("=== LED Sleep Mode Request Received ===");
-  
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  // Sleeping Light - Soft red
-  Serial.println("Setting LEDs to Sleep Mode (Soft Red)");
-  for (int i = 0; i < NUM_LEDS; i++) {
-    strip.setPixelColor(i, strip.Color(255, 50, 0)); // Soft red
-  }
-  strip.show();
-  ledStatus = true;
-  ledMode = 3;
-  
-  Serial.println("LEDs updated successfully");
-  
+// Network-core task: move pump switches into the audit ring and log them
+void drainPumpAudit() {
+  PumpActuation change;
+  while (pumpAuditHandoff.pop(change)) {
+    {
+      NetworkDataLock lock;
+      pumpAudit[pumpAuditCount++ % PUMP_AUDIT_DEPTH] = change;
+    }
+    Serial.printf("Pump %s: %s%s%s\n", change.on ? "on" : "off", PUMP_REASON_NAMES[change.reason],
+                  change.rule >= 0 ? ", rule " : "", change.rule >= 0 ? PUMP_RULES[change.rule].name : "");
+  }
+}
+
+// GET /api/pump/audit: rules in force, the schedule they make and the
+// last switches (newest first) with why each happened
+void handleGetPumpAudit(AsyncWebServerRequest* request) {
+  SensorSnapshot snap = sensorSnapshot.read();
+  uint32_t now = millis();
+  uint32_t wall = wallClockSeconds();
+  JsonDocument doc;
+  doc["auto"] = snap.autoPumpEnabled && !snap.manualPumpOverride;
+  doc["runMinutes"] = snap.pumpRunMs / 60000.0;
+  doc["periodMinutes"] = snap.pumpPeriodMs / 60000.0;
+  JsonObject rules = doc["rules"].to<JsonObject>();
+  for (size_t i = 0; i < PUMP_RULE_COUNT; i++) {
+    rules[PUMP_RULES[i].name] = ((snap.pumpRules >> i) & 1) != 0;
+  }
+  doc["dropped"] = snap.pumpAuditDropped;
+
+  JsonArray switches = doc["switches"].to<JsonArray>();
+  {
+    NetworkDataLock lock;
+    uint32_t kept = min(pumpAuditCount, (uint32_t)PUMP_AUDIT_DEPTH);
+    for (uint32_t n = 1; n <= kept; n++) {
+      const PumpActuation& change = pumpAudit[(pumpAuditCount - n) % PUMP_AUDIT_DEPTH];
+      uint32_t ago = (now - change.atMs) / 1000;
+      JsonObject entry = switches.add<JsonObject>();
+      entry["ago"] = ago;
+      if (wall != 0) {
+        entry["time"] = wall - ago;
+      }
+      entry["on"] = change.on;
+      entry["reason"] = PUMP_REASON_NAMES[change.reason];
+      if (change.rule >= 0) {
+        entry["rule"] = PUMP_RULES[change.rule].name;
+      } else {
+        entry["rule"] = nullptr;
+      }
+    }
+  }
+  sendJson(request, 200, doc);
+}
+
+// GET /api/wifi: link state and connection metrics
+void handleGetWifi(AsyncWebServerRequest* request) {
+  WifiCredentials credentials = currentWifiCredentials();
+  uint32_t now = millis();
+  JsonDocument doc;
+  doc["state"] = WIFI_LINK_STATE_NAMES[wifiLink.state()];
+  doc["ssid"] = credentials.ssid;
+  doc["portal"] = portalRunning.load();
+  if (wifiLink.up()) {
+    const uint8_t* bssid = WiFi.BSSID();
+    char text[18];
+    if (bssid != nullptr) {
+      snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+      doc["bssid"] = text;
+    }
+    doc["channel"] = WiFi.channel();
+    doc["rssi"] = WiFi.RSSI();
+    doc["ip"] = WiFi.localIP().toString();
+  } else {
+    doc["downForMs"] = wifiLink.downForMs(now);
+    doc["retryInMs"] = wifiLink.retryInMs(now);
+  }
+  doc["connects"] = wifiLink.connects();
+  doc["fastConnects"] = wifiLink.fastConnects();
+  doc["attempts"] = wifiLink.attempts();
+  doc["failedAttempts"] = wifiLink.failedAttempts();
+  doc["outages"] = wifiLink.outages();
+  doc["lastConnectMs"] = wifiLink.lastConnectMs();
+  doc["maxReconnectMs"] = wifiLink.maxReconnectMs();
+  doc["downTotalMs"] = wifiLink.downTotalMs();
+  sendJson(request, 200, doc);
+}
+
+// POST /api/wifi?ssid=X&password=Y: save new credentials to NVS and join
+// that network (also what the setup portal posts)
+void handlePostWifi(AsyncWebServerRequest* request) {
+  if (!request->hasArg("ssid")) {
+    sendError(request, 400, "Missing ssid");
+    return;
+  }
+  String name = request->arg("ssid");
+  String key = request->hasArg("password") ? request->arg("password") : String();
+  WifiCredentials credentials = {};
+  if (name.length() == 0 || name.length() >= sizeof(credentials.ssid)
+      || (key.length() > 0 && (key.length() < 8 || key.length() >= sizeof(credentials.password)))) {
+    sendError(request, 400, "Expected ssid of 1-32 characters and a password of 8-63 (or none)");
+    return;
+  }
+  credentials.version = WIFI_CREDENTIALS_VERSION;
+  strlcpy(credentials.ssid, name.c_str(), sizeof(credentials.ssid));
+  strlcpy(credentials.password, key.c_str(), sizeof(credentials.password));
+  {
+    NetworkDataLock lock;
+    wifiCredentials = credentials;
+    wifiStorage.write("credentials", &credentials, sizeof(credentials));
+  }
+  wifiCredentialsChanged.store(true);
+
   JsonDocument doc;
   doc["status"] = "success";
-  doc["message"] = "LED set to Sleep Mode";
-  doc["ledStatus"] = ledStatus;
-  doc["ledMode"] = "sleep";
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  Serial.print("Sending response: ");
-  Serial.println(jsonString);
-  
-  server.send(200, "application/json", jsonString);
-  Serial.println("Response sent");
+  doc["ssid"] = credentials.ssid;
+  sendJson(request, 200, doc);
 }
 
-void handleLedOff() {
-  Serial.println("=== LED OFF Request Received ===");
-  
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  
-  // Turn off all LEDs
-  Serial.println("Turning off all LEDs");
-  for (int i = 0; i < NUM_LEDS; i++) {
-    strip.setPixelColor(i, strip.Color(0, 0, 0));
-  }
-  strip.show();
-  ledStatus = false;
-  ledMode = 0;
-  
-  Serial.println("LEDs turned off successfully");
-  
+// Lighting settings and where the day stands (caller holds NetworkDataLock)
+void addLightingJson(JsonDocument& doc) {
+  const PhotoperiodConfig& schedule = lightingSettings.schedule;
+  char clock[6];
+  doc["enabled"] = lightingSettings.enabled;
+  snprintf(clock, sizeof(clock), "%02u:%02u", schedule.onMinute / 60, schedule.onMinute % 60);
+  doc["on"] = clock;
+  doc["hours"] = schedule.periodMinutes / 60.0;
+  doc["rampMinutes"] = schedule.rampMinutes;
+  doc["level"] = schedule.levelPercent;
+  doc["ppfd"] = schedule.ppfd;
+  doc["dliTarget"] = schedule.dliTarget;
+
+  uint32_t now = wallClockSeconds();
+  if (lightingNextAt == 0 || now == 0) {
+    doc["phase"] = nullptr;
+    return;
+  }
+  uint32_t local = now + gmtOffset_sec + daylightOffset_sec;
+  uint32_t dusk = photoperiod.duskStart() % Photoperiod::DAY;
+  doc["phase"] = LIGHT_PHASE_NAMES[lightingStep.phase];
+  doc["nextTransition"] = lightingNextAt > now ? lightingNextAt - now : 0;
+  snprintf(clock, sizeof(clock), "%02lu:%02lu", (unsigned long)(dusk / 3600), (unsigned long)(dusk / 60 % 60));
+  doc["duskAt"] = clock;
+  doc["dli"] = photoperiod.dliAt(local);
+  doc["dliYesterday"] = photoperiod.lastDli();
+}
+
+void handleGetLighting(AsyncWebServerRequest* request) {
   JsonDocument doc;
+  {
+    NetworkDataLock lock;
+    addLightingJson(doc);
+  }
+  sendJson(request, 200, doc);
+}
+
+// POST /api/lighting: change any of enabled, on=HH:MM, hours, ramp
+// (minutes), level (%), ppfd and dli (target, 0 = none). Saved to NVS and
+// applied at once.
+void handlePostLighting(AsyncWebServerRequest* request) {
+  LightingSettings settings;
+  {
+    NetworkDataLock lock;
+    settings = lightingSettings;
+  }
+  PhotoperiodConfig& schedule = settings.schedule;
+  bool valid = true;
+  if (request->hasArg("enabled")) {
+    String enabled = request->arg("enabled");
+    settings.enabled = enabled == "1" || enabled == "true";
+  }
+  if (request->hasArg("on")) {
+    int hour = -1;
+    int minute = -1;
+    valid &= sscanf(request->arg("on").c_str(), "%d:%d", &hour, &minute) == 2
+          && hour >= 0 && hour < 24 && minute >= 0 && minute < 60;
+    schedule.onMinute = (uint16_t)(hour * 60 + minute);
+  }
+  if (request->hasArg("hours")) {
+    float hours = request->arg("hours").toFloat();
+    valid &= hours >= 0 && hours <= 24;
+    schedule.periodMinutes = (uint16_t)lroundf(hours * 60);
+  }
+  if (request->hasArg("ramp")) {
+    long ramp = request->arg("ramp").toInt();
+    valid &= ramp >= 0 && ramp <= 180;
+    schedule.rampMinutes = (uint16_t)ramp;
+  }
+  if (request->hasArg("level")) {
+    long level = request->arg("level").toInt();
+    valid &= level >= 1 && level <= 100;
+    schedule.levelPercent = (uint8_t)level;
+  }
+  if (request->hasArg("ppfd")) {
+    float ppfd = request->arg("ppfd").toFloat();
+    valid &= ppfd > 0 && ppfd <= 3000;
+    schedule.ppfd = ppfd;
+  }
+  if (request->hasArg("dli")) {
+    float dli = request->arg("dli").toFloat();
+    valid &= dli >= 0 && dli <= 100;
+    schedule.dliTarget = dli;
+  }
+  if (!valid) {
+    sendError(request, 400, "Expected on=HH:MM, hours 0-24, ramp 0-180, level 1-100, ppfd 0-3000, dli 0-100");
+    return;
+  }
+
+  JsonDocument doc;
+  {
+    NetworkDataLock lock;
+    lightingSettings = settings;
+    lightingStorage.write("settings", &settings, sizeof(settings));
+    addLightingJson(doc);
+  }
+  lightingWake.fetch_or(LIGHTING_WAKE | LIGHTING_REAPPLY);
   doc["status"] = "success";
-  doc["message"] = "LED turned OFF";
-  doc["ledStatus"] = ledStatus;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  Serial.print("Sending response: ");
-  Serial.println(jsonString);
+  sendJson(request, 200, doc);
+}
+
+// Calibration point for a probe from the live (filtered) reading and the
+// solution's reference value. TDS points are stored with a 25 °C input and
+// EC points with a 25 °C value, matching how sampleTDS() and sampleEC()
+// compensate, so a point reads back as the reference at the temperature
+// it was captured at.
+CalibrationPoint calibrationPoint(CalibrationProbe probe, const SensorSnapshot& snap, float reference) {
+  switch (probe) {
+    case PROBE_EC:  return ecCalibrationPoint(snap.ecVoltage, snap.waterTemp, reference);
+    case PROBE_TDS: return tdsCalibrationPoint(snap.tdsVoltage, snap.waterTemp, reference);
+    default:        return phCalibrationPoint(snap.phVoltage, reference);
+  }
+}
+
+void addCalibrationJson(JsonObject probeJson, CalibrationProbe probe) {
+  const ProbeCalibration& cal = calibrations[probe];
+  probeJson["custom"] = cal.usable();
+  probeJson["capturedPoints"] = cal.count;
+  const ProbeCalibration& active = effectiveCalibration(probe);
+  JsonArray points = probeJson["points"].to<JsonArray>();
+  for (int i = 0; i < active.count; i++) {
+    JsonObject point = points.add<JsonObject>();
+    point["input"] = active.points[i].input;
+    point["value"] = active.points[i].value;
+  }
+}
+
+void handleGetCalibration(AsyncWebServerRequest* request) {
+  JsonDocument doc;
+  {
+    NetworkDataLock lock;
+    for (int probe = 0; probe < PROBE_COUNT; probe++) {
+      addCalibrationJson(doc[PROBE_NAMES[probe]].to<JsonObject>(), (CalibrationProbe)probe);
+    }
+  }
+  sendJson(request, 200, doc);
+}
+
+template <CalibrationProbe Probe>
+void handleCalibrationCapture(AsyncWebServerRequest* request) {
+  if (!request->hasArg("value")) {
+    sendError(request, 400, "Missing reference value");
+    return;
+  }
+
+  float reference = request->arg("value").toFloat();
+  SensorSnapshot snap = sensorSnapshot.read();
+  CalibrationPoint point = calibrationPoint(Probe, snap, reference);
+  float replaceWithin = Probe == PROBE_EC ? EC_REPLACE_WITHIN : ProbeCalibration::kValueTolerance;
+
+  JsonDocument doc;
+  int code = 200;
+  {
+    NetworkDataLock lock;
+    if (calibrations[Probe].addPoint(point.input, point.value, replaceWithin)) {
+      calibrationStore.save(PROBE_NAMES[Probe], calibrations[Probe]);
+      calibrationChanged = true;
+      doc["status"] = "success";
+      doc["message"] = calibrations[Probe].usable()
+        ? "Calibration point captured"
+        : "Calibration point captured, capture one more to apply";
+    } else {
+      code = 409;
+      doc["status"] = "error";
+      doc["message"] = "Calibration full or reading too close to an existing point";
+    }
+    doc["probe"] = PROBE_NAMES[Probe];
+    doc["input"] = point.input;
+    doc["value"] = reference;
+    doc["waterTemp"] = snap.waterTemp;
+    addCalibrationJson(doc["calibration"].to<JsonObject>(), Probe);
+  }
+  sendJson(request, code, doc);
+}
+
+template <CalibrationProbe Probe>
+void handleCalibrationClear(AsyncWebServerRequest* request) {
+  {
+    NetworkDataLock lock;
+    calibrations[Probe].clear();
+    calibrationStore.save(PROBE_NAMES[Probe], calibrations[Probe]);
+    calibrationChanged = true;
+  }
+
+  JsonDocument doc;
+  doc["status"] = "success";
+  doc["message"] = "Calibration reset to factory defaults";
+  doc["probe"] = PROBE_NAMES[Probe];
+  sendJson(request, 200, doc);
+}
+
+// Seconds since boot from the 64-bit timer (millis() wraps after 49 days)
+uint32_t uptimeSeconds() {
+  return (uint32_t)(esp_timer_get_time() / 1000000LL);
+}
+
+// Unix seconds from the cached clock offset, 0 until NTP has synced
+uint32_t wallClockSeconds() {
+  return wallClock.seconds(esp_timer_get_time());
+}
+
+// SNTP callback (lwIP task): cache the new offset for wallClockSeconds()
+void onTimeSync(struct timeval* tv) {
+  if ((unsigned long)tv->tv_sec >= EPOCH_VALID_AFTER) {
+    wallClock.sync((int64_t)tv->tv_sec * 1000000LL + tv->tv_usec, esp_timer_get_time());
+    lightingWake.fetch_or(LIGHTING_WAKE);
+    markBootStage(BOOT_NTP);
+  }
+}
+
+// Record the first time a boot stage is reached; later calls are ignored
+void markBootStage(BootStage stage) {
+  uint32_t notReached = BOOT_NOT_REACHED;
+  uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+  if (bootStageMs[stage].compare_exchange_strong(notReached, now)) {
+    Serial.printf("Boot: %s at %lu ms\n", BOOT_STAGE_NAMES[stage], (unsigned long)now);
+  }
+}
+
+const char* resetReasonName(esp_reset_reason_t reason) {
+  switch (reason) {
+    case ESP_RST_POWERON:  return "powerOn";
+    case ESP_RST_EXT:      return "external";
+    case ESP_RST_SW:       return "software";
+    case ESP_RST_PANIC:    return "panic";
+    case ESP_RST_INT_WDT:  return "interruptWatchdog";
+    case ESP_RST_TASK_WDT: return "taskWatchdog";
+    case ESP_RST_WDT:      return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deepSleep";
+    case ESP_RST_BROWNOUT: return "brownout";
+    case ESP_RST_SDIO:     return "sdio";
+    default:               return "unknown";
+  }
+}
+
+// GET /api/boot: reset reason and the boot timeline, so time-to-first-sample
+// and time-to-online can be compared across builds
+void handleGetBoot(AsyncWebServerRequest* request) {
+  JsonDocument doc;
+  doc["build"] = __DATE__ " " __TIME__;
+  doc["resetReason"] = resetReasonName(esp_reset_reason());
+  JsonObject stages = doc["stages"].to<JsonObject>();
+  for (size_t i = 0; i < BOOT_STAGE_COUNT; i++) {
+    uint32_t at = bootStageMs[i].load();
+    if (at == BOOT_NOT_REACHED) {
+      stages[BOOT_STAGE_NAMES[i]] = nullptr;
+    } else {
+      stages[BOOT_STAGE_NAMES[i]] = at;
+    }
+  }
+  sendJson(request, 200, doc);
+}
+
+// Query bound: absolute seconds since boot, or relative to now if negative
+uint32_t historyBound(const String& arg, uint32_t now) {
+  long value = arg.toInt();
+  if (value >= 0) {
+    return (uint32_t)value;
+  }
+  return (uint32_t)-value >= now ? 0 : now - (uint32_t)-value;
+}
+
+// State of one chunked export, kept between chunks by the response. The
+// count of live exports is what API_MAX_EXPORTS limits.
+struct ExportCursor {
+  ExportCursor() { activeExports++; }
+  ~ExportCursor() { activeExports--; }
+  ExportCursor(const ExportCursor&) = delete;
+  ExportCursor& operator=(const ExportCursor&) = delete;
+
+  uint32_t from = 0;
+  uint32_t to = 0;
+  uint32_t next = 0;     // First time not yet sent
+  bool started = false;
+  bool finished = false;
+};
+
+struct HistoryExport : ExportCursor {
+  int metric = 0;
+  int tier = 0;
+  uint32_t now = 0;
+  bool first = true;
+};
+
+struct LogExport : ExportCursor {
+  bool csv = true;
+};
+
+// Fill one chunk of a history response. Points are [time, min, max, avg].
+size_t fillHistoryChunk(HistoryExport& state, uint8_t* buffer, size_t maxLen) {
+  if (state.finished) {
+    return 0;
+  }
+  if (maxLen < 4 * HISTORY_POINT_BYTES) {
+    return RESPONSE_TRY_AGAIN;  // Wait for room for the header or a few points
+  }
+
+  char* out = (char*)buffer;
+  size_t used = 0;
+  const HistoryMetricInfo& info = HISTORY_METRICS[state.metric];
+  uint32_t interval = history.interval(state.tier);
+  if (!state.started) {
+    used += snprintf(out, maxLen,
+      "{\"metric\":\"%s\",\"resolution\":%u,\"now\":%u,\"from\":%u,\"to\":%u,\"points\":[",
+      info.name, (unsigned)interval, (unsigned)state.now, (unsigned)state.from, (unsigned)state.to);
+    state.started = true;
+  }
+
+  bool more = false;
+  {
+    NetworkDataLock lock;
+    history.query(state.tier, state.metric, state.next, state.to, [&](uint32_t at, int16_t mins, int16_t maxs, int16_t avg) {
+      if (maxLen - used < HISTORY_POINT_BYTES + 2) {
+        more = true;
+        return false;
+      }
+      used += snprintf(out + used, maxLen - used, "%s[%u,%.*f,%.*f,%.*f]",
+        state.first ? "" : ",", (unsigned)at,
+        info.decimals, mins / info.scale, info.decimals, maxs / info.scale, info.decimals, avg / info.scale);
+      state.first = false;
+      state.next = at + interval;
+      return true;
+    });
+  }
+  if (!more) {
+    memcpy(out + used, "]}", 2);
+    used += 2;
+    state.finished = true;
+  }
+  return used;
+}
+
+// GET /api/history?metric=ph&from=-3600&to=0[&resolution=60]
+// from/to are seconds since boot, negative values are relative to now and
+// a missing or zero "to" means now. The finest tier that still covers
+// "from" is used unless a coarser resolution (seconds) is asked for.
+// Answered straight from the history rings and streamed in chunks, so the
+// response size doesn't depend on free heap.
+void handleGetHistory(AsyncWebServerRequest* request) {
+  int metric = -1;
+  for (int i = 0; i < HIST_COUNT; i++) {
+    if (request->arg("metric") == HISTORY_METRICS[i].name) {
+      metric = i;
+    }
+  }
+  if (metric < 0) {
+    sendError(request, 400, "Unknown metric");
+    return;
+  }
+  if (activeExports.load() >= API_MAX_EXPORTS) {
+    sendError(request, 503, "Too many exports in progress");
+    return;
+  }
+
+  std::shared_ptr<HistoryExport> state = std::make_shared<HistoryExport>();
+  state->metric = metric;
+  state->now = uptimeSeconds();
+  uint32_t now = state->now;
+  state->from = request->hasArg("from") ? historyBound(request->arg("from"), now)
+                                        : (now > HISTORY_DEFAULT_SPAN ? now - HISTORY_DEFAULT_SPAN : 0);
+  state->to = request->hasArg("to") && request->arg("to").toInt() != 0 ? historyBound(request->arg("to"), now) : now;
+  state->next = state->from;
+
+  {
+    NetworkDataLock lock;
+    state->tier = history.pickTier(state->from);
+  }
+  if (request->hasArg("resolution")) {
+    uint32_t resolution = (uint32_t)request->arg("resolution").toInt();
+    for (int i = history.TIER_COUNT - 1; i >= 0; i--) {
+      if (history.interval(i) >= resolution) {
+        state->tier = i;
+      }
+    }
+  }
+
+  // The first chunk may be filled inside send(), so no lock held here
+  request->send(request->beginChunkedResponse("application/json",
+    [state](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      return fillHistoryChunk(*state, buffer, maxLen);
+    }));
+}
+
+// One exported log record (at most LOG_LINE_BYTES)
+size_t formatLogRecord(char* out, size_t room, bool csv, uint32_t at, const int16_t* values, size_t count) {
+  size_t used = snprintf(out, room, csv ? "%u" : "{\"time\":%u", (unsigned)at);
+  for (size_t m = 0; m < count && m < HIST_COUNT; m++) {
+    const HistoryMetricInfo& info = HISTORY_METRICS[m];
+    if (!csv) {
+      used += snprintf(out + used, room - used, ",\"%s\":", info.name);
+    } else {
+      out[used++] = ',';
+    }
+    if (values[m] != HISTORY_NO_DATA) {
+      used += snprintf(out + used, room - used, "%.*f", info.decimals, values[m] / info.scale);
+    } else if (!csv) {
+      used += snprintf(out + used, room - used, "null");
+    }
+  }
+  used += snprintf(out + used, room - used, csv ? "\n" : "}\n");
+  return used;
+}
+
+// Fill one chunk of a log export. Each chunk rescans from the cursor (the
+// segment index makes that cheap), so records sharing a timestamp across
+// a chunk boundary can only be lost if the clock was stepped back.
+size_t fillLogChunk(LogExport& state, uint8_t* buffer, size_t maxLen) {
+  if (state.finished) {
+    return 0;
+  }
+  if (maxLen < 2 * LOG_LINE_BYTES) {
+    return RESPONSE_TRY_AGAIN;
+  }
+
+  char* out = (char*)buffer;
+  size_t used = 0;
+  if (!state.started) {
+    if (state.csv) {
+      used += snprintf(out, maxLen, "time");
+      for (int m = 0; m < HIST_COUNT; m++) {
+        used += snprintf(out + used, maxLen - used, ",%s", HISTORY_METRICS[m].name);
+      }
+      used += snprintf(out + used, maxLen - used, "\n");
+    }
+    state.started = true;
+  }
+
+  bool more = false;
+  {
+    NetworkDataLock lock;
+    flashLog.scan(state.next, state.to, [&](uint32_t at, const int16_t* values, size_t count) {
+      if (maxLen - used < LOG_LINE_BYTES) {
+        more = true;
+        return false;
+      }
+      used += formatLogRecord(out + used, maxLen - used, state.csv, at, values, count);
+      state.next = at + 1;
+      return true;
+    });
+  }
+  state.finished = !more;
+  return used;
+}
+
+// GET /api/log?from=&to=&format=csv|ndjson
+// from/to are Unix times, negative values are relative to now. Records are
+// streamed block by block, so the export never holds the log in RAM.
+void handleGetLog(AsyncWebServerRequest* request) {
+  if (!flashLog.ready()) {
+    sendError(request, 503, "Flash log unavailable");
+    return;
+  }
+  if (activeExports.load() >= API_MAX_EXPORTS) {
+    sendError(request, 503, "Too many exports in progress");
+    return;
+  }
+
+  std::shared_ptr<LogExport> state = std::make_shared<LogExport>();
+  uint32_t now = wallClockSeconds();
+  state->from = request->hasArg("from") ? historyBound(request->arg("from"), now)
+                                        : (now > LOG_DEFAULT_SPAN ? now - LOG_DEFAULT_SPAN : 0);
+  state->to = request->hasArg("to") && request->arg("to").toInt() != 0 ? historyBound(request->arg("to"), now) : now;
+  state->next = state->from;
+  state->csv = request->arg("format") != "ndjson";
+
+  request->send(request->beginChunkedResponse(state->csv ? "text/csv" : "application/x-ndjson",
+    [state](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      return fillLogChunk(*state, buffer, maxLen);
+    }));
+}
+
+typedef void (*ApiHandler)(AsyncWebServerRequest*);
+
+// Every API endpoint. OPTIONS (CORS preflight) is answered for any path
+// listed here and the CORS headers are added to every response.
+const ApiRoute<WebRequestMethod, ApiHandler> API_ROUTES[] = {
+  {HTTP_GET,  "/api/status",               handleGetStatus,                      "Get all sensor data and status (JSON, CBOR or MessagePack by Accept)"},
+  {HTTP_GET,  "/api/uptime",               handleGetUptime,                      "Uptime, heap, RSSI, pump timers and task run times"},
+  {HTTP_GET,  "/api/boot",                 handleGetBoot,                        "Reset reason and boot stage timestamps (ms since start)"},
+  {HTTP_GET,  "/api/events",               nullptr,                              "Live updates (Server-Sent Events, served by the event source)"},
+  {HTTP_POST, "/api/pump/on",              handlePumpOn,                         "Turn pump ON manually"},
+  {HTTP_POST, "/api/pump/off",             handlePumpOff,                        "Turn pump OFF manually"},
+  {HTTP_POST, "/api/pump/auto",            handlePumpAuto,                       "Set pump to AUTO mode"},
+  {HTTP_GET,  "/api/pump/audit",           handleGetPumpAudit,                   "Pump rules in force and the last switches, with reasons"},
+  {HTTP_POST, "/api/led/growth",           handleLedMode<LED_MODE_GROWTH>,       "Set LED to Growth mode"},
+  {HTTP_POST, "/api/led/relax",            handleLedMode<LED_MODE_RELAX>,        "Set LED to Relaxing mode"},
+  {HTTP_POST, "/api/led/sleep",            handleLedMode<LED_MODE_SLEEP>,        "Set LED to Sleep mode"},
+  {HTTP_POST, "/api/led/off",              handleLedMode<LED_MODE_OFF>,          "Turn LED OFF"},
+  {HTTP_POST, "/api/led/zone",             handleLedZone,                        "?zone=N&color=RRGGBB - Fade one tower level to a colour"},
+  {HTTP_GET,  "/api/wifi",                 handleGetWifi,                        "WiFi link state, reconnect times and outage counts"},
+  {HTTP_POST, "/api/wifi",                 handlePostWifi,                       "?ssid=X&password=Y - Save WiFi credentials and join that network"},
+  {HTTP_GET,  "/api/lighting",             handleGetLighting,                    "Photoperiod schedule, current phase and daily light integral"},
+  {HTTP_POST, "/api/lighting",             handlePostLighting,                   "?enabled=&on=HH:MM&hours=&ramp=&level=&ppfd=&dli= - Change the schedule"},
+  {HTTP_GET,  "/api/calibration",          handleGetCalibration,                 "Get probe calibrations"},
+  {HTTP_POST, "/api/calibration/ph",       handleCalibrationCapture<PROBE_PH>,   "?value=X - Capture a pH point at the live reading"},
+  {HTTP_POST, "/api/calibration/ec",       handleCalibrationCapture<PROBE_EC>,   "?value=X - Capture an EC point at the live reading"},
+  {HTTP_POST, "/api/calibration/tds",      handleCalibrationCapture<PROBE_TDS>,  "?value=X - Capture a TDS point at the live reading"},
+  {HTTP_POST, "/api/calibration/ph/clear", handleCalibrationClear<PROBE_PH>,     "Revert pH to factory calibration"},
+  {HTTP_POST, "/api/calibration/ec/clear", handleCalibrationClear<PROBE_EC>,     "Revert EC to factory calibration"},
+  {HTTP_POST, "/api/calibration/tds/clear", handleCalibrationClear<PROBE_TDS>,   "Revert TDS to factory calibration"},
+  {HTTP_GET,  "/api/history",              handleGetHistory,                     "?metric=X&from=&to= - Min/max/avg history of one metric"},
+  {HTTP_GET,  "/api/log",                  handleGetLog,                         "?from=&to=&format=csv|ndjson - Export the flash log"},
+  {HTTP_GET,  "/api/reporting",            handleGetReporting,                   "Deadband reporting counters per channel and field"}
+};
+
+ApiRouter<WebRequestMethod, ApiHandler> apiRouter(API_ROUTES, HTTP_OPTIONS);
+
+// Every /api/* request lands here; the route table does the rest
+void dispatchApi(AsyncWebServerRequest* request) {
+  const ApiRouter<WebRequestMethod, ApiHandler>::Route* route = nullptr;
+  switch (apiRouter.match(request->url().c_str(), request->method(), route)) {
+    case API_ROUTE_FOUND:
+      if (route->handler) {
+        route->handler(request);
+      } else {
+        request->send(503, "text/plain", "Service Unavailable");  // Its own handler refused it
+      }
+      break;
+    case API_PREFLIGHT:
+      request->send(204);
+      break;
+    case API_METHOD_NOT_ALLOWED:
+      request->send(405, "text/plain", "Method Not Allowed");
+      break;
+    default:
+      request->send(404, "text/plain", "Not Found");
+      break;
+  }
+}
+
+// Dashboard files, straight from flash. The page is revalidated on every
+// load (a 304 when unchanged); what it links to carries its hash in the
+// URL and is cached for a year.
+void handleAsset(AsyncWebServerRequest* request, const WebAsset& asset) {
+  AsyncWebServerResponse* response;
+  if (request->header("If-None-Match") == asset.etag) {
+    response = request->beginResponse(304);
+  } else {
+    response = request->beginResponse(200, asset.contentType, asset.data, asset.length);
+    if (asset.gzip) {
+      response->addHeader("Content-Encoding", "gzip");
+    }
+  }
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", asset.immutable ? "public, max-age=31536000, immutable" : "no-cache");
+  request->send(response);
+}
+
+// With the setup portal open, anything unknown (the OS connectivity
+// checks included) is sent to the portal page
+void handleNotFound(AsyncWebServerRequest* request) {
+  if (portalRunning.load()) {
+    request->redirect("http://" + WiFi.softAPIP().toString() + PORTAL_PAGE);
+    return;
+  }
+  request->send(404, "text/plain", "Not Found");
+}
+
+// Blink the IP address on the first pixels, one octet at a time: octet
+// n is announced by n white flashes, then shown as value/10 green pixels.
+// Played by ledEngine, so boot carries on while it runs (~25 s).
+void startIpPattern() {
+  IPAddress ip = WiFi.localIP();
+  size_t count = 0;
+  auto step = [&](uint16_t durationMs, uint8_t lit, Rgb color) {
+    if (count < LED_IP_PATTERN_STEPS) {
+      ipPatternSteps[count++] = {durationMs, lit, color};
+    }
+  };
+  step(1000, 0, {0, 0, 0});
+  for (int octet = 0; octet < 4; octet++) {
+    for (int flash = 0; flash <= octet; flash++) {
+      step(300, 10, {255, 255, 255});
+      step(300, 0, {0, 0, 0});
+    }
+    step(1000, 0, {0, 0, 0});
+    step(2000, ip[octet] / 10, {0, 255, 0});
+    step(1000, 0, {0, 0, 0});
+  }
+  ledEngine.play(ipPatternSteps, count, millis());
+}
+
+// A probe produced a value: publish it on the next pass
+void readingTaken() {
+  snapshotDirty = true;
+  if (!readingsStarted) {
+    readingsStarted = true;
+    markBootStage(BOOT_FIRST_SAMPLE);
+  }
+}
+
+// --- Sensor sampling state machines
+// Each of these is a scheduler task: it does a small, bounded amount of work
+// per call and returns, so HTTP and pump control keep being serviced while a
+// reading is in progress.
+
+bool startAdcDma() {
+  adc_digi_init_config_t initConfig = {};
+  initConfig.max_store_buf_size = ADC_DMA_STORE_BYTES;
+  initConfig.conv_num_each_intr = ADC_DMA_FRAME_BYTES;
+  initConfig.adc1_chan_mask = BIT(TDS_ADC_CHANNEL) | BIT(PH_ADC_CHANNEL) | BIT(EC_ADC_CHANNEL);
+  initConfig.adc2_chan_mask = 0;
+  if (adc_digi_initialize(&initConfig) != ESP_OK) {
+    Serial.println("ADC DMA init failed");
+    return false;
+  }
+
+  const adc1_channel_t channels[ADC_SLOT_COUNT] = {TDS_ADC_CHANNEL, PH_ADC_CHANNEL, EC_ADC_CHANNEL};
+  adc_digi_pattern_config_t pattern[ADC_SLOT_COUNT] = {};
+  for (int slot = 0; slot < ADC_SLOT_COUNT; slot++) {
+    pattern[slot].atten = ADC_ATTEN_DB_11;
+    pattern[slot].channel = channels[slot];
+    pattern[slot].unit = 0; // ADC1
+    pattern[slot].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    adcDemux.mapChannel(slot, channels[slot]);
+  }
+
+  adc_digi_configuration_t digiConfig = {};
+  digiConfig.conv_limit_en = true;
+  digiConfig.conv_limit_num = 250;
+  digiConfig.pattern_num = ADC_SLOT_COUNT;
+  digiConfig.adc_pattern = pattern;
+  digiConfig.sample_freq_hz = ADC_DMA_SAMPLE_RATE;
+  digiConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digiConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if (adc_digi_controller_configure(&digiConfig) != ESP_OK || adc_digi_start() != ESP_OK) {
+    Serial.println("ADC DMA start failed");
+    adc_digi_deinitialize();
+    return false;
+  }
+
+  Serial.println("ADC DMA sampling started");
+  return true;
+}
+
+// Move every completed DMA frame into the demultiplexer. Never waits.
+void adcDrain() {
+  if (!adcDmaRunning) {
+    return;
+  }
+
+  static uint16_t frame[ADC_DMA_FRAME_BYTES / sizeof(uint16_t)];
+  for (;;) {
+    uint32_t bytes = 0;
+    esp_err_t err = adc_digi_read_bytes((uint8_t*)frame, sizeof(frame), &bytes, 0);
+    // ESP_ERR_INVALID_STATE means the driver ring overflowed; the bytes we
+    // did get are still valid
+    if ((err != ESP_OK && err != ESP_ERR_INVALID_STATE) || bytes == 0) {
+      return;
+    }
+    adcDemux.push(frame, bytes / sizeof(uint16_t), [](size_t slot, int32_t code) {
+      switch (slot) {
+        case ADC_SLOT_PH:  return phFilter.update(code);
+        case ADC_SLOT_TDS: return tdsFilter.update(code);
+        case ADC_SLOT_EC:  return ecFilter.update(code);
+        default:           return code;
+      }
+    });
+  }
+}
+
+// Average of the analog channel since the last reading, in raw ADC codes
+bool takeAdcReading(AdcSlot slot, float& raw) {
+  uint32_t samples = 0;
+  if (!adcDemux.takeAverage(slot, raw, &samples)) {
+    return false;
+  }
+  adcSamplesPerReading = samples;
+  return true;
+}
+
+void sampleWaterTemp() {
+  unsigned long now = millis();
+
+  // Start a conversion; the DS18B20 converts on its own while we return
+  if (!waterTempConverting) {
+    if ((long)(now - waterTempNextSample) < 0) {
+      return;
+    }
+    waterTempSensor.requestTemperatures();
+    waterTempRequestTime = now;
+    waterTempConverting = true;
+    return;
+  }
+
+  // Collect the result once the conversion time has passed
+  if (now - waterTempRequestTime < DS18B20_CONVERSION_TIME) {
+    return;
+  }
+  waterTempConverting = false;
+  waterTempNextSample = waterTempRequestTime + SENSOR_SAMPLE_PERIOD;
+
+  float reading = waterTempSensor.getTempCByIndex(0);
+  if (reading == DEVICE_DISCONNECTED_C) {
+    Serial.println("Failed to read water temp");
+    waterTemp = 25.0;
+    feedPump(PUMP_SIGNAL_WATER_TEMP, NAN);  // Rules keep their state, not the stand-in
+  } else {
+    waterTemp = reading;
+    feedPump(PUMP_SIGNAL_WATER_TEMP, waterTemp);
+  }
+  readingTaken();
+}
+
+void sampleAir() {
+  // DHT22 (Air Temperature & Humidity)
+  airTemp = dht.readTemperature();
+  humidity = dht.readHumidity();
+
+  if (isnan(airTemp) || isnan(humidity)) {
+    Serial.println("Failed to read from DHT22 sensor!");
+  }
+  feedPump(PUMP_SIGNAL_AIR_TEMP, airTemp);
+  readingTaken();
+}
+
+// One ping. Like the DHT22 read above it waits on the wire, at most
+// JSN_ECHO_TIMEOUT_US for an echo from below the empty mark.
+void sampleWaterLevel() {
+  long distance = levelSensor.read(CM);  // 0 when no echo came back
+  if (distance == 0) {
+    Serial.println("Failed to read water level");
+    feedPump(PUMP_SIGNAL_WATER_LEVEL, NAN);  // Rules keep their state
+    return;
+  }
+  waterLevel = constrain(map(distance, WATER_LEVEL_EMPTY_CM, WATER_LEVEL_FULL_CM, 0, 100), 0L, 100L);
+  feedPump(PUMP_SIGNAL_WATER_LEVEL, waterLevel);
+  readingTaken();
+}
+
+void sampleEC() {
+  float ec_raw;
+  if (!takeAdcReading(ADC_SLOT_EC, ec_raw)) {
+    return;
+  }
+  ecVoltage = ec_raw * ADC_VOLTS_PER_CODE;
+
+  const ConversionTables* tables = conversionTables.load();
+  ecValue = tables->ecAt(ec_raw, waterTemp, temperatureTables);
+  feedPump(PUMP_SIGNAL_EC, ecValue);
+  readingTaken();
+}
+
+void sampleTDS() {
+  float adc_raw;
+  if (!takeAdcReading(ADC_SLOT_TDS, adc_raw)) {
+    return;
+  }
+  tdsVoltage = adc_raw * ADC_VOLTS_PER_CODE;
+
+  const ConversionTables* tables = conversionTables.load();
+  tds_value = tables->tdsAt(adc_raw, waterTemp, temperatureTables);
+  readingTaken();
+}
+
+void samplePH() {
+  float ph_raw;
+  if (!takeAdcReading(ADC_SLOT_PH, ph_raw)) {
+    return;
+  }
+  float ph_voltage = ph_raw * ADC_VOLTS_PER_CODE;
+  phVoltage = ph_voltage;
   
-  server.send(200, "application/json", jsonString);
-  Serial.println("Response sent");
+  // Check sensor status
+  if (ph_raw < 1) {
+    Serial.println("ERROR: pH no signal - check wiring/power!");
+    phValue = 0.0;
+  } else if (ph_raw >= 4090) {
+    Serial.println("ERROR: pH sensor saturated (3.3V max)!");
+    phValue = 0.0;
+  } else if (ph_voltage < 0.1) {
+    Serial.println("WARNING: pH very low voltage!");
+    phValue = 0.0;
+  } else {
+    phValue = conversionTables.load()->phAt(ph_raw);
+  }
+  readingTaken();
+}
+
+// Copy the shared state out for the acquisition core's consumers
+void publishSnapshot() {
+  if (!snapshotDirty) {
+    return;
+  }
+  snapshotDirty = false;
+
+  SensorSnapshot snap;
+  snap.waterTemp = waterTemp;
+  snap.airTemp = airTemp;
+  snap.humidity = humidity;
+  snap.tds = tds_value;
+  snap.ph = phValue;
+  snap.ec = ecValue;
+  snap.ecVoltage = ecVoltage;
+  snap.tdsVoltage = tdsVoltage;
+  snap.phVoltage = phVoltage;
+  snap.waterLevel = waterLevel;
+  snap.pumpRunning = pumpRunning;
+  snap.autoPumpEnabled = autoPumpEnabled;
+  snap.manualPumpOverride = manualPumpOverride;
+  snap.pumpStartTime = pumpStartTime;
+  snap.lastPumpCycle = lastPumpCycle;
+  snap.pumpScheduled = pumpEngine.deadline(snap.pumpDeadline);
+  snap.pumpInhibited = pumpEngine.inhibited();
+  snap.pumpRules = pumpEngine.activeRules();
+  snap.pumpRunMs = pumpEngine.runMs();
+  snap.pumpPeriodMs = pumpEngine.periodMs();
+  snap.pumpRuntimeS = (uint32_t)((pumpRuntimeMs + (pumpRunning ? millis() - pumpStartTime : 0)) / 1000);
+  snap.pumpAuditDropped = pumpAuditDropped;
+  snap.adcSamples = adcSamplesPerReading;
+  snap.phSpikesRejected = phFilter.head().rejected();
+  snap.tdsSpikesRejected = tdsFilter.head().rejected();
+  snap.sampledAt = millis();
+  snap.loopLastUs = scheduler.lastTickUs();
+  snap.loopMaxUs = scheduler.maxTickUs();
+  snap.loopOverruns = scheduler.overruns();
+  sensorSnapshot.write(snap);
+}
+
+int16_t toHistoryValue(float reading, HistoryMetric metric) {
+  if (isnan(reading)) {
+    return HISTORY_NO_DATA;
+  }
+  float scaled = roundf(reading * HISTORY_METRICS[metric].scale);
+  if (scaled <= -32767.0) return -32767;
+  if (scaled >= 32767.0) return 32767;
+  return (int16_t)scaled;
+}
+
+void toHistoryValues(const SensorSnapshot& snap, int16_t* values) {
+  values[HIST_WATER_TEMP] = toHistoryValue(snap.waterTemp, HIST_WATER_TEMP);
+  values[HIST_AIR_TEMP] = toHistoryValue(snap.airTemp, HIST_AIR_TEMP);
+  values[HIST_HUMIDITY] = toHistoryValue(snap.humidity, HIST_HUMIDITY);
+  values[HIST_TDS] = toHistoryValue(snap.tds, HIST_TDS);
+  values[HIST_PH] = toHistoryValue(snap.ph, HIST_PH);
+  values[HIST_EC] = toHistoryValue(snap.ec, HIST_EC);
+  values[HIST_WATER_LEVEL] = toHistoryValue(snap.waterLevel, HIST_WATER_LEVEL);
+}
+
+const char* mqttTopicName(size_t topic) {
+  return topic < HIST_COUNT ? HISTORY_METRICS[topic].name : MQTT_STATE_TOPICS[topic - HIST_COUNT];
+}
+
+// Network-core task: stage the topics that moved past their deadband.
+// Values are rounded like the history.
+void stageMqttState() {
+  SensorSnapshot snap = sensorSnapshot.read();
+  float readings[MQTT_TOPIC_COUNT] = {snap.waterTemp, snap.airTemp, snap.humidity, snap.tds, snap.ph, snap.ec,
+                                      (float)snap.waterLevel, (float)snap.pumpRunning,
+                                      (float)snap.autoPumpEnabled, (float)ledMode};
+  uint32_t topics = mqttReporter.offer(readings, millis());
+  if (topics == 0) {
+    return;
+  }
+  int16_t values[HIST_COUNT];
+  toHistoryValues(snap, values);
+
+  char payload[MQTT_PAYLOAD_BYTES];
+  for (size_t i = 0; i < HIST_COUNT; i++) {
+    if (!reported(topics, i) || values[i] == HISTORY_NO_DATA) {
+      continue;  // Leave the last good value retained
+    }
+    snprintf(payload, sizeof(payload), "%.*f", HISTORY_METRICS[i].decimals, values[i] / HISTORY_METRICS[i].scale);
+    mqttOutbox.set(i, payload);
+  }
+  if (reported(topics, MQTT_PUMP)) mqttOutbox.set(MQTT_PUMP, snap.pumpRunning ? "on" : "off");
+  if (reported(topics, MQTT_PUMP_MODE)) mqttOutbox.set(MQTT_PUMP_MODE, snap.autoPumpEnabled ? "auto" : "manual");
+  if (reported(topics, MQTT_LED)) mqttOutbox.set(MQTT_LED, LED_PRESETS[ledMode].name);
+}
+
+// Network-core task: connect (with backoff) and drain the outbox. Nothing
+// here waits on the broker: connect() and publish() only queue work for
+// the async_tcp task, and a full send buffer leaves the rest for next time.
+void serviceMqtt() {
+  if (mqttSessionStarted.exchange(false)) {
+    mqttBackoff.reset();
+    mqttOutbox.requeueAll();  // A restarted broker may have lost the retained values
+  }
+  if (!mqttClient.connected()) {
+    if (WiFi.status() == WL_CONNECTED && (int32_t)(millis() - nextMqttConnect) >= 0) {
+      nextMqttConnect = millis() + mqttBackoff.fail(esp_random());
+      mqttClient.connect();
+    }
+    return;
+  }
+
+  char topic[48];
+  for (int i = mqttOutbox.next(); i >= 0; i = mqttOutbox.next()) {
+    snprintf(topic, sizeof(topic), "%s/%s", mqttRoot, mqttTopicName(i));
+    if (mqttClient.publish(topic, MQTT_STATE_QOS, true, mqttOutbox.payload(i)) == 0) {
+      break;
+    }
+    mqttOutbox.sent(i);
+  }
+}
+
+// async_tcp task: announce, subscribe to commands and have networkTask
+// resend the state
+void onMqttConnect(bool sessionPresent) {
+  mqttClient.publish(mqttStatusTopic, MQTT_STATUS_QOS, true, "online");
+  char topic[40];
+  snprintf(topic, sizeof(topic), "%s/cmd/+", mqttRoot);
+  mqttClient.subscribe(topic, MQTT_COMMAND_QOS);
+  mqttSessionStarted.store(true);
+  markBootStage(BOOT_MQTT);
+  Serial.println("MQTT connected");
+}
+
+void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
+  Serial.print("MQTT disconnected: ");
+  Serial.println((int)reason);
+}
+
+// async_tcp task: commands only post to the mailboxes, like the HTTP API
+void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties,
+                   size_t length, size_t index, size_t total) {
+  const char* command = strrchr(topic, '/');
+  if (command == nullptr || properties.retain || index != 0 || length != total) {
+    return;  // A retained command would replay on every reconnect
+  }
+  char value[16];
+  length = min(length, sizeof(value) - 1);
+  memcpy(value, payload, length);
+  value[length] = '\0';
+
+  if (strcmp(command, "/pump") == 0) {
+    for (uint8_t cmd = PUMP_CMD_ON; cmd <= PUMP_CMD_AUTO; cmd++) {
+      if (strcasecmp(value, PUMP_COMMAND_NAMES[cmd]) == 0) {
+        pendingPumpCommand.store(cmd);
+      }
+    }
+  } else if (strcmp(command, "/led") == 0) {
+    for (int8_t mode = 0; mode < LED_MODE_COUNT; mode++) {
+      if (strcasecmp(value, LED_PRESETS[mode].name) == 0) {
+        pendingLedMode.store(mode);
+      }
+    }
+  }
+}
+
+// Append the current snapshot to the history rings
+void recordHistory() {
+  int16_t values[HIST_COUNT];
+  toHistoryValues(sensorSnapshot.read(), values);
+  for (size_t card = 0; card < CARD_COUNT; card++) {
+    sparklines[card].add(values[CARD_METRICS[card]]);
+  }
+  NetworkDataLock lock;
+  history.add(uptimeSeconds(), values);
+}
+
+// Append the current snapshot to the flash log (needs wall-clock time)
+void recordLog() {
+  uint32_t now = wallClockSeconds();
+  if (!flashLog.ready() || now == 0) {
+    return;
+  }
+  int16_t values[HIST_COUNT];
+  toHistoryValues(sensorSnapshot.read(), values);
+  NetworkDataLock lock;
+  if (!flashLog.append(now, values)) {
+    Serial.println("Flash log write failed");
+  }
+}
+
+void flushLog() {
+  NetworkDataLock lock;
+  if (!flashLog.flush()) {
+    Serial.println("Flash log flush failed");
+  }
+}
+
+// Network-core task: print the readings that moved past their deadband;
+// everything, with the pump timers and loop timing, on the heartbeat
+void printSensorReport() {
+  SensorSnapshot snap = sensorSnapshot.read();
+  float values[REPORT_FIELD_COUNT] = {snap.waterTemp, snap.airTemp, snap.humidity, snap.tds, snap.ph, snap.ec,
+                                      (float)snap.waterLevel, (float)snap.pumpRunning,
+                                      (float)snap.autoPumpEnabled, (float)ledStatus};
+  uint32_t fields = serialReporter.offer(values, millis());
+  if (fields == 0) {
+    return;
+  }
+  bool full = fields == serialReporter.allFields();
+
+  if (reported(fields, HIST_WATER_TEMP)) {
+    Serial.print("Water Temp: ");
+    Serial.print(snap.waterTemp, 1);
+    Serial.println(" °C");
+  }
+  if (reported(fields, HIST_AIR_TEMP)) {
+    Serial.print("Air Temp: ");
+    Serial.print(snap.airTemp, 1);
+    Serial.println(" °C");
+  }
+  if (reported(fields, HIST_HUMIDITY)) {
+    Serial.print("Humidity: ");
+    Serial.print(snap.humidity, 1);
+    Serial.println(" %");
+  }
+  if (reported(fields, HIST_EC)) {
+    Serial.print("EC: ");
+    Serial.print(snap.ec, 2);
+    Serial.println(" µS/cm");
+  }
+  if (reported(fields, HIST_TDS)) {
+    Serial.print("TDS: ");
+    Serial.print(snap.tds, 1);
+    Serial.println(" ppm");
+  }
+  if (reported(fields, HIST_PH)) {
+    Serial.print("pH: ");
+    Serial.println(snap.ph, 2);
+  }
+  if (reported(fields, HIST_WATER_LEVEL)) {
+    Serial.print("Water Level: ");
+    Serial.print(snap.waterLevel);
+    Serial.println(" %");
+  }
+  if (reported(fields, REPORT_LED_ON)) {
+    Serial.print("LED: ");
+    Serial.println(LED_PRESETS[ledMode].name);
+  }
+
+  // Pump status, with its timers
+  if (full || reported(fields, REPORT_PUMP_RUNNING) || reported(fields, REPORT_AUTO_MODE)) {
+    Serial.print("Pump Status: ");
+    Serial.print(snap.pumpRunning ? "RUNNING" : "STOPPED");
+    if (snap.autoPumpEnabled && !snap.manualPumpOverride) {
+      Serial.print(" (AUTO MODE)");
+      uint32_t left = snap.pumpDeadline - millis();
+      if (!snap.pumpScheduled) {
+        Serial.print(" - Inhibited");
+      } else if ((int32_t)left < 0) {
+        Serial.print(" - Switching");
+      } else if (snap.pumpRunning) {
+        Serial.print(" - ");
+        Serial.print(left / 60000);
+        Serial.print("min remaining");
+      } else {
+        Serial.print(" - Next cycle in ");
+        Serial.print(left / 60000);
+        Serial.print("min");
+      }
+    } else if (snap.manualPumpOverride) {
+      Serial.print(" (MANUAL MODE)");
+    }
+    Serial.println();
+  }
+
+  if (full) {
+    Serial.print("Loop: last ");
+    Serial.print(snap.loopLastUs);
+    Serial.print("us, worst ");
+    Serial.print(snap.loopMaxUs);
+    Serial.print("us, ");
+    Serial.print(snap.loopOverruns);
+    Serial.print(" over ");
+    Serial.print(LOOP_BUDGET_US);
+    Serial.println("us");
+  }
+
+  Serial.println("------------------------");
+}
+
+// Push changes to the event stream clients
+void publishEvents() {
+  unsigned long now = millis();
+  if (events.count() == 0) {
+    return;
+  }
+
+  // The LED state isn't versioned, so offer on every pass; the reporter
+  // holds a burst of changes for EVENTS_HOLD and sends them as one delta
+  SensorSnapshot snap;
+  liveVersion = sensorSnapshot.read(snap);
+  float values[LIVE_FIELD_COUNT] = {snap.waterTemp, snap.airTemp, snap.humidity, snap.tds, snap.ph, snap.ec,
+                                    (float)snap.waterLevel, (float)snap.pumpRunning, (float)snap.autoPumpEnabled,
+                                    (float)snap.manualPumpOverride, (float)ledStatus, (float)ledMode};
+  uint32_t fields = liveReporter.offer(values, now);
+  if (fields != 0) {
+    char event[384];
+    JsonEncoder delta((uint8_t*)event, sizeof(event) - 1);
+    delta.beginObject();
+    if (reported(fields, HIST_WATER_TEMP)) delta.field("waterTemp", snap.waterTemp);
+    if (reported(fields, HIST_AIR_TEMP)) delta.field("airTemp", snap.airTemp);
+    if (reported(fields, HIST_HUMIDITY)) delta.field("humidity", snap.humidity);
+    if (reported(fields, HIST_TDS)) delta.field("tds", snap.tds);
+    if (reported(fields, HIST_PH)) delta.field("ph", snap.ph);
+    if (reported(fields, HIST_EC)) delta.field("ec", snap.ec);
+    if (reported(fields, HIST_WATER_LEVEL)) delta.field("waterLevel", snap.waterLevel);
+    if (reported(fields, LIVE_PUMP_RUNNING)) {
+      delta.field("pumpStatus", snap.pumpRunning);
+      delta.field("pumpRunning", snap.pumpRunning);
+    }
+    if (reported(fields, LIVE_AUTO_PUMP)) delta.field("autoPumpEnabled", snap.autoPumpEnabled);
+    if (reported(fields, LIVE_MANUAL_OVERRIDE)) delta.field("manualPumpOverride", snap.manualPumpOverride);
+    if (reported(fields, LIVE_LED_ON)) delta.field("ledStatus", ledStatus.load());
+    if (reported(fields, LIVE_LED_MODE)) delta.field("ledMode", (int32_t)ledMode.load());
+    delta.endObject();
+
+    if (delta.ok()) {
+      event[delta.size()] = '\0';
+      events.send(event, "delta", liveVersion);
+      lastEventTime = now;
+    }
+  }
+
+  if (now - lastEventTime >= EVENTS_PING_PERIOD) {
+    events.send("{}", "ping", liveVersion);
+    lastEventTime = now;
+  }
+}
+
+void refreshTFTDisplay() {
+  updateTFTDisplay();
+}
+
+// TFT reset and first frame. The panel belongs to the network core.
+void beginDisplay() {
+  pinMode(TFT_LED, OUTPUT);
+  digitalWrite(TFT_LED, HIGH);
+  tft.init();  // TFT_eSPI sets up the SPI bus itself
+  tft.setRotation(1); // Landscape mode
+  tft.initDMA();
+  tft.fillScreen(BACKGROUND_COLOR);
+  updateTFTDisplay();
+  markBootStage(BOOT_DISPLAY);
+}
+
+// Flash log and upload spill: mount LittleFS (formatting a blank partition)
+// and index both. Their writers (networkTask, uplinkTask) start after this.
+void beginStorage() {
+  bool fsReady = LittleFS.begin(true);
+  if (fsReady && flashLog.begin()) {
+    Serial.print("Flash log: ");
+    Serial.print(flashLog.segments());
+    Serial.print(" segments, ");
+    Serial.print(flashLog.storedBytes());
+    Serial.println(" bytes");
+  } else {
+    Serial.println("Flash log unavailable");
+  }
+
+  // Upload spill: resume after the last sample the server confirmed
+  if (fsReady && uploadSpill.begin()) {
+    uploadStorage.read("cursor", &uploadSpillCursor, sizeof(uploadSpillCursor));
+    uploadSpillPending = uploadSpill.storedBytes() > 0;  // Cleared once nothing is past the cursor
+  }
+  markBootStage(BOOT_STORAGE);
+}
+
+void loadWifiCredentials() {
+  WifiCredentials stored;
+  if (wifiStorage.read("credentials", &stored, sizeof(stored)) == sizeof(stored)
+      && stored.version == WIFI_CREDENTIALS_VERSION) {
+    stored.ssid[sizeof(stored.ssid) - 1] = '\0';
+    stored.password[sizeof(stored.password) - 1] = '\0';
+    wifiCredentials = stored;
+    Serial.println("WiFi credentials loaded");
+  } else {
+    wifiCredentials.version = WIFI_CREDENTIALS_VERSION;
+    strlcpy(wifiCredentials.ssid, ssid, sizeof(wifiCredentials.ssid));
+    strlcpy(wifiCredentials.password, password, sizeof(wifiCredentials.password));
+  }
+}
+
+WifiCredentials currentWifiCredentials() {
+  NetworkDataLock lock;
+  return wifiCredentials;
+}
+
+uint32_t fastConnectCheck(const WifiFastConnect& cache) {
+  return logCrc32((const uint8_t*)&cache, offsetof(WifiFastConnect, check));
+}
+
+uint32_t ssidCrc(const char* name) {
+  return logCrc32((const uint8_t*)name, strlen(name));
+}
+
+// The cache is only good for the network it was taken on
+bool fastConnectValid(const WifiCredentials& credentials) {
+  const WifiFastConnect& cache = wifiFastConnect;
+  return cache.magic == WIFI_FAST_MAGIC && cache.check == fastConnectCheck(cache)
+      && cache.ssidCrc == ssidCrc(credentials.ssid) && cache.channel != 0;
+}
+
+void saveFastConnect(const WifiCredentials& credentials) {
+  WifiFastConnect cache = {};
+  const uint8_t* bssid = WiFi.BSSID();
+  if (bssid == nullptr) {
+    return;
+  }
+  cache.magic = WIFI_FAST_MAGIC;
+  cache.ssidCrc = ssidCrc(credentials.ssid);
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gateway = (uint32_t)WiFi.gatewayIP();
+  cache.subnet = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP();
+  memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+  cache.channel = (uint8_t)WiFi.channel();
+  cache.check = fastConnectCheck(cache);
+  memcpy(&wifiFastConnect, &cache, sizeof(cache));
+  wifiLink.cached();
+}
+
+void forgetFastConnect() {
+  wifiFastConnect.magic = 0;
+}
+
+// Start an attempt. A fast one joins the cached access point on its
+// channel with the cached address; a full one scans and asks DHCP.
+void connectWifi(bool fast) {
+  WifiCredentials credentials = currentWifiCredentials();
+  if (fast) {
+    const WifiFastConnect& cache = wifiFastConnect;
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    WiFi.begin(credentials.ssid, credentials.password, cache.channel, cache.bssid);
+  } else {
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));  // Back to DHCP
+    WiFi.begin(credentials.ssid, credentials.password);
+  }
+  Serial.printf("WiFi: %s connect to %s\n", fast ? "fast" : "full", credentials.ssid);
+}
+
+void wifiOnline() {
+  saveFastConnect(currentWifiCredentials());
+  markBootStage(BOOT_WIFI);
+  Serial.printf("WiFi connected in %lu ms, IP %s, RSSI %d\n", (unsigned long)wifiLink.lastConnectMs(),
+                WiFi.localIP().toString().c_str(), WiFi.RSSI());
+
+  // Initialize time. Nothing waits for it: timestamps come from
+  // wallClock, which the callback fills in once the first reply is in.
+  if (!ntpStarted) {
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
+    ntpStarted = true;
+  }
+  if (!ipPatternShown) {
+    startIpPattern();
+    ipPatternShown = true;
+  }
+  Serial.println("Dashboard: http://" + WiFi.localIP().toString() + "/");
+}
+
+void startPortal() {
+  char name[24];
+  snprintf(name, sizeof(name), "HydroBrain-%04X", (unsigned)(ESP.getEfuseMac() >> 32) & 0xFFFF);
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.softAP(name);
+  portalDns.start(PORTAL_DNS_PORT, "*", WiFi.softAPIP());
+  portalRunning.store(true);
+  Serial.printf("Setup portal: join %s, then http://%s%s\n", name, WiFi.softAPIP().toString().c_str(), PORTAL_PAGE);
+}
+
+void stopPortal() {
+  portalDns.stop();
+  WiFi.softAPdisconnect(true);
+  WiFi.mode(WIFI_STA);
+  portalRunning.store(false);
+  Serial.println("Setup portal closed");
+}
+
+// Listen while there is someone to serve. Handlers share state with this
+// task, which is set up by the time this first runs.
+void setServerRunning(bool run) {
+  if (run == serverRunning) {
+    return;
+  }
+  if (run) {
+    server.begin();
+    markBootStage(BOOT_SERVER);
+  } else {
+    server.end();
+  }
+  serverRunning = run;
+  Serial.println(run ? "Web server started" : "Web server stopped");
 }
 
-void handleOptions() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "*");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.sendHeader("Access-Control-Max-Age", "86400");
-  server.send(200, "text/plain", "");
+void applyWifiAction(WifiLinkAction action) {
+  switch (action) {
+    case WIFI_LINK_CONNECT_FAST:
+      connectWifi(true);
+      break;
+    case WIFI_LINK_CONNECT:
+      connectWifi(false);
+      break;
+    case WIFI_LINK_ABORT:
+      WiFi.disconnect();
+      Serial.printf("WiFi attempt timed out, next in %lu ms\n", (unsigned long)wifiLink.retryInMs(millis()));
+      break;
+    case WIFI_LINK_ONLINE:
+      wifiOnline();
+      break;
+    case WIFI_LINK_OFFLINE:
+      Serial.println("WiFi connection lost");
+      break;
+    default:
+      break;
+  }
 }
 
-void handleNotFound() {
-  server.send(404, "text/plain", "Not Found");
+// Network-core task: new credentials, the link state machine, the portal
+// and the web server
+void serviceWifi() {
+  if (wifiCredentialsChanged.exchange(false)) {
+    WifiCredentials credentials = currentWifiCredentials();
+    forgetFastConnect();
+    wifiLink.begin(credentials.ssid[0] != '\0', false, millis());
+    WiFi.disconnect();  // If up, reported as an outage; then the new network is joined
+  }
+  applyWifiAction(wifiLink.update(WiFi.status() == WL_CONNECTED, millis(), esp_random()));
+
+  bool portal = wifiLink.portalWanted();
+  if (portal && !portalRunning.load()) {
+    startPortal();
+  } else if (!portal && portalRunning.load()) {
+    stopPortal();
+  }
+  if (portal) {
+    portalDns.processNextRequest();
+  }
+  setServerRunning(wifiLink.up() || portal);
 }
 
-void showIPAddressOnLED() {
-  // Show IP address using LED colors
-  // Get IP address
-  IPAddress ip = WiFi.localIP();
-  
-  // Turn off all LEDs first
-  for (int i = 0; i < NUM_LEDS; i++) {
-    strip.setPixelColor(i, strip.Color(0, 0, 0));
+void networkTask(void* param) {
+  beginDisplay();
+  beginStorage();
+  xTaskCreatePinnedToCore(uplinkTask, "uplink", UPLINK_TASK_STACK, nullptr, 1,
+                          &uplinkTaskHandle, NETWORK_CORE);
+  for (;;) {
+    networkScheduler.tick();
+    vTaskDelay(1); // Let the idle task and WiFi stack run on this core
   }
-  strip.show();
-  delay(1000);
-  
-  // Show each octet of IP address
-  for (int octet = 0; octet < 4; octet++) {
-    int value = ip[octet];
-    
-    // Show octet number with white flash
-    for (int flash = 0; flash <= octet; flash++) {
-      for (int i = 0; i < 10; i++) {
-        strip.setPixelColor(i, strip.Color(255, 255, 255)); // White
-      }
-      strip.show();
-      delay(300);
-      
-      for (int i = 0; i < 10; i++) {
-        strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-      }
-      strip.show();
-      delay(300);
-    }
-    
-    delay(1000);
-    
-    // Show value using green LEDs (number of LEDs = value/10)
-    int numLeds = value / 10;
-    if (numLeds > NUM_LEDS) numLeds = NUM_LEDS;
-    
-    for (int i = 0; i < numLeds; i++) {
-      strip.setPixelColor(i, strip.Color(0, 255, 0)); // Green
-    }
-    strip.show();
-    delay(2000);
-    
-    // Clear
-    for (int i = 0; i < NUM_LEDS; i++) {
-      strip.setPixelColor(i, strip.Color(0, 0, 0));
-    }
-    strip.show();
-    delay(1000);
+}
+
+// Everything here may block for up to the uplink timeouts
+void uplinkTask(void* param) {
+  for (;;) {
+    uplinkScheduler.tick();
+    vTaskDelay(pdMS_TO_TICKS(10));
   }
 }
 
 void setup() {
   Serial.begin(115200);
   Serial.println("=== HYDROBRAIN STARTING ===");
-  
-  // Wait for power to stabilize - IMPORTANT FOR EXTERNAL POWER
-  delay(5000);
-
-  // *** FIXED: INITIALIZE TFT DISPLAY FIRST ***
-  Serial.println("=== TFT INITIALIZATION START ===");
-  
-  // 1. TFT Backlight FIRST
-  pinMode(TFT_LED, OUTPUT);
-  digitalWrite(TFT_LED, HIGH);
-  Serial.println("TFT Backlight ON");
-  
-  // 2. Initialize SPI BEFORE tft.begin() - THIS WAS MISSING!
-  Serial.println("Initializing SPI for TFT...");
-  SPI.begin(TFT_SCLK, -1, TFT_MOSI, TFT_CS);
-  SPI.setFrequency(4000000); // 4MHz - good balance of speed and stability
-  
-  // 3. Initialize TFT display
-  Serial.println("Initializing TFT display...");
-  tft.begin();
-  tft.setRotation(1); // Landscape mode
-  tft.fillScreen(BACKGROUND_COLOR);
-  
-  // 4. Show startup message on TFT
-  tft.setTextSize(2);
-  tft.setTextColor(TEXT_DARK);
-  tft.setCursor(50, 100);
-  tft.println("HYDROBRAIN");
-  tft.setCursor(85, 120);
-  tft.println("STARTING...");
-  
-  Serial.println("TFT Display initialized successfully!");
-  Serial.println("=== TFT INITIALIZATION COMPLETE ===");
+  networkDataMutex = xSemaphoreCreateMutex();
+  for (size_t i = 0; i < BOOT_STAGE_COUNT; i++) {
+    bootStageMs[i].store(BOOT_NOT_REACHED);
+  }
+  Serial.printf("Reset reason: %s\n", resetReasonName(esp_reset_reason()));
 
-  // Initialize pump relay pin
+  // Pump relay first: whatever reset us, the pump is off until control runs
   pinMode(PUMP_RELAY_PIN, OUTPUT);
   digitalWrite(PUMP_RELAY_PIN, HIGH); // Start with pump OFF (assuming active LOW)
-  Serial.println("Pump relay initialized");
+  lastPumpCycle = millis();
+  pumpEngine.resume(lastPumpCycle, false, lastPumpCycle);  // First cycle one period from now
+  markBootStage(BOOT_PUMP);
 
-  // Connect to WiFi with enhanced retry logic
-  Serial.println("=== WiFi Connection Start ===");
-  Serial.print("Connecting to: ");
-  Serial.println(ssid);
-  
-  // Update TFT with WiFi status
-  tft.fillScreen(BACKGROUND_COLOR);
-  tft.setTextSize(2);
-  tft.setTextColor(TEXT_DARK);
-  tft.setCursor(50, 80);
-  tft.println("HYDROBRAIN");
-  tft.setTextSize(1);
-  tft.setCursor(10, 120);
-  tft.println("Connecting to WiFi...");
-  
-  // Try multiple connection attempts
-  int connectionAttempts = 0;
-  bool wifiConnected = false;
-  
-  while (!wifiConnected && connectionAttempts < 5) {
-    connectionAttempts++;
-    Serial.print("Connection attempt #");
-    Serial.println(connectionAttempts);
-    
-    // Update TFT with attempt number
-    tft.setCursor(10, 140);
-    tft.print("Attempt: ");
-    tft.println(connectionAttempts);
-    
-    WiFi.disconnect();
-    delay(1000);
-    WiFi.mode(WIFI_OFF);
-    delay(1000);
-    WiFi.mode(WIFI_STA);
-    delay(1000);
-    
-    WiFi.begin(ssid, password);
-    
-    // Wait for connection with timeout
-    int wifi_attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && wifi_attempts < 30) {
-      Serial.print(".");
-      delay(500);
-      wifi_attempts++;
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-      wifiConnected = true;
-      Serial.println();
-      Serial.println("=== WiFi CONNECTED! ===");
-      Serial.print("IP Address: ");
-      Serial.println(WiFi.localIP());
-      Serial.print("Signal Strength (RSSI): ");
-      Serial.println(WiFi.RSSI());
-      
-      // Update TFT with success
-      tft.fillScreen(BACKGROUND_COLOR);
-      tft.setTextSize(2);
-      tft.setTextColor(PRIMARY_COLOR);
-      tft.setCursor(10, 60);
-      tft.println("WiFi Connected!");
-      
-      tft.setTextSize(1);
-      tft.setTextColor(TEXT_DARK);
-      tft.setCursor(10, 90);
-      tft.print("IP: ");
-      tft.println(WiFi.localIP());
-      tft.setCursor(10, 110);
-      tft.print("RSSI: ");
-      tft.print(WiFi.RSSI());
-      tft.println(" dBm");
-      
-      break;
-    } else {
-      Serial.println();
-      Serial.print("Attempt ");
-      Serial.print(connectionAttempts);
-      Serial.println(" failed. Retrying...");
-      delay(2000);
-    }
-  }
-  
-  if (wifiConnected) {
-    // Initialize time
-    configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
-    Serial.println("Initializing NTP time sync...");
-    
-    // Setup web server routes
-    server.on("/api/status", HTTP_GET, handleGetStatus);
-    server.on("/api/pump/on", HTTP_POST, handlePumpOn);
-    server.on("/api/pump/off", HTTP_POST, handlePumpOff);
-    server.on("/api/pump/auto", HTTP_POST, handlePumpAuto);
-    server.on("/api/led/growth", HTTP_POST, handleLedGrowth);
-    server.on("/api/led/relax", HTTP_POST, handleLedRelax);
-    server.on("/api/led/sleep", HTTP_POST, handleLedSleep);
-    server.on("/api/led/off", HTTP_POST, handleLedOff);
-    server.onNotFound(handleNotFound);
-    
-    // Handle CORS preflight requests
-    server.on("/api/status", HTTP_OPTIONS, handleOptions);
-    server.on("/api/pump/on", HTTP_OPTIONS, handleOptions);
-    server.on("/api/pump/off", HTTP_OPTIONS, handleOptions);
-    server.on("/api/pump/auto", HTTP_OPTIONS, handleOptions);
-    server.on("/api/led/growth", HTTP_OPTIONS, handleOptions);
-    server.on("/api/led/relax", HTTP_OPTIONS, handleOptions);
-    server.on("/api/led/sleep", HTTP_OPTIONS, handleOptions);
-    server.on("/api/led/off", HTTP_OPTIONS, handleOptions);
-    
-    server.begin();
-    Serial.println("=== WEB SERVER STARTED ===");
-    Serial.println("Local IP Address: " + WiFi.localIP().toString());
-    Serial.println("=== API ENDPOINTS AVAILABLE ===");
-    Serial.println("GET  /api/status       - Get all sensor data and status");
-    Serial.println("POST /api/pump/on      - Turn pump ON manually");
-    Serial.println("POST /api/pump/off     - Turn pump OFF manually");
-    Serial.println("POST /api/pump/auto    - Set pump to AUTO mode");
-    Serial.println("POST /api/led/growth   - Set LED to Growth mode");
-    Serial.println("POST /api/led/relax    - Set LED to Relaxing mode");
-    Serial.println("POST /api/led/sleep    - Set LED to Sleep mode");  
-    Serial.println("POST /api/led/off      - Turn LED OFF");
-    Serial.println("=========================");
-  } else {
-    Serial.println("=== WiFi CONNECTION FAILED AFTER ALL ATTEMPTS! ===");
-    Serial.println("Continuing without WiFi...");
-    
-    // Update TFT with failure
-    tft.fillScreen(BACKGROUND_COLOR);
-    tft.setTextSize(2);
-    tft.setTextColor(ALERT_COLOR);
-    tft.setCursor(10, 90);
-    tft.println("WiFi Failed!");
-    tft.setTextSize(1);
-    tft.setCursor(10, 120);
-    tft.println("Check credentials/power");
-  }
-
-  // Init Sensors
+  // Sensors, then continuous DMA sampling of every analog probe. There is
+  // no settling delay: the big inrush is the radio, which starts last.
   waterTempSensor.begin();
+  waterTempSensor.setWaitForConversion(false); // Conversions are collected by sampleWaterTemp()
   dht.begin();
-  ec.begin();
+  loadCalibrations();
+  loadLightingSettings();
+  buildConversionTables();
+  adcDmaRunning = startAdcDma();
 
-  // Init LED Strip for Plant Growth
-  strip.begin();
-  strip.setBrightness(BRIGHTNESS);
-  
-  if (wifiConnected) {
-    // Show IP address using LED blink pattern
-    showIPAddressOnLED();
-    delay(3000);
+  // Register loop() tasks. HTTP and pump control run every few milliseconds;
+  // the ADC bursts are staggered so they don't sample on the same tick.
+  scheduler.add("pumpCommand", pollPumpCommand, 10);
+  scheduler.add("pump", handlePumpControl, PUMP_IDLE_MS);
+  scheduler.add("waterTemp", sampleWaterTemp, 50);
+  scheduler.add("air", sampleAir, SENSOR_SAMPLE_PERIOD);
+  scheduler.add("level", sampleWaterLevel, SENSOR_SAMPLE_PERIOD, SENSOR_SAMPLE_PERIOD / 2);  // Not on the DHT22's tick
+  scheduler.add("adc", adcDrain, 5);
+  scheduler.add("ec", sampleEC, SENSOR_SAMPLE_PERIOD, 0);
+  scheduler.add("tds", sampleTDS, SENSOR_SAMPLE_PERIOD, 5);
+  scheduler.add("ph", samplePH, SENSOR_SAMPLE_PERIOD, 10);
+  scheduler.add("publish", publishSnapshot, 10);
+  scheduler.add("uploadSample", handOffUploadSample, FIREBASE_UPLOAD_INTERVAL, FIREBASE_UPLOAD_INTERVAL);
+  markBootStage(BOOT_SENSORS);
+
+  // Init LED Strip for Plant Growth: sunrise into the growth spectrum
+  // (warm sunlight). The IP pattern plays over it once WiFi is up.
+  if (!beginLedOutput()) {
+    Serial.println("LED strip output (RMT) failed to start");
   }
-  
-  // Set LED strip to optimal plant growth spectrum (Warm sunlight) - ALWAYS ON
-  Serial.println("Turning on LED strip - Growth Mode");
-  for (int i = 0; i < NUM_LEDS; i++) {
-    strip.setPixelColor(i, strip.Color(255, 180, 80)); // Warm sunlight color
-  }
-  strip.show();
-  ledStatus = true;
-  ledMode = 1; // Growth mode
-  
-  Serial.println("LED Strip initialized and ON - Plant Growth Mode ACTIVE");
+  ledEngine.setBrightness(BRIGHTNESS);
+  applyLedMode(LED_MODE_GROWTH, SUNRISE_STOPS, sizeof(SUNRISE_STOPS) / sizeof(SUNRISE_STOPS[0]), LED_SUNRISE_MS);
 
-  // ADC setup
-  analogReadResolution(12);
-  analogSetAttenuation(ADC_11db);
+  // WiFi: the first attempt starts here, serviceWifi() takes it from
+  // there (retries, NTP, web server, portal)
+  loadWifiCredentials();
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  WiFi.mode(WIFI_STA);
+  wifiLink.begin(wifiCredentials.ssid[0] != '\0', fastConnectValid(wifiCredentials), millis());
+  applyWifiAction(wifiLink.update(false, millis(), esp_random()));
+
+  // Web server: the event source first, then everything under /api goes
+  // through the route table. CORS headers ride on every response. It
+  // only listens while serviceWifi() says so.
+  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
+  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "*");
+  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "*");
+  DefaultHeaders::Instance().addHeader("Access-Control-Max-Age", "86400");
+  events.onConnect(handleEventsConnect);
+  server.addHandler(&events);
+  server.on("/api/*", HTTP_ANY, dispatchApi);
+  for (size_t i = 0; i < WEB_ASSET_COUNT; i++) {
+    const WebAsset& asset = WEB_ASSETS[i];
+    server.on(asset.path, HTTP_GET, [&asset](AsyncWebServerRequest* request) { handleAsset(request, asset); });
+  }
+  server.onNotFound(handleNotFound);
+
+  if (mqttHost[0] != '\0') {
+    unsigned long long chipId = ESP.getEfuseMac();
+    snprintf(mqttClientId, sizeof(mqttClientId), "hydrobrain-%012llx", chipId);
+    snprintf(mqttRoot, sizeof(mqttRoot), "hydrobrain/%012llx", chipId);
+    snprintf(mqttStatusTopic, sizeof(mqttStatusTopic), "%s/status", mqttRoot);
+    mqttClient.setServer(mqttHost, mqttPort);
+    mqttClient.setClientId(mqttClientId);
+    mqttClient.setKeepAlive(MQTT_KEEPALIVE);
+    mqttClient.setWill(mqttStatusTopic, MQTT_STATUS_QOS, true, "offline");
+    if (mqttUser[0] != '\0') {
+      mqttClient.setCredentials(mqttUser, mqttPassword);
+    }
+    mqttClient.onConnect(onMqttConnect);
+    mqttClient.onDisconnect(onMqttDisconnect);
+    mqttClient.onMessage(onMqttMessage);
+    Serial.printf("MQTT: %s:%u, topics under %s/\n", mqttHost, mqttPort, mqttRoot);
+  }
+  Serial.println("=== API ENDPOINTS AVAILABLE ===");
+  for (size_t i = 0; i < apiRouter.size(); i++) {
+    const ApiRoute<WebRequestMethod, ApiHandler>& route = apiRouter[i];
+    Serial.printf("%-4s %-26s %s\n", route.method == HTTP_GET ? "GET" : "POST", route.path, route.description);
+  }
+  Serial.println("=========================");
+
+  firebaseTls.setInsecure();  // No CA bundle configured for the database host
+  firebaseHttp.setReuse(true);
+
+  networkScheduler.add("wifi", serviceWifi, WIFI_SERVICE_PERIOD);
+  networkScheduler.add("events", publishEvents, EVENTS_PERIOD);
+  networkScheduler.add("pumpAudit", drainPumpAudit, PUMP_AUDIT_PERIOD);
+  networkScheduler.add("led", serviceLeds, LED_FRAME_PERIOD);
+  networkScheduler.add("lighting", serviceLighting, LIGHTING_IDLE_MS);
+  networkScheduler.add("calibration", applyCalibrationChanges, SENSOR_SAMPLE_PERIOD);
+  networkScheduler.add("history", recordHistory, HISTORY_SAMPLE_PERIOD, HISTORY_SAMPLE_PERIOD);
+  networkScheduler.add("log", recordLog, LOG_INTERVAL, LOG_INTERVAL);
+  networkScheduler.add("logFlush", flushLog, LOG_FLUSH_INTERVAL, LOG_FLUSH_INTERVAL);
+  networkScheduler.add("report", printSensorReport, SENSOR_SAMPLE_PERIOD, SENSOR_SAMPLE_PERIOD);
+  networkScheduler.add("display", refreshTFTDisplay, TFT_FRAME_INTERVAL, SENSOR_SAMPLE_PERIOD);
+  if (mqttHost[0] != '\0') {
+    networkScheduler.add("mqttStage", stageMqttState, MQTT_STAGE_PERIOD);
+    networkScheduler.add("mqtt", serviceMqtt, MQTT_SEND_PERIOD);
+  }
+  uplinkScheduler.add("drain", drainUploadSamples, UPLOAD_DRAIN_PERIOD);
+  uplinkScheduler.add("upload", serviceUploads, UPLOAD_POLL_PERIOD);
+  uplinkScheduler.add("spillFlush", flushUploadSpill, LOG_FLUSH_INTERVAL, LOG_FLUSH_INTERVAL);
+
+  // The display and flash come up on the network core (see networkTask),
+  // so loop() starts sampling as soon as this returns
+  xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, nullptr, 1,
+                          &networkTaskHandle, NETWORK_CORE);
 
-  // Initialize pump timing
-  lastPumpCycle = millis();
-  
-  // Show sensor initialization on TFT
-  delay(3000); // Show WiFi status for 3 seconds
-  tft.fillScreen(BACKGROUND_COLOR);
-  tft.setTextSize(2);
-  tft.setTextColor(TEXT_DARK);
-  tft.setCursor(50, 80);
-  tft.println("HYDROBRAIN");
-  tft.setTextSize(1);
-  tft.setCursor(10, 120);
-  tft.println("Initializing sensors...");
-  
-  delay(2000); // Show initialization message
-  
-  // Initial display update
-  updateTFTDisplay();
-  Serial.println("Initial TFT Display updated");
   Serial.println("=== HYDROBRAIN STARTUP COMPLETE ===");
 }
 
 void loop() {
-  // Handle web server requests
-  server.handleClient();
-  
-  // Handle pump control
-  handlePumpControl();
-  
-  // --- Water Temp
-  waterTempSensor.requestTemperatures();
-  waterTemp = waterTempSensor.getTempCByIndex(0);
-  if (waterTemp == DEVICE_DISCONNECTED_C) {
-    Serial.println("Failed to read water temp");
-    waterTemp = 25.0;
-  } else {
-    Serial.print("Water Temp: ");
-    Serial.print(waterTemp, 1);
-    Serial.println(" °C");
-  }
+  scheduler.tick();
+}
 
-  // --- DHT22 (Air Temperature & Humidity)
-  airTemp = dht.readTemperature();
-  humidity = dht.readHumidity();
-  
-  if (isnan(airTemp) || isnan(humidity)) {
-    Serial.println("Failed to read from DHT22 sensor!");
-  } else {
-    Serial.print("Air Temp: ");
-    Serial.print(airTemp, 1);
-    Serial.println(" °C");
-    Serial.print("Humidity: ");
-    Serial.print(humidity, 1);
-    Serial.println(" %");
+// Render columns [left, left + cols) of a w x h screen rectangle off-screen
+// and push them. draw paints the whole rectangle in local coordinates; it
+// is called once per strip, alternating between the two canvases.
+// pushImageDMA() waits for the transfer before it, so the canvas drawn
+// next (the one that transfer came from) is always free again.
+template <typename Draw>
+void pushColumns(int16_t x, int16_t y, int16_t w, int16_t h, int16_t left, int16_t cols, Draw draw) {
+  if (!tftFrame.open) {
+    tft.startWrite();
+    tftFrame.open = true;
   }
-
-  // --- EC Sensor
-  int ec_raw = 0;
-  for (int i = 0; i < 10; i++) {
-    ec_raw += analogRead(EC_PIN);
-    delay(10);
+  int16_t rows = tftCanvas[0].rowsFor(cols);
+  for (int16_t top = 0; top < h; top += rows) {
+    int16_t count = min(rows, (int16_t)(h - top));
+    RegionCanvas& canvas = tftCanvas[tftCanvasNext];
+    tftCanvasNext ^= 1;
+    uint32_t start = micros();
+    canvas.beginWindow(w, h, left, top, cols, count);
+    draw(canvas);
+    tftFrame.renderUs += micros() - start;
+    tft.pushImageDMA(x + left, y + top, cols, count, canvas.buffer());
+    tftFrame.bytes += TFT_WINDOW_BYTES + (uint32_t)cols * count * 2;
   }
-  ec_raw /= 10;
-  ecVoltage = ec_raw * (3.3 / 4095.0);
+}
+
+template <typename Draw>
+void pushRegion(int16_t x, int16_t y, int16_t w, int16_t h, Draw draw) {
+  pushColumns(x, y, w, h, 0, w, draw);
+}
 
-  // Try library method first
-  if (!ecCalibrated && ecVoltage > 0.5 && ecVoltage < 2.5 && waterTemp > 5 && waterTemp < 45) {
-    ec.calibration(ecVoltage, waterTemp);
-    Serial.println("EC sensor calibrated");
-    ecCalibrated = true;
+// Store text as a widget's content; true if the widget must be repainted
+bool widgetChanged(char* shown, const char* text) {
+  if (strncmp(shown, text, TFT_WIDGET_TEXT - 1) == 0) {
+    return false;
   }
+  strncpy(shown, text, TFT_WIDGET_TEXT - 1);
+  shown[TFT_WIDGET_TEXT - 1] = '\0';
+  return true;
+}
 
-  float libraryEC = ec.readEC(ecVoltage, waterTemp);
-  float manualEC = calculateECManual(ecVoltage, waterTemp);
+void updateTFTDisplay() {
+  SensorSnapshot snap = sensorSnapshot.read();
+  tftFrame.startUs = micros();
+  tftFrame.bytes = 0;
+  tftFrame.renderUs = 0;
 
-  // Use manual calculation if library gives unrealistic reading
-  if (libraryEC < 10.0 && ecVoltage > 0.1) {
-    ecValue = manualEC;
-  } else {
-    ecValue = libraryEC;
-  }
-
-  Serial.print("EC: ");
-  Serial.print(ecValue, 2);
-  Serial.println(" µS/cm");
-
-  // --- TDS Sensor
-  int adc_raw = 0;
-  for (int i = 0; i < 10; i++) {
-    adc_raw += analogRead(TDS_PIN);
-    delay(10);
-  }
-  adc_raw /= 10;
-  float adc_voltage = adc_raw * (3.3 / 4095.0);
-  float compensation_coefficient = 1.0 + 0.02 * (waterTemp - 25.0);
-  float compensated_voltage = adc_voltage / compensation_coefficient;
-  tds_value = (133.42 * pow(compensated_voltage, 3)) 
-            - (255.86 * pow(compensated_voltage, 2)) 
-            + (857.39 * compensated_voltage);
-  tds_value *= 124.0 / 165.0;
-
-  Serial.print("TDS: ");
-  Serial.print(tds_value, 1);
-  Serial.println(" ppm");
-
-  // --- pH Sensor with detailed diagnostics
-  int ph_raw = 0;
-  for (int i = 0; i < 10; i++) {
-    ph_raw += analogRead(PH_PIN);
-    delay(10);
-  }
-  ph_raw /= 10;
-  float ph_voltage = ph_raw * (3.3 / 4095.0);
-  
-  // Check sensor status
-  if (ph_raw == 0) {
-    Serial.print("ERROR: No signal - check wiring/power! | ");
-    phValue = 0.0;
-  } else if (ph_raw >= 4090) {
-    Serial.print("ERROR: Sensor saturated (3.3V max)! | ");
-    phValue = 0.0;
-  } else if (ph_voltage < 0.1) {
-    Serial.print("WARNING: Very low voltage! | ");
-    phValue = 0.0;
-  } else {
-    // Calibration based on your actual readings
-    // 1.810V = pH 4.0 (your measurement)
-    // Assuming typical pH sensor: ~0.059V per pH unit (theoretical)
-    // and neutral point around 2.5V = pH 7.0
-    
-    float voltage_ph4 = 1.810;  // Your measured voltage at pH 4.0
-    float voltage_ph7 = 1.326;    // Estimated voltage at pH 7.0 (typical)
-    
-    // Calculate slope: (pH2 - pH1) / (V2 - V1)
-    float slope = (7.0 - 4.0) / (voltage_ph7 - voltage_ph4);
-    
-    // Calculate pH: pH4 + slope * (current_voltage - voltage_at_pH4)
-    phValue = 4.0 + slope * (ph_voltage - voltage_ph4);
-  }
-
-  Serial.print("pH: ");
-  Serial.println(phValue, 2);
-
-  // Print pump status
-  Serial.print("Pump Status: ");
-  Serial.print(pumpRunning ? "RUNNING" : "STOPPED");
-  if (autoPumpEnabled && !manualPumpOverride) {
-    Serial.print(" (AUTO MODE)");
-    if (pumpRunning) {
-      unsigned long remaining = PUMP_RUN_DURATION - (millis() - pumpStartTime);
-      Serial.print(" - ");
-      Serial.print(remaining / 60000);
-      Serial.print("min remaining");
-    } else {
-      unsigned long nextCycle = PUMP_CYCLE_INTERVAL - (millis() - lastPumpCycle);
-      Serial.print(" - Next cycle in ");
-      Serial.print(nextCycle / 60000);
-      Serial.print("min");
+  // Static parts once; every widget is then repainted on top
+  if (!tftLayoutDrawn) {
+    pushRegion(0, 0, tft.width(), tft.height(), drawLayout);
+    memset(cardShown, 0, sizeof(cardShown));
+    waterLevelShown[0] = ledIndicatorShown[0] = pumpIndicatorShown[0] = footerShown[0] = clockShown[0] = '\0';
+    waterFillShown = -1;
+    for (size_t card = 0; card < CARD_COUNT; card++) {
+      sparkStale[card] = true;
     }
-  } else if (manualPumpOverride) {
-    Serial.print(" (MANUAL MODE)");
+    tftLayoutDrawn = true;
   }
-  Serial.println();
 
-  Serial.println("------------------------");
-  
-  // Send data to Firebase every 2 minutes
-  static unsigned long lastFirebaseUpdate = 0;
-  if (millis() - lastFirebaseUpdate > 120000) { // 120000ms = 2 minutes
-    sendToFirebase();
-    lastFirebaseUpdate = millis();
+  char value[TFT_WIDGET_TEXT];
+  snprintf(value, sizeof(value), "%.1fC", snap.airTemp);
+  drawSensorCard(CARD_AIR_TEMP, value);
+  snprintf(value, sizeof(value), "%.1f%%", snap.humidity);
+  drawSensorCard(CARD_HUMIDITY, value);
+  snprintf(value, sizeof(value), "%.0fppm", snap.tds);
+  drawSensorCard(CARD_TDS, value);
+  snprintf(value, sizeof(value), "%.0fuS", snap.ec);
+  drawSensorCard(CARD_EC, value);
+  snprintf(value, sizeof(value), "%.1f", snap.ph);
+  drawSensorCard(CARD_PH, value);
+  snprintf(value, sizeof(value), "%.1fC", snap.waterTemp);
+  drawSensorCard(CARD_WATER_TEMP, value);
+  for (size_t card = 0; card < CARD_COUNT; card++) {
+    drawSparkline((TftCard)card);
   }
-  
-  // Update TFT Display every 5 minutes (after first immediate update)
-  static unsigned long lastTFTUpdate = 0;
-  static bool firstUpdate = true;
-  
-  if (firstUpdate || millis() - lastTFTUpdate > 300000) { // First update immediately, then every 5 minutes
-    updateTFTDisplay();
-    lastTFTUpdate = millis();
-    firstUpdate = false;
-    Serial.println("TFT Display updated");
+
+  drawWaterLevelBar(snap.waterLevel);
+  drawSystemStatus(snap);
+  drawClock();
+  drawFooter();
+
+  if (!tftFrame.open) {
+    return;
   }
-  
-  delay(2000);
+  tft.dmaWait();
+  tft.endWrite();
+  tftFrame.open = false;
+  tftFrames++;
+  tftFrameBytes = tftFrame.bytes;
+  tftFrameUs = micros() - tftFrame.startUs;
+  tftRenderUs = tftFrame.renderUs;
+  tftFrameMaxUs = max(tftFrameMaxUs, tftFrameUs);
+  tftBytesTotal += tftFrame.bytes;
 }
 
-void updateTFTDisplay() {
-  // Clear screen
-  tft.fillScreen(BACKGROUND_COLOR);
-  
-  // Draw header
-  drawHeader();
-  
-  // Draw sensor cards in a grid layout
-  drawSensorCard(5, 45, 100, 50, "AIR TEMP", String(airTemp, 1) + "C");
-  drawSensorCard(110, 45, 100, 50, "HUMIDITY", String(humidity, 1) + "%");
-  drawSensorCard(215, 45, 100, 50, "TDS", String(tds_value, 0) + "ppm");
-  
-  drawSensorCard(5, 100, 100, 50, "EC", String(ecValue, 0) + "uS");
-  drawSensorCard(110, 100, 100, 50, "pH", String(phValue, 1));
-  drawSensorCard(215, 100, 100, 50, "H2O TEMP", String(waterTemp, 1) + "C");
-  
-  // Draw water level bar
-  drawWaterLevelBar();
-  
-  // Draw system status
-  drawSystemStatus();
-  
-  // Draw footer with time
-  drawFooter();
+// Everything that never changes: header, card frames and titles, the
+// water level frame, plant info and the footer band
+void drawLayout(Adafruit_GFX& gfx) {
+  gfx.fillScreen(BACKGROUND_COLOR);
+  drawHeader(gfx);
+
+  gfx.setTextSize(1);
+  gfx.setTextColor(DARK_GRAY);
+  for (size_t i = 0; i < CARD_COUNT; i++) {
+    const CardLayout& card = CARD_LAYOUT[i];
+    gfx.fillRoundRect(card.x, card.y, CARD_WIDTH, CARD_HEIGHT, 4, CARD_BG_COLOR);
+    gfx.drawRoundRect(card.x, card.y, CARD_WIDTH, CARD_HEIGHT, 4, PRIMARY_COLOR);
+    gfx.setCursor(card.x + 8, card.y + 8);
+    gfx.print(card.title);
+  }
+
+  gfx.drawRoundRect(10, 160, 300, 20, 3, PRIMARY_COLOR);
+
+  // Plant info
+  gfx.setTextColor(TEXT_DARK);
+  gfx.setCursor(170, 195);
+  gfx.print("GROWTH MODE");
+  gfx.setCursor(170, 205);
+  gfx.print("SPECTRUM ACTIVE");
+
+  // Footer band and version
+  gfx.fillRect(0, 220, 320, 20, DARK_GRAY);
+  gfx.setTextColor(TEXT_LIGHT);
+  gfx.setCursor(200, 226);
+  gfx.print("v2.0.0");
 }
 
-void drawHeader() {
+void drawHeader(Adafruit_GFX& gfx) {
   // Header background
-  tft.fillRect(0, 0, 320, 40, HEADER_COLOR);
+  gfx.fillRect(0, 0, 320, 40, HEADER_COLOR);
   
   // Title
-  tft.setTextColor(TEXT_LIGHT);
-  tft.setTextSize(2);
-  tft.setCursor(85, 12);
-  tft.print("HYDROBRAIN");
+  gfx.setTextColor(TEXT_LIGHT);
+  gfx.setTextSize(2);
+  gfx.setCursor(85, 12);
+  gfx.print("HYDROBRAIN");
   
   // Status indicator
-  tft.fillCircle(25, 20, 6, ON_COLOR);
-  tft.setTextSize(1);
-  tft.setCursor(35, 16);
-  tft.print("ONLINE");
+  gfx.fillCircle(25, 20, 6, ON_COLOR);
+  gfx.setTextSize(1);
+  gfx.setCursor(35, 16);
+  gfx.print("ONLINE");
 }
 
-void drawSensorCard(int x, int y, int w, int h, String title, String value) {
-  // Card background
-  tft.fillRoundRect(x, y, w, h, 4, CARD_BG_COLOR);
-  tft.drawRoundRect(x, y, w, h, 4, PRIMARY_COLOR);
-  
-  // Title
-  tft.setTextColor(DARK_GRAY);
-  tft.setTextSize(1);
-  tft.setCursor(x + 8, y + 8);
-  tft.print(title);
-  
-  // Value
-  tft.setTextColor(TEXT_DARK);
-  tft.setTextSize(1);
-  
-  // Center the value
-  int valueWidth = value.length() * 6;
-  int valueX = x + (w - valueWidth) / 2;
-  tft.setCursor(valueX, y + 28);
-  tft.print(value);
-}
-
-void drawWaterLevelBar() {
-  int barX = 10;
-  int barY = 160;
-  int barWidth = 300;
-  int barHeight = 20;
-  
-  // Background
-  tft.fillRoundRect(barX, barY, barWidth, barHeight, 3, CARD_BG_COLOR);
-  tft.drawRoundRect(barX, barY, barWidth, barHeight, 3, PRIMARY_COLOR);
-  
-  // Fill based on water level
-  int fillWidth = (waterLevel * (barWidth - 4)) / 100;
-  uint16_t fillColor = HIGHLIGHT_COLOR; // Always use the same green color
-  
-  tft.fillRect(barX + 2, barY + 2, fillWidth, barHeight - 4, fillColor);
-  
-  // Label
-  tft.setTextColor(TEXT_DARK);
-  tft.setTextSize(1);
-  tft.setCursor(barX + 5, barY + 6);
-  tft.print("WATER LEVEL: ");
-  tft.print(waterLevel);
-  tft.print("%");
-}
-
-void drawSystemStatus() {
-  // LED Status
-  int ledX = 10;
-  int ledY = 190;
-  drawStatusIndicator(ledX, ledY, 70, 25, "LED", ledStatus, getLedModeText());
-  
-  // Pump Status
-  int pumpX = 90;
-  int pumpY = 190;
-  String pumpText = pumpRunning ? "ACTIVE" : "IDLE";
-  if (autoPumpEnabled && !manualPumpOverride) {
-    pumpText += " AUTO";
-  } else if (manualPumpOverride) {
-    pumpText += " MAN";
-  }
-  drawStatusIndicator(pumpX, pumpY, 70, 25, "PUMP", pumpRunning, pumpText);
-  
-  // Plant info
-  tft.setTextColor(TEXT_DARK);
-  tft.setTextSize(1);
-  tft.setCursor(170, 195);
-  tft.print("GROWTH MODE");
-  tft.setCursor(170, 205);
-  tft.print("SPECTRUM ACTIVE");
-}
-
-void drawStatusIndicator(int x, int y, int w, int h, String label, bool status, String statusText) {
-  // Background
-  uint16_t bgColor = status ? ON_COLOR : OFF_COLOR;
-  tft.fillRoundRect(x, y, w, h, 3, bgColor);
-  tft.drawRoundRect(x, y, w, h, 3, PRIMARY_COLOR);
-  
-  // Label
-  tft.setTextColor(TEXT_DARK);
-  tft.setTextSize(1);
-  tft.setCursor(x + 3, y + 3);
-  tft.print(label);
-  
-  // Status
-  tft.setCursor(x + 3, y + 13);
-  tft.print(statusText);
+// The value line of a card (the frame and title are in the layout)
+void drawSensorCard(TftCard card, const char* value) {
+  if (!widgetChanged(cardShown[card], value)) {
+    return;
+  }
+  const CardLayout& layout = CARD_LAYOUT[card];
+  int16_t valueX = (CARD_WIDTH - 4 - (int16_t)strlen(value) * 6) / 2;
+  pushRegion(layout.x + 2, layout.y + 18, CARD_WIDTH - 4, 12, [&](Adafruit_GFX& gfx) {
+    gfx.fillScreen(CARD_BG_COLOR);
+    gfx.setTextColor(TEXT_DARK);
+    gfx.setTextSize(1);
+    gfx.setCursor(valueX, 2);
+    gfx.print(value);
+  });
+}
+
+// A card's trend line, below its value. Only the columns a new sample
+// touched are pushed (one window, two when the sweep wraps); a rescale or
+// a backlog repaints the plot.
+void drawSparkline(TftCard card) {
+  Sparkline<SPARK_COLUMNS, SPARK_COLUMN_SAMPLES>& spark = sparklines[card];
+  uint32_t fresh = spark.written() - sparkDrawn[card];
+  if (!sparkStale[card] && fresh == 0) {
+    return;
+  }
+  HistoryMetric metric = CARD_METRICS[card];
+  int16_t minSpan = (int16_t)(SPARK_MIN_SPAN * SENSOR_DEADBANDS[metric].absolute * HISTORY_METRICS[metric].scale);
+  bool full = spark.fit(minSpan) || sparkStale[card] || fresh >= SPARK_COLUMNS / 2;
+  sparkDrawn[card] = spark.written();
+  sparkStale[card] = false;
+
+  size_t gap = spark.cursor();
+  auto draw = [&](Adafruit_GFX& gfx) {
+    gfx.fillScreen(CARD_BG_COLOR);
+    for (size_t column = 0; column < SPARK_COLUMNS; column++) {
+      size_t previous = (column + SPARK_COLUMNS - 1) % SPARK_COLUMNS;
+      int16_t value = spark.at(column);
+      if (column == gap || value == HISTORY_NO_DATA) {
+        continue;
+      }
+      int16_t row = spark.row(value, SPARK_ROWS);
+      int16_t from = row;
+      if (previous != gap && spark.at(previous) != HISTORY_NO_DATA) {
+        from = spark.row(spark.at(previous), SPARK_ROWS);
+      }
+      gfx.drawFastVLine(column, min(row, from), abs(row - from) + 1, PRIMARY_COLOR);
+    }
+  };
+
+  const CardLayout& layout = CARD_LAYOUT[card];
+  int16_t x = layout.x + 4;
+  int16_t y = layout.y + 32;
+  if (full) {
+    pushRegion(x, y, SPARK_COLUMNS, SPARK_ROWS, draw);
+    return;
+  }
+  // The new columns, the gap, and the oldest column (its lead-in is gone)
+  size_t first = (gap + SPARK_COLUMNS - fresh) % SPARK_COLUMNS;
+  size_t count = fresh + 2;
+  size_t head = min(count, SPARK_COLUMNS - first);
+  pushColumns(x, y, SPARK_COLUMNS, SPARK_ROWS, first, head, draw);
+  if (count > head) {
+    pushColumns(x, y, SPARK_COLUMNS, SPARK_ROWS, 0, count - head, draw);
+  }
+}
+
+// Inside of the water level frame: the fill and its label. The fill eases
+// towards the reading over a few frames and the label counts along with
+// it; each frame repaints only the columns the fill crossed (plus the
+// label when its text changed).
+void drawWaterLevelBar(long waterLevel) {
+  int16_t target = (constrain(waterLevel, 0L, 100L) * WATER_BAR_WIDTH) / 100;
+  int16_t from = waterFillShown;
+  int16_t fill = target;
+  if (from >= 0 && from != target) {
+    int16_t step = (target - from) / WATER_BAR_EASE;
+    fill = from + (step != 0 ? step : (target > from ? 1 : -1));
+  }
+
+  char label[TFT_WIDGET_TEXT];
+  snprintf(label, sizeof(label), "WATER LEVEL: %d%%", (fill * 100 + WATER_BAR_WIDTH / 2) / WATER_BAR_WIDTH);
+  int16_t labelWidth = 6 * (int16_t)max(strlen(waterLevelShown), strlen(label));
+  bool labelChanged = widgetChanged(waterLevelShown, label);
+  if (!labelChanged && fill == from) {
+    return;
+  }
+  waterFillShown = fill;
+
+  int16_t left = 0;
+  int16_t right = WATER_BAR_WIDTH;
+  if (from >= 0) {
+    left = min(from, fill);
+    right = max(from, fill);
+    if (labelChanged) {
+      left = min(left, (int16_t)3);
+      right = max(right, (int16_t)(3 + labelWidth));
+    }
+  }
+  pushColumns(12, 162, WATER_BAR_WIDTH, 16, left, right - left, [&](Adafruit_GFX& gfx) {
+    gfx.fillScreen(CARD_BG_COLOR);
+    gfx.fillRect(0, 0, fill, 16, HIGHLIGHT_COLOR);
+    gfx.setTextColor(TEXT_DARK);
+    gfx.setTextSize(1);
+    gfx.setCursor(3, 4);
+    gfx.print(label);
+  });
+}
+
+void drawSystemStatus(const SensorSnapshot& snap) {
+  drawStatusIndicator(10, 190, ledIndicatorShown, "LED", ledStatus, getLedModeText());
+
+  char pumpText[TFT_WIDGET_TEXT];
+  snprintf(pumpText, sizeof(pumpText), "%s%s", snap.pumpRunning ? "ACTIVE" : "IDLE",
+           snap.manualPumpOverride ? " MAN" : (snap.autoPumpEnabled ? " AUTO" : ""));
+  drawStatusIndicator(90, 190, pumpIndicatorShown, "PUMP", snap.pumpRunning, pumpText);
+}
+
+void drawStatusIndicator(int16_t x, int16_t y, char* shown, const char* label, bool status, const char* statusText) {
+  char key[TFT_WIDGET_TEXT];
+  snprintf(key, sizeof(key), "%c%s", status ? '1' : '0', statusText);
+  if (!widgetChanged(shown, key)) {
+    return;
+  }
+  pushRegion(x, y, 70, 25, [&](Adafruit_GFX& gfx) {
+    gfx.fillScreen(BACKGROUND_COLOR);
+    gfx.fillRoundRect(0, 0, 70, 25, 3, status ? ON_COLOR : OFF_COLOR);
+    gfx.drawRoundRect(0, 0, 70, 25, 3, PRIMARY_COLOR);
+    gfx.setTextColor(TEXT_DARK);
+    gfx.setTextSize(1);
+    gfx.setCursor(3, 3);
+    gfx.print(label);
+    gfx.setCursor(3, 13);
+    gfx.print(statusText);
+  });
+}
+
+// Wall-clock time, right of the header title
+void drawClock() {
+  char text[TFT_WIDGET_TEXT];
+  time_t now = wallClockSeconds();
+  struct tm timeinfo;
+  if (now == 0 || !localtime_r(&now, &timeinfo)) {
+    snprintf(text, sizeof(text), "--:--:--");
+  } else {
+    strftime(text, sizeof(text), "%H:%M:%S", &timeinfo);
+  }
+  if (!widgetChanged(clockShown, text)) {
+    return;
+  }
+  pushRegion(262, 16, 48, 8, [&](Adafruit_GFX& gfx) {
+    gfx.fillScreen(HEADER_COLOR);
+    gfx.setTextColor(TEXT_LIGHT);
+    gfx.setTextSize(1);
+    gfx.setCursor(0, 0);
+    gfx.print(text);
+  });
 }
 
+// Uptime, inside the footer band
 void drawFooter() {
-  // Footer background
-  tft.fillRect(0, 220, 320, 20, DARK_GRAY);
-  
-  // System info
-  tft.setTextColor(TEXT_LIGHT);
-  tft.setTextSize(1);
-  tft.setCursor(5, 226);
-  tft.print("UPTIME: ");
-  tft.print(millis() / 60000);
-  tft.print("min");
-  
-  // Version
-  tft.setCursor(200, 226);
-  tft.print("v2.0.0");
+  char text[TFT_WIDGET_TEXT];
+  snprintf(text, sizeof(text), "UPTIME: %lumin", millis() / 60000);
+  if (!widgetChanged(footerShown, text)) {
+    return;
+  }
+  pushRegion(5, 224, 150, 12, [&](Adafruit_GFX& gfx) {
+    gfx.fillScreen(DARK_GRAY);
+    gfx.setTextColor(TEXT_LIGHT);
+    gfx.setTextSize(1);
+    gfx.setCursor(0, 2);
+    gfx.print(text);
+  });
 }
 
-String getLedModeText() {
+const char* getLedModeText() {
   switch (ledMode) {
     case 1: return "GROWTH";
     case 2: return "RELAX";
@@ -1043,56 +3396,232 @@ String getLedModeText() {
   }
 }
 
-void sendToFirebase() {
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("WiFi not connected, skipping Firebase upload");
+void uploadTimestamp(uint32_t time, char* timestamp, size_t length) {
+  struct tm timeinfo;
+  time_t at = time;
+  if (time != 0 && localtime_r(&at, &timeinfo)) {
+    strftime(timestamp, length, "%Y-%m-%d %H:%M:%S", &timeinfo);
+  } else {
+    snprintf(timestamp, length, "Time sync failed");
+  }
+}
+
+float uploadValue(const UploadSample& sample, HistoryMetric metric) {
+  int16_t value = sample.values[metric];
+  return value == HISTORY_NO_DATA ? NAN : value / HISTORY_METRICS[metric].scale;
+}
+
+// Upload record, shared by the Firebase (JSON) and collector encodings
+template <typename Encoder>
+void encodeUpload(Encoder& out, const UploadSample& sample) {
+  char timestamp[30];
+  uploadTimestamp(sample.time, timestamp, sizeof(timestamp));
+  int16_t flags = sample.values[UPLOAD_FLAGS];
+  uint32_t fields = (uint16_t)sample.values[UPLOAD_FIELDS];
+  if (fields == 0) {
+    fields = uploadReporter.allFields();
+  }
+
+  out.beginObject();
+  if (reported(fields, HIST_EC)) out.field("ec", uploadValue(sample, HIST_EC));
+  if (reported(fields, HIST_HUMIDITY)) out.field("humidity", uploadValue(sample, HIST_HUMIDITY));
+  if (reported(fields, HIST_PH)) out.field("pH", uploadValue(sample, HIST_PH));
+  if (reported(fields, HIST_TDS)) out.field("tds", uploadValue(sample, HIST_TDS));
+  if (reported(fields, HIST_AIR_TEMP)) out.field("airtemp", uploadValue(sample, HIST_AIR_TEMP));
+  if (reported(fields, HIST_WATER_LEVEL)) out.field("waterLevel", (int32_t)sample.values[HIST_WATER_LEVEL]);
+  if (reported(fields, HIST_WATER_TEMP)) out.field("waterTemp", uploadValue(sample, HIST_WATER_TEMP));
+  if (reported(fields, REPORT_PUMP_RUNNING)) out.field("pumpStatus", (flags & UPLOAD_PUMP_RUNNING) != 0);
+  if (reported(fields, REPORT_AUTO_MODE)) out.field("pumpMode", (flags & UPLOAD_AUTO_MODE) ? "AUTO" : "MANUAL");
+  if (reported(fields, REPORT_LED_ON)) out.field("ledStatus", (flags & UPLOAD_LED_ON) != 0);
+  out.field("timestamp", timestamp);
+  out.endObject();
+}
+
+void takeUploadSample(UploadSample& sample) {
+  SensorSnapshot snap = sensorSnapshot.read();
+  sample.time = wallClockSeconds();
+  sample.uptime = uptimeSeconds();
+  toHistoryValues(snap, sample.values);
+  sample.values[UPLOAD_FLAGS] = (snap.pumpRunning ? UPLOAD_PUMP_RUNNING : 0)
+                              | (snap.autoPumpEnabled ? UPLOAD_AUTO_MODE : 0)
+                              | (ledStatus ? UPLOAD_LED_ON : 0);
+  sample.values[UPLOAD_FIELDS] = 0;
+}
+
+// A sample's ReportField values, in real units
+void uploadReportValues(const UploadSample& sample, float* values) {
+  for (size_t i = 0; i < HIST_COUNT; i++) {
+    values[i] = uploadValue(sample, (HistoryMetric)i);
+  }
+  int16_t flags = sample.values[UPLOAD_FLAGS];
+  values[REPORT_PUMP_RUNNING] = (flags & UPLOAD_PUMP_RUNNING) ? 1 : 0;
+  values[REPORT_AUTO_MODE] = (flags & UPLOAD_AUTO_MODE) ? 1 : 0;
+  values[REPORT_LED_ON] = (flags & UPLOAD_LED_ON) ? 1 : 0;
+}
+
+// Fill in the Unix time of a sample taken before the clock was set
+bool resolveSampleTime(UploadSample& sample) {
+  if (sample.time == 0) {
+    if (!wallClock.valid()) {
+      return false;
+    }
+    sample.time = wallClockSeconds() - (uptimeSeconds() - sample.uptime);
+  }
+  return true;
+}
+
+// Control-loop task: hand a sample to uplinkTask. Never waits; if the
+// uplink has fallen that far behind, the sample is dropped and counted.
+void handOffUploadSample() {
+  UploadSample sample;
+  takeUploadSample(sample);
+  if (!uploadHandoff.push(sample)) {
+    uploadHandoffDropped++;
+  }
+}
+
+// Uplink task: pass handed-off samples through the upload reporter, and
+// what it lets through into the upload queue (a full queue spills its
+// oldest to flash) and on to the collector, if there is one
+void drainUploadSamples() {
+  UploadSample sample;
+  while (uploadHandoff.pop(sample)) {
+    float values[REPORT_FIELD_COUNT];
+    uploadReportValues(sample, values);
+    uint32_t fields = uploadReporter.offer(values, sample.uptime * 1000);
+    if (fields == 0) {
+      continue;
+    }
+    sample.values[UPLOAD_FIELDS] = (int16_t)fields;
+    uploadQueue.push(sample, [](UploadSample& oldest) {
+      if (resolveSampleTime(oldest) && uploadSpill.append(oldest.time, oldest.values)) {
+        uploadSpillPending = true;
+      } else {
+        uploadDropped++;
+      }
+    });
+    if (collectorUrl[0] != '\0') {
+      sendToCollector(sample);
+    }
+  }
+}
+
+void flushUploadSpill() {
+  uploadSpill.flush();
+}
+
+// Add a sample to a /sensor_data batch under its key. Returns false if
+// it doesn't fit.
+bool addUploadRecord(UploadBatch& batch, const UploadSample& sample) {
+  char key[UPLOAD_KEY_BYTES];
+  uploadKey(sample.time, ESP.getEfuseMac(), key);
+  return batch.add(key, [&](JsonEncoder& record) { encodeUpload(record, sample); });
+}
+
+// PATCH a batch into /sensor_data. HTTPClient keeps the connection open
+// after end() when the server allows it; print=silent skips the echo.
+int patchFirebase(uint8_t* body, size_t length) {
+  char url[160];
+  snprintf(url, sizeof(url), "%s/sensor_data.json?print=silent", firebaseHost);
+  bool tls = strncmp(firebaseHost, "https://", 8) == 0;
+  WiFiClient& client = tls ? (WiFiClient&)firebaseTls : firebasePlain;
+
+  firebaseHttp.setConnectTimeout(UPLINK_CONNECT_TIMEOUT);
+  firebaseHttp.setTimeout(UPLINK_IO_TIMEOUT);
+  if (!firebaseHttp.begin(client, url)) {
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  firebaseHttp.addHeader("Content-Type", JsonEncoder::contentType());
+  int code = firebaseHttp.sendRequest("PATCH", body, length);
+  firebaseHttp.end();
+  if (code < 0) {
+    client.stop();  // Reconnect from scratch next time
+  }
+  return code;
+}
+
+// Uplink task: send the next batch once one is due. Spilled samples
+// (the oldest) go first, then the RAM queue.
+void serviceUploads() {
+  if ((int32_t)(millis() - nextUploadAttempt) < 0 || WiFi.status() != WL_CONNECTED) {
+    return;
+  }
+  bool fromSpill = uploadSpillPending;
+  if (!fromSpill && (uploadQueue.empty() || (uploadQueue.size() < UPLOAD_BATCH_RECORDS
+      && uptimeSeconds() - uploadQueue.at(0).uptime < UPLOAD_BATCH_AGE))) {
     return;
   }
 
-  HTTPClient http;
-  String url = String(firebaseHost) + "/sensor_data.json";
-  
-  http.begin(url);
-  http.addHeader("Content-Type", "application/json");
-  
-  // Create JSON payload (using JsonDocument instead of deprecated DynamicJsonDocument)
-  JsonDocument doc;
-  doc["ec"] = ecValue;
-  doc["humidity"] = humidity;
-  doc["pH"] = phValue;
-  doc["tds"] = tds_value;
-  doc["airtemp"] = airTemp;
-  doc["waterLevel"] = waterLevel;
-  doc["waterTemp"] = waterTemp;
-  doc["pumpStatus"] = pumpRunning;
-  doc["pumpMode"] = autoPumpEnabled ? "AUTO" : "MANUAL";
-  doc["ledStatus"] = ledStatus;
-  
-  // Add timestamp
-  struct tm timeinfo;
-  if (getLocalTime(&timeinfo)) {
-    char timestamp[30];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo);
-    doc["timestamp"] = timestamp;
+  static uint8_t body[UPLOAD_BODY_BYTES];  // Network core only
+  UploadBatch batch(body, sizeof(body));
+  uint32_t lastTime = 0;
+  bool more = false;
+  if (fromSpill) {
+    uploadSpill.scan(uploadSpillCursor, UINT32_MAX, [&](uint32_t at, const int16_t* values, size_t count) {
+      UploadSample sample = {at, 0, {}};
+      memcpy(sample.values, values, min(count, (size_t)UPLOAD_VALUES) * sizeof(int16_t));
+      if (batch.records() == UPLOAD_BATCH_RECORDS || !addUploadRecord(batch, sample)) {
+        more = true;
+        return false;
+      }
+      lastTime = at;
+      return true;
+    });
   } else {
-    doc["timestamp"] = "Time sync failed";
+    // Stops at the first sample still waiting for the clock
+    while (batch.records() < uploadQueue.size() && batch.records() < UPLOAD_BATCH_RECORDS) {
+      UploadSample& sample = uploadQueue.at(batch.records());
+      if (!resolveSampleTime(sample) || !addUploadRecord(batch, sample)) {
+        break;
+      }
+    }
   }
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  Serial.println("Sending to Firebase:");
-  Serial.println(jsonString);
-  
-  int httpResponseCode = http.POST(jsonString);
-  
-  if (httpResponseCode > 0) {
-    String response = http.getString();
-    Serial.println("Firebase Response Code: " + String(httpResponseCode));
-    Serial.println("Firebase Response: " + response);
+  size_t records = batch.records();
+  if (records == 0) {
+    if (fromSpill) {
+      uploadSpillPending = false;  // Nothing left past the cursor
+    }
+    return;
+  }
+  size_t used = batch.finish();
+
+  int code = patchFirebase(body, used);
+  if (code < 200 || code >= 300) {
+    uint32_t delay = uploadBackoff.fail(esp_random());
+    nextUploadAttempt = millis() + delay;
+    Serial.printf("Firebase error %d, retrying in %lus\n", code, (unsigned long)(delay / 1000));
+    return;
+  }
+
+  uploadBackoff.reset();
+  if (fromSpill) {
+    uploadSpillCursor = lastTime + 1;
+    uploadStorage.write("cursor", &uploadSpillCursor, sizeof(uploadSpillCursor));
+    uploadSpillPending = more;
   } else {
-    Serial.println("Firebase Error: " + String(httpResponseCode));
+    uploadQueue.pop(records);
+  }
+  Serial.printf("Firebase: %u samples uploaded (%u bytes)\n", (unsigned)records, (unsigned)used);
+}
+
+// Same record as the Firebase upload, binary-encoded for collectors
+void sendToCollector(const UploadSample& sample) {
+  if (WiFi.status() != WL_CONNECTED) {
+    return;
+  }
+
+  static uint8_t body[UPLOAD_BUFFER_BYTES];  // uplinkTask only
+  CollectorEncoder payload(body, sizeof(body));
+  encodeUpload(payload, sample);
+
+  HTTPClient http;
+  http.setConnectTimeout(UPLINK_CONNECT_TIMEOUT);
+  http.setTimeout(UPLINK_IO_TIMEOUT);
+  http.begin(collectorUrl);
+  http.addHeader("Content-Type", CollectorEncoder::contentType());
+  int httpResponseCode = http.POST(body, payload.size());
+  if (httpResponseCode <= 0 || httpResponseCode >= 300) {
+    Serial.println("Collector Error: " + String(httpResponseCode));
   }
-  
   http.end();
-}
\ No newline at end of file
+}
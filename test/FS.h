@@ -0,0 +1,122 @@
+#pragma once
+
+// In-memory stand-in for the Arduino fs::FS/File subset FlashLog uses,
+// shared by the host tests. FlashLog.h's #include <FS.h> finds it because
+// PlatformIO puts test/ on the include path. Writes are all-or-nothing, as
+// a file update is on LittleFS; failWritesAfter simulates losing power.
+
+#include <stdint.h>
+#include <stdio.h>   // The core's FS.h brings these in through Arduino.h
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fs {
+
+class FS;
+
+class File {
+public:
+  File() {}
+
+  explicit operator bool() const { return fs_ != nullptr; }
+  const char* name() const { return path_.c_str(); }
+  bool isDirectory() const { return directory_; }
+  size_t size() const;
+  bool seek(uint32_t position);
+  size_t read(uint8_t* buffer, size_t length);
+  size_t write(const uint8_t* buffer, size_t length);
+  File openNextFile();
+  void close() { fs_ = nullptr; }
+
+private:
+  friend class FS;
+  FS* fs_ = nullptr;
+  std::string path_;
+  bool directory_ = false;
+  size_t position_ = 0;
+  std::vector<std::string> entries_;
+  size_t nextEntry_ = 0;
+};
+
+class FS {
+public:
+  std::map<std::string, std::vector<uint8_t>> files;
+  std::set<std::string> directories;
+  size_t bytesWritten = 0;
+  long failWritesAfter = -1;  // Writes that still succeed; -1 for all
+
+  bool exists(const char* path) const { return files.count(path) || directories.count(path); }
+  bool mkdir(const char* path) { return directories.insert(path).second; }
+  bool remove(const char* path) { return files.erase(path) > 0; }
+
+  File open(const char* path, const char* mode = "r") {
+    File file;
+    if (directories.count(path)) {
+      std::string prefix = std::string(path) + "/";
+      for (const auto& entry : files) {
+        if (entry.first.compare(0, prefix.size(), prefix) == 0) {
+          file.entries_.push_back(entry.first);
+        }
+      }
+      file.directory_ = true;
+    } else if (mode[0] == 'w') {
+      files[path].clear();
+    } else if (!files.count(path)) {
+      return file;
+    }
+    file.fs_ = this;
+    file.path_ = path;
+    return file;
+  }
+};
+
+inline size_t File::size() const { return fs_->files[path_].size(); }
+
+inline bool File::seek(uint32_t position) {
+  if (position > size()) {
+    return false;
+  }
+  position_ = position;
+  return true;
+}
+
+inline size_t File::read(uint8_t* buffer, size_t length) {
+  const std::vector<uint8_t>& data = fs_->files[path_];
+  size_t n = position_ < data.size() ? data.size() - position_ : 0;
+  if (n > length) n = length;
+  memcpy(buffer, data.data() + position_, n);
+  position_ += n;
+  return n;
+}
+
+inline size_t File::write(const uint8_t* buffer, size_t length) {
+  if (fs_->failWritesAfter == 0) {
+    return 0;
+  }
+  if (fs_->failWritesAfter > 0) {
+    fs_->failWritesAfter--;
+  }
+  std::vector<uint8_t>& data = fs_->files[path_];
+  if (data.size() < position_ + length) {
+    data.resize(position_ + length);
+  }
+  memcpy(data.data() + position_, buffer, length);
+  position_ += length;
+  fs_->bytesWritten += length;
+  return length;
+}
+
+inline File File::openNextFile() {
+  if (!directory_ || nextEntry_ >= entries_.size()) {
+    return File();
+  }
+  return fs_->open(entries_[nextEntry_++].c_str());
+}
+
+}  // namespace fs
+
+using fs::File;
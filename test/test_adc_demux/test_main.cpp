@@ -0,0 +1,222 @@
+// AdcDemux replaying DMA streams laid out as the I2S driver delivers them:
+// TYPE1 words scanning TDS, pH and EC in turn, cut into frames that split
+// the scan pattern anywhere, with a dropped frame and stray channels.
+
+#include <stdio.h>
+#include <vector>
+#include <unity.h>
+#include "AdcDemux.h"
+#include "Filters.h"
+
+// The firmware's channels (src/main.cpp) and slots
+const uint8_t CHANNELS[3] = {0, 6, 3};  // TDS, pH, EC on ADC1
+enum { TDS = 0, PH, EC, SLOTS };
+
+const uint32_t SCANS = 20000;           // One second at 20 kS/s is ~6700 scans
+const uint32_t SPIKE_EVERY = 500;       // Pump switching transient on pH...
+const uint32_t SPIKE_AT = 250;          // ...mid-way through each stretch...
+const uint32_t SPIKE_LENGTH = 3;        // ...a few samples long
+const int32_t SPIKE_CODES = 900;
+
+uint16_t word(uint8_t channel, int32_t code) {
+  return (uint16_t)((channel << 12) | (code & 0x0FFF));
+}
+
+// Scan k of the stream: small zero-mean noise around fixed levels, EC
+// drifting slowly, pH with a spike burst now and then
+int32_t codeAt(int slot, uint32_t k) {
+  int32_t noise = (int32_t)((k * 7 + slot * 3) % 9) - 4;
+  uint32_t phase = k % SPIKE_EVERY;
+  switch (slot) {
+    case TDS: return 1500 + noise;
+    case PH:  return 2000 + noise + (phase >= SPIKE_AT && phase < SPIKE_AT + SPIKE_LENGTH ? SPIKE_CODES : 0);
+    default:  return 800 + (int32_t)(k / 1000) + noise;
+  }
+}
+
+std::vector<uint16_t> capture(uint32_t scans) {
+  std::vector<uint16_t> words;
+  for (uint32_t k = 0; k < scans; k++) {
+    for (int slot = 0; slot < SLOTS; slot++) {
+      words.push_back(word(CHANNELS[slot], codeAt(slot, k)));
+    }
+  }
+  return words;
+}
+
+// Mean of what the stream holds for a slot, computed without the demux
+double truth(const std::vector<uint16_t>& words, int slot, uint32_t* count) {
+  double sum = 0;
+  *count = 0;
+  for (uint16_t w : words) {
+    if (ADC_DEMUX_CHANNEL(w) == CHANNELS[slot]) {
+      sum += ADC_DEMUX_CODE(w);
+      (*count)++;
+    }
+  }
+  return sum / *count;
+}
+
+void mapAll(AdcDemux<SLOTS>& demux) {
+  for (int slot = 0; slot < SLOTS; slot++) {
+    TEST_ASSERT_TRUE(demux.mapChannel(slot, CHANNELS[slot]));
+  }
+}
+
+void replay(AdcDemux<SLOTS>& demux, const std::vector<uint16_t>& words, size_t frameWords) {
+  for (size_t i = 0; i < words.size(); i += frameWords) {
+    size_t n = words.size() - i < frameWords ? words.size() - i : frameWords;
+    demux.push(&words[i], n);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_routes_by_channel_bits() {
+  std::vector<uint16_t> words = capture(SCANS);
+  AdcDemux<SLOTS> demux;
+  mapAll(demux);
+  replay(demux, words, 128);  // 256-byte DMA frames
+
+  for (int slot = 0; slot < SLOTS; slot++) {
+    uint32_t expected = 0;
+    double mean = truth(words, slot, &expected);
+    float average = 0;
+    uint32_t samples = 0;
+    TEST_ASSERT_TRUE(demux.takeAverage(slot, average, &samples));
+    TEST_ASSERT_EQUAL_UINT32(SCANS, samples);
+    TEST_ASSERT_EQUAL_UINT32(expected, samples);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, (float)mean, average);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, demux.unmapped());
+}
+
+void test_frame_boundaries_do_not_matter() {
+  std::vector<uint16_t> words = capture(3000);
+  float reference[SLOTS];
+  const size_t frames[] = {1, 2, 7, 128, 1000, words.size()};
+  for (size_t f = 0; f < sizeof(frames) / sizeof(frames[0]); f++) {
+    AdcDemux<SLOTS> demux;
+    mapAll(demux);
+    replay(demux, words, frames[f]);
+    for (int slot = 0; slot < SLOTS; slot++) {
+      float average = 0;
+      TEST_ASSERT_TRUE(demux.takeAverage(slot, average));
+      if (f == 0) {
+        reference[slot] = average;
+      }
+      TEST_ASSERT_EQUAL_FLOAT(reference[slot], average);
+    }
+  }
+}
+
+// A frame lost to a driver overflow and words from a channel nobody
+// mapped: the averages cover exactly what arrived on each slot
+void test_overflow_gap_and_stray_channels() {
+  std::vector<uint16_t> words = capture(SCANS);
+  words.erase(words.begin() + 3001, words.begin() + 3001 + 128);
+  for (size_t i = 0; i < words.size(); i += 1000) {
+    words.insert(words.begin() + i, word(5, 4095));
+  }
+  AdcDemux<SLOTS> demux;
+  mapAll(demux);
+  replay(demux, words, 128);
+
+  uint32_t total = 0;
+  for (int slot = 0; slot < SLOTS; slot++) {
+    uint32_t expected = 0;
+    double mean = truth(words, slot, &expected);
+    float average = 0;
+    uint32_t samples = 0;
+    TEST_ASSERT_TRUE(demux.takeAverage(slot, average, &samples));
+    TEST_ASSERT_EQUAL_UINT32(expected, samples);
+    TEST_ASSERT_EQUAL_UINT32(expected, demux.received(slot));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, (float)mean, average);
+    total += samples;
+  }
+  TEST_ASSERT_EQUAL_UINT32(3 * SCANS - 128, total);
+  TEST_ASSERT_EQUAL_UINT32(words.size() - total, demux.unmapped());
+}
+
+void test_each_reading_restarts_the_decimator() {
+  AdcDemux<SLOTS> demux;
+  mapAll(demux);
+  float average = 0;
+  uint32_t samples = 99;
+  TEST_ASSERT_FALSE(demux.takeAverage(TDS, average, &samples));
+  TEST_ASSERT_EQUAL_UINT32(0, samples);
+
+  const uint16_t first[] = {word(0, 100), word(0, 300)};
+  demux.push(first, 2);
+  TEST_ASSERT_TRUE(demux.takeAverage(TDS, average, &samples));
+  TEST_ASSERT_EQUAL_FLOAT(200.0f, average);
+  TEST_ASSERT_FALSE(demux.takeAverage(TDS, average));
+
+  const uint16_t second[] = {word(0, 1000)};
+  demux.push(second, 1);
+  TEST_ASSERT_TRUE(demux.takeAverage(TDS, average, &samples));
+  TEST_ASSERT_EQUAL_UINT32(1, samples);
+  TEST_ASSERT_EQUAL_FLOAT(1000.0f, average);
+  TEST_ASSERT_EQUAL_UINT32(3, demux.received(TDS));
+}
+
+// The firmware's pH chain, run per sample inside push(): the pump spikes
+// that pull the plain mean up are gone from the filtered one
+void test_filtered_replay_rejects_pump_spikes() {
+  std::vector<uint16_t> words = capture(SCANS);
+  Chain<OutlierReject<15, 120>, Median<7>, Ema<q15(0.02)>> phFilter;
+
+  AdcDemux<SLOTS> raw;
+  AdcDemux<SLOTS> filtered;
+  mapAll(raw);
+  mapAll(filtered);
+  replay(raw, words, 128);
+  for (size_t i = 0; i < words.size(); i += 128) {
+    size_t n = words.size() - i < 128 ? words.size() - i : 128;
+    filtered.push(&words[i], n, [&](size_t slot, int32_t code) {
+      return slot == PH ? phFilter.update(code) : code;
+    });
+  }
+
+  float plain = 0;
+  float clean = 0;
+  TEST_ASSERT_TRUE(raw.takeAverage(PH, plain));
+  TEST_ASSERT_TRUE(filtered.takeAverage(PH, clean));
+  char line[80];
+  snprintf(line, sizeof(line), "pH mean: raw %.2f, filtered %.2f codes (level 2000)", plain, clean);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_GREATER_THAN(2004.0f, plain);
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 2000.0f, clean);
+  TEST_ASSERT_EQUAL_UINT32(SCANS / SPIKE_EVERY * SPIKE_LENGTH, phFilter.head().rejected());
+}
+
+void test_filter_output_is_clamped_to_12_bits() {
+  AdcDemux<SLOTS> demux;
+  mapAll(demux);
+  const uint16_t words[] = {word(0, 10), word(6, 4000)};
+  demux.push(words, 2, [](size_t slot, int32_t code) { return slot == TDS ? code - 100 : code + 500; });
+  float average = 0;
+  TEST_ASSERT_TRUE(demux.takeAverage(TDS, average));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, average);
+  TEST_ASSERT_TRUE(demux.takeAverage(PH, average));
+  TEST_ASSERT_EQUAL_FLOAT(4095.0f, average);
+}
+
+void test_mapping_is_bounded() {
+  AdcDemux<SLOTS> demux;
+  TEST_ASSERT_FALSE(demux.mapChannel(SLOTS, 1));
+  TEST_ASSERT_FALSE(demux.mapChannel(0, 16));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_routes_by_channel_bits);
+  RUN_TEST(test_frame_boundaries_do_not_matter);
+  RUN_TEST(test_overflow_gap_and_stray_channels);
+  RUN_TEST(test_each_reading_restarts_the_decimator);
+  RUN_TEST(test_filtered_replay_rejects_pump_spikes);
+  RUN_TEST(test_filter_output_is_clamped_to_12_bits);
+  RUN_TEST(test_mapping_is_bounded);
+  return UNITY_END();
+}
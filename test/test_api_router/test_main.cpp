@@ -0,0 +1,255 @@
+// ApiRouter driven by mock requests: the firmware's route table matched
+// exhaustively, then several client threads at full rate with every
+// request accounted for, and the dispatch latency per request.
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unity.h>
+#include "ApiRouter.h"
+
+// ESPAsyncWebServer's WebRequestMethod bits
+enum Method {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000
+};
+
+struct MockRequest {
+  std::string url;
+  Method method;
+  int code = 0;
+  int route = -1;  // Index of the handler that ran
+};
+
+typedef void (*MockHandler)(MockRequest*);
+
+// One counter and one handler per route; the handler records which row ran
+const int ROUTE_COUNT = 27;
+std::atomic<uint32_t> handled[ROUTE_COUNT];
+
+template <int Index>
+void handler(MockRequest* request) {
+  handled[Index]++;
+  request->route = Index;
+  request->code = 200;
+}
+
+// API_ROUTES in src/main.cpp, path for path; /api/events has no handler
+// there either (the event source serves it)
+const ApiRoute<Method, MockHandler> ROUTES[ROUTE_COUNT] = {
+  {HTTP_GET,  "/api/status",                handler<0>,  ""},
+  {HTTP_GET,  "/api/uptime",                handler<1>,  ""},
+  {HTTP_GET,  "/api/boot",                  handler<2>,  ""},
+  {HTTP_GET,  "/api/events",                nullptr,     ""},
+  {HTTP_POST, "/api/pump/on",               handler<4>,  ""},
+  {HTTP_POST, "/api/pump/off",              handler<5>,  ""},
+  {HTTP_POST, "/api/pump/auto",             handler<6>,  ""},
+  {HTTP_GET,  "/api/pump/audit",            handler<7>,  ""},
+  {HTTP_POST, "/api/led/growth",            handler<8>,  ""},
+  {HTTP_POST, "/api/led/relax",             handler<9>,  ""},
+  {HTTP_POST, "/api/led/sleep",             handler<10>, ""},
+  {HTTP_POST, "/api/led/off",               handler<11>, ""},
+  {HTTP_POST, "/api/led/zone",              handler<12>, ""},
+  {HTTP_GET,  "/api/wifi",                  handler<13>, ""},
+  {HTTP_POST, "/api/wifi",                  handler<14>, ""},
+  {HTTP_GET,  "/api/lighting",              handler<15>, ""},
+  {HTTP_POST, "/api/lighting",              handler<16>, ""},
+  {HTTP_GET,  "/api/calibration",           handler<17>, ""},
+  {HTTP_POST, "/api/calibration/ph",        handler<18>, ""},
+  {HTTP_POST, "/api/calibration/ec",        handler<19>, ""},
+  {HTTP_POST, "/api/calibration/tds",       handler<20>, ""},
+  {HTTP_POST, "/api/calibration/ph/clear",  handler<21>, ""},
+  {HTTP_POST, "/api/calibration/ec/clear",  handler<22>, ""},
+  {HTTP_POST, "/api/calibration/tds/clear", handler<23>, ""},
+  {HTTP_GET,  "/api/history",               handler<24>, ""},
+  {HTTP_GET,  "/api/log",                   handler<25>, ""},
+  {HTTP_GET,  "/api/reporting",             handler<26>, ""}
+};
+
+ApiRouter<Method, MockHandler> router(ROUTES, HTTP_OPTIONS);
+
+// dispatchApi() in src/main.cpp, answering with status codes only
+void dispatch(MockRequest* request) {
+  const ApiRouter<Method, MockHandler>::Route* route = nullptr;
+  switch (router.match(request->url.c_str(), request->method, route)) {
+    case API_ROUTE_FOUND:
+      if (route->handler) {
+        route->handler(request);
+      } else {
+        request->code = 503;
+      }
+      break;
+    case API_PREFLIGHT:
+      request->code = 204;
+      break;
+    case API_METHOD_NOT_ALLOWED:
+      request->code = 405;
+      break;
+    default:
+      request->code = 404;
+      break;
+  }
+}
+
+const Method METHODS[] = {HTTP_GET, HTTP_POST, HTTP_DELETE, HTTP_PUT, HTTP_PATCH, HTTP_HEAD, HTTP_OPTIONS};
+
+// What dispatch() should answer, worked out from the table directly
+int expectedCode(const std::string& url, Method method, int& route) {
+  route = -1;
+  bool known = false;
+  for (int i = 0; i < ROUTE_COUNT; i++) {
+    if (url != ROUTES[i].path) continue;
+    known = true;
+    if (ROUTES[i].method == method) {
+      if (!ROUTES[i].handler) return 503;
+      route = i;
+      return 200;
+    }
+  }
+  if (!known) return 404;
+  return method == HTTP_OPTIONS ? 204 : 405;
+}
+
+std::vector<MockRequest> requestMix() {
+  std::vector<MockRequest> mix;
+  for (int i = 0; i < ROUTE_COUNT; i++) {
+    for (Method method : METHODS) {
+      mix.push_back({ROUTES[i].path, method});
+    }
+  }
+  const char* strays[] = {"/api/", "/api/status/", "/api/STATUS", "/api/statu", "/api/pump", "/", "/api/history?metric=ph"};
+  for (const char* url : strays) {
+    mix.push_back({url, HTTP_GET});
+  }
+  return mix;
+}
+
+void setUp() {
+  for (std::atomic<uint32_t>& count : handled) {
+    count = 0;
+  }
+}
+void tearDown() {}
+
+void test_table_has_no_duplicates() {
+  for (int i = 0; i < ROUTE_COUNT; i++) {
+    for (int j = i + 1; j < ROUTE_COUNT; j++) {
+      TEST_ASSERT_FALSE(ROUTES[i].method == ROUTES[j].method && !strcmp(ROUTES[i].path, ROUTES[j].path));
+    }
+  }
+  TEST_ASSERT_EQUAL_size_t(ROUTE_COUNT, router.size());
+}
+
+// Every path in the table with every method, and near misses
+void test_every_path_and_method() {
+  for (MockRequest request : requestMix()) {
+    int route;
+    int code = expectedCode(request.url, request.method, route);
+    dispatch(&request);
+    TEST_ASSERT_EQUAL_INT(code, request.code);
+    TEST_ASSERT_EQUAL_INT(route, request.route);
+  }
+  // A path served by GET and POST picks by method
+  MockRequest get = {"/api/wifi", HTTP_GET};
+  MockRequest post = {"/api/wifi", HTTP_POST};
+  dispatch(&get);
+  dispatch(&post);
+  TEST_ASSERT_EQUAL_INT(13, get.route);
+  TEST_ASSERT_EQUAL_INT(14, post.route);
+}
+
+// Client threads replaying the mix at full rate; every handler call is
+// counted against what the threads sent, and per-request latency is kept
+void test_load() {
+  const int THREADS = 4;
+  const int PER_THREAD = 500000;
+  std::vector<MockRequest> mix = requestMix();
+  std::vector<uint32_t> expected(ROUTE_COUNT);
+  std::vector<std::vector<uint32_t>> latencies(THREADS);
+  std::atomic<int> wrong(0);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (int t = 0; t < THREADS; t++) {
+    clients.emplace_back([&, t]() {
+      std::vector<uint32_t>& ns = latencies[t];
+      ns.reserve(PER_THREAD);
+      for (int i = 0; i < PER_THREAD; i++) {
+        MockRequest request = mix[(i * 7 + t) % mix.size()];
+        auto t0 = std::chrono::steady_clock::now();
+        dispatch(&request);
+        ns.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        int route;
+        if (request.code != expectedCode(request.url, request.method, route) || request.route != route) {
+          wrong++;
+        }
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (int t = 0; t < THREADS; t++) {
+    for (int i = 0; i < PER_THREAD; i++) {
+      const MockRequest& request = mix[(i * 7 + t) % mix.size()];
+      int route;
+      if (expectedCode(request.url, request.method, route) == 200) {
+        expected[route]++;
+      }
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(0, wrong.load());
+  for (int i = 0; i < ROUTE_COUNT; i++) {
+    TEST_ASSERT_EQUAL_UINT32(expected[i], handled[i].load());
+  }
+
+  std::vector<uint32_t> all;
+  for (const std::vector<uint32_t>& ns : latencies) {
+    all.insert(all.end(), ns.begin(), ns.end());
+  }
+  std::sort(all.begin(), all.end());
+  char line[128];
+  snprintf(line, sizeof(line), "%d threads: %.1f M requests/s (includes the checks), dispatch p50 %u ns, p99 %u ns, max %u ns",
+           THREADS, THREADS * PER_THREAD / seconds / 1e6,
+           all[all.size() / 2], all[all.size() * 99 / 100], all.back());
+  TEST_MESSAGE(line);
+}
+
+// The table is a linear scan; cost of matching the first and last rows
+// and a miss, which walks the whole table
+void test_match_cost() {
+  const char* urls[] = {"/api/status", "/api/reporting", "/api/missing"};
+  for (const char* url : urls) {
+    const int ROUNDS = 2000000;
+    const ApiRouter<Method, MockHandler>::Route* route = nullptr;
+    volatile int sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; i++) {
+      sink = sink + router.match(url, HTTP_GET, route);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+    char line[80];
+    snprintf(line, sizeof(line), "match %-16s %6.1f ns", url, ns);
+    TEST_MESSAGE(line);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_table_has_no_duplicates);
+  RUN_TEST(test_every_path_and_method);
+  RUN_TEST(test_load);
+  RUN_TEST(test_match_cost);
+  return UNITY_END();
+}
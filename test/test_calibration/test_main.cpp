@@ -0,0 +1,265 @@
+// Calibration math, persistence through an in-memory stand-in for NVS,
+// and captured points read back through the conversion tables.
+
+#include <map>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <unity.h>
+#include "Calibration.h"
+#include "ProbeConversion.h"
+
+// Behaves like Preferences: getBytes() fails on a buffer shorter than the
+// stored blob, and removing a missing key is not an error
+class FakeNvs : public CalibrationStorage {
+public:
+  size_t read(const char* key, void* data, size_t length) override {
+    auto it = blobs.find(key);
+    if (it == blobs.end() || length < it->second.size()) {
+      return 0;
+    }
+    memcpy(data, it->second.data(), it->second.size());
+    return it->second.size();
+  }
+
+  bool write(const char* key, const void* data, size_t length) override {
+    if (failWrites) {
+      return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    blobs[key].assign(bytes, bytes + length);
+    writes++;
+    return true;
+  }
+
+  bool remove(const char* key) override {
+    blobs.erase(key);
+    return true;
+  }
+
+  std::map<std::string, std::vector<uint8_t>> blobs;
+  bool failWrites = false;
+  int writes = 0;
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_points_stay_sorted() {
+  ProbeCalibration cal = {};
+  TEST_ASSERT_TRUE(cal.addPoint(2.0f, 4.0f));
+  TEST_ASSERT_TRUE(cal.addPoint(1.0f, 10.0f));
+  TEST_ASSERT_TRUE(cal.addPoint(1.5f, 7.0f));
+  TEST_ASSERT_EQUAL_UINT8(3, cal.count);
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, cal.points[0].input);
+  TEST_ASSERT_EQUAL_FLOAT(1.5f, cal.points[1].input);
+  TEST_ASSERT_EQUAL_FLOAT(2.0f, cal.points[2].input);
+}
+
+void test_needs_two_points() {
+  ProbeCalibration cal = {};
+  TEST_ASSERT_FALSE(cal.usable());
+  cal.addPoint(1.0f, 7.0f);
+  TEST_ASSERT_FALSE(cal.usable());
+  TEST_ASSERT_EQUAL_FLOAT(7.0f, cal.evaluate(3.0f));
+  cal.addPoint(2.0f, 4.0f);
+  TEST_ASSERT_TRUE(cal.usable());
+}
+
+void test_piecewise_interpolation_and_extrapolation() {
+  ProbeCalibration cal = {};
+  cal.addPoint(1.0f, 10.0f);
+  cal.addPoint(2.0f, 7.0f);
+  cal.addPoint(3.0f, 3.0f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 8.5f, cal.evaluate(1.5f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 5.0f, cal.evaluate(2.5f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 13.0f, cal.evaluate(0.0f));   // First segment extended
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, -1.0f, cal.evaluate(4.0f));   // Last segment extended
+}
+
+void test_remeasuring_replaces_the_point() {
+  ProbeCalibration cal = {};
+  cal.addPoint(1.81f, 4.0f);
+  cal.addPoint(1.33f, 7.0f);
+  TEST_ASSERT_TRUE(cal.addPoint(1.79f, 4.0f));
+  TEST_ASSERT_EQUAL_UINT8(2, cal.count);
+  TEST_ASSERT_EQUAL_FLOAT(1.79f, cal.points[1].input);
+
+  // A wider match only where the caller asks for one
+  TEST_ASSERT_TRUE(cal.addPoint(1.70f, 4.4f));
+  TEST_ASSERT_EQUAL_UINT8(3, cal.count);
+  TEST_ASSERT_TRUE(cal.addPoint(1.60f, 4.6f, 0.25f));
+  TEST_ASSERT_EQUAL_UINT8(3, cal.count);
+}
+
+void test_rejects_full_close_and_non_finite() {
+  ProbeCalibration cal = {};
+  for (int i = 0; i < CALIBRATION_MAX_POINTS; i++) {
+    TEST_ASSERT_TRUE(cal.addPoint(0.5f * i, 100.0f * i));
+  }
+  TEST_ASSERT_FALSE(cal.addPoint(9.0f, 9000.0f));
+  cal.clear();
+  cal.addPoint(1.0f, 1.0f);
+  TEST_ASSERT_FALSE(cal.addPoint(1.0005f, 2.0f));
+  TEST_ASSERT_FALSE(cal.addPoint(NAN, 2.0f));
+  TEST_ASSERT_FALSE(cal.addPoint(2.0f, INFINITY));
+  TEST_ASSERT_EQUAL_UINT8(1, cal.count);
+}
+
+// A re-measure that lands on another point's input is refused and the
+// point it would have replaced stays, so a 409 reports (and the next save
+// keeps) the curve as it was
+void test_rejected_replacement_leaves_points() {
+  ProbeCalibration cal = {};
+  cal.addPoint(1.81f, 4.0f);
+  cal.addPoint(1.33f, 7.0f);
+  cal.addPoint(1.00f, 10.0f);
+  ProbeCalibration before = cal;
+  TEST_ASSERT_FALSE(cal.addPoint(1.3305f, 4.0f));
+  TEST_ASSERT_EQUAL_UINT8(before.count, cal.count);
+  TEST_ASSERT_EQUAL_MEMORY(before.points, cal.points, sizeof(cal.points));
+
+  // Full: a replacement still goes through, a new point doesn't
+  cal.addPoint(0.70f, 12.0f);
+  cal.addPoint(0.40f, 14.0f);
+  TEST_ASSERT_EQUAL_UINT8(CALIBRATION_MAX_POINTS, cal.count);
+  TEST_ASSERT_TRUE(cal.addPoint(1.82f, 4.0f));
+  TEST_ASSERT_EQUAL_FLOAT(1.82f, cal.points[CALIBRATION_MAX_POINTS - 1].input);
+  before = cal;
+  TEST_ASSERT_FALSE(cal.addPoint(2.5f, 2.0f));
+  TEST_ASSERT_EQUAL_MEMORY(before.points, cal.points, sizeof(cal.points));
+}
+
+void test_store_round_trip() {
+  FakeNvs nvs;
+  CalibrationStore store(nvs);
+  ProbeCalibration cal = {};
+  cal.addPoint(0.4f, 342.0f);
+  cal.addPoint(1.2f, 1000.0f);
+  cal.addPoint(2.1f, 1500.0f);
+  TEST_ASSERT_TRUE(store.save("tds", cal));
+
+  ProbeCalibration loaded;
+  TEST_ASSERT_TRUE(store.load("tds", loaded));
+  TEST_ASSERT_EQUAL_UINT8(3, loaded.count);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL_FLOAT(cal.points[i].input, loaded.points[i].input);
+    TEST_ASSERT_EQUAL_FLOAT(cal.points[i].value, loaded.points[i].value);
+  }
+  TEST_ASSERT_FALSE(store.load("ph", loaded));
+  TEST_ASSERT_EQUAL_UINT8(0, loaded.count);
+}
+
+void test_clearing_removes_the_record() {
+  FakeNvs nvs;
+  CalibrationStore store(nvs);
+  ProbeCalibration cal = {};
+  cal.addPoint(0.4f, 342.0f);
+  cal.addPoint(1.2f, 1000.0f);
+  store.save("ec", cal);
+  cal.clear();
+  TEST_ASSERT_TRUE(store.save("ec", cal));
+  TEST_ASSERT_EQUAL(0, (int)nvs.blobs.count("ec"));
+}
+
+// Anything but an intact record of this version loads as "no calibration"
+void test_bad_records_are_ignored() {
+  FakeNvs nvs;
+  CalibrationStore store(nvs);
+  ProbeCalibration cal = {};
+  cal.addPoint(0.4f, 342.0f);
+  cal.addPoint(1.2f, 1000.0f);
+  store.save("ec", cal);
+  std::vector<uint8_t> good = nvs.blobs["ec"];
+  ProbeCalibration loaded;
+
+  nvs.blobs["ec"][0] ^= 0xFF;  // Magic
+  TEST_ASSERT_FALSE(store.load("ec", loaded));
+  nvs.blobs["ec"] = good;
+  nvs.blobs["ec"][2] = 99;     // Version
+  TEST_ASSERT_FALSE(store.load("ec", loaded));
+  nvs.blobs["ec"] = good;
+  nvs.blobs["ec"][3] = 9;      // Count past the maximum
+  TEST_ASSERT_FALSE(store.load("ec", loaded));
+  nvs.blobs["ec"] = good;
+  nvs.blobs["ec"].resize(8);   // Truncated
+  TEST_ASSERT_FALSE(store.load("ec", loaded));
+  TEST_ASSERT_EQUAL_UINT8(0, loaded.count);
+
+  nvs.blobs["ec"] = good;
+  TEST_ASSERT_TRUE(store.load("ec", loaded));
+  TEST_ASSERT_EQUAL_UINT8(2, loaded.count);
+}
+
+void test_failed_write_is_reported() {
+  FakeNvs nvs;
+  nvs.failWrites = true;
+  CalibrationStore store(nvs);
+  ProbeCalibration cal = {};
+  cal.addPoint(0.4f, 342.0f);
+  TEST_ASSERT_FALSE(store.save("ph", cal));
+}
+
+// Points captured at one temperature read back as their references
+// through the tables at that temperature, whatever it is
+void test_captured_points_read_back_at_capture_temperature() {
+  const float temps[] = {15.0f, 25.0f, 30.0f, 38.5f};
+  TemperatureTables temperature;
+  temperature.build();
+  for (float t : temps) {
+    // Voltages the probes put out in the two solutions at t
+    ProbeCalibration ec = {};
+    CalibrationPoint water = ecCalibrationPoint(0.02f, t, 0.0f);
+    CalibrationPoint high = ecCalibrationPoint(1.30f, t, 1413.0f);
+    ec.addPoint(water.input, water.value);
+    ec.addPoint(high.input, high.value);
+
+    ProbeCalibration tds = {};
+    CalibrationPoint low = tdsCalibrationPoint(0.45f, t, 342.0f);
+    CalibrationPoint mid = tdsCalibrationPoint(1.25f, t, 1000.0f);
+    tds.addPoint(low.input, low.value);
+    tds.addPoint(mid.input, mid.value);
+
+    ProbeCalibration ph = {};
+    ph.addPoint(phCalibrationPoint(1.81f, 4.0f).input, 4.0f);
+    ph.addPoint(phCalibrationPoint(1.33f, 7.0f).input, 7.0f);
+
+    ConversionTables tables;
+    tables.build(tds, ec, ph);
+    float perVolt = 1.0f / (float)ADC_VOLTS_PER_CODE;
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 1413.0f, tables.ecAt(1.30f * perVolt, t, temperature));
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 342.0f, tables.tdsAt(0.45f * perVolt, t, temperature));
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 1000.0f, tables.tdsAt(1.25f * perVolt, t, temperature));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 4.0f, tables.phAt(1.81f * perVolt));
+  }
+}
+
+// The same EC solution re-measured 5 °C warmer replaces its point
+void test_ec_remeasure_at_another_temperature_replaces() {
+  ProbeCalibration ec = {};
+  CalibrationPoint zero = ecCalibrationPoint(0.0f, 25.0f, 0.0f);
+  CalibrationPoint first = ecCalibrationPoint(1.23f, 25.0f, 1413.0f);
+  CalibrationPoint again = ecCalibrationPoint(1.35f, 30.0f, 1413.0f);
+  ec.addPoint(zero.input, zero.value, EC_REPLACE_WITHIN);
+  ec.addPoint(first.input, first.value, EC_REPLACE_WITHIN);
+  TEST_ASSERT_TRUE(ec.addPoint(again.input, again.value, EC_REPLACE_WITHIN));
+  TEST_ASSERT_EQUAL_UINT8(2, ec.count);
+  TEST_ASSERT_EQUAL_FLOAT(1.35f, ec.points[1].input);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_points_stay_sorted);
+  RUN_TEST(test_needs_two_points);
+  RUN_TEST(test_piecewise_interpolation_and_extrapolation);
+  RUN_TEST(test_remeasuring_replaces_the_point);
+  RUN_TEST(test_rejects_full_close_and_non_finite);
+  RUN_TEST(test_rejected_replacement_leaves_points);
+  RUN_TEST(test_store_round_trip);
+  RUN_TEST(test_clearing_removes_the_record);
+  RUN_TEST(test_bad_records_are_ignored);
+  RUN_TEST(test_failed_write_is_reported);
+  RUN_TEST(test_captured_points_read_back_at_capture_temperature);
+  RUN_TEST(test_ec_remeasure_at_another_temperature_replaces);
+  return UNITY_END();
+}
@@ -0,0 +1,289 @@
+// DeltaReporter: deadbands, hold-window merging, heartbeat and counters,
+// then a day of upload samples through the firmware's upload settings,
+// with the records and bytes it saves against sending every field.
+
+#include <stdio.h>
+#include <math.h>
+#include <unity.h>
+#include "DeltaReporter.h"
+#include "Encoding.h"
+
+// SENSOR_DEADBANDS in src/main.cpp; fields past these are on/off state
+const size_t METRICS = 7;
+const Deadband BANDS[METRICS] = {
+  {0.1, 0},      // waterTemp, °C
+  {0.2, 0},      // airTemp, °C
+  {1.0, 0},      // humidity, %
+  {5.0, 0.02},   // tds, ppm
+  {0.05, 0},     // pH
+  {10.0, 0.02},  // ec, µS/cm
+  {1.0, 0}       // waterLevel, %
+};
+const size_t FIELDS = METRICS + 3;  // + pump running, auto mode, LED on
+const char* const NAMES[FIELDS] = {
+  "waterTemp", "airTemp", "humidity", "tds", "pH", "ec", "waterLevel", "pumpStatus", "pumpMode", "ledStatus"
+};
+enum { WATER_TEMP = 0, TDS = 3, PH = 4, EC = 5, PUMP = 7 };
+
+const uint32_t UPLOAD_HEARTBEAT = 1800000;
+const uint32_t SAMPLE_PERIOD = 120000;
+
+typedef DeltaReporter<FIELDS> Reporter;
+
+struct Values {
+  float v[FIELDS] = {21.0f, 24.0f, 60.0f, 800.0f, 6.0f, 1600.0f, 80.0f, 0, 1, 1};
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_first_offer_sends_everything() {
+  Reporter reporter(BANDS, METRICS, 0, 0);
+  Values values;
+  TEST_ASSERT_EQUAL_HEX32(Reporter::allFields(), reporter.offer(values.v, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 1000));
+  TEST_ASSERT_EQUAL_UINT32(1, reporter.heartbeats());
+  TEST_ASSERT_EQUAL_UINT32(1, reporter.reports());
+  TEST_ASSERT_EQUAL_UINT32(2, reporter.offers());
+}
+
+// pH has a fixed ±0.05; movement is measured from the last value sent, so
+// small steps add up until they cross it
+void test_absolute_deadband() {
+  Reporter reporter(BANDS, METRICS, 0, 0);
+  Values values;
+  reporter.offer(values.v, 0);
+  values.v[PH] = 6.04f;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 1));
+  values.v[PH] = 5.97f;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 2));
+  values.v[PH] = 6.06f;
+  TEST_ASSERT_EQUAL_HEX32(1UL << PH, reporter.offer(values.v, 3));
+  values.v[PH] = 6.02f;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 4));  // 0.04 from 6.06
+  TEST_ASSERT_EQUAL_UINT32(3, reporter.suppressed(PH));
+  TEST_ASSERT_EQUAL_UINT32(2, reporter.sent(PH));
+}
+
+// EC: the larger of ±10 µS/cm and 2 % of the last value sent
+void test_relative_deadband() {
+  Reporter reporter(BANDS, METRICS, 0, 0);
+  Values values;
+  values.v[EC] = 2000.0f;
+  reporter.offer(values.v, 0);
+  values.v[EC] = 2039.0f;  // Inside 2 % (40)
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 1));
+  values.v[EC] = 2041.0f;
+  TEST_ASSERT_EQUAL_HEX32(1UL << EC, reporter.offer(values.v, 2));
+
+  // Low readings fall back to the absolute band
+  values.v[EC] = 100.0f;
+  TEST_ASSERT_EQUAL_HEX32(1UL << EC, reporter.offer(values.v, 3));
+  values.v[EC] = 109.0f;   // 2 % would be 2; the band is 10
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 4));
+  values.v[EC] = 110.5f;
+  TEST_ASSERT_EQUAL_HEX32(1UL << EC, reporter.offer(values.v, 5));
+}
+
+// Fields without a band go on any change; a probe dropping out (NaN) and
+// coming back are both changes, a NaN that stays is not
+void test_state_fields_and_nan() {
+  Reporter reporter(BANDS, METRICS, 0, 0);
+  Values values;
+  reporter.offer(values.v, 0);
+  values.v[PUMP] = 1;
+  TEST_ASSERT_EQUAL_HEX32(1UL << PUMP, reporter.offer(values.v, 1));
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 2));
+
+  values.v[WATER_TEMP] = NAN;
+  TEST_ASSERT_EQUAL_HEX32(1UL << WATER_TEMP, reporter.offer(values.v, 3));
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 4));
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.suppressed(WATER_TEMP));
+  values.v[WATER_TEMP] = 21.0f;
+  TEST_ASSERT_EQUAL_HEX32(1UL << WATER_TEMP, reporter.offer(values.v, 5));
+}
+
+// A burst: the first change opens a 250 ms window, and it and everything
+// else that moves inside it goes out as one report when it closes
+void test_burst_merges_into_one_report() {
+  Reporter reporter(BANDS, METRICS, 250, 0);
+  Values values;
+  reporter.offer(values.v, 0);
+  values.v[PUMP] = 1;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 1000));
+  values.v[EC] = 1700.0f;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 1100));
+  values.v[TDS] = 850.0f;
+  values.v[EC] = 1750.0f;  // Moves again before the report; the newest goes
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 1249));
+  TEST_ASSERT_EQUAL_HEX32((1UL << PUMP) | (1UL << EC) | (1UL << TDS), reporter.offer(values.v, 1250));
+  TEST_ASSERT_EQUAL_UINT32(2, reporter.reports());
+
+  // A new window opens with the next change, not from the last report
+  values.v[PH] = 7.0f;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 5000));
+  TEST_ASSERT_EQUAL_HEX32(1UL << PH, reporter.offer(values.v, 5250));
+  TEST_ASSERT_EQUAL_UINT32(3, reporter.reports());
+}
+
+// Every heartbeat resends every field, changed or not, and restarts the
+// interval; pending changes go with it
+void test_heartbeat_sends_every_field() {
+  Reporter reporter(BANDS, METRICS, 5000, 60000);
+  Values values;
+  TEST_ASSERT_EQUAL_HEX32(Reporter::allFields(), reporter.offer(values.v, 0));
+  for (uint32_t t = 1000; t < 60000; t += 1000) {
+    TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, t));
+  }
+  TEST_ASSERT_EQUAL_HEX32(Reporter::allFields(), reporter.offer(values.v, 60000));
+  values.v[PH] = 7.0f;
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 118000));
+  TEST_ASSERT_EQUAL_HEX32(Reporter::allFields(), reporter.offer(values.v, 120000));
+  TEST_ASSERT_EQUAL_UINT32(0, reporter.offer(values.v, 123000));  // Already sent
+  TEST_ASSERT_EQUAL_UINT32(3, reporter.heartbeats());
+  for (size_t i = 0; i < FIELDS; i++) {
+    TEST_ASSERT_EQUAL_UINT32(3, reporter.sent(i));
+  }
+
+  reporter.forceFull();
+  TEST_ASSERT_EQUAL_HEX32(Reporter::allFields(), reporter.offer(values.v, 124000));
+  TEST_ASSERT_EQUAL_UINT32(4, reporter.heartbeats());
+}
+
+// Sent and suppressed per field over a scripted run, and the totals the
+// counters add up to
+void test_counters() {
+  Reporter reporter(BANDS, METRICS, 0, 0);
+  Values values;
+  reporter.offer(values.v, 0);
+  const float temps[] = {21.05f, 21.0f, 21.2f, 21.25f, 21.25f, 21.4f};
+  uint32_t reports = 1;
+  for (size_t i = 0; i < sizeof(temps) / sizeof(temps[0]); i++) {
+    values.v[WATER_TEMP] = temps[i];
+    if (reporter.offer(values.v, 1 + i)) {
+      reports++;
+    }
+  }
+  // Sent: first, 21.2, 21.4. Suppressed: 21.05, 21.25 (a repeat of an
+  // unsent value counts each time it is offered). 21.0 equals the last sent.
+  TEST_ASSERT_EQUAL_UINT32(3, reporter.sent(WATER_TEMP));
+  TEST_ASSERT_EQUAL_UINT32(3, reporter.suppressed(WATER_TEMP));
+  TEST_ASSERT_EQUAL_UINT32(reports, reporter.reports());
+  TEST_ASSERT_EQUAL_UINT32(7, reporter.offers());
+  for (size_t i = 1; i < FIELDS; i++) {
+    TEST_ASSERT_EQUAL_UINT32(1, reporter.sent(i));
+    TEST_ASSERT_EQUAL_UINT32(0, reporter.suppressed(i));
+  }
+}
+
+// --- One day of upload samples
+
+uint32_t seed = 12345;
+
+// Roughly normal noise from a sum of uniforms, standard deviation sd
+float noise(float sd) {
+  float sum = 0;
+  for (int i = 0; i < 4; i++) {
+    seed = seed * 1103515245u + 12345u;
+    sum += (seed >> 8) / 16777216.0f - 0.5f;
+  }
+  return sum * sd * 1.732f;
+}
+
+// A record as the Firebase upload encodes it: the sent fields and the time
+size_t recordBytes(const float* values, uint32_t fields, uint32_t time) {
+  uint8_t buffer[256];
+  JsonEncoder out(buffer, sizeof(buffer));
+  out.beginObject();
+  for (size_t i = 0; i < FIELDS; i++) {
+    if (fields & (1UL << i)) {
+      out.field(NAMES[i], values[i]);
+    }
+  }
+  out.field("time", time);
+  out.endObject();
+  TEST_ASSERT_TRUE(out.ok());
+  return out.size();
+}
+
+// Diurnal drift, probe noise and an hourly 10-minute pump run, sampled
+// every 2 minutes through uploadReporter's settings
+void test_one_day_of_uploads() {
+  Reporter reporter(BANDS, METRICS, 0, UPLOAD_HEARTBEAT);
+  uint32_t samples = 0;
+  uint32_t records = 0;
+  uint32_t fieldsSent = 0;
+  size_t fullBytes = 0;
+  size_t deltaBytes = 0;
+  uint32_t lastHeartbeat = 0;
+  uint32_t longestGap = 0;
+
+  for (uint32_t t = 0; t < 86400000; t += SAMPLE_PERIOD) {
+    float day = 2 * (float)M_PI * t / 86400000.0f;
+    float hour = t / 3600000.0f;
+    Values values;
+    values.v[0] = 21.0f + 1.5f * sinf(day) + noise(0.03f);
+    values.v[1] = 24.0f + 4.0f * sinf(day) + noise(0.1f);
+    values.v[2] = 60.0f - 10.0f * sinf(day) + noise(0.4f);
+    values.v[3] = 800.0f + 20.0f * hour / 24 + noise(2.0f);
+    values.v[4] = 6.0f + 0.1f * hour / 24 + noise(0.015f);
+    values.v[5] = 1600.0f + 40.0f * hour / 24 + noise(5.0f);
+    values.v[6] = 80.0f - 6.0f * hour / 24 + noise(0.3f);
+    values.v[7] = fmodf(hour, 1.0f) < 10.0f / 60 ? 1 : 0;
+    values.v[8] = 1;
+    values.v[9] = hour >= 6 && hour < 22 ? 1 : 0;
+
+    samples++;
+    fullBytes += recordBytes(values.v, Reporter::allFields(), t / 1000);
+    uint32_t fields = reporter.offer(values.v, t);
+    if (fields == 0) {
+      continue;
+    }
+    records++;
+    deltaBytes += recordBytes(values.v, fields, t / 1000);
+    for (size_t i = 0; i < FIELDS; i++) {
+      fieldsSent += (fields >> i) & 1;
+    }
+    if (fields == Reporter::allFields()) {
+      if (t - lastHeartbeat > longestGap) longestGap = t - lastHeartbeat;
+      lastHeartbeat = t;
+    }
+  }
+
+  char line[160];
+  snprintf(line, sizeof(line), "%u of %u records, %u of %u fields, %u of %u bytes (%.1fx fewer)",
+           (unsigned)records, (unsigned)samples, (unsigned)fieldsSent, (unsigned)(samples * FIELDS),
+           (unsigned)deltaBytes, (unsigned)fullBytes, (double)fullBytes / deltaBytes);
+  TEST_MESSAGE(line);
+
+  // Heartbeats keep every field at most 30 min stale
+  TEST_ASSERT_TRUE(longestGap <= UPLOAD_HEARTBEAT);
+  TEST_ASSERT_TRUE(reporter.heartbeats() >= 86400000 / UPLOAD_HEARTBEAT);
+  TEST_ASSERT_EQUAL_UINT32(records, reporter.reports());
+  uint32_t sent = 0;
+  uint32_t suppressed = 0;
+  for (size_t i = 0; i < FIELDS; i++) {
+    sent += reporter.sent(i);
+    suppressed += reporter.suppressed(i);
+  }
+  TEST_ASSERT_EQUAL_UINT32(fieldsSent, sent);
+  TEST_ASSERT_TRUE(suppressed > 0);
+  // The pump switches 48 times a day, and each switch is a record
+  TEST_ASSERT_TRUE(records >= 48);
+  TEST_ASSERT_TRUE(records < samples / 2);
+  TEST_ASSERT_TRUE(fullBytes > 5 * deltaBytes);
+
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_offer_sends_everything);
+  RUN_TEST(test_absolute_deadband);
+  RUN_TEST(test_relative_deadband);
+  RUN_TEST(test_state_fields_and_nan);
+  RUN_TEST(test_burst_merges_into_one_report);
+  RUN_TEST(test_heartbeat_sends_every_field);
+  RUN_TEST(test_counters);
+  RUN_TEST(test_one_day_of_uploads);
+  return UNITY_END();
+}
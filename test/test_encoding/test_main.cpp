@@ -0,0 +1,380 @@
+// The three encoders against hand-assembled bytes, the status record
+// decoded back from each format, and bytes and encode time per format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unity.h>
+#include "Encoding.h"
+
+// A small record that touches every head size the encoders pick from
+template <typename Encoder>
+void encodeSample(Encoder& out) {
+  out.beginObject();
+  out.field("a", (uint32_t)1);
+  out.field("b", (int32_t)-100);
+  out.field("c", (uint32_t)1000000);
+  out.field("d", true);
+  out.nullField("e");
+  out.field("f", 0.5f);
+  out.field("s", "x");
+  out.endObject();
+}
+
+// The fields of encodeStatus() in src/main.cpp, with typical readings
+template <typename Encoder>
+void encodeStatusRecord(Encoder& out) {
+  out.beginObject();
+  out.field("waterTemp", 23.5625f);
+  out.field("airTemp", 26.1f);
+  out.field("humidity", 55.3f);
+  out.field("tds", 512.25f);
+  out.field("ph", 6.12f);
+  out.field("ec", 1024.5f);
+  out.field("waterLevel", (int32_t)78);
+  out.field("ledStatus", true);
+  out.field("ledMode", (int32_t)1);
+  out.field("pumpStatus", false);
+  out.field("pumpRunning", false);
+  out.field("autoPumpEnabled", true);
+  out.field("manualPumpOverride", false);
+  out.field("snapshotVersion", (uint32_t)123456);
+  out.field("adcSamplesPerReading", (uint32_t)13000);
+  out.field("phSpikesRejected", (uint32_t)3);
+  out.field("tdsSpikesRejected", (uint32_t)0);
+  out.field("deviceId", "HydroBrain-ESP32");
+  out.endObject();
+}
+
+// --- Minimal decoders for flat objects, just enough to read back what
+// the encoders write
+
+struct Field {
+  enum Type { NUMBER, BOOL, NUL, STRING } type;
+  std::string key;
+  double number;
+  std::string text;
+};
+
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok = true;
+
+  uint8_t byte() {
+    if (p >= end) {
+      ok = false;
+      return 0;
+    }
+    return *p++;
+  }
+  uint32_t be(int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | byte();
+    return v;
+  }
+  std::string bytes(size_t n) {
+    if ((size_t)(end - p) < n) {
+      ok = false;
+      return "";
+    }
+    std::string s((const char*)p, n);
+    p += n;
+    return s;
+  }
+};
+
+float floatFromBits(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+uint32_t cborArgument(Cursor& in, uint8_t initial) {
+  uint8_t info = initial & 0x1F;
+  if (info < 24) return info;
+  if (info == 24) return in.be(1);
+  if (info == 25) return in.be(2);
+  if (info == 26) return in.be(4);
+  in.ok = false;
+  return 0;
+}
+
+std::vector<Field> decodeCbor(const uint8_t* data, size_t length) {
+  Cursor in = {data, data + length};
+  std::vector<Field> fields;
+  uint8_t initial = in.byte();
+  TEST_ASSERT_EQUAL_UINT8(5, initial >> 5);  // Map
+  uint32_t count = cborArgument(in, initial);
+  for (uint32_t i = 0; i < count && in.ok; i++) {
+    Field f = {};
+    uint8_t k = in.byte();
+    TEST_ASSERT_EQUAL_UINT8(3, k >> 5);
+    f.key = in.bytes(cborArgument(in, k));
+    uint8_t v = in.byte();
+    switch (v >> 5) {
+      case 0: f.type = Field::NUMBER; f.number = cborArgument(in, v); break;
+      case 1: f.type = Field::NUMBER; f.number = -1.0 - cborArgument(in, v); break;
+      case 3: f.type = Field::STRING; f.text = in.bytes(cborArgument(in, v)); break;
+      case 7:
+        if (v == 0xF4 || v == 0xF5) { f.type = Field::BOOL; f.number = v == 0xF5; }
+        else if (v == 0xF6) f.type = Field::NUL;
+        else if (v == 0xFA) { f.type = Field::NUMBER; f.number = floatFromBits(in.be(4)); }
+        else in.ok = false;
+        break;
+      default: in.ok = false;
+    }
+    fields.push_back(f);
+  }
+  TEST_ASSERT_TRUE(in.ok);
+  TEST_ASSERT_TRUE(in.p == in.end);
+  return fields;
+}
+
+std::string msgpackString(Cursor& in, uint8_t type) {
+  if ((type & 0xE0) == 0xA0) return in.bytes(type & 0x1F);
+  if (type == 0xD9) return in.bytes(in.be(1));
+  if (type == 0xDA) return in.bytes(in.be(2));
+  in.ok = false;
+  return "";
+}
+
+std::vector<Field> decodeMsgPack(const uint8_t* data, size_t length) {
+  Cursor in = {data, data + length};
+  std::vector<Field> fields;
+  TEST_ASSERT_EQUAL_UINT8(0xDE, in.byte());
+  uint32_t count = in.be(2);
+  for (uint32_t i = 0; i < count && in.ok; i++) {
+    Field f = {};
+    f.key = msgpackString(in, in.byte());
+    uint8_t v = in.byte();
+    f.type = Field::NUMBER;
+    if (v < 0x80) f.number = v;
+    else if (v >= 0xE0) f.number = (int8_t)v;
+    else if (v == 0xCC) f.number = in.be(1);
+    else if (v == 0xCD) f.number = in.be(2);
+    else if (v == 0xCE) f.number = in.be(4);
+    else if (v == 0xD0) f.number = (int8_t)in.be(1);
+    else if (v == 0xD1) f.number = (int16_t)in.be(2);
+    else if (v == 0xD2) f.number = (int32_t)in.be(4);
+    else if (v == 0xCA) f.number = floatFromBits(in.be(4));
+    else if (v == 0xC2 || v == 0xC3) { f.type = Field::BOOL; f.number = v == 0xC3; }
+    else if (v == 0xC0) f.type = Field::NUL;
+    else { f.type = Field::STRING; f.text = msgpackString(in, v); }
+    fields.push_back(f);
+  }
+  TEST_ASSERT_TRUE(in.ok);
+  TEST_ASSERT_TRUE(in.p == in.end);
+  return fields;
+}
+
+std::string jsonString(const char*& p) {
+  TEST_ASSERT_EQUAL_INT('"', *p);
+  std::string s;
+  for (p++; *p != '"'; p++) {
+    if (*p == '\\') p++;
+    TEST_ASSERT_TRUE(*p != 0);
+    s += *p;
+  }
+  p++;
+  return s;
+}
+
+std::vector<Field> decodeJson(const uint8_t* data, size_t length) {
+  std::string text((const char*)data, length);
+  const char* p = text.c_str();
+  std::vector<Field> fields;
+  TEST_ASSERT_EQUAL_INT('{', *p++);
+  while (*p != '}') {
+    Field f = {};
+    f.key = jsonString(p);
+    TEST_ASSERT_EQUAL_INT(':', *p++);
+    if (*p == '"') { f.type = Field::STRING; f.text = jsonString(p); }
+    else if (!strncmp(p, "true", 4)) { f.type = Field::BOOL; f.number = 1; p += 4; }
+    else if (!strncmp(p, "false", 5)) { f.type = Field::BOOL; f.number = 0; p += 5; }
+    else if (!strncmp(p, "null", 4)) { f.type = Field::NUL; p += 4; }
+    else {
+      char* end;
+      f.type = Field::NUMBER;
+      f.number = strtod(p, &end);
+      TEST_ASSERT_TRUE(end != p);
+      p = end;
+    }
+    fields.push_back(f);
+    if (*p == ',') p++;
+    else TEST_ASSERT_EQUAL_INT('}', *p);
+  }
+  TEST_ASSERT_EQUAL_size_t(length - 1, (size_t)(p - text.c_str()));
+  return fields;
+}
+
+// JSON floats go through "%.7g", so they match the binary ones to ~1e-7
+void assertSameFields(const std::vector<Field>& expected, const std::vector<Field>& actual) {
+  TEST_ASSERT_EQUAL_size_t(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    TEST_ASSERT_EQUAL_STRING(expected[i].key.c_str(), actual[i].key.c_str());
+    TEST_ASSERT_EQUAL_INT(expected[i].type, actual[i].type);
+    TEST_ASSERT_EQUAL_STRING(expected[i].text.c_str(), actual[i].text.c_str());
+    double tolerance = fabs(expected[i].number) * 2e-7;
+    TEST_ASSERT_TRUE(fabs(expected[i].number - actual[i].number) <= tolerance);
+  }
+}
+
+template <typename Encoder, typename Record>
+size_t encode(uint8_t* buffer, size_t capacity, Record record) {
+  Encoder out(buffer, capacity);
+  record(out);
+  TEST_ASSERT_TRUE(out.ok());
+  return out.size();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_json_bytes() {
+  uint8_t buffer[128];
+  size_t n = encode<JsonEncoder>(buffer, sizeof(buffer), [](JsonEncoder& out) { encodeSample(out); });
+  const char* expected = "{\"a\":1,\"b\":-100,\"c\":1000000,\"d\":true,\"e\":null,\"f\":0.5,\"s\":\"x\"}";
+  TEST_ASSERT_EQUAL_size_t(strlen(expected), n);
+  TEST_ASSERT_EQUAL_MEMORY(expected, buffer, n);
+
+  n = encode<JsonEncoder>(buffer, sizeof(buffer), [](JsonEncoder& out) {
+    out.beginObject();
+    out.field("say \"hi\"", "a\\b");
+    out.field("nan", NAN);
+    out.endObject();
+  });
+  expected = "{\"say \\\"hi\\\"\":\"a\\\\b\",\"nan\":null}";
+  TEST_ASSERT_EQUAL_size_t(strlen(expected), n);
+  TEST_ASSERT_EQUAL_MEMORY(expected, buffer, n);
+}
+
+void test_cbor_bytes() {
+  uint8_t buffer[128];
+  size_t n = encode<CborEncoder>(buffer, sizeof(buffer), [](CborEncoder& out) { encodeSample(out); });
+  const uint8_t expected[] = {
+    0xB9, 0x00, 0x07,
+    0x61, 'a', 0x01,
+    0x61, 'b', 0x38, 0x63,
+    0x61, 'c', 0x1A, 0x00, 0x0F, 0x42, 0x40,
+    0x61, 'd', 0xF5,
+    0x61, 'e', 0xF6,
+    0x61, 'f', 0xFA, 0x3F, 0x00, 0x00, 0x00,
+    0x61, 's', 0x61, 'x'
+  };
+  TEST_ASSERT_EQUAL_size_t(sizeof(expected), n);
+  TEST_ASSERT_EQUAL_MEMORY(expected, buffer, n);
+}
+
+void test_msgpack_bytes() {
+  uint8_t buffer[128];
+  size_t n = encode<MsgPackEncoder>(buffer, sizeof(buffer), [](MsgPackEncoder& out) { encodeSample(out); });
+  const uint8_t expected[] = {
+    0xDE, 0x00, 0x07,
+    0xA1, 'a', 0x01,
+    0xA1, 'b', 0xD0, 0x9C,
+    0xA1, 'c', 0xCE, 0x00, 0x0F, 0x42, 0x40,
+    0xA1, 'd', 0xC3,
+    0xA1, 'e', 0xC0,
+    0xA1, 'f', 0xCA, 0x3F, 0x00, 0x00, 0x00,
+    0xA1, 's', 0xA1, 'x'
+  };
+  TEST_ASSERT_EQUAL_size_t(sizeof(expected), n);
+  TEST_ASSERT_EQUAL_MEMORY(expected, buffer, n);
+}
+
+// Integer boundaries where the encoders switch head sizes
+void test_integer_boundaries() {
+  const int32_t values[] = {0, 23, 24, 127, 128, 255, 256, 65535, 65536, INT32_MAX,
+                            -1, -24, -25, -32, -33, -128, -129, -32768, -32769, INT32_MIN};
+  uint8_t cbor[512], msgpack[512];
+  auto record = [&](auto& out) {
+    out.beginObject();
+    for (int32_t v : values) {
+      out.field("v", v);
+    }
+    out.field("u", (uint32_t)UINT32_MAX);
+    out.endObject();
+  };
+  std::vector<Field> a = decodeCbor(cbor, encode<CborEncoder>(cbor, sizeof(cbor), record));
+  std::vector<Field> b = decodeMsgPack(msgpack, encode<MsgPackEncoder>(msgpack, sizeof(msgpack), record));
+  TEST_ASSERT_EQUAL_size_t(21, a.size());
+  for (size_t i = 0; i < 20; i++) {
+    TEST_ASSERT_TRUE(a[i].number == values[i]);
+  }
+  TEST_ASSERT_TRUE(a[20].number == UINT32_MAX);
+  assertSameFields(a, b);
+}
+
+// All three formats carry the same status record
+void test_status_record_round_trips() {
+  uint8_t json[1024], cbor[1024], msgpack[1024];
+  std::vector<Field> fromJson = decodeJson(json, encode<JsonEncoder>(json, sizeof(json), [](JsonEncoder& out) { encodeStatusRecord(out); }));
+  std::vector<Field> fromCbor = decodeCbor(cbor, encode<CborEncoder>(cbor, sizeof(cbor), [](CborEncoder& out) { encodeStatusRecord(out); }));
+  std::vector<Field> fromMsgPack = decodeMsgPack(msgpack, encode<MsgPackEncoder>(msgpack, sizeof(msgpack), [](MsgPackEncoder& out) { encodeStatusRecord(out); }));
+  TEST_ASSERT_EQUAL_size_t(18, fromJson.size());
+  assertSameFields(fromCbor, fromJson);
+  assertSameFields(fromCbor, fromMsgPack);
+}
+
+// A record that doesn't fit reports it and never writes past the buffer
+template <typename Encoder>
+void assertOverflowContained() {
+  uint8_t buffer[1024];
+  size_t full = encode<Encoder>(buffer, sizeof(buffer), [](Encoder& out) { encodeStatusRecord(out); });
+  for (size_t capacity = 0; capacity < full; capacity += 7) {
+    memset(buffer, 0xA5, sizeof(buffer));
+    Encoder out(buffer, capacity);
+    encodeStatusRecord(out);
+    TEST_ASSERT_FALSE(out.ok());
+    TEST_ASSERT_TRUE(out.size() <= capacity);
+    for (size_t i = capacity; i < sizeof(buffer); i++) {
+      TEST_ASSERT_EQUAL_UINT8(0xA5, buffer[i]);
+    }
+  }
+}
+
+void test_overflow() {
+  assertOverflowContained<JsonEncoder>();
+  assertOverflowContained<CborEncoder>();
+  assertOverflowContained<MsgPackEncoder>();
+}
+
+// Bytes on the wire and encode time on this host for the status record
+template <typename Encoder>
+void bench(const char* name) {
+  const int ROUNDS = 200000;
+  uint8_t buffer[1024];
+  size_t n = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; i++) {
+    Encoder out(buffer, sizeof(buffer));
+    encodeStatusRecord(out);
+    n = out.size();
+    asm volatile("" : : "r"(buffer) : "memory");
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+  char line[80];
+  snprintf(line, sizeof(line), "%-8s %4u bytes %8.1f ns", name, (unsigned)n, ns);
+  TEST_MESSAGE(line);
+}
+
+void test_size_and_time() {
+  bench<JsonEncoder>("JSON");
+  bench<CborEncoder>("CBOR");
+  bench<MsgPackEncoder>("MsgPack");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_json_bytes);
+  RUN_TEST(test_cbor_bytes);
+  RUN_TEST(test_msgpack_bytes);
+  RUN_TEST(test_integer_boundaries);
+  RUN_TEST(test_status_record_round_trips);
+  RUN_TEST(test_overflow);
+  RUN_TEST(test_size_and_time);
+  return UNITY_END();
+}
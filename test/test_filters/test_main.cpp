@@ -0,0 +1,161 @@
+// Filter stages against brute-force references, and the cost per sample
+// of each stage and of the firmware's three chains.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <unity.h>
+#include "Filters.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+// Deterministic ADC-like stream: a level, noise, and rare large spikes
+std::vector<int32_t> stream(size_t n, uint32_t seed) {
+  std::vector<int32_t> out(n);
+  for (size_t i = 0; i < n; i++) {
+    seed = seed * 1103515245u + 12345u;
+    int32_t noise = (int32_t)((seed >> 16) % 41) - 20;
+    int32_t spike = (seed >> 8) % 97 == 0 ? 1200 : 0;
+    out[i] = 2000 + noise + spike;
+  }
+  return out;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_median_matches_sorting() {
+  std::vector<int32_t> in = stream(5000, 1);
+  Median<7> median;
+  for (size_t i = 0; i < in.size(); i++) {
+    size_t from = i >= 6 ? i - 6 : 0;
+    std::vector<int32_t> window(in.begin() + from, in.begin() + i + 1);
+    std::sort(window.begin(), window.end());
+    TEST_ASSERT_EQUAL_INT32(window[window.size() / 2], median.update(in[i]));
+  }
+}
+
+void test_moving_average_matches_sum() {
+  std::vector<int32_t> in = stream(5000, 2);
+  MovingAverage<64> average;
+  for (size_t i = 0; i < in.size(); i++) {
+    size_t from = i >= 63 ? i - 63 : 0;
+    int64_t sum = 0;
+    for (size_t j = from; j <= i; j++) {
+      sum += in[j];
+    }
+    TEST_ASSERT_EQUAL_INT32((int32_t)(sum / (int64_t)(i - from + 1)), average.update(in[i]));
+  }
+}
+
+// A small alpha still reaches a step instead of stalling on rounding
+void test_ema_settles_on_a_step() {
+  Ema<q15(0.02)> ema;
+  TEST_ASSERT_EQUAL_INT32(1000, ema.update(1000));
+  int32_t out = 0;
+  for (int i = 0; i < 600; i++) {
+    out = ema.update(1010);
+  }
+  TEST_ASSERT_EQUAL_INT32(1010, out);
+}
+
+void test_kalman_converges() {
+  Kalman1D<1, 400> kalman;
+  std::vector<int32_t> in = stream(20000, 3);
+  int32_t out = 0;
+  for (int32_t v : in) {
+    out = kalman.update(v < 2100 ? v : 2000);  // Spikes are OutlierReject's job
+  }
+  TEST_ASSERT_INT32_WITHIN(5, 2000, out);
+}
+
+void test_outlier_reject_holds_spikes_and_follows_steps() {
+  OutlierReject<15, 120> reject;
+  for (int i = 0; i < 15; i++) {
+    reject.update(2000);
+  }
+  TEST_ASSERT_EQUAL_INT32(2000, reject.update(3000));
+  TEST_ASSERT_EQUAL_INT32(2000, reject.update(1000));
+  TEST_ASSERT_EQUAL_INT32(2050, reject.update(2050));
+  TEST_ASSERT_EQUAL_UINT32(2, reject.rejected());
+
+  // A real change of level gets through after N rejections in a row
+  int32_t out = 0;
+  int passedAfter = -1;
+  for (int i = 0; i < 40 && passedAfter < 0; i++) {
+    out = reject.update(2600);
+    if (out == 2600) {
+      passedAfter = i;
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(15, passedAfter);
+}
+
+void test_chain_is_the_stages_in_order() {
+  std::vector<int32_t> in = stream(5000, 4);
+  Chain<OutlierReject<15, 120>, Median<5>, MovingAverage<64>> chain;
+  OutlierReject<15, 120> a;
+  Median<5> b;
+  MovingAverage<64> c;
+  for (int32_t v : in) {
+    TEST_ASSERT_EQUAL_INT32(c.update(b.update(a.update(v))), chain.update(v));
+  }
+  chain.reset();
+  TEST_ASSERT_EQUAL_INT32(in[0], chain.update(in[0]));
+}
+
+// Cost per sample on this host (cycles from the TSC on x86). Use them to
+// compare stages and chains with each other; the ESP32's own figure for
+// a chain comes from timing the same loop with ESP.getCycleCount().
+template <typename Filter>
+void bench(const char* name, const std::vector<int32_t>& in) {
+  Filter filter;
+  volatile int32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+  uint64_t c0 = __rdtsc();
+#endif
+  for (int32_t v : in) {
+    sink = filter.update(v);
+  }
+#ifdef HAVE_TSC
+  double cycles = (double)(__rdtsc() - c0) / in.size();
+#else
+  double cycles = 0;
+#endif
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / in.size();
+  (void)sink;
+  char line[96];
+  snprintf(line, sizeof(line), "%-28s %6.1f ns/sample %7.1f cycles/sample", name, ns, cycles);
+  TEST_MESSAGE(line);
+}
+
+void test_cost_per_sample() {
+  std::vector<int32_t> in = stream(2000000, 5);
+  bench<Median<5>>("Median<5>", in);
+  bench<Median<7>>("Median<7>", in);
+  bench<Ema<q15(0.02)>>("Ema<0.02>", in);
+  bench<MovingAverage<64>>("MovingAverage<64>", in);
+  bench<Kalman1D<1, 400>>("Kalman1D<1,400>", in);
+  bench<OutlierReject<15, 120>>("OutlierReject<15,120>", in);
+  // The chains in src/main.cpp
+  bench<Chain<OutlierReject<15, 120>, Median<7>, Ema<q15(0.02)>>>("pH chain", in);
+  bench<Chain<OutlierReject<15, 120>, Median<5>, MovingAverage<64>>>("TDS chain", in);
+  bench<Chain<Median<5>, Kalman1D<1, 400>>>("EC chain", in);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_median_matches_sorting);
+  RUN_TEST(test_moving_average_matches_sum);
+  RUN_TEST(test_ema_settles_on_a_step);
+  RUN_TEST(test_kalman_converges);
+  RUN_TEST(test_outlier_reject_holds_spikes_and_follows_steps);
+  RUN_TEST(test_chain_is_the_stages_in_order);
+  RUN_TEST(test_cost_per_sample);
+  return UNITY_END();
+}
@@ -0,0 +1,311 @@
+// The log block format byte for byte, and FlashLog on an in-memory
+// filesystem (test/FS.h): reboots, segment rotation, damaged blocks and
+// failed writes.
+
+#include <stdio.h>
+#include <vector>
+#include <unity.h>
+#include "FlashLog.h"
+
+#define VALUES 7
+const uint32_t T0 = 1700000000;
+const uint32_t STEP = 120;  // LOG_INTERVAL in src/main.cpp
+
+// Small segments so rotation happens within a few hundred records
+typedef FlashLog<VALUES, 8, 4> SmallLog;
+
+fs::FS flash;
+
+void record(uint32_t i, int16_t* values) {
+  for (int m = 0; m < VALUES; m++) {
+    values[m] = (int16_t)(i * 7 + m - 3000);
+  }
+}
+
+void appendRecords(SmallLog& log, uint32_t from, uint32_t to, uint32_t flushEvery) {
+  int16_t values[VALUES];
+  for (uint32_t i = from; i < to; i++) {
+    record(i, values);
+    TEST_ASSERT_TRUE(log.append(T0 + i * STEP, values));
+    if (flushEvery && i % flushEvery == flushEvery - 1) {
+      TEST_ASSERT_TRUE(log.flush());
+    }
+  }
+}
+
+// Every record in the log, checked against record(); returns their indices
+std::vector<uint32_t> scanAll(SmallLog& log) {
+  std::vector<uint32_t> indices;
+  log.scan(0, UINT32_MAX, [&](uint32_t at, const int16_t* values, size_t count) {
+    TEST_ASSERT_EQUAL_size_t(VALUES, count);
+    TEST_ASSERT_EQUAL_UINT32(0, (at - T0) % STEP);
+    int16_t expected[VALUES];
+    record((at - T0) / STEP, expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, values, sizeof(expected));
+    indices.push_back((at - T0) / STEP);
+    return true;
+  });
+  return indices;
+}
+
+void assertConsecutive(const std::vector<uint32_t>& indices, uint32_t first, uint32_t last) {
+  TEST_ASSERT_EQUAL_size_t(last - first + 1, indices.size());
+  for (size_t i = 0; i < indices.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(first + i, indices[i]);
+  }
+}
+
+void setUp() {
+  flash = fs::FS();
+}
+void tearDown() {}
+
+void test_crc_is_ieee() {
+  const char* check = "123456789";
+  TEST_ASSERT_EQUAL_UINT32(0xCBF43926, logCrc32((const uint8_t*)check, 9));
+  // Chaining equals one pass
+  TEST_ASSERT_EQUAL_UINT32(0xCBF43926, logCrc32((const uint8_t*)check + 4, 5, logCrc32((const uint8_t*)check, 4)));
+}
+
+void test_block_layout() {
+  LogBlockWriter<2> writer;
+  int16_t a[2] = {1, -2};
+  int16_t b[2] = {3, 4};
+  TEST_ASSERT_TRUE(writer.append(T0, a));
+  TEST_ASSERT_TRUE(writer.append(T0 + 10, b));
+
+  const uint8_t header[12] = {0x47, 0x4C, 1, 2, 2, 0, 0, 0, 0x00, 0xF1, 0x53, 0x65};
+  const uint8_t records[12] = {0x00, 0x00, 0x01, 0x00, 0xFE, 0xFF,
+                               0x0A, 0x00, 0x03, 0x00, 0x04, 0x00};
+  const uint8_t* block = writer.data();
+  TEST_ASSERT_EQUAL_MEMORY(header, block, sizeof(header));
+  TEST_ASSERT_EQUAL_MEMORY(records, block + LOG_HEADER_BYTES, sizeof(records));
+  for (size_t i = LOG_HEADER_BYTES + sizeof(records); i < LOG_BLOCK_BYTES; i++) {
+    TEST_ASSERT_EQUAL_UINT8(0xFF, block[i]);
+  }
+  uint8_t sealed[LOG_HEADER_BYTES + sizeof(records)];
+  memcpy(sealed, block, sizeof(sealed));
+  logPut32(sealed + 12, 0);
+  TEST_ASSERT_EQUAL_UINT32(logCrc32(sealed, sizeof(sealed)), logGet32(block + 12));
+
+  LogBlockReader reader;
+  TEST_ASSERT_TRUE(reader.open(block));
+  TEST_ASSERT_EQUAL_size_t(2, reader.count());
+  TEST_ASSERT_EQUAL_UINT32(T0 + 10, reader.lastTime());
+  int16_t out[4] = {0, 0, 99, 99};
+  TEST_ASSERT_EQUAL_size_t(2, reader.read(1, out, 4));
+  TEST_ASSERT_EQUAL_MEMORY(b, out, sizeof(b));
+  TEST_ASSERT_EQUAL_INT(99, out[2]);
+}
+
+void test_writer_limits() {
+  LogBlockWriter<VALUES> writer;
+  TEST_ASSERT_EQUAL_size_t(31, LogBlockWriter<VALUES>::CAPACITY);
+  int16_t values[VALUES] = {};
+  TEST_ASSERT_TRUE(writer.append(T0, values));
+  TEST_ASSERT_FALSE(writer.append(T0 - 1, values));        // Before the base time
+  TEST_ASSERT_FALSE(writer.append(T0 + 0x10000, values));  // Offset past 16 bits
+  TEST_ASSERT_TRUE(writer.append(T0 + 0xFFFF, values));
+  while (!writer.full()) {
+    TEST_ASSERT_TRUE(writer.append(T0 + 0xFFFF, values));
+  }
+  TEST_ASSERT_FALSE(writer.append(T0 + 0xFFFF, values));
+  TEST_ASSERT_EQUAL_size_t(31, writer.count());
+}
+
+// A flipped bit anywhere in the header or the records fails the block;
+// so do erased flash and a different record width
+void test_reader_rejects_damage() {
+  LogBlockWriter<VALUES> writer;
+  int16_t values[VALUES];
+  for (uint32_t i = 0; i < 10; i++) {
+    record(i, values);
+    writer.append(T0 + i * STEP, values);
+  }
+  size_t used = LOG_HEADER_BYTES + 10 * LogBlockWriter<VALUES>::RECORD_BYTES;
+  uint8_t block[LOG_BLOCK_BYTES];
+  LogBlockReader reader;
+  for (size_t bit = 0; bit < used * 8; bit++) {
+    memcpy(block, writer.data(), LOG_BLOCK_BYTES);
+    block[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    TEST_ASSERT_FALSE(reader.open(block));
+  }
+  // Bytes past the records are not covered
+  memcpy(block, writer.data(), LOG_BLOCK_BYTES);
+  block[used] = 0;
+  TEST_ASSERT_TRUE(reader.open(block));
+
+  memset(block, 0xFF, sizeof(block));
+  TEST_ASSERT_FALSE(reader.open(block));
+  LogBlockWriter<VALUES + 1> wider;
+  TEST_ASSERT_FALSE(wider.resume(writer.data()));
+}
+
+// A block resumed after a reboot ends up identical to one never interrupted
+void test_resume_matches_uninterrupted() {
+  LogBlockWriter<VALUES> whole, first;
+  int16_t values[VALUES];
+  for (uint32_t i = 0; i < 20; i++) {
+    record(i, values);
+    whole.append(T0 + i * STEP, values);
+    if (i < 8) first.append(T0 + i * STEP, values);
+  }
+  LogBlockWriter<VALUES> resumed;
+  TEST_ASSERT_TRUE(resumed.resume(first.data()));
+  for (uint32_t i = 8; i < 20; i++) {
+    record(i, values);
+    resumed.append(T0 + i * STEP, values);
+  }
+  TEST_ASSERT_EQUAL_MEMORY(whole.data(), resumed.data(), LOG_BLOCK_BYTES);
+}
+
+void test_records_survive_reboots() {
+  {
+    SmallLog log(flash, "/log");
+    TEST_ASSERT_TRUE(log.begin());
+    appendRecords(log, 0, 100, 5);
+  }
+  // Rebooted with a flushed partial tail block: it is reopened, not
+  // left behind as a short block
+  SmallLog log(flash, "/log");
+  TEST_ASSERT_TRUE(log.begin());
+  assertConsecutive(scanAll(log), 0, 99);
+  appendRecords(log, 100, 200, 5);
+  TEST_ASSERT_TRUE(log.flush());
+  assertConsecutive(scanAll(log), 0, 199);
+  TEST_ASSERT_EQUAL_size_t(7 * LOG_BLOCK_BYTES, log.storedBytes());  // 200 records, 31 a block
+  TEST_ASSERT_EQUAL_UINT32(T0, log.oldestTime());
+
+  // Unflushed records are scanned too, and lost on a reboot
+  int16_t values[VALUES];
+  record(200, values);
+  log.append(T0 + 200 * STEP, values);
+  assertConsecutive(scanAll(log), 0, 200);
+  SmallLog rebooted(flash, "/log");
+  TEST_ASSERT_TRUE(rebooted.begin());
+  assertConsecutive(scanAll(rebooted), 0, 199);
+}
+
+// At most one block write per flush or completed block
+void test_flash_writes() {
+  SmallLog log(flash, "/log");
+  TEST_ASSERT_TRUE(log.begin());
+  appendRecords(log, 0, 310, 0);
+  TEST_ASSERT_EQUAL_UINT32(10, log.blocksWritten());
+  TEST_ASSERT_TRUE(log.flush());  // Nothing pending
+  TEST_ASSERT_EQUAL_UINT32(10, log.blocksWritten());
+  appendRecords(log, 310, 320, 1);
+  TEST_ASSERT_EQUAL_UINT32(20, log.blocksWritten());
+  TEST_ASSERT_EQUAL_size_t(20 * LOG_BLOCK_BYTES, flash.bytesWritten);
+}
+
+// Four segments of eight blocks: the oldest segment goes as a whole
+void test_segments_rotate() {
+  SmallLog log(flash, "/log");
+  TEST_ASSERT_TRUE(log.begin());
+  const uint32_t perSegment = 8 * 31;
+  appendRecords(log, 0, 6 * perSegment + 10, 0);
+  TEST_ASSERT_EQUAL_size_t(4, log.segments());
+  TEST_ASSERT_EQUAL_size_t(4, flash.files.size());
+  TEST_ASSERT_TRUE(flash.exists("/log/00000006.log"));
+  TEST_ASSERT_FALSE(flash.exists("/log/00000002.log"));
+  // Four full segments on flash, the ten newest records in RAM
+  TEST_ASSERT_EQUAL_size_t(SmallLog::capacityBytes() + LOG_BLOCK_BYTES, log.storedBytes());
+
+  assertConsecutive(scanAll(log), 2 * perSegment, 6 * perSegment + 9);
+  TEST_ASSERT_EQUAL_UINT32(T0 + 2 * perSegment * STEP, log.oldestTime());
+
+  SmallLog rebooted(flash, "/log");
+  TEST_ASSERT_TRUE(rebooted.begin());
+  assertConsecutive(scanAll(rebooted), 2 * perSegment, 6 * perSegment - 1);
+}
+
+// Ranges, and export in chunks that resume from the last time + 1
+void test_scan_ranges_and_chunks() {
+  SmallLog log(flash, "/log");
+  TEST_ASSERT_TRUE(log.begin());
+  appendRecords(log, 0, 900, 0);
+  std::vector<uint32_t> indices;
+  size_t n = log.scan(T0 + 700 * STEP - 1, T0 + 750 * STEP, [&](uint32_t at, const int16_t*, size_t) {
+    indices.push_back((at - T0) / STEP);
+    return true;
+  });
+  TEST_ASSERT_EQUAL_size_t(51, n);
+  assertConsecutive(indices, 700, 750);
+
+  uint32_t next = 0;
+  size_t total = 0, chunks = 0;
+  for (bool more = true; more; chunks++) {
+    size_t taken = 0;
+    more = false;
+    log.scan(next, UINT32_MAX, [&](uint32_t at, const int16_t*, size_t) {
+      if (taken == 37) {
+        more = true;
+        return false;
+      }
+      taken++;
+      next = at + 1;
+      return true;
+    });
+    total += taken;
+  }
+  TEST_ASSERT_EQUAL_size_t(log.scan(0, UINT32_MAX, [](uint32_t, const int16_t*, size_t) { return true; }), total);
+  TEST_ASSERT_EQUAL_size_t((total + 36) / 37 + (total % 37 == 0), chunks);
+}
+
+// A damaged block costs its own records only, and is counted
+void test_damaged_block_is_skipped() {
+  {
+    SmallLog log(flash, "/log");
+    TEST_ASSERT_TRUE(log.begin());
+    appendRecords(log, 0, 124, 0);  // Four full blocks
+  }
+  flash.files["/log/00000001.log"][LOG_BLOCK_BYTES + 100] ^= 0x01;
+  SmallLog log(flash, "/log");
+  TEST_ASSERT_TRUE(log.begin());
+  std::vector<uint32_t> indices = scanAll(log);
+  TEST_ASSERT_EQUAL_size_t(124 - 31, indices.size());
+  TEST_ASSERT_EQUAL_UINT32(30, indices[30]);
+  TEST_ASSERT_EQUAL_UINT32(62, indices[31]);
+  TEST_ASSERT_EQUAL_UINT32(1, log.crcErrors());
+}
+
+// A write that never lands fails append; records flushed before it and
+// the ones still in RAM are kept, and writing resumes once flash is back
+void test_failed_write() {
+  SmallLog log(flash, "/log");
+  TEST_ASSERT_TRUE(log.begin());
+  appendRecords(log, 0, 40, 0);
+  flash.failWritesAfter = 0;
+  int16_t values[VALUES];
+  bool failed = false;
+  for (uint32_t i = 40; i < 62 && !failed; i++) {
+    record(i, values);
+    failed = !log.append(T0 + i * STEP, values);
+  }
+  TEST_ASSERT_TRUE(failed);
+  TEST_ASSERT_FALSE(log.flush());
+  assertConsecutive(scanAll(log), 0, 61);
+
+  flash.failWritesAfter = -1;
+  TEST_ASSERT_TRUE(log.flush());
+  SmallLog rebooted(flash, "/log");
+  TEST_ASSERT_TRUE(rebooted.begin());
+  assertConsecutive(scanAll(rebooted), 0, 61);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_is_ieee);
+  RUN_TEST(test_block_layout);
+  RUN_TEST(test_writer_limits);
+  RUN_TEST(test_reader_rejects_damage);
+  RUN_TEST(test_resume_matches_uninterrupted);
+  RUN_TEST(test_records_survive_reboots);
+  RUN_TEST(test_flash_writes);
+  RUN_TEST(test_segments_rotate);
+  RUN_TEST(test_scan_ranges_and_chunks);
+  RUN_TEST(test_damaged_block_is_skipped);
+  RUN_TEST(test_failed_write);
+  return UNITY_END();
+}
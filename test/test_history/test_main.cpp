@@ -0,0 +1,238 @@
+// History against a brute-force model that keeps every sample, and the
+// cost of add() and of a full-range query on each tier.
+
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <unity.h>
+#include "History.h"
+
+// The firmware's dimensions (src/main.cpp): 7 metrics, 5 s samples for
+// 30 min, 1 min rollups for 4 h, 15 min rollups for 48 h
+#define METRICS 7
+typedef History<METRICS, 360, 240, 192> FirmwareHistory;
+const uint32_t INTERVALS[3] = {5, 60, 900};
+const size_t CAPACITIES[3] = {360, 240, 192};
+
+struct Sample {
+  uint32_t time;
+  int16_t values[METRICS];
+};
+
+struct Bucket {
+  int16_t mins, maxs, avg;
+};
+
+// Samples every 5 s with dropped samples, missing metrics and one outage
+// longer than every tier
+std::vector<Sample> samples(uint32_t seconds, uint32_t seed) {
+  std::vector<Sample> out;
+  for (uint32_t t = 0; t < seconds; t += 5) {
+    if (t >= 20000 && t < 20000 + 3 * 86400 / 2) {
+      continue;
+    }
+    seed = seed * 1103515245u + 12345u;
+    if ((seed >> 16) % 23 == 0) {
+      continue;
+    }
+    Sample s;
+    s.time = t;
+    for (int m = 0; m < METRICS; m++) {
+      seed = seed * 1103515245u + 12345u;
+      s.values[m] = (seed >> 16) % 31 == 0 ? HISTORY_NO_DATA
+                  : (int16_t)(1000 * m + (int)((seed >> 8) % 2001) - 1000);
+    }
+    out.push_back(s);
+  }
+  return out;
+}
+
+// What a tier should hold for metric after all samples: the raw tier keeps
+// the last sample per slot, rollup tiers every closed bucket; both only
+// the newest Capacity slots
+std::map<uint32_t, Bucket> model(const std::vector<Sample>& in, int tier, size_t metric) {
+  uint32_t interval = INTERVALS[tier];
+  std::map<uint32_t, std::vector<int16_t>> slots;
+  for (const Sample& s : in) {
+    std::vector<int16_t>& values = slots[s.time / interval];
+    if (tier == 0) {
+      values.clear();
+    }
+    values.push_back(s.values[metric]);
+  }
+  uint32_t newest = in.back().time / interval;
+  if (tier > 0) {
+    newest--;  // The last bucket is still open
+  }
+
+  std::map<uint32_t, Bucket> out;
+  for (const auto& entry : slots) {
+    if (entry.first > newest || entry.first + CAPACITIES[tier] <= newest) {
+      continue;
+    }
+    int32_t sum = 0, count = 0;
+    int16_t mins = INT16_MAX, maxs = INT16_MIN;
+    for (int16_t v : entry.second) {
+      if (v == HISTORY_NO_DATA) continue;
+      sum += v;
+      count++;
+      if (v < mins) mins = v;
+      if (v > maxs) maxs = v;
+    }
+    if (count > 0) {
+      out[entry.first * interval] = {mins, maxs, (int16_t)(sum / count)};
+    }
+  }
+  return out;
+}
+
+FirmwareHistory history(5, 60, 900);
+
+void setUp() {}
+void tearDown() {}
+
+void test_tiers_match_the_model() {
+  history = FirmwareHistory(5, 60, 900);
+  std::vector<Sample> in = samples(4 * 86400, 1);
+  for (const Sample& s : in) {
+    history.add(s.time, s.values);
+  }
+  for (int tier = 0; tier < 3; tier++) {
+    for (size_t m = 0; m < METRICS; m++) {
+      std::map<uint32_t, Bucket> expected = model(in, tier, m);
+      TEST_ASSERT_TRUE(expected.size() > CAPACITIES[tier] / 2);
+      auto next = expected.begin();
+      size_t emitted = history.query(tier, m, 0, UINT32_MAX,
+                                     [&](uint32_t time, int16_t mins, int16_t maxs, int16_t avg) {
+        TEST_ASSERT_TRUE(next != expected.end());
+        TEST_ASSERT_EQUAL_UINT32(next->first, time);
+        TEST_ASSERT_EQUAL_INT16(next->second.mins, mins);
+        TEST_ASSERT_EQUAL_INT16(next->second.maxs, maxs);
+        TEST_ASSERT_EQUAL_INT16(next->second.avg, avg);
+        ++next;
+        return true;
+      });
+      TEST_ASSERT_EQUAL_size_t(expected.size(), emitted);
+    }
+  }
+}
+
+// Gaps, late samples, and an outage longer than every tier
+void test_gaps_late_samples_and_outage() {
+  History<1, 10, 10, 10> small(5, 60, 900);
+  int16_t v = 7;
+  small.add(0, &v);
+  small.add(30, &v);
+  std::vector<uint32_t> times;
+  small.query(0, 0, 0, 100, [&](uint32_t time, int16_t, int16_t, int16_t) {
+    times.push_back(time);
+    return true;
+  });
+  TEST_ASSERT_EQUAL_size_t(2, times.size());
+  TEST_ASSERT_EQUAL_UINT32(0, times[0]);
+  TEST_ASSERT_EQUAL_UINT32(30, times[1]);
+
+  // A late sample misses the raw slot it belongs to but still counts in
+  // the open rollup buckets
+  v = 9;
+  small.add(10, &v);
+  TEST_ASSERT_EQUAL_size_t(0, small.query(0, 0, 10, 10, [](uint32_t, int16_t, int16_t, int16_t) { return true; }));
+
+  // The outage closes minute 0; the raw ring only holds the new sample
+  small.add(100000, &v);
+  TEST_ASSERT_EQUAL_size_t(1, small.query(0, 0, 0, UINT32_MAX, [](uint32_t, int16_t, int16_t, int16_t) { return true; }));
+  size_t buckets = small.query(1, 0, 0, UINT32_MAX, [](uint32_t time, int16_t mins, int16_t maxs, int16_t avg) {
+    TEST_ASSERT_EQUAL_UINT32(0, time);
+    TEST_ASSERT_EQUAL_INT16(7, mins);
+    TEST_ASSERT_EQUAL_INT16(9, maxs);
+    TEST_ASSERT_EQUAL_INT16(7, avg);  // 23 / 3, truncated
+    return true;
+  });
+  TEST_ASSERT_EQUAL_size_t(1, buckets);
+}
+
+void test_query_range_and_early_stop() {
+  history = FirmwareHistory(5, 60, 900);
+  int16_t values[METRICS] = {1, 2, 3, 4, 5, 6, 7};
+  for (uint32_t t = 0; t < 3600; t += 5) {
+    history.add(t, values);
+  }
+  // Bounds are inclusive and rounded down to the bucket
+  TEST_ASSERT_EQUAL_size_t(13, history.query(0, 0, 3002, 3060, [](uint32_t, int16_t, int16_t, int16_t) { return true; }));
+  TEST_ASSERT_EQUAL_size_t(0, history.query(0, METRICS, 0, UINT32_MAX, [](uint32_t, int16_t, int16_t, int16_t) { return true; }));
+
+  size_t calls = 0;
+  size_t accepted = history.query(1, 6, 0, UINT32_MAX, [&](uint32_t, int16_t, int16_t, int16_t avg) {
+    TEST_ASSERT_EQUAL_INT16(7, avg);
+    return ++calls < 5;
+  });
+  TEST_ASSERT_EQUAL_size_t(5, calls);
+  TEST_ASSERT_EQUAL_size_t(4, accepted);
+}
+
+void test_pick_tier() {
+  history = FirmwareHistory(5, 60, 900);
+  int16_t values[METRICS] = {};
+  uint32_t now = 0;
+  for (; now < 86400; now += 5) {
+    history.add(now, values);
+  }
+  now -= 5;
+  TEST_ASSERT_EQUAL_INT(0, history.pickTier(now - 1200));
+  TEST_ASSERT_EQUAL_INT(1, history.pickTier(now - 3600));
+  TEST_ASSERT_EQUAL_INT(2, history.pickTier(now - 6 * 3600));
+  TEST_ASSERT_EQUAL_INT(2, history.pickTier(0));
+}
+
+// int16 columns plus a few words of bookkeeping per tier
+void test_memory() {
+  size_t columns = METRICS * 2 * (360 + 3 * 240 + 3 * 192);
+  char line[64];
+  snprintf(line, sizeof(line), "memoryBytes %u (columns %u)",
+           (unsigned)FirmwareHistory::memoryBytes(), (unsigned)columns);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(FirmwareHistory::memoryBytes() >= columns);
+  TEST_ASSERT_TRUE(FirmwareHistory::memoryBytes() < columns + 256);
+}
+
+// Cost on this host of add() and of the /api/history query per tier
+void test_cost() {
+  history = FirmwareHistory(5, 60, 900);
+  std::vector<Sample> in = samples(30 * 86400, 2);
+  auto start = std::chrono::steady_clock::now();
+  for (const Sample& s : in) {
+    history.add(s.time, s.values);
+  }
+  double addNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / in.size();
+  char line[96];
+  snprintf(line, sizeof(line), "add()                %7.1f ns", addNs);
+  TEST_MESSAGE(line);
+
+  const int ROUNDS = 2000;
+  for (int tier = 0; tier < 3; tier++) {
+    volatile int32_t sink = 0;
+    size_t points = 0;
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++) {
+      points = history.query(tier, r % METRICS, 0, UINT32_MAX, [&](uint32_t, int16_t, int16_t, int16_t avg) {
+        sink = sink + avg;
+        return true;
+      });
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+    snprintf(line, sizeof(line), "query tier %d        %7.2f us for %u points", tier, us, (unsigned)points);
+    TEST_MESSAGE(line);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_tiers_match_the_model);
+  RUN_TEST(test_gaps_late_samples_and_outage);
+  RUN_TEST(test_query_range_and_early_stop);
+  RUN_TEST(test_pick_tier);
+  RUN_TEST(test_memory);
+  RUN_TEST(test_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,168 @@
+// Conversion tables against the formulas they replaced (the original
+// loop() arithmetic, in double), over every 12-bit code and half-code and
+// 0-50 °C in 0.1 °C steps.
+
+#include <stdio.h>
+#include <math.h>
+#include <unity.h>
+#include "ProbeConversion.h"
+
+// Stated maximum errors; ProbeConversion.h quotes the same figures
+const double MAX_TDS_ERROR_PPM = 0.1;
+const double MAX_EC_ERROR_US = 0.01;
+const double MAX_PH_ERROR = 0.0001;
+
+double volts(double code) { return code * 3.3 / 4095.0; }
+double coefficient(double t) { return 1.0 + 0.02 * (t - 25.0); }
+
+double tdsReference(double code, double t) {
+  double v = volts(code) / coefficient(t);
+  return (133.42 * v * v * v - 255.86 * v * v + 857.39 * v) * 124.0 / 165.0;
+}
+
+double ecReference(double code, double t) {
+  double v = volts(code);
+  if (v <= 0.0) {
+    return 0.0;
+  }
+  return 1413.0 / 1.229 * v * coefficient(t);
+}
+
+double phReference(double code) {
+  double slope = (7.0 - 4.0) / (1.326 - 1.810);
+  return 4.0 + slope * (volts(code) - 1.810);
+}
+
+ConversionTables tables;
+TemperatureTables temperature;
+
+void setUp() {}
+void tearDown() {}
+
+void report(const char* name, double maxError, double atCode, double atTemp, const char* unit) {
+  char line[112];
+  snprintf(line, sizeof(line), "%-4s max error %.5f %s (code %.1f, %.1f C)", name, maxError, unit, atCode, atTemp);
+  TEST_MESSAGE(line);
+}
+
+void test_lut_is_exact_for_lines() {
+  LutCurve<16> line;
+  line.build(-10.0f, 30.0f, [](float x) { return 3.0f * x - 7.0f; });
+  for (float x = -10.0f; x <= 30.0f; x += 0.37f) {
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 3.0f * x - 7.0f, line.lookup(x));
+  }
+}
+
+// Interpolation error stays within step^2 / 8 * max|f''|
+void test_lut_error_bound_for_curves() {
+  LutCurve<32> square;
+  square.build(0.0f, 8.0f, [](float x) { return x * x; });
+  float step = 8.0f / 32;
+  float bound = step * step / 8 * 2;
+  for (float x = 0.0f; x <= 8.0f; x += 0.01f) {
+    TEST_ASSERT_FLOAT_WITHIN(bound * 1.01f, x * x, square.lookup(x));
+  }
+}
+
+void test_lut_clamps_outside_range() {
+  LutCurve<4> line;
+  line.build(0.0f, 4.0f, [](float x) { return x; });
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, line.lookup(-5.0f));
+  TEST_ASSERT_EQUAL_FLOAT(4.0f, line.lookup(9.0f));
+}
+
+void test_formulas_match_the_original_arithmetic() {
+  for (double code = 0; code <= 4095; code += 1) {
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, (float)tdsReference(code, 25.0), tdsFromVoltage((float)volts(code)));
+  }
+  for (double t = 0; t <= 50; t += 0.5) {
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, (float)coefficient(t), tempCoefficient((float)t));
+  }
+}
+
+void test_tds_table() {
+  double worst = 0;
+  double worstCode = 0;
+  double worstTemp = 0;
+  for (int step = 0; step <= 500; step++) {
+    double t = step * 0.1;
+    for (double code = 0; code <= 4095; code += 0.5) {
+      double error = fabs(tables.tdsAt((float)code, (float)t, temperature) - tdsReference(code, t));
+      if (error > worst) {
+        worst = error;
+        worstCode = code;
+        worstTemp = t;
+      }
+    }
+  }
+  report("TDS", worst, worstCode, worstTemp, "ppm");
+  TEST_ASSERT_TRUE(worst <= MAX_TDS_ERROR_PPM);
+}
+
+void test_ec_table() {
+  double worst = 0;
+  double worstCode = 0;
+  double worstTemp = 0;
+  for (int step = 0; step <= 500; step++) {
+    double t = step * 0.1;
+    for (double code = 0; code <= 4095; code += 0.5) {
+      double error = fabs(tables.ecAt((float)code, (float)t, temperature) - ecReference(code, t));
+      if (error > worst) {
+        worst = error;
+        worstCode = code;
+        worstTemp = t;
+      }
+    }
+  }
+  report("EC", worst, worstCode, worstTemp, "uS/cm");
+  TEST_ASSERT_TRUE(worst <= MAX_EC_ERROR_US);
+}
+
+void test_ph_table() {
+  double worst = 0;
+  double worstCode = 0;
+  for (double code = 0; code <= 4095; code += 0.5) {
+    double error = fabs(tables.phAt((float)code) - phReference(code));
+    if (error > worst) {
+      worst = error;
+      worstCode = code;
+    }
+  }
+  report("pH", worst, worstCode, 25.0, "pH");
+  TEST_ASSERT_TRUE(worst <= MAX_PH_ERROR);
+}
+
+// Temperatures outside the table hold the end values
+void test_temperature_is_clamped() {
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, tempCoefficient(0.0f), temperature.coefficient.lookup(-8.0f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, tempCoefficient(50.0f), temperature.coefficient.lookup(70.0f));
+}
+
+// A TDS calibration replaces the cubic; the table follows its points
+void test_tds_calibration_replaces_the_curve() {
+  ProbeCalibration tdsCal = {};
+  tdsCal.addPoint(0.5f, 300.0f);
+  tdsCal.addPoint(1.5f, 1000.0f);
+  ConversionTables calibrated;
+  calibrated.build(tdsCal, EC_FACTORY_CALIBRATION, PH_FACTORY_CALIBRATION);
+  float code = 1.0f / (float)ADC_VOLTS_PER_CODE;
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 650.0f, calibrated.tdsAt(code, 25.0f, temperature));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, calibrated.tdsAt(0.0f, 25.0f, temperature));
+}
+
+int main() {
+  tables.build(ProbeCalibration{}, EC_FACTORY_CALIBRATION, PH_FACTORY_CALIBRATION);
+  temperature.build();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_lut_is_exact_for_lines);
+  RUN_TEST(test_lut_error_bound_for_curves);
+  RUN_TEST(test_lut_clamps_outside_range);
+  RUN_TEST(test_formulas_match_the_original_arithmetic);
+  RUN_TEST(test_tds_table);
+  RUN_TEST(test_ec_table);
+  RUN_TEST(test_ph_table);
+  RUN_TEST(test_temperature_is_clamped);
+  RUN_TEST(test_tds_calibration_replaces_the_curve);
+  return UNITY_END();
+}
@@ -0,0 +1,222 @@
+// Photoperiod driven the way serviceLighting() drives it: reconfigure
+// only when the settings change, update, then sleep until the next
+// transition or an hour. Days of it run in a blink on a fake clock, and
+// the light the strip gave is checked second by second.
+
+#include <stdio.h>
+#include <math.h>
+#include <unity.h>
+#include "Photoperiod.h"
+
+const uint32_t DAY = Photoperiod::DAY;
+const uint32_t IDLE = 3600;            // LIGHTING_IDLE_MS, in seconds
+const uint32_t MIDNIGHT = 20000 * DAY;  // Local time of the first day's start
+
+// 16/8 from 06:00 with 30 min ramps, 150 µmol/m²/s at full brightness:
+// 8.37 mol/m² a day unbudgeted
+const PhotoperiodConfig SCHEDULE = {360, 960, 30, 100, 150.0f, 0};
+
+struct DayLog {
+  uint32_t wakes;
+  uint32_t dusks;        // Wakes that found dusk newly begun
+  uint32_t brightDusk;   // Seconds past dusk start with the level still at the day level
+  float stepped;         // mol/m² from the level second by second
+};
+
+// serviceLighting() against a fake clock. settings is what the handlers
+// last stored; each wake passes it on only if it differs.
+struct Lighting {
+  Photoperiod photoperiod{SCHEDULE};
+  PhotoperiodConfig settings = SCHEDULE;
+  LightStep step = {LIGHT_NIGHT, 0, 0};
+  bool configureEveryWake = false;  // What the firmware used to do
+
+  uint32_t wake(uint32_t now) {
+    if (configureEveryWake || settings != photoperiod.config()) {
+      photoperiod.configure(settings, now);
+    }
+    step = photoperiod.update(now);
+    return step.next < IDLE ? step.next : IDLE;
+  }
+};
+
+// Run from `from` to `to`, waking as the firmware would, and sample the
+// level every second from a copy so the sampling doesn't add wakes.
+// change(now) may edit the settings; it is called every second and the
+// edit takes effect at once, as a POST that wakes the task does.
+template <typename Change>
+void run(Lighting& lighting, uint32_t from, uint32_t to, DayLog* days, Change change) {
+  uint32_t nextWake = from;
+  LightPhase lastPhase = LIGHT_NIGHT;
+  for (uint32_t now = from; now < to; now++) {
+    DayLog& day = days[(now - MIDNIGHT) / DAY];
+    if (change(now)) {
+      nextWake = now;
+    }
+    if (now == nextWake) {
+      nextWake = now + lighting.wake(now);
+      day.wakes++;
+      if (lighting.step.phase == LIGHT_DUSK && lastPhase != LIGHT_DUSK) {
+        day.dusks++;
+      }
+      lastPhase = lighting.step.phase;
+    }
+    Photoperiod probe = lighting.photoperiod;
+    LightStep seen = probe.update(now);
+    day.stepped += seen.level * lighting.settings.ppfd / 1e6f;
+    if (now > lighting.photoperiod.duskStart() && seen.phase == LIGHT_DUSK
+        && seen.level >= lighting.settings.levelPercent / 100.0f) {
+      day.brightDusk++;
+    }
+  }
+}
+
+void run(Lighting& lighting, uint32_t from, uint32_t to, DayLog* days) {
+  run(lighting, from, to, days, [](uint32_t) { return false; });
+}
+
+void report(const char* name, const DayLog& day, float lastDli) {
+  char line[112];
+  snprintf(line, sizeof(line), "%-18s %2u wakes, DLI %.3f mol/m2 (stepped %.3f)",
+           name, (unsigned)day.wakes, lastDli, day.stepped);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// No budget: each phase is slept through in hour-long naps at most, so
+// dawn 1 + day 15 + dusk 1 + night 8 wakes, and the natural DLI
+void test_plain_days() {
+  const int DAYS = 5;
+  Lighting lighting;
+  DayLog days[DAYS + 1] = {};
+  run(lighting, MIDNIGHT, MIDNIGHT + DAYS * DAY, days);
+  for (int d = 1; d < DAYS; d++) {
+    TEST_ASSERT_EQUAL_UINT32(25, days[d].wakes);
+    TEST_ASSERT_EQUAL_UINT32(1, days[d].dusks);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, 8.37f, days[d].stepped);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.005f, 8.37f, lighting.photoperiod.lastDli());
+  report("plain", days[DAYS - 1], lighting.photoperiod.lastDli());
+}
+
+// A 6 mol budget brings dusk forward to about 17:06. Dusk starts once and
+// runs down; waking during it must not start it again. Wakes: dawn 1, day
+// 11, dusk 1, night 13.
+void test_budget_is_met_and_dusk_runs_once() {
+  const int DAYS = 5;
+  Lighting lighting;
+  lighting.settings.dliTarget = 6.0f;
+  DayLog days[DAYS + 1] = {};
+  float lastDli[DAYS];
+  for (int d = 0; d < DAYS; d++) {
+    run(lighting, MIDNIGHT + d * DAY, MIDNIGHT + (d + 1) * DAY, days);
+    lastDli[d] = lighting.photoperiod.lastDli();
+  }
+  for (int d = 1; d < DAYS; d++) {
+    TEST_ASSERT_EQUAL_UINT32(1, days[d].dusks);
+    TEST_ASSERT_EQUAL_UINT32(0, days[d].brightDusk);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, days[d].stepped);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, lastDli[d]);  // Day d-1, closed at day d's dawn
+    TEST_ASSERT_EQUAL_UINT32(26, days[d].wakes);
+  }
+  uint32_t dusk = lighting.photoperiod.duskStart() % DAY;
+  TEST_ASSERT_TRUE(dusk > 17 * 3600 && dusk < 17 * 3600 + 15 * 60);
+  report("6 mol budget", days[DAYS - 1], lastDli[DAYS - 1]);
+}
+
+// The reported case: configure() on every wake used to restart a budgeted
+// dusk from each wake, leaving the level at full while the strip was
+// dark and the day at 7.16 mol. configure() now keeps a begun dusk.
+void test_configure_on_every_wake_keeps_dusk() {
+  const int DAYS = 3;
+  Lighting lighting;
+  lighting.configureEveryWake = true;
+  lighting.settings.dliTarget = 6.0f;
+  DayLog days[DAYS + 1] = {};
+  run(lighting, MIDNIGHT, MIDNIGHT + DAYS * DAY, days);
+  for (int d = 1; d < DAYS; d++) {
+    TEST_ASSERT_EQUAL_UINT32(1, days[d].dusks);
+    TEST_ASSERT_EQUAL_UINT32(0, days[d].brightDusk);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, days[d].stepped);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, lighting.photoperiod.lastDli());
+}
+
+// Dimmed to 60 % at noon with a 5 mol budget: the afternoon re-plans from
+// what the morning gave and the day still ends on the target
+void test_mid_day_level_change() {
+  Lighting lighting;
+  lighting.settings.dliTarget = 5.0f;
+  DayLog days[3] = {};
+  run(lighting, MIDNIGHT, MIDNIGHT + DAY, days);
+  run(lighting, MIDNIGHT + DAY, MIDNIGHT + 2 * DAY, days, [&](uint32_t now) {
+    if (now == MIDNIGHT + DAY + 12 * 3600) {
+      lighting.settings.levelPercent = 60;
+      return true;
+    }
+    return false;
+  });
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 5.0f, days[1].stepped);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 5.0f, lighting.photoperiod.lastDli());
+  TEST_ASSERT_EQUAL_UINT32(1, days[1].dusks);
+  TEST_ASSERT_EQUAL_UINT32(0, days[1].brightDusk);
+  // Dimmer light lasts longer than the 100 % plan (near 15:15)
+  uint32_t dusk = lighting.photoperiod.duskStart() % DAY;
+  TEST_ASSERT_TRUE(dusk > 16 * 3600);
+  report("dimmed at noon", days[1], lighting.photoperiod.lastDli());
+}
+
+// A level change once dusk is under way leaves dusk where it was
+void test_change_during_dusk_keeps_dusk() {
+  Lighting lighting;
+  lighting.settings.dliTarget = 6.0f;
+  DayLog days[2] = {};
+  uint32_t dusk = 0;
+  run(lighting, MIDNIGHT, MIDNIGHT + DAY, days, [&](uint32_t now) {
+    if (dusk == 0 && lighting.step.phase == LIGHT_DUSK) {
+      dusk = lighting.photoperiod.duskStart();
+    }
+    if (dusk != 0 && now == dusk + 600) {
+      lighting.settings.levelPercent = 80;
+      return true;
+    }
+    return false;
+  });
+  TEST_ASSERT_TRUE(dusk != 0);
+  TEST_ASSERT_EQUAL_UINT32(dusk, lighting.photoperiod.duskStart());
+  TEST_ASSERT_EQUAL_UINT32(1, days[0].dusks);
+  TEST_ASSERT_EQUAL_UINT32(0, days[0].brightDusk);
+}
+
+// Booted ten minutes into dawn: the first wake lands in dawn a third of
+// the way up with 100 s at full already counted, as if the schedule had
+// run since dawn
+void test_boot_during_dawn() {
+  Lighting lighting;
+  lighting.settings.dliTarget = 6.0f;
+  DayLog days[2] = {};
+  uint32_t boot = MIDNIGHT + 6 * 3600 + 600;
+  uint32_t sleep = lighting.wake(boot);
+  TEST_ASSERT_EQUAL_INT(LIGHT_DAWN, lighting.step.phase);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f / 3, lighting.step.level);
+  TEST_ASSERT_EQUAL_UINT32(1200, sleep);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 150.0f * 100 / 1e6f, lighting.photoperiod.dli());
+
+  run(lighting, boot, MIDNIGHT + DAY + 6 * 3600 + 1, days);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, lighting.photoperiod.lastDli());
+  TEST_ASSERT_EQUAL_UINT32(1, days[0].dusks);
+  report("boot in dawn", days[0], lighting.photoperiod.lastDli());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_plain_days);
+  RUN_TEST(test_budget_is_met_and_dusk_runs_once);
+  RUN_TEST(test_configure_on_every_wake_keeps_dusk);
+  RUN_TEST(test_mid_day_level_change);
+  RUN_TEST(test_change_during_dusk_keeps_dusk);
+  RUN_TEST(test_boot_during_dawn);
+  return UNITY_END();
+}
@@ -0,0 +1,262 @@
+// Scheduler under a fake clock: periods, wrap, and the worst-case loop
+// latency of the acquisition core's task set, also with the uplink down.
+
+#include <stdio.h>
+#include <unity.h>
+#include <string.h>
+#include "Scheduler.h"
+#include "SpscQueue.h"
+
+// Time only moves when a test, or a task standing in for real work, says so
+static uint32_t fakeMs = 0;
+static uint32_t fakeUs = 0;
+
+static uint32_t clockMs() { return fakeMs; }
+static uint32_t clockUs() { return fakeUs; }
+
+static uint32_t spareUs = 0;  // Sub-millisecond remainder, so ms and us stay in step
+
+static void advanceUs(uint32_t us) {
+  fakeUs += us;
+  spareUs += us;
+  fakeMs += spareUs / 1000;
+  spareUs %= 1000;
+}
+
+// Task i costs costUs[i] of fake time and records its runs and the
+// longest gap between two of them
+const size_t TASKS = 11;
+static uint32_t costUs[TASKS];
+static uint32_t runs[TASKS];
+static uint32_t lastRunUs[TASKS];
+static uint32_t maxGapUs[TASKS];
+
+template <size_t I>
+void task() {
+  if (runs[I] > 0 && fakeUs - lastRunUs[I] > maxGapUs[I]) {
+    maxGapUs[I] = fakeUs - lastRunUs[I];
+  }
+  lastRunUs[I] = fakeUs;
+  runs[I]++;
+  advanceUs(costUs[I]);
+}
+
+void setUp() {
+  fakeMs = 0;
+  fakeUs = 0;
+  spareUs = 0;
+  for (size_t i = 0; i < TASKS; i++) {
+    costUs[i] = 0;
+    runs[i] = 0;
+    lastRunUs[i] = 0;
+    maxGapUs[i] = 0;
+  }
+}
+
+void tearDown() {}
+
+// Call tick() every stepUs for durationMs of fake time
+template <size_t N>
+void runFor(Scheduler<N>& s, uint32_t durationMs, uint32_t stepUs) {
+  uint32_t end = fakeMs + durationMs;
+  while ((int32_t)(fakeMs - end) < 0) {
+    s.tick();
+    advanceUs(stepUs);
+  }
+}
+
+void test_tasks_run_at_their_period() {
+  Scheduler<4> s(clockMs, clockUs);
+  s.add("fast", task<0>, 10);
+  s.add("every", task<1>, 0);
+  s.add("slow", task<2>, 1000, 500);
+  runFor(s, 10000, 1000);
+  TEST_ASSERT_EQUAL_UINT32(1000, runs[0]);
+  TEST_ASSERT_EQUAL_UINT32(10000, runs[1]);
+  TEST_ASSERT_EQUAL_UINT32(10, runs[2]);
+  TEST_ASSERT_EQUAL_UINT32(10000, s.ticks());
+}
+
+void test_millis_wrap() {
+  fakeMs = 0xFFFFFF00u;
+  Scheduler<2> s(clockMs, clockUs);
+  s.add("fast", task<0>, 10);
+  runFor(s, 1000, 1000);
+  TEST_ASSERT_TRUE(fakeMs < 0x1000);
+  TEST_ASSERT_EQUAL_UINT32(100, runs[0]);
+}
+
+// A stall of several periods is not caught up with back-to-back runs
+void test_resyncs_after_stall() {
+  Scheduler<2> s(clockMs, clockUs);
+  s.add("fast", task<0>, 10);
+  s.tick();
+  advanceUs(55000);
+  s.tick();
+  s.tick();
+  TEST_ASSERT_EQUAL_UINT32(2, runs[0]);
+  // Back on a 10 ms beat from the late run at 55 ms: 65, 75 ... 145
+  runFor(s, 100, 1000);
+  TEST_ASSERT_EQUAL_UINT32(11, runs[0]);
+}
+
+void test_trigger_and_run_in() {
+  Scheduler<2> s(clockMs, clockUs);
+  s.add("event", task<0>, 60000);
+  s.tick();
+  TEST_ASSERT_EQUAL_UINT32(1, runs[0]);
+  s.trigger(task<0>);
+  s.tick();
+  TEST_ASSERT_EQUAL_UINT32(2, runs[0]);
+  s.runIn(task<0>, 25);
+  runFor(s, 24, 1000);
+  TEST_ASSERT_EQUAL_UINT32(2, runs[0]);
+  runFor(s, 2, 1000);
+  TEST_ASSERT_EQUAL_UINT32(3, runs[0]);
+}
+
+// One slow state machine: the overruns and maxRunUs point at it, and
+// only at it
+void test_overruns_name_the_offender() {
+  Scheduler<3> s(clockMs, clockUs, 10000);
+  costUs[0] = 200;
+  costUs[1] = 15000;
+  costUs[2] = 300;
+  s.add("quick", task<0>, 10);
+  s.add("slow", task<1>, 1000);
+  s.add("other", task<2>, 50);
+  runFor(s, 10000, 100);
+
+  TEST_ASSERT_EQUAL_UINT32(0, s.task(0).overruns);
+  TEST_ASSERT_EQUAL_UINT32(runs[1], s.task(1).overruns);
+  TEST_ASSERT_EQUAL_UINT32(0, s.task(2).overruns);
+  TEST_ASSERT_EQUAL_UINT32(15000, s.task(1).maxRunUs);
+  TEST_ASSERT_EQUAL_UINT32(200, s.task(0).maxRunUs);
+  TEST_ASSERT_EQUAL_UINT32(runs[1], s.overruns());
+  TEST_ASSERT_GREATER_OR_EQUAL(15000, s.maxTickUs());
+}
+
+// The acquisition core's task set (src/main.cpp setup()) with a
+// pessimistic cost for each state machine. The DHT22 read and the level
+// ping are the blocking calls left: ~5 ms with interrupts off, and up to
+// the 5.8 ms echo timeout, half a period apart. Every task due on the
+// same tick runs back to back, and the 10 ms pump command poll is never
+// more than the worst tick late.
+const uint32_t LOOP_BUDGET_US = 10000;
+
+struct AcquisitionTask {
+  const char* name;
+  SchedulerTaskFn fn;
+  uint32_t periodMs;
+  uint32_t offsetMs;
+  uint32_t costUs;
+};
+
+const AcquisitionTask ACQUISITION_SET[] = {
+  {"pumpCommand",  task<0>, 10,     0,      20},
+  {"pump",         task<1>, 60000,  0,      150},
+  {"waterTemp",    task<2>, 50,     0,      900},   // OneWire start/collect
+  {"air",          task<3>, 2000,   0,      5200},  // DHT22
+  {"level",        task<4>, 2000,   1000,   5900},  // JSN-SR04T, echo timeout
+  {"adc",          task<5>, 5,      0,      400},   // Drain + filter ~100 words
+  {"ec",           task<6>, 2000,   0,      150},
+  {"tds",          task<7>, 2000,   5,      150},
+  {"ph",           task<8>, 2000,   10,     150},
+  {"publish",      task<9>, 10,     0,      80},
+  {"uploadSample", task<10>, 120000, 120000, 60},
+};
+const size_t ACQUISITION_TASKS = sizeof(ACQUISITION_SET) / sizeof(ACQUISITION_SET[0]);
+
+// Register the set, with uploadSample's work done by `upload` if given;
+// returns the sum of the costs
+template <size_t N>
+uint32_t addAcquisitionSet(Scheduler<N>& s, SchedulerTaskFn upload = nullptr) {
+  uint32_t sumUs = 0;
+  for (size_t i = 0; i < ACQUISITION_TASKS; i++) {
+    const AcquisitionTask& t = ACQUISITION_SET[i];
+    bool isUpload = upload && !strcmp(t.name, "uploadSample");
+    costUs[i] = isUpload ? 0 : t.costUs;
+    sumUs += t.costUs;
+    s.add(t.name, isUpload ? upload : t.fn, t.periodMs, t.offsetMs);
+  }
+  return sumUs;
+}
+
+void reportTasks(const Scheduler<12>& s) {
+  char line[96];
+  for (size_t i = 0; i < s.taskCount(); i++) {
+    const SchedulerTask& t = s.task(i);
+    snprintf(line, sizeof(line), "%-12s runs %6u maxRunUs %5u overruns %u",
+             t.name, (unsigned)t.runs, (unsigned)t.maxRunUs, (unsigned)t.overruns);
+    TEST_MESSAGE(line);
+  }
+  snprintf(line, sizeof(line), "worst tick %u us, worst pump command gap %u us",
+           (unsigned)s.maxTickUs(), (unsigned)maxGapUs[0]);
+  TEST_MESSAGE(line);
+}
+
+void test_worst_case_loop_latency() {
+  Scheduler<12> s(clockMs, clockUs, LOOP_BUDGET_US);
+  uint32_t sumUs = addAcquisitionSet(s);
+  runFor(s, 300000, 50);
+  reportTasks(s);
+
+  for (size_t i = 0; i < s.taskCount(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(0, s.task(i).overruns);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(sumUs, s.maxTickUs());
+  TEST_ASSERT_LESS_OR_EQUAL(LOOP_BUDGET_US, s.maxTickUs());
+  TEST_ASSERT_EQUAL_UINT32(150, runs[4]);
+  TEST_ASSERT_EQUAL_UINT32(0, s.overruns());
+  TEST_ASSERT_LESS_OR_EQUAL(10000 + s.maxTickUs(), maxGapUs[0]);
+  TEST_ASSERT_EQUAL_UINT32(150, runs[3]);
+}
+
+// handOffUploadSample() with the uplink unreachable: uplinkTask is stuck
+// in a connect and never pops, so the handoff fills after four samples.
+// From then on each push fails and is counted, at the same cost, and the
+// loop stays inside its budget.
+struct HandoffSample {
+  uint32_t time;
+  uint32_t uptime;
+  int16_t values[9];
+};
+
+SpscQueue<HandoffSample, 4> handoff;  // UPLOAD_HANDOFF_RECORDS
+uint32_t handoffDropped = 0;
+
+void handOffWithUplinkDown() {
+  HandoffSample sample = {fakeMs / 1000, fakeMs / 1000, {}};
+  if (!handoff.push(sample)) {
+    handoffDropped++;
+  }
+  advanceUs(60);
+}
+
+void test_loop_budget_with_uplink_down() {
+  Scheduler<12> s(clockMs, clockUs, LOOP_BUDGET_US);
+  addAcquisitionSet(s, handOffWithUplinkDown);
+  runFor(s, 20 * 60000, 100);
+  reportTasks(s);
+
+  const SchedulerTask& upload = s.task(ACQUISITION_TASKS - 1);
+  TEST_ASSERT_EQUAL_UINT32(9, upload.runs);  // Every 2 min from 2 min on
+  TEST_ASSERT_EQUAL_size_t(4, handoff.size());
+  TEST_ASSERT_EQUAL_UINT32(5, handoffDropped);
+  TEST_ASSERT_LESS_OR_EQUAL(100, upload.maxRunUs);
+  TEST_ASSERT_EQUAL_UINT32(0, s.overruns());
+  TEST_ASSERT_LESS_OR_EQUAL(LOOP_BUDGET_US, s.maxTickUs());
+  TEST_ASSERT_LESS_OR_EQUAL(10000 + s.maxTickUs(), maxGapUs[0]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_tasks_run_at_their_period);
+  RUN_TEST(test_millis_wrap);
+  RUN_TEST(test_resyncs_after_stall);
+  RUN_TEST(test_trigger_and_run_in);
+  RUN_TEST(test_overruns_name_the_offender);
+  RUN_TEST(test_worst_case_loop_latency);
+  RUN_TEST(test_loop_budget_with_uplink_down);
+  return UNITY_END();
+}
@@ -0,0 +1,148 @@
+// SeqLock under contention: one writer thread publishing as fast as it
+// can while reader threads check that every copy they get is whole.
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unity.h>
+#include "SensorSnapshot.h"
+
+const uint32_t WRITES = 2000000;
+
+// Every word carries the write's sequence number, so a torn read (words
+// from two different writes) shows up as a mismatch
+struct Stamped {
+  uint32_t words[24];
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_nothing_published() {
+  SeqLock<Stamped> lock;
+  Stamped out;
+  TEST_ASSERT_EQUAL_UINT32(0, lock.version());
+  TEST_ASSERT_EQUAL_UINT32(0, lock.read(out));
+  TEST_ASSERT_EQUAL_UINT32(0, out.words[0]);
+}
+
+void test_version_counts_writes() {
+  SeqLock<Stamped> lock;
+  Stamped value = {};
+  for (uint32_t i = 1; i <= 10; i++) {
+    value.words[0] = i;
+    lock.write(value);
+    TEST_ASSERT_EQUAL_UINT32(i, lock.version());
+  }
+  Stamped out;
+  TEST_ASSERT_EQUAL_UINT32(10, lock.read(out));
+  TEST_ASSERT_EQUAL_UINT32(10, out.words[0]);
+}
+
+void test_readers_never_see_a_torn_value() {
+  SeqLock<Stamped> lock;
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> torn(0);
+  std::atomic<uint32_t> backwards(0);
+  std::atomic<uint64_t> reads(0);
+
+  std::thread writer([&] {
+    Stamped value;
+    for (uint32_t i = 1; i <= WRITES; i++) {
+      for (uint32_t& w : value.words) {
+        w = i;
+      }
+      lock.write(value);
+    }
+    done.store(true);
+  });
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; r++) {
+    readers.emplace_back([&] {
+      Stamped value;
+      uint32_t last = 0;
+      uint64_t n = 0;
+      while (!done.load()) {
+        uint32_t version = lock.read(value);
+        for (uint32_t w : value.words) {
+          if (w != value.words[0]) {
+            torn++;
+            break;
+          }
+        }
+        if (version != value.words[0]) {
+          torn++;
+        }
+        if (version < last) {
+          backwards++;
+        }
+        last = version;
+        n++;
+      }
+      reads += n;
+    });
+  }
+
+  writer.join();
+  for (std::thread& t : readers) {
+    t.join();
+  }
+
+  char line[96];
+  snprintf(line, sizeof(line), "%u writes, %llu reads across 2 readers",
+           (unsigned)WRITES, (unsigned long long)reads.load());
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+  TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+  TEST_ASSERT_GREATER_THAN(0, (uint32_t)reads.load());
+  TEST_ASSERT_EQUAL_UINT32(WRITES, lock.version());
+}
+
+// The real payload: fields the writer keeps in a fixed relation
+void test_sensor_snapshot_stays_consistent() {
+  SeqLock<SensorSnapshot> lock;
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> torn(0);
+
+  std::thread writer([&] {
+    SensorSnapshot snap = {};
+    for (uint32_t i = 1; i <= WRITES / 4; i++) {
+      snap.waterTemp = (float)(i % 1000);
+      snap.ec = snap.waterTemp * 2;
+      snap.pumpStartTime = i;
+      snap.pumpDeadline = i + 600000;
+      snap.pumpRunning = (i & 1) != 0;
+      lock.write(snap);
+    }
+    done.store(true);
+  });
+
+  std::thread reader([&] {
+    SensorSnapshot snap;
+    while (!done.load()) {
+      uint32_t version = lock.read(snap);
+      if (version == 0) {
+        continue;
+      }
+      if (snap.pumpStartTime != version || snap.pumpDeadline != version + 600000
+          || snap.ec != snap.waterTemp * 2 || snap.pumpRunning != ((version & 1) != 0)) {
+        torn++;
+      }
+    }
+  });
+
+  writer.join();
+  reader.join();
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_nothing_published);
+  RUN_TEST(test_version_counts_writes);
+  RUN_TEST(test_readers_never_see_a_torn_value);
+  RUN_TEST(test_sensor_snapshot_stays_consistent);
+  return UNITY_END();
+}
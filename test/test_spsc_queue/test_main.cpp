@@ -0,0 +1,184 @@
+// SpscQueue under contention: one producer and one consumer thread, both
+// as fast as they can, with every item checked for order and loss. A
+// thread that can't make progress yields, so this also runs on one core.
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include "SpscQueue.h"
+
+const uint32_t PUSHES = 2000000;
+
+// Like UploadSample: a few words the consumer can check for tearing
+struct Item {
+  uint32_t sequence;
+  uint32_t words[6];
+};
+
+void fill(Item& item, uint32_t sequence) {
+  item.sequence = sequence;
+  for (uint32_t& w : item.words) {
+    w = sequence * 2654435761u;
+  }
+}
+
+bool whole(const Item& item) {
+  for (uint32_t w : item.words) {
+    if (w != item.sequence * 2654435761u) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_and_full() {
+  SpscQueue<Item, 4> queue;
+  Item item;
+  TEST_ASSERT_FALSE(queue.pop(item));
+  for (uint32_t i = 1; i <= 4; i++) {
+    fill(item, i);
+    TEST_ASSERT_TRUE(queue.push(item));
+  }
+  TEST_ASSERT_EQUAL_size_t(4, queue.size());
+  fill(item, 5);
+  TEST_ASSERT_FALSE(queue.push(item));  // Full: fails, nothing overwritten
+  for (uint32_t i = 1; i <= 4; i++) {
+    TEST_ASSERT_TRUE(queue.pop(item));
+    TEST_ASSERT_EQUAL_UINT32(i, item.sequence);
+  }
+  TEST_ASSERT_FALSE(queue.pop(item));
+  TEST_ASSERT_EQUAL_size_t(0, queue.size());
+}
+
+// Many times round the ring, in and out of step
+void test_fifo_across_wraps() {
+  SpscQueue<Item, 8> queue;
+  uint32_t pushed = 0;
+  uint32_t popped = 0;
+  Item item;
+  for (uint32_t round = 0; round < 1000; round++) {
+    for (uint32_t n = round % 7 + 1; n > 0; n--) {
+      fill(item, pushed + 1);
+      if (queue.push(item)) {
+        pushed++;
+      }
+    }
+    for (uint32_t n = round % 5 + 1; n > 0 && queue.pop(item); n--) {
+      TEST_ASSERT_EQUAL_UINT32(++popped, item.sequence);
+    }
+    TEST_ASSERT_EQUAL_size_t(pushed - popped, queue.size());
+  }
+  while (queue.pop(item)) {
+    TEST_ASSERT_EQUAL_UINT32(++popped, item.sequence);
+  }
+  TEST_ASSERT_EQUAL_UINT32(pushed, popped);
+}
+
+// A producer that retries until each item goes in: the consumer gets all
+// of them, whole and in order
+void test_concurrent_nothing_lost() {
+  SpscQueue<Item, 64> queue;
+  std::atomic<uint32_t> outOfOrder(0);
+  std::atomic<uint32_t> torn(0);
+  uint32_t fullPushes = 0;
+  uint32_t received = 0;
+
+  std::thread producer([&] {
+    Item item;
+    for (uint32_t i = 1; i <= PUSHES; i++) {
+      fill(item, i);
+      while (!queue.push(item)) {
+        fullPushes++;
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::thread consumer([&] {
+    Item item;
+    uint32_t expected = 1;
+    while (expected <= PUSHES) {
+      if (!queue.pop(item)) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (item.sequence != expected) outOfOrder++;
+      if (!whole(item)) torn++;
+      expected = item.sequence + 1;
+      received++;
+    }
+  });
+  producer.join();
+  consumer.join();
+
+  char line[96];
+  snprintf(line, sizeof(line), "%u items, %u pushes found the queue full",
+           (unsigned)PUSHES, (unsigned)fullPushes);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(PUSHES, received);
+  TEST_ASSERT_EQUAL_UINT32(0, outOfOrder.load());
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+}
+
+// The firmware's producer: a full queue drops the item and counts it.
+// What arrives is in order with gaps only where drops were counted.
+void test_concurrent_drops_are_counted() {
+  SpscQueue<Item, 4> queue;
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> backwards(0);
+  std::atomic<uint32_t> torn(0);
+  uint32_t dropped = 0;
+  uint32_t received = 0;
+
+  std::thread producer([&] {
+    Item item;
+    for (uint32_t i = 1; i <= PUSHES; i++) {
+      fill(item, i);
+      if (!queue.push(item)) {
+        dropped++;
+      }
+      if (i % 64 == 0) {
+        std::this_thread::yield();
+      }
+    }
+    done.store(true);
+  });
+  std::thread consumer([&] {
+    Item item;
+    uint32_t last = 0;
+    for (;;) {
+      bool finished = done.load();
+      if (!queue.pop(item)) {
+        if (finished) break;
+        std::this_thread::yield();
+        continue;
+      }
+      if (item.sequence <= last) backwards++;
+      if (!whole(item)) torn++;
+      last = item.sequence;
+      received++;
+    }
+  });
+  producer.join();
+  consumer.join();
+
+  char line[96];
+  snprintf(line, sizeof(line), "%u items: %u received, %u dropped",
+           (unsigned)PUSHES, (unsigned)received, (unsigned)dropped);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(PUSHES, received + dropped);
+  TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_and_full);
+  RUN_TEST(test_fifo_across_wraps);
+  RUN_TEST(test_concurrent_nothing_lost);
+  RUN_TEST(test_concurrent_drops_are_counted);
+  return UNITY_END();
+}
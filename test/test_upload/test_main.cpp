@@ -0,0 +1,381 @@
+// The batch uploader against an in-process stand-in for the Realtime
+// Database REST API: batch bodies and keys, then two days of samples
+// through an outage, a flaky link and lost replies, checking that every
+// sample lands exactly once and how many requests and bytes it took.
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <unity.h>
+#include "UploadBatch.h"
+#include "UploadQueue.h"
+#include "Backoff.h"
+#include "FlashLog.h"
+
+// The uploader's settings in src/main.cpp
+#define SAMPLE_PERIOD      120     // s (FIREBASE_UPLOAD_INTERVAL)
+#define QUEUE_RECORDS      64
+#define BATCH_RECORDS      30
+#define BATCH_AGE          600     // s
+#define BACKOFF_BASE       5000    // ms
+#define BACKOFF_CAP        900000  // ms
+#define BODY_BYTES         8192
+#define SPILL_BLOCKS       32
+#define SPILL_SEGMENTS     4
+#define VALUES             9       // HIST_COUNT + flags + fields
+
+const uint64_t DEVICE_ID = 0x24A1B2C3D4E5ull;
+const uint32_t EPOCH = 1750000000;
+
+struct Sample {
+  uint32_t time;
+  uint32_t uptime;
+  int16_t values[VALUES];
+};
+
+template <typename Encoder>
+void encodeSample(Encoder& out, uint32_t time, const int16_t* values) {
+  out.beginObject();
+  out.field("waterTemp", values[0] / 100.0f);
+  out.field("tds", (int32_t)values[3]);
+  out.field("pH", values[4] / 1000.0f);
+  out.field("time", time);
+  out.endObject();
+}
+
+// --- Stand-in for PATCH /sensor_data.json: each top-level key of the body
+// replaces that child whole, as the Realtime Database does
+
+struct FakeRtdb {
+  std::map<std::string, std::string> children;
+  bool down = false;          // Connection refused
+  bool dropReplies = false;   // Applied, but the reply is lost (timeout)
+  uint32_t failEvery = 0;     // Every n-th request answers 503
+  uint32_t requests = 0;
+  uint32_t applied = 0;
+  size_t bytes = 0;
+  size_t largestBody = 0;
+
+  int patch(const uint8_t* body, size_t length) {
+    requests++;
+    if (down) return -1;
+    if (failEvery && requests % failEvery == 0) return 503;
+    bytes += length;
+    if (length > largestBody) largestBody = length;
+
+    // {"key":{...},"key":{...}}; records are flat, so no nested braces
+    std::string text((const char*)body, length);
+    TEST_ASSERT_EQUAL_INT('{', text.front());
+    TEST_ASSERT_EQUAL_INT('}', text.back());
+    size_t at = 1;
+    while (at < text.size() - 1) {
+      TEST_ASSERT_EQUAL_INT('"', text[at]);
+      size_t keyEnd = text.find('"', at + 1);
+      std::string key = text.substr(at + 1, keyEnd - at - 1);
+      TEST_ASSERT_EQUAL_size_t(UPLOAD_KEY_BYTES - 1, key.size());
+      TEST_ASSERT_EQUAL_INT(':', text[keyEnd + 1]);
+      size_t recordEnd = text.find('}', keyEnd);
+      children[key] = text.substr(keyEnd + 2, recordEnd - keyEnd - 1);
+      at = recordEnd + 1;
+      if (text[at] == ',') at++;
+    }
+    applied++;
+    return dropReplies ? -11 : 200;  // HTTPC_ERROR_READ_TIMEOUT
+  }
+};
+
+// --- serviceUploads() and drainUploadSamples() from src/main.cpp, with
+// the clock, the link and the spill filesystem passed in
+
+fs::FS flash;
+
+struct Uploader {
+  UploadQueue<Sample, QUEUE_RECORDS> queue;
+  FlashLog<VALUES, SPILL_BLOCKS, SPILL_SEGMENTS> spill{flash, "/upload"};
+  Backoff backoff{BACKOFF_BASE, BACKOFF_CAP};
+  uint32_t spillCursor = 0;
+  bool spillPending = false;
+  uint32_t dropped = 0;
+  uint32_t nextAttempt = 0;
+  uint32_t random = 1;
+  std::vector<uint32_t> retryDelays;
+  uint8_t body[BODY_BYTES];
+
+  void take(const Sample& sample) {
+    queue.push(sample, [&](Sample& oldest) {
+      if (spill.append(oldest.time, oldest.values)) {
+        spillPending = true;
+      } else {
+        dropped++;
+      }
+    });
+  }
+
+  bool add(UploadBatch& batch, uint32_t time, const int16_t* values) {
+    char key[UPLOAD_KEY_BYTES];
+    uploadKey(time, DEVICE_ID, key);
+    return batch.add(key, [&](JsonEncoder& record) { encodeSample(record, time, values); });
+  }
+
+  void service(uint32_t nowMs, FakeRtdb& rtdb) {
+    if ((int32_t)(nowMs - nextAttempt) < 0) {
+      return;
+    }
+    bool fromSpill = spillPending;
+    if (!fromSpill && (queue.empty() || (queue.size() < BATCH_RECORDS
+        && nowMs / 1000 - queue.at(0).uptime < BATCH_AGE))) {
+      return;
+    }
+
+    UploadBatch batch(body, sizeof(body));
+    uint32_t lastTime = 0;
+    bool more = false;
+    if (fromSpill) {
+      spill.scan(spillCursor, UINT32_MAX, [&](uint32_t at, const int16_t* values, size_t) {
+        if (batch.records() == BATCH_RECORDS || !add(batch, at, values)) {
+          more = true;
+          return false;
+        }
+        lastTime = at;
+        return true;
+      });
+    } else {
+      while (batch.records() < queue.size() && batch.records() < BATCH_RECORDS) {
+        const Sample& sample = queue.at(batch.records());
+        if (!add(batch, sample.time, sample.values)) {
+          break;
+        }
+      }
+    }
+    size_t records = batch.records();
+    if (records == 0) {
+      if (fromSpill) {
+        spillPending = false;
+      }
+      return;
+    }
+    size_t used = batch.finish();
+
+    int code = rtdb.patch(body, used);
+    if (code < 200 || code >= 300) {
+      random = random * 1103515245u + 12345u;
+      uint32_t delay = backoff.fail(random >> 8);
+      retryDelays.push_back(delay);
+      nextAttempt = nowMs + delay;
+      return;
+    }
+    backoff.reset();
+    if (fromSpill) {
+      spillCursor = lastTime + 1;
+      spillPending = more;
+    } else {
+      queue.pop(records);
+    }
+  }
+};
+
+Sample makeSample(uint32_t index) {
+  Sample s;
+  s.time = EPOCH + index * SAMPLE_PERIOD;
+  s.uptime = index * SAMPLE_PERIOD;
+  for (int m = 0; m < VALUES; m++) {
+    s.values[m] = (int16_t)(index % 500 + m * 100);
+  }
+  return s;
+}
+
+std::string keyOf(uint32_t time) {
+  char key[UPLOAD_KEY_BYTES];
+  uploadKey(time, DEVICE_ID, key);
+  return key;
+}
+
+// Every sample taken is in the database once, under its key, with its values
+void assertAllDelivered(const FakeRtdb& rtdb, uint32_t samples) {
+  TEST_ASSERT_EQUAL_size_t(samples, rtdb.children.size());
+  uint8_t expected[128];
+  for (uint32_t i = 0; i < samples; i++) {
+    Sample s = makeSample(i);
+    auto child = rtdb.children.find(keyOf(s.time));
+    TEST_ASSERT_TRUE(child != rtdb.children.end());
+    JsonEncoder out(expected, sizeof(expected));
+    encodeSample(out, s.time, s.values);
+    TEST_ASSERT_EQUAL_size_t(out.size(), child->second.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected, child->second.data(), out.size());
+  }
+}
+
+struct Outcome {
+  uint32_t samples;
+  uint32_t requests;
+  size_t bytes;
+};
+
+// Run the uploader over `hours`, one service call a second as on the
+// device; link(hour) sets the stand-in up for that part of the run
+template <typename Link>
+Outcome simulate(Uploader& uploader, FakeRtdb& rtdb, uint32_t hours, Link link) {
+  uint32_t samples = 0;
+  for (uint32_t s = 0; s < hours * 3600; s++) {
+    if (s % SAMPLE_PERIOD == 0) {
+      uploader.take(makeSample(samples++));
+    }
+    link(s / 3600.0);
+    uploader.service(s * 1000, rtdb);
+  }
+  // Flush the tail once the link is fine
+  rtdb.down = rtdb.dropReplies = false;
+  rtdb.failEvery = 0;
+  for (uint32_t s = hours * 3600; s < hours * 3600 + 3600; s++) {
+    uploader.service(s * 1000, rtdb);
+  }
+  return {samples, rtdb.requests, rtdb.bytes};
+}
+
+void report(const char* name, const Outcome& outcome, const Uploader& uploader) {
+  char line[128];
+  snprintf(line, sizeof(line), "%-22s %4u samples, %3u requests, %7u bytes, %2u retries",
+           name, (unsigned)outcome.samples, (unsigned)outcome.requests, (unsigned)outcome.bytes,
+           (unsigned)uploader.retryDelays.size());
+  TEST_MESSAGE(line);
+}
+
+void setUp() {
+  flash = fs::FS();
+}
+void tearDown() {}
+
+// Keys sort by time and are stable per sample and device
+void test_keys() {
+  std::string previous = keyOf(EPOCH);
+  for (uint32_t t = EPOCH + 1; t < EPOCH + 100000; t += 7) {
+    std::string key = keyOf(t);
+    TEST_ASSERT_TRUE(key > previous);
+    previous = key;
+  }
+  TEST_ASSERT_EQUAL_STRING(keyOf(EPOCH).c_str(), keyOf(EPOCH).c_str());
+  char other[UPLOAD_KEY_BYTES];
+  uploadKey(EPOCH, DEVICE_ID + 1, other);
+  TEST_ASSERT_EQUAL_STRING_LEN(keyOf(EPOCH).c_str(), other, 8);
+  TEST_ASSERT_TRUE(strcmp(keyOf(EPOCH).c_str(), other) != 0);
+}
+
+void test_batch_body() {
+  // Two records and the closing brace take 107 bytes, three 160
+  uint8_t body[200];
+  UploadBatch batch(body, 159);
+  int16_t values[VALUES] = {2150, 0, 0, 512, 6120};
+  TEST_ASSERT_TRUE(batch.add("k1", [&](JsonEncoder& out) { encodeSample(out, 7, values); }));
+  TEST_ASSERT_TRUE(batch.add("k2", [&](JsonEncoder& out) { encodeSample(out, 8, values); }));
+  size_t before = batch.size();
+  // A record that doesn't fit leaves the body as it was
+  TEST_ASSERT_FALSE(batch.add("k3", [&](JsonEncoder& out) { encodeSample(out, 9, values); }));
+  TEST_ASSERT_EQUAL_size_t(before, batch.size());
+  TEST_ASSERT_EQUAL_size_t(2, batch.records());
+  size_t length = batch.finish();
+  const char* expected =
+    "{\"k1\":{\"waterTemp\":21.5,\"tds\":512,\"pH\":6.12,\"time\":7},"
+    "\"k2\":{\"waterTemp\":21.5,\"tds\":512,\"pH\":6.12,\"time\":8}}";
+  TEST_ASSERT_EQUAL_size_t(strlen(expected), length);
+  TEST_ASSERT_EQUAL_MEMORY(expected, body, length);
+
+  // Every capacity either fits a record whole or leaves room to close
+  for (size_t capacity = 2; capacity < sizeof(body); capacity++) {
+    memset(body, 0xA5, sizeof(body));
+    UploadBatch small(body, capacity);
+    while (small.add("key", [&](JsonEncoder& out) { encodeSample(out, 1, values); })) {
+    }
+    TEST_ASSERT_TRUE(small.finish() <= capacity);
+    for (size_t i = capacity; i < sizeof(body); i++) {
+      TEST_ASSERT_EQUAL_UINT8(0xA5, body[i]);
+    }
+  }
+}
+
+// A healthy link: a sample every 2 minutes never fills a batch of 30, so
+// each request goes when the oldest queued sample is 10 minutes old and
+// carries six; nothing is retried
+void test_healthy_link() {
+  Uploader uploader;
+  TEST_ASSERT_TRUE(uploader.spill.begin());
+  FakeRtdb rtdb;
+  Outcome outcome = simulate(uploader, rtdb, 48, [](double) {});
+  assertAllDelivered(rtdb, outcome.samples);
+  const uint32_t PER_REQUEST = BATCH_AGE / SAMPLE_PERIOD + 1;
+  TEST_ASSERT_EQUAL_UINT32((outcome.samples + PER_REQUEST - 1) / PER_REQUEST, outcome.requests);
+  TEST_ASSERT_EQUAL_size_t(0, uploader.retryDelays.size());
+  TEST_ASSERT_TRUE(rtdb.largestBody <= BODY_BYTES);
+  report("healthy", outcome, uploader);
+}
+
+// 12 hours down: the queue overflows into the spill log, which goes out
+// first once the link is back; the backoff never waits past its cap
+void test_outage_spills_and_recovers() {
+  Uploader uploader;
+  TEST_ASSERT_TRUE(uploader.spill.begin());
+  FakeRtdb rtdb;
+  Outcome outcome = simulate(uploader, rtdb, 48, [&](double hour) {
+    rtdb.down = hour >= 10 && hour < 22;
+  });
+  assertAllDelivered(rtdb, outcome.samples);
+  TEST_ASSERT_EQUAL_UINT32(0, uploader.dropped);
+  TEST_ASSERT_FALSE(uploader.spillPending);
+  TEST_ASSERT_TRUE(uploader.spill.storedBytes() > 0);
+
+  // Delays double from the base to the cap, each with up to half jitter
+  TEST_ASSERT_TRUE(uploader.retryDelays.size() > 40);
+  uint32_t cap = BACKOFF_BASE;
+  for (uint32_t delay : uploader.retryDelays) {
+    TEST_ASSERT_TRUE(delay >= cap / 2 && delay <= cap);
+    cap = cap * 2 > BACKOFF_CAP ? BACKOFF_CAP : cap * 2;
+  }
+  report("12 h outage", outcome, uploader);
+}
+
+// Replies lost after the write landed, and a link failing every third
+// request: resent batches overwrite their own records, never duplicate
+void test_lost_replies_and_flaky_link() {
+  Uploader uploader;
+  TEST_ASSERT_TRUE(uploader.spill.begin());
+  FakeRtdb rtdb;
+  Outcome outcome = simulate(uploader, rtdb, 48, [&](double hour) {
+    rtdb.dropReplies = hour >= 5 && hour < 6;
+    rtdb.failEvery = hour >= 30 ? 3 : 0;
+  });
+  assertAllDelivered(rtdb, outcome.samples);
+  TEST_ASSERT_TRUE(rtdb.applied > outcome.samples / (BATCH_AGE / SAMPLE_PERIOD + 1));
+  report("lost replies, flaky", outcome, uploader);
+}
+
+// Longer than the spill log holds: the oldest spilled samples are lost,
+// the rest arrive once each
+void test_outage_beyond_spill() {
+  Uploader uploader;
+  TEST_ASSERT_TRUE(uploader.spill.begin());
+  FakeRtdb rtdb;
+  Outcome outcome = simulate(uploader, rtdb, 24 * 8, [&](double hour) {
+    rtdb.down = hour >= 1 && hour < 24 * 7;
+  });
+  TEST_ASSERT_TRUE(rtdb.children.size() < outcome.samples);
+  uint32_t first = outcome.samples - (uint32_t)rtdb.children.size();
+  for (uint32_t i = 0; i < outcome.samples; i++) {
+    bool delivered = rtdb.children.count(keyOf(makeSample(i).time)) > 0;
+    // The first hour went out before the outage; a run of the oldest
+    // spilled samples went with the segments that rotated out
+    if (i >= 30 && i < first + 30) continue;
+    TEST_ASSERT_TRUE(delivered);
+  }
+  report("7 day outage", outcome, uploader);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_keys);
+  RUN_TEST(test_batch_body);
+  RUN_TEST(test_healthy_link);
+  RUN_TEST(test_outage_spills_and_recovers);
+  RUN_TEST(test_lost_replies_and_flaky_link);
+  RUN_TEST(test_outage_beyond_spill);
+  return UNITY_END();
+}
@@ -0,0 +1,92 @@
+// WallClock: unknown until synced, within a second of the true time after,
+// monotonic between syncs, and readable while another thread syncs it.
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include "WallClock.h"
+
+const int64_t EPOCH_US = 1750000000LL * 1000000;
+
+void setUp() {}
+void tearDown() {}
+
+void test_unknown_until_synced() {
+  WallClock clock;
+  TEST_ASSERT_FALSE(clock.valid());
+  TEST_ASSERT_EQUAL_UINT32(0, clock.seconds(0));
+  TEST_ASSERT_EQUAL_UINT32(0, clock.seconds(123456789));
+  clock.sync(EPOCH_US, 5000000);
+  TEST_ASSERT_TRUE(clock.valid());
+  TEST_ASSERT_EQUAL_UINT32(1750000000, clock.seconds(5000000));
+}
+
+// Synced at any sub-second phase of either clock, the reading is never
+// more than a second off the true Unix time, and never goes backwards
+void test_within_a_second_and_monotonic() {
+  uint32_t seed = 1;
+  for (int trial = 0; trial < 2000; trial++) {
+    seed = seed * 1103515245u + 12345u;
+    int64_t monoAtSync = (int64_t)(seed % 100000) * 997;  // Up to ~100 s after boot
+    seed = seed * 1103515245u + 12345u;
+    int64_t epochAtSync = EPOCH_US + (int64_t)(seed % 1000000);
+    WallClock clock;
+    clock.sync(epochAtSync, monoAtSync);
+
+    uint32_t last = 0;
+    for (int64_t mono = monoAtSync; mono < monoAtSync + 5000000; mono += 37013) {
+      int64_t trueSeconds = (epochAtSync + (mono - monoAtSync)) / 1000000;
+      int64_t read = clock.seconds(mono);
+      TEST_ASSERT_TRUE(read >= trueSeconds - 1 && read <= trueSeconds + 1);
+      TEST_ASSERT_TRUE(read >= last);
+      last = (uint32_t)read;
+    }
+  }
+}
+
+// A later sync replaces the offset; readings step only then
+void test_resync() {
+  WallClock clock;
+  clock.sync(EPOCH_US, 0);
+  TEST_ASSERT_EQUAL_UINT32(1750000100, clock.seconds(100000000));
+  clock.sync(EPOCH_US + 97000000, 100000000);  // The oscillator ran 3 s fast
+  TEST_ASSERT_EQUAL_UINT32(1750000097, clock.seconds(100000000));
+  TEST_ASSERT_EQUAL_UINT32(1750000197, clock.seconds(200000000));
+}
+
+// The SNTP callback syncs from one task while others read: each reading
+// comes from one offset or the other, never a mix
+void test_read_while_syncing() {
+  WallClock clock;
+  clock.sync(EPOCH_US, 0);
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> wrong(0);
+  std::thread syncer([&] {
+    for (int i = 0; i < 200000; i++) {
+      clock.sync(EPOCH_US + (i & 1) * 86400000000LL, 0);
+    }
+    done.store(true);
+  });
+  std::thread reader([&] {
+    while (!done.load()) {
+      uint32_t read = clock.seconds(1000000);
+      if (read != 1750000001 && read != 1750086401) {
+        wrong++;
+      }
+      std::this_thread::yield();
+    }
+  });
+  syncer.join();
+  reader.join();
+  TEST_ASSERT_EQUAL_UINT32(0, wrong.load());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_unknown_until_synced);
+  RUN_TEST(test_within_a_second_and_monotonic);
+  RUN_TEST(test_resync);
+  RUN_TEST(test_read_while_syncing);
+  return UNITY_END();
+}
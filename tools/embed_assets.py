@@ -0,0 +1,127 @@
+"""Embed the web dashboard (data/) in the firmware.
+
+Every asset is gzip'd when that makes it smaller, hashed, and written to
+WebAssetData.h as a const byte array. Const data stays in flash on the
+ESP32, so the firmware serves it straight from there (see WebAsset.h).
+References to hashed assets inside the HTML get a ?v=<hash> suffix, so
+they can be cached for a year and still change with the file.
+
+Runs before every PlatformIO build (extra_scripts = pre:tools/embed_assets.py)
+and writes into the build directory; standalone:
+
+    python tools/embed_assets.py [output_dir]
+"""
+
+import gzip
+import hashlib
+import os
+import sys
+
+# (file under data/, URL path, content type). Files linked from a page come
+# before the page, so their hashed URLs are known when it is processed.
+ASSETS = [
+    ("images/back.jpg", "/images/back.jpg", "image/jpeg"),
+    ("index.html", "/index.html", "text/html; charset=utf-8"),
+    ("portal.html", "/portal.html", "text/html; charset=utf-8"),
+]
+
+# Extra URL paths serving an asset
+ALIASES = {"/": "/index.html"}
+
+# Pages are revalidated on every load (cheap with the ETag); everything
+# they link to is addressed by hash and never revalidated.
+PAGES = ("text/html",)
+
+HEADER = "WebAssetData.h"
+
+
+def c_name(path):
+    name = "".join(ch if ch.isalnum() else "_" for ch in path.strip("/"))
+    return "WEB_ASSET_" + (name.upper() or "ROOT")
+
+
+def load(data_dir, versions, filename, content_type):
+    with open(os.path.join(data_dir, filename), "rb") as f:
+        raw = f.read()
+    if content_type.startswith(PAGES):
+        text = raw.decode("utf-8")
+        for path, version in versions.items():
+            for quote in ("'", '"', "("):
+                close = ")" if quote == "(" else quote
+                text = text.replace(quote + path + close, quote + path + "?v=" + version + close)
+        raw = text.encode("utf-8")
+
+    digest = hashlib.sha256(raw).hexdigest()[:16]
+    packed = gzip.compress(raw, compresslevel=9, mtime=0)
+    if len(packed) < len(raw) * 0.95:
+        return packed, digest, True, len(raw)
+    return raw, digest, False, len(raw)  # Already compressed (PNG, ...)
+
+
+def byte_lines(data, per_line=20):
+    for i in range(0, len(data), per_line):
+        yield "  " + ",".join("0x%02x" % b for b in data[i:i + per_line]) + ","
+
+
+def generate(project_dir, out_dir):
+    data_dir = os.path.join(project_dir, "data")
+    versions = {}
+    entries = []
+    body = []
+    for filename, path, content_type in ASSETS:
+        data, digest, packed, raw_size = load(data_dir, versions, filename, content_type)
+        page = content_type.startswith(PAGES)
+        if not page:
+            versions[path] = digest[:8]
+        name = c_name(path)
+        body.append("// %s: %d bytes%s" % (filename, raw_size, ", %d gzip'd" % len(data) if packed else ""))
+        body.append("alignas(4) const uint8_t %s[] PROGMEM = {" % name)
+        body.extend(byte_lines(data))
+        body.append("};")
+        body.append("")
+        entries.append((path, content_type, name, len(data), digest, packed, not page))
+
+    table = []
+    for path, content_type, name, size, digest, packed, immutable in entries:
+        aliases = [alias for alias, target in sorted(ALIASES.items()) if target == path]
+        for url in [path] + aliases:
+            table.append('  {"%s", "%s", %s, %d, "\\"%s\\"", %s, %s},' % (
+                url, content_type, name, size, digest,
+                "true" if packed else "false", "true" if immutable else "false"))
+
+    text = "\n".join([
+        "// Generated by tools/embed_assets.py from data/ - do not edit.",
+        "#pragma once",
+        "",
+        "#include \"WebAsset.h\"",
+        "",
+    ] + body + [
+        "const WebAsset WEB_ASSETS[] = {",
+    ] + table + [
+        "};",
+        "",
+        "const size_t WEB_ASSET_COUNT = sizeof(WEB_ASSETS) / sizeof(WEB_ASSETS[0]);",
+        "",
+    ])
+
+    os.makedirs(out_dir, exist_ok=True)
+    target = os.path.join(out_dir, HEADER)
+    if os.path.exists(target):
+        with open(target) as f:
+            if f.read() == text:
+                return target  # Unchanged: don't trigger a rebuild
+    with open(target, "w") as f:
+        f.write(text)
+    for path, content_type, name, size, digest, packed, immutable in entries:
+        print("embed_assets: %-18s %7d bytes%s" % (path, size, " (gzip)" if packed else ""))
+    return target
+
+
+if __name__ == "__main__":
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    generate(root, sys.argv[1] if len(sys.argv) > 1 else os.path.join(root, ".pio", "generated"))
+else:
+    Import("env")  # noqa: F821 - provided by PlatformIO's SCons
+    generated = os.path.join(env.subst("$BUILD_DIR"), "generated")  # noqa: F821
+    generate(env.subst("$PROJECT_DIR"), generated)  # noqa: F821
+    env.Append(CPPPATH=[generated])  # noqa: F821
@@ -0,0 +1,193 @@
+// Run the pump engine against a sensor trace, faster than real time, and
+// compare it with the plain timer it replaces.
+//
+//     g++ -std=c++17 -O2 -Iinclude tools/pump_sim.cpp -o pump_sim
+//     ./pump_sim                      # 30 synthetic days, unpaced
+//     ./pump_sim trace.csv            # recorded trace
+//     ./pump_sim --days 7 --speed 1000
+//
+// A trace is CSV: seconds,waterTemp,airTemp,waterLevel,ec per line (a
+// header line, blank cells and NaN are skipped). Samples arrive every
+// 2 s, as on the tower. The engine uses the tower's rules and
+// schedule (PumpRules.h). Simulated time jumps from one sample or
+// deadline to the next, so nothing is polled here either. --speed N
+// paces the run at N times real time; 0 runs it as fast as it goes.
+// The output is duty cycle, cycles, runtime and energy for both
+// controllers, and how many switches each rule was behind.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "PumpRules.h"
+
+namespace {
+
+const uint32_t SAMPLE_PERIOD_MS = 2000;
+const char* const REASON_NAMES[] = {"cycleStart", "cycleEnd", "inhibit", "manual"};
+
+struct Sample {
+  double seconds;
+  float values[PUMP_SIGNAL_COUNT];
+};
+
+// Reservoir drains from 90 % to 15 % over five days and is topped up;
+// water follows the air a few degrees cooler, with a warm spell mid-run
+Sample synthetic(double seconds, double days) {
+  const double pi = 3.14159265358979;
+  double day = seconds / 86400.0;
+  double phase = 2 * pi * (day - 0.375);  // Warmest mid-afternoon
+  double spell = (day > days * 0.4 && day < days * 0.6) ? 4.0 : 0.0;
+  Sample s;
+  s.seconds = seconds;
+  s.values[PUMP_SIGNAL_AIR_TEMP] = (float)(24.0 + spell + 7.0 * sin(phase));
+  s.values[PUMP_SIGNAL_WATER_TEMP] = (float)(22.0 + spell + 4.0 * sin(phase - 0.6));
+  s.values[PUMP_SIGNAL_WATER_LEVEL] = (float)(90.0 - 75.0 * fmod(day, 5.0) / 5.0);
+  s.values[PUMP_SIGNAL_EC] = 1.6f;
+  return s;
+}
+
+bool loadTrace(const char* path, std::vector<Sample>& trace) {
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    Sample s;
+    char* p = line;
+    char* end;
+    s.seconds = strtod(p, &end);
+    if (end == p) {
+      continue;  // Header or junk
+    }
+    for (int i = 0; i < PUMP_SIGNAL_COUNT; i++) {
+      p = *end == ',' ? end + 1 : end;
+      s.values[i] = strtof(p, &end);
+      if (end == p) {
+        s.values[i] = NAN;
+      }
+    }
+    trace.push_back(s);
+  }
+  fclose(f);
+  return true;
+}
+
+struct Result {
+  uint64_t onMs = 0;
+  uint32_t cycles = 0;
+  uint32_t inhibits = 0;
+  uint32_t wakes = 0;  // update() calls: samples that flipped a rule, and deadlines
+  uint32_t byRule[PUMP_RULE_COUNT][4] = {};  // Switches per rule and PumpReason
+};
+
+template <typename Engine>
+Result run(Engine& engine, const std::vector<Sample>* trace, double days, double speed) {
+  Result result;
+  uint64_t endMs = trace != nullptr && !trace->empty()
+    ? (uint64_t)(trace->back().seconds * 1000)
+    : (uint64_t)(days * 86400000.0);
+  engine.resume(0, false, 0);
+  size_t next = 0;
+  uint64_t nowMs = 0;
+  uint64_t sampleMs = 0;
+  auto started = std::chrono::steady_clock::now();
+
+  while (nowMs < endMs) {
+    uint32_t wait = engine.nextEventMs((uint32_t)nowMs);
+    uint64_t deadlineMs = wait == UINT32_MAX ? UINT64_MAX : nowMs + wait;
+    uint64_t at = deadlineMs < sampleMs ? deadlineMs : sampleMs;
+    if (at >= endMs) {
+      break;
+    }
+    if (speed > 0) {
+      std::this_thread::sleep_until(started + std::chrono::microseconds((uint64_t)(at * 1000 / speed)));
+    }
+    nowMs = at;
+
+    bool wake = nowMs == deadlineMs;
+    if (nowMs == sampleMs) {
+      Sample s;
+      if (trace != nullptr) {
+        s = (*trace)[next++];
+        sampleMs = next < trace->size() ? (uint64_t)((*trace)[next].seconds * 1000) : UINT64_MAX;
+      } else {
+        s = synthetic(nowMs / 1000.0, days);
+        sampleMs += SAMPLE_PERIOD_MS;
+      }
+      for (int i = 0; i < PUMP_SIGNAL_COUNT; i++) {
+        wake |= engine.sample((PumpSignal)i, s.values[i], (uint32_t)nowMs);
+      }
+    }
+    if (!wake) {
+      continue;
+    }
+    result.wakes++;
+    if (engine.update((uint32_t)nowMs)) {
+      const PumpActuation& change = engine.last();
+      result.inhibits += change.reason == PUMP_REASON_INHIBIT;
+      if (change.rule >= 0) {
+        result.byRule[change.rule][change.reason]++;
+      }
+    }
+  }
+  result.onMs = engine.onMs((uint32_t)nowMs);
+  result.cycles = engine.cycles();
+  return result;
+}
+
+void report(const char* name, const Result& r, double hours) {
+  double onHours = r.onMs / 3600000.0;
+  printf("%-8s duty %5.1f %%  cycles %5u  runtime %7.1f h  energy %7.2f kWh  inhibits %3u  wakes %6u\n",
+         name, 100.0 * onHours / hours, r.cycles, onHours, onHours * PUMP_POWER_W / 1000.0, r.inhibits, r.wakes);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  double days = 30;
+  double speed = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+      days = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      speed = atof(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+
+  std::vector<Sample> trace;
+  if (path != nullptr && !loadTrace(path, trace)) {
+    fprintf(stderr, "pump_sim: cannot read %s\n", path);
+    return 1;
+  }
+  const std::vector<Sample>* source = path != nullptr ? &trace : nullptr;
+  double hours = source != nullptr && !trace.empty() ? trace.back().seconds / 3600.0 : days * 24;
+
+  PumpEngine<PUMP_RULE_COUNT> rules(PUMP_CYCLE, PUMP_RULES, PUMP_RULE_COUNT);
+  Result ruled = run(rules, source, days, speed);
+  PumpEngine<1> timer(PUMP_CYCLE, PUMP_RULES, 0);
+  Result timed = run(timer, source, days, speed);
+
+  printf("Switches behind each rule:\n");
+  for (size_t i = 0; i < PUMP_RULE_COUNT; i++) {
+    printf("  %-10s", PUMP_RULES[i].name);
+    for (int reason = 0; reason < PUMP_REASON_MANUAL; reason++) {
+      printf("  %s %u", REASON_NAMES[reason], ruled.byRule[i][reason]);
+    }
+    printf("\n");
+  }
+  printf("Over %.1f hours:\n", hours);
+  report("timer", timed, hours);
+  report("rules", ruled, hours);
+  if (timed.onMs > 0) {
+    printf("Energy saved: %.1f %%\n", 100.0 * (1.0 - (double)ruled.onMs / timed.onMs));
+  }
+  return 0;
+}